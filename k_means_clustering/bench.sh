@@ -0,0 +1,481 @@
+#!/bin/sh
+#
+# k-means benchmarks on gen_data.py's drifting Gaussian clusters, written by kmeans_gen (prune
+# also runs its uniform points).
+#
+#   ./bench.sh prune [points] [clusters] [dimensions...]
+#   ./bench.sh init [points] [clusters] [dimensions...]
+#   ./bench.sh fused [points] [clusters] [dimensions...]
+#   ./bench.sh stream [points] [clusters] [dimensions...]
+#   ./bench.sh batch [points] [clusters] [dimensions...]
+#   ./bench.sh predict [points] [clusters] [dimensions...]
+#   ./bench.sh bisect [points] [clusters] [dimensions...]
+#   ./bench.sh launch [points] [clusters] [dimensions...]
+#
+# prune: the default (auto) against brute force and Hamerly and Elkan bounds, for every dimension
+# given, and against kd-tree filtering up to 4 dimensions, on each distribution of DISTS (default
+# "normal uniform"). Runs stop at the fixed point (-t 0). Prints one CSV line per run:
+#
+#   binary,prune,data,dim,points,clusters,iterations,seconds,distances,same_as_seq
+#
+# same_as_seq compares the partition and final centroid files with kmeans_seq byte for byte.
+# kmeans_cpu with prune=none, and auto above 4 dimensions, runs the blocked SIMD engine (KM_SIMD
+# caps its instruction set), whose centroid sums, like the kd-tree's, are added in another order
+# and can differ from kmeans_seq in the last bit.
+#
+# init: the centroid file against k-means++ and k-means|| seeding, on the bundled
+# centroid.point/data.point and on generated data for every dimension given. seconds includes
+# the seeding; runs stop at the fixed point (-t 0). Prints:
+#
+#   binary,init,dim,points,clusters,iterations,seconds,inertia
+#
+# fused: kmeans_opencl with the fused assign+update kernel against kmeans_assign + kmeans_update +
+# kmeans_reduct, brute force and Hamerly, for a fixed number of iterations (no convergence check).
+# Prints:
+#
+#   kernels,prune,dim,points,clusters,iterations,seconds,ms_per_iteration,same_as_split
+#
+# stream: kmeans_opencl reading the whole file against streaming it in chunks of CHUNKS points
+# (default "65536 262144"), same iterations as fused. MB_per_s is the data file size times the
+# iterations over the run time. Prints:
+#
+#   mode,chunk,dim,points,clusters,iterations,seconds,MB_per_s,same_as_memory
+#
+# batch: RUNS (default 8) k-means++ restarts of kmeans_opencl, one process per seed against one
+# -r batch, and the same for the cluster counts KS (default "clusters/2 clusters 2*clusters"),
+# each run to its fixed point (-t 0).
+# seconds is wall time including process start-up and upload; best_inertia is the lowest over
+# the runs. Prints:
+#
+#   mode,runs,dim,points,clusters,seconds,best_inertia
+#
+# predict: the data assigned to trained centroids (-q) in batches of BATCHES points (default
+# 1 to 1000000 by powers of ten), by kmeans_cpu and kmeans_opencl. us_per_batch is the call
+# latency, points_per_s the throughput; same_as_cpu compares the labels with kmeans_cpu's for
+# one batch of all points. Prints:
+#
+#   binary,dim,points,clusters,batch,us_per_batch,points_per_s,same_as_cpu
+#
+# bisect: kmeans_cpu Lloyd from k-means++ for ITERATIONS (default 5) iterations against bisecting
+# k-means, splits run to convergence, refined by each of REFINE (default "0 2 5") iterations, for a
+# large number of clusters.
+# seconds includes the seeding or the splits. Prints:
+#
+#   mode,refine,dim,points,clusters,iterations,seconds,inertia
+#
+# launch: kmeans_opencl with every kernel enqueued on its own against the iterations recorded in
+# command buffers (cl_khr_command_buffer; without it the run is kernel by kernel again, with a note
+# on stderr) and the single-launch persistent kernel, on small problems where launching costs as
+# much as the work. Each runs BASE (default 10) and ITERATIONS (default 1000) iterations with
+# the convergence check off; us_per_iteration is the difference in run time over the difference in
+# iterations, so program build and upload drop out. same_as_enqueue compares the partition and
+# final centroid files. Prints:
+#
+#   launch,dim,points,clusters,iterations,seconds,us_per_iteration,same_as_enqueue
+#
+# Builds the binaries with make first; kmeans_opencl runs only if it was built. The data files
+# are KMPT float rows, which the mini-batch and streaming modes map in place.
+
+cd "$(dirname "$0")"
+
+WORK=${WORK:-/tmp/kmeans_bench}
+mkdir -p "$WORK"
+
+make -s gen || exit 1
+
+gen_data()
+{
+    ./kmeans_gen -f rows "$@" 2>/dev/null
+}
+
+run()
+{
+    # run <binary> <prune> <distribution> <dim> <points> <clusters>
+    bin=$1; prune=$2; dist=$3; dim=$4; points=$5; clusters=$6
+    out=$(./$bin -d "$dim" -p "$prune" -t 0 "$WORK/cent_$dim" "$WORK/${dist}_$dim" "$WORK/part_$bin" "$WORK/fin_$bin") || return 0
+    secs=$(echo "$out" | sed -n 's/^Time spent: //p')
+    iters=$(echo "$out" | sed -n 's/^Iterations: \([0-9]*\).*/\1/p')
+    dists=$(echo "$out" | sed -n 's/^Distances: //p')
+    same=no
+    if cmp -s "$WORK/part_$bin" "$WORK/part_kmeans_seq" && cmp -s "$WORK/fin_$bin" "$WORK/fin_kmeans_seq"; then
+        same=yes
+    fi
+    echo "$bin,$prune,$dist,$dim,$points,$clusters,$iters,$secs,${dists:-0},$same"
+}
+
+bench_prune()
+{
+    points=${1:-200000}
+    clusters=${2:-64}
+    dims="2 8 32"
+    if [ $# -gt 2 ]; then
+        shift 2
+        dims=$*
+    fi
+
+    make -s seq cpu || exit 1
+    make -s opencl 2>/dev/null || true
+
+    echo "binary,prune,data,dim,points,clusters,iterations,seconds,distances,same_as_seq"
+    for dim in $dims; do
+        gen_data centroid "$clusters" "$WORK/cent_$dim" "$dim"
+        gen_data data "$points" "$WORK/normal_$dim" "$clusters" "$dim"
+        gen_data centroid "$points" "$WORK/uniform_$dim" "$dim"
+
+        for dist in ${DISTS:-normal uniform}; do
+            run kmeans_seq none $dist "$dim" "$points" "$clusters"
+            for prune in auto none hamerly elkan; do
+                run kmeans_cpu $prune $dist "$dim" "$points" "$clusters"
+            done
+            if [ "$dim" -le 4 ]; then
+                run kmeans_cpu kdtree $dist "$dim" "$points" "$clusters"
+            fi
+            if [ -x kmeans_opencl ]; then
+                for prune in none hamerly; do
+                    run kmeans_opencl $prune $dist "$dim" "$points" "$clusters"
+                done
+            fi
+        done
+    done
+}
+
+run_init()
+{
+    # run_init <binary> <init> <dim> <points> <clusters> <centroid file> <data file>
+    # (sh has no locals: only the positional arguments are used, the callers' loop variables stay put)
+    out=$(./$1 -d "$3" -i "$2" -t 0 "$6" "$7" "$WORK/part_$1" "$WORK/fin_$1") || return 0
+    secs=$(echo "$out" | sed -n 's/^Time spent: //p')
+    iters=$(echo "$out" | sed -n 's/^Iterations: \([0-9]*\).*/\1/p')
+    inertia=$(echo "$out" | sed -n 's/^Inertia: //p')
+    echo "$1,$2,$3,$4,$5,$iters,$secs,$inertia"
+}
+
+bench_init()
+{
+    points=${1:-200000}
+    clusters=${2:-64}
+    dims="2 8"
+    if [ $# -gt 2 ]; then
+        shift 2
+        dims=$*
+    fi
+
+    make -s seq cpu || exit 1
+    make -s opencl 2>/dev/null || true
+    bins="kmeans_seq kmeans_cpu"
+    if [ -x kmeans_opencl ]; then
+        bins="$bins kmeans_opencl"
+    fi
+
+    echo "binary,init,dim,points,clusters,iterations,seconds,inertia"
+    for bin in $bins; do
+        for init in file "kmeans++" "kmeans||"; do
+            run_init $bin "$init" 2 bundled bundled centroid.point data.point
+        done
+    done
+    for dim in $dims; do
+        gen_data centroid "$clusters" "$WORK/cent_$dim" "$dim"
+        gen_data data "$points" "$WORK/data_$dim" "$clusters" "$dim"
+
+        for bin in $bins; do
+            for init in file "kmeans++" "kmeans||"; do
+                run_init $bin "$init" "$dim" "$points" "$clusters" "$WORK/cent_$dim" "$WORK/data_$dim"
+            done
+        done
+    done
+}
+
+run_fused()
+{
+    # run_fused <fused|split> <prune> <dim> <points> <clusters> <iterations>
+    out=$(./kmeans_opencl -d "$3" -p "$2" -f "$1" -t -1 "$WORK/cent_$3" "$WORK/data_$3" "$WORK/part_$1" "$WORK/fin_$1" "$6") || return 0
+    secs=$(echo "$out" | sed -n 's/^Time spent: //p')
+    iters=$(echo "$out" | sed -n 's/^Iterations: \([0-9]*\).*/\1/p')
+    ms=$(awk -v s="$secs" -v n="$iters" 'BEGIN { printf "%.3f", (n > 0) ? 1000 * s / n : 0 }')
+    same=-
+    if [ "$1" = fused ]; then
+        same=no
+        if cmp -s "$WORK/part_fused" "$WORK/part_split" && cmp -s "$WORK/fin_fused" "$WORK/fin_split"; then
+            same=yes
+        fi
+    fi
+    echo "$1,$2,$3,$4,$5,$iters,$secs,$ms,$same"
+}
+
+bench_fused()
+{
+    points=${1:-1000000}
+    clusters=${2:-64}
+    dims="2 8 32"
+    if [ $# -gt 2 ]; then
+        shift 2
+        dims=$*
+    fi
+    iterations=100
+
+    make -s opencl || exit 1
+
+    echo "kernels,prune,dim,points,clusters,iterations,seconds,ms_per_iteration,same_as_split"
+    for dim in $dims; do
+        gen_data centroid "$clusters" "$WORK/cent_$dim" "$dim"
+        gen_data data "$points" "$WORK/data_$dim" "$clusters" "$dim"
+
+        for prune in none hamerly; do
+            run_fused split $prune "$dim" "$points" "$clusters" $iterations
+            run_fused fused $prune "$dim" "$points" "$clusters" $iterations
+        done
+    done
+}
+
+run_stream()
+{
+    # run_stream <memory|chunk size> <dim> <points> <clusters> <iterations>
+    if [ "$1" = memory ]; then
+        mode=memory; opt=
+    else
+        mode=stream; opt="-S $1"
+    fi
+    out=$(./kmeans_opencl -d "$2" -t -1 $opt "$WORK/cent_$2" "$WORK/data_$2" "$WORK/part_$mode" "$WORK/fin_$mode" "$5") || return 0
+    secs=$(echo "$out" | sed -n 's/^Time spent: //p')
+    iters=$(echo "$out" | sed -n 's/^Iterations: \([0-9]*\).*/\1/p')
+    bytes=$(wc -c < "$WORK/data_$2")
+    mbs=$(awk -v b="$bytes" -v n="$iters" -v s="$secs" 'BEGIN { printf "%.1f", (s > 0) ? b * n / s / 1e6 : 0 }')
+    same=-
+    if [ $mode = stream ]; then
+        same=no
+        if cmp -s "$WORK/part_stream" "$WORK/part_memory"; then
+            same=yes
+        fi
+    fi
+    echo "$mode,$1,$2,$3,$4,$iters,$secs,$mbs,$same"
+}
+
+bench_stream()
+{
+    points=${1:-1000000}
+    clusters=${2:-64}
+    dims="2 8 32"
+    if [ $# -gt 2 ]; then
+        shift 2
+        dims=$*
+    fi
+    iterations=100
+
+    make -s opencl || exit 1
+
+    echo "mode,chunk,dim,points,clusters,iterations,seconds,MB_per_s,same_as_memory"
+    for dim in $dims; do
+        gen_data centroid "$clusters" "$WORK/cent_$dim" "$dim"
+        gen_data data "$points" "$WORK/data_$dim" "$clusters" "$dim"
+
+        run_stream memory "$dim" "$points" "$clusters" $iterations
+        for chunk in ${CHUNKS:-65536 262144}; do
+            run_stream "$chunk" "$dim" "$points" "$clusters" $iterations
+        done
+    done
+}
+
+bench_batch()
+{
+    points=${1:-1000000}
+    clusters=${2:-64}
+    dims="2 8 32"
+    if [ $# -gt 2 ]; then
+        shift 2
+        dims=$*
+    fi
+    runs=${RUNS:-8}
+    ks=${KS:-"$((clusters / 2)) $clusters $((clusters * 2))"}
+
+    make -s opencl || exit 1
+
+    echo "mode,runs,dim,points,clusters,seconds,best_inertia"
+    for dim in $dims; do
+        gen_data data "$points" "$WORK/data_$dim" "$clusters" "$dim"
+
+        # restarts: one process per seed, then one batch
+        start=$(date +%s.%N)
+        best=$(for seed in $(seq 1 $runs); do
+            ./kmeans_opencl -d "$dim" -i "kmeans++" -t 0 -k "$clusters" -s "$seed" - "$WORK/data_$dim" "$WORK/part_proc" | sed -n 's/^Inertia: //p'
+        done | sort -g | head -n 1)
+        end=$(date +%s.%N)
+        echo "process,$runs,$dim,$points,$clusters,$(awk -v a="$start" -v b="$end" 'BEGIN { printf "%.3f", b - a }'),$best"
+
+        start=$(date +%s.%N)
+        best=$(./kmeans_opencl -d "$dim" -i "kmeans++" -t 0 -k "$clusters" -r "$runs" - "$WORK/data_$dim" "$WORK/part_batch" | sed -n 's/^Inertia: //p')
+        end=$(date +%s.%N)
+        echo "batch,$runs,$dim,$points,$clusters,$(awk -v a="$start" -v b="$end" 'BEGIN { printf "%.3f", b - a }'),$best"
+
+        # cluster counts: one process per K, then one batch (the lowest inertia is the largest K)
+        start=$(date +%s.%N)
+        for k in $ks; do
+            ./kmeans_opencl -d "$dim" -i "kmeans++" -t 0 -k "$k" - "$WORK/data_$dim" "$WORK/part_proc" > /dev/null
+        done
+        end=$(date +%s.%N)
+        echo "process,$(echo $ks | tr ' ' '/'),$dim,$points,$clusters,$(awk -v a="$start" -v b="$end" 'BEGIN { printf "%.3f", b - a }'),-"
+
+        start=$(date +%s.%N)
+        ./kmeans_opencl -d "$dim" -i "kmeans++" -t 0 -k "$(echo $ks | tr ' ' ',')" - "$WORK/data_$dim" "$WORK/part_batch" > /dev/null
+        end=$(date +%s.%N)
+        echo "batch,$(echo $ks | tr ' ' '/'),$dim,$points,$clusters,$(awk -v a="$start" -v b="$end" 'BEGIN { printf "%.3f", b - a }'),-"
+    done
+}
+
+run_predict()
+{
+    # run_predict <binary> <dim> <points> <clusters> <batch>
+    out=$(./$1 -d "$2" -q "$5" "$WORK/fin_$2" "$WORK/data_$2" "$WORK/part_$1") || return 0
+    us=$(echo "$out" | sed -n 's/^Batches: .* points, \([0-9.]*\) us per batch.*/\1/p')
+    pps=$(echo "$out" | sed -n 's/.*us per batch, \([0-9]*\) points per second/\1/p')
+    same=no
+    if cmp -s "$WORK/part_$1" "$WORK/part_ref"; then
+        same=yes
+    fi
+    echo "$1,$2,$3,$4,$5,$us,$pps,$same"
+}
+
+bench_predict()
+{
+    points=${1:-1000000}
+    clusters=${2:-64}
+    dims="2 8 32"
+    if [ $# -gt 2 ]; then
+        shift 2
+        dims=$*
+    fi
+
+    make -s cpu || exit 1
+    make -s opencl 2>/dev/null || true
+    bins=kmeans_cpu
+    if [ -x kmeans_opencl ]; then
+        bins="$bins kmeans_opencl"
+    fi
+
+    echo "binary,dim,points,clusters,batch,us_per_batch,points_per_s,same_as_cpu"
+    for dim in $dims; do
+        gen_data centroid "$clusters" "$WORK/cent_$dim" "$dim"
+        gen_data data "$points" "$WORK/data_$dim" "$clusters" "$dim"
+        ./kmeans_cpu -d "$dim" "$WORK/cent_$dim" "$WORK/data_$dim" "$WORK/part_train" "$WORK/fin_$dim" 20 > /dev/null
+        ./kmeans_cpu -d "$dim" -q "$points" "$WORK/fin_$dim" "$WORK/data_$dim" "$WORK/part_ref" > /dev/null
+
+        for bin in $bins; do
+            for batch in ${BATCHES:-1 10 100 1000 10000 100000 1000000}; do
+                run_predict $bin "$dim" "$points" "$clusters" "$batch"
+            done
+        done
+    done
+}
+
+run_bisect()
+{
+    # run_bisect <mode> <refine> <dim> <points> <clusters> <iterations> <options...>
+    mode=$1; refine=$2; dim=$3; points=$4; clusters=$5; iters=$6
+    shift 6
+    out=$(./kmeans_cpu -d "$dim" -k "$clusters" "$@" - "$WORK/data_$dim" "$WORK/part_bisect" "$WORK/fin_bisect" "$iters") || return 0
+    secs=$(echo "$out" | sed -n 's/^Time spent: //p')
+    iters=$(echo "$out" | sed -n 's/^Iterations: \([0-9]*\).*/\1/p')
+    inertia=$(echo "$out" | sed -n 's/^Inertia: //p')
+    echo "$mode,$refine,$dim,$points,$clusters,$iters,$secs,$inertia"
+}
+
+bench_bisect()
+{
+    points=${1:-1000000}
+    clusters=${2:-4096}
+    dims="2 8 32"
+    if [ $# -gt 2 ]; then
+        shift 2
+        dims=$*
+    fi
+    iterations=${ITERATIONS:-5}
+
+    make -s cpu || exit 1
+
+    echo "mode,refine,dim,points,clusters,iterations,seconds,inertia"
+    for dim in $dims; do
+        gen_data data "$points" "$WORK/data_$dim" "$clusters" "$dim"
+
+        run_bisect lloyd 0 "$dim" "$points" "$clusters" "$iterations" -i "kmeans++" -t -1
+        for refine in ${REFINE:-0 2 5}; do
+            run_bisect bisect "$refine" "$dim" "$points" "$clusters" 1024 -b "$refine"
+        done
+    done
+}
+
+run_launch()
+{
+    # run_launch <launch> <dim> <points> <clusters> <base iterations> <iterations>
+    base=$(./kmeans_opencl -d "$2" -l "$1" -t -1 "$WORK/cent_$2" "$WORK/data_$2" "$WORK/part_$1" "$WORK/fin_$1" "$5" 2>/dev/null |
+           sed -n 's/^Time spent: //p')
+    out=$(./kmeans_opencl -d "$2" -l "$1" -t -1 "$WORK/cent_$2" "$WORK/data_$2" "$WORK/part_$1" "$WORK/fin_$1" "$6") || return 0
+    secs=$(echo "$out" | sed -n 's/^Time spent: //p')
+    iters=$(echo "$out" | sed -n 's/^Iterations: \([0-9]*\).*/\1/p')
+    us=$(awk -v s="$secs" -v b="$base" -v n="$6" -v m="$5" 'BEGIN { printf "%.1f", (n > m) ? 1e6 * (s - b) / (n - m) : 0 }')
+    same=no
+    if cmp -s "$WORK/part_$1" "$WORK/part_enqueue" && cmp -s "$WORK/fin_$1" "$WORK/fin_enqueue"; then
+        same=yes
+    fi
+    echo "$1,$2,$3,$4,$iters,$secs,$us,$same"
+}
+
+bench_launch()
+{
+    points=${1:-10000}
+    clusters=${2:-16}
+    dims="2 8"
+    if [ $# -gt 2 ]; then
+        shift 2
+        dims=$*
+    fi
+
+    make -s opencl || exit 1
+
+    echo "launch,dim,points,clusters,iterations,seconds,us_per_iteration,same_as_enqueue"
+    for dim in $dims; do
+        gen_data centroid "$clusters" "$WORK/cent_$dim" "$dim"
+        gen_data data "$points" "$WORK/data_$dim" "$clusters" "$dim"
+
+        for launch in enqueue record persistent; do
+            run_launch $launch "$dim" "$points" "$clusters" "${BASE:-10}" "${ITERATIONS:-1000}"
+        done
+    done
+}
+
+case "$1" in
+prune)
+    shift
+    bench_prune "$@"
+    ;;
+init)
+    shift
+    bench_init "$@"
+    ;;
+fused)
+    shift
+    bench_fused "$@"
+    ;;
+stream)
+    shift
+    bench_stream "$@"
+    ;;
+batch)
+    shift
+    bench_batch "$@"
+    ;;
+predict)
+    shift
+    bench_predict "$@"
+    ;;
+bisect)
+    shift
+    bench_bisect "$@"
+    ;;
+launch)
+    shift
+    bench_launch "$@"
+    ;;
+*)
+    echo "usage: $0 prune|init|fused|stream|batch|predict|bisect|launch [points] [clusters] [dimensions...]" >&2
+    exit 1
+    ;;
+esac
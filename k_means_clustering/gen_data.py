@@ -62,8 +62,8 @@ def gen_data_normal(n_data, output_f, cluster_num):
 if __name__ == '__main__':
     
     if len(sys.argv) < 4:
-        print('{0} centroid <data size> <output file>'.format(sys.argv[0]))
-        print('{0} data <data size> <output file> <cluster num>'.format(sys.argv[0]))
+        print('{0} centroid <data size> <output file> [<dimension>]'.format(sys.argv[0]))
+        print('{0} data <data size> <output file> <cluster num> [<dimension>]'.format(sys.argv[0]))
         sys.exit()
 
     random.seed()
@@ -74,10 +74,14 @@ if __name__ == '__main__':
 
     mode = sys.argv[1]
     if mode == 'centroid':
+        if len(sys.argv) > 4:
+            DIM = int(sys.argv[4])
         gen_data_uniform(n_data, output_f)
     elif mode == 'data':
         if len(sys.argv) < 5:
             sys.exit()
+        if len(sys.argv) > 5:
+            DIM = int(sys.argv[5])
         cluster_num = int(sys.argv[4])
         gen_data_normal(n_data, output_f, cluster_num)
 
@@ -1,212 +1,842 @@
-#define MAX_NO_DATA       (1048576)
-#define SZ_MAX_CENTROID   (32)
+/*
 
-#define SZ_MAX_CU         (32)
-#define SZ_MAX_PE         (64)
-#define SZ_MAX_DAT_TRANSF (MAX_NO_DATA / (SZ_MAX_CU * SZ_MAX_PE))
+ k-means kernels for any dimension.
 
+ Data is stored SoA: dimension d of point i is g_data[d * sz_data_stride + i], so neighbouring
+ work-items read neighbouring addresses. Centroids are row-major: g_cent[c * dim + d].
 
-__kernel __attribute__((vec_type_hint(float4))) void kmeans_assign(	__global        float4* g_src_cent_arr_f32x2x2,
-																	__global        float4* g_src_data_arr_f32x2x2, 
-																	__global        int2*   p_res_part_arr_s32x2,
-																	__private       int     sz_max_class, 
-																	__private       int     sz_max_src_data)
+ Build options:
+	-DKM_DIM=<dim>  specialize for one dimension: the point is held in private memory and every
+	                per-dimension loop has a constant trip count. KM_DIM=0 is the generic path,
+	                which takes the dimension from the dim argument.
+
+ Convergence: every kernel takes the g_status words below. kmeans_assign counts the points that
+ changed cluster, the centroid kernels keep the largest coordinate shift, and kmeans_check turns
+ them into the done flag. Once done is set every kernel returns at once, so the host can keep
+ the queue full and read the flag only now and then.
+
+ Floating-point contraction is off in every kernel file, as on the host.
+
+*/
+
+/* no contraction of a * b + c into an fma: the host engines are built with -ffp-contract=off,
+   and every distance has to round as it does there for the labels to match */
+#pragma OPENCL FP_CONTRACT OFF
+
+/* g_status words, keep in sync with kmeans_opencl.cpp */
+#define KM_STATUS_CHANGED (0) /* points that changed cluster in this iteration */
+#define KM_STATUS_SHIFT   (1) /* largest centroid coordinate shift, as float bits */
+#define KM_STATUS_DONE    (2) /* set by kmeans_check once converged */
+#define KM_STATUS_ITER    (3) /* iterations run */
+#define KM_STATUS_BOUND   (4) /* largest centroid move for the pruning bounds, as float bits (kmeans_prune.cl) */
+#define KM_STATUS_EMPTY   (5) /* clusters left without points by this iteration's update */
+#define KM_STATUS_SIZE    (6) /* status words; kmeans_batch.cl keeps one set per run */
+
+/* Centroid sums are compensated: KM_ACC floats per element, the running sum and the rounding
+   error its additions have lost so far, so that a million points add up as a double sum would.
+   Keep in sync with KM_ACC_SIZE in kmeans_opencl.cpp. */
+#define KM_ACC (2)
+
+#ifndef KM_DIM
+#define KM_DIM (0)
+#endif
+
+#if (0 < KM_DIM)
+#define DIM (KM_DIM)
+#else
+#define DIM (dim)
+#endif
+
+/* float += on local memory through compare-and-swap */
+void local_atomic_add_f32(volatile __local float* p_dst, float val)
 {
-	int pos_cur_src = get_global_id(0);
-	int pos_local_id = get_local_id(0);
-
-	if(pos_cur_src < sz_max_src_data)
-	{
-		float  min_dist_x = DBL_MAX;
-		float  min_dist_y = DBL_MAX;
-		int    min_class_x = 0;
-		int    min_class_y = 0;
-		float4 diff4, cent4;
-		float  dist;
-		int class_i;		
-		__local float4 l_tmp_cent_buf[SZ_MAX_CENTROID];
-        
-        float4 src_data_f32x2x2 = 0;
-        float4 cur_cent_f32x2x2 = 0;
-		
-		if(pos_local_id < sz_max_class)
-		{
-			l_tmp_cent_buf[pos_local_id] = g_src_cent_arr_f32x2x2[pos_local_id];
-		}
+	union { unsigned int u32; float f32; } old_val, new_val;
+
+	do
+	{
+		old_val.f32 = *p_dst;
+		new_val.f32 = old_val.f32 + val;
+	} while(atomic_cmpxchg((volatile __local unsigned int*)p_dst, old_val.u32, new_val.u32) != old_val.u32);
+}
+
+/* float += on global memory through compare-and-swap */
+void global_atomic_add_f32(volatile __global float* p_dst, float val)
+{
+	union { unsigned int u32; float f32; } old_val, new_val;
+
+	do
+	{
+		old_val.f32 = *p_dst;
+		new_val.f32 = old_val.f32 + val;
+	} while(atomic_cmpxchg((volatile __global unsigned int*)p_dst, old_val.u32, new_val.u32) != old_val.u32);
+}
+
+/* the exact rounding error of sum = a + b (TwoSum: no assumption on the magnitudes) */
+float acc_err(float a, float b, float sum)
+{
+	float b_virtual = sum - a;
+
+	return (a - (sum - b_virtual)) + (b - b_virtual);
+}
+
+/* compensated += on local memory: the sum as local_atomic_add_f32, then the error of the
+   addition that went in, which the compare-and-swap knows exactly, into p_dst[1] */
+void local_atomic_acc_f32(volatile __local float* p_dst, float val)
+{
+	union { unsigned int u32; float f32; } old_val, new_val;
+	float err = 0;
+
+	do
+	{
+		old_val.f32 = *p_dst;
+		new_val.f32 = old_val.f32 + val;
+	} while(atomic_cmpxchg((volatile __local unsigned int*)p_dst, old_val.u32, new_val.u32) != old_val.u32);
+
+	err = acc_err(old_val.f32, val, new_val.f32);
+	if(0 != err)
+	{
+		local_atomic_add_f32(&p_dst[1], err);
+	}
+}
+
+/* compensated += on global memory, as local_atomic_acc_f32 */
+void global_atomic_acc_f32(volatile __global float* p_dst, float val)
+{
+	union { unsigned int u32; float f32; } old_val, new_val;
+	float err = 0;
+
+	do
+	{
+		old_val.f32 = *p_dst;
+		new_val.f32 = old_val.f32 + val;
+	} while(atomic_cmpxchg((volatile __global unsigned int*)p_dst, old_val.u32, new_val.u32) != old_val.u32);
+
+	err = acc_err(old_val.f32, val, new_val.f32);
+	if(0 != err)
+	{
+		global_atomic_add_f32(&p_dst[1], err);
+	}
+}
+
+/* (p_acc[0], p_acc[1]) += (sum, err) for one work-item's own accumulator */
+void acc_add(float* p_acc, float sum, float err)
+{
+	float new_sum = p_acc[0] + sum;
+
+	p_acc[1] += acc_err(p_acc[0], sum, new_sum) + err;
+	p_acc[0]  = new_sum;
+}
+
+/* largest centroid shift so far: non-negative floats order like their bit patterns, and NaN sorts above all */
+void status_shift_max(volatile __global int* g_status, float new_cent, float old_cent)
+{
+	float shift = fabs(new_cent - old_cent);
+
+	if(0 != shift)
+	{
+		atomic_max((volatile __global unsigned int*)&g_status[KM_STATUS_SHIFT], as_uint(shift));
+	}
+}
+
+/* Nearest centroid of point pos_cur_src, ties to the lowest index, and its squared distance in
+   *p_min_dist. Centroids pass through l_tmp_cent_buf in tiles of sz_tile_class, so any number of
+   them works. Holds barriers: every work-item of the group calls it, is_valid or not. */
+int nearest_cent_tiled(	__global  const float*  g_src_cent_arr,
+						__global  const float*  g_src_data_arr,
+						                int     pos_cur_src,
+						                int     is_valid,
+						                int     sz_max_class,
+						                int     dim,
+						                int     sz_data_stride,
+						                int     sz_tile_class,
+						__local         float*  l_tmp_cent_buf,
+						                float*  p_min_dist)
+{
+	int idx_elem     = 0;
+	int idx_tile     = 0;
+	int idx_class    = 0;
+	int idx_dim      = 0;
+	int sz_cur_tile  = 0;
+	int min_class    = 0;
+	float min_dist   = FLT_MAX;
+	float dist       = 0;
+	float diff       = 0;
+#if (0 < KM_DIM)
+	float p_cur_data[KM_DIM];
+
+	for(idx_dim = 0 ; idx_dim < KM_DIM ; idx_dim++)
+	{
+		p_cur_data[idx_dim] = is_valid ? g_src_data_arr[(size_t)idx_dim * sz_data_stride + pos_cur_src] : 0;
+	}
+#endif
+
+	for(idx_tile = 0 ; idx_tile < sz_max_class ; idx_tile += sz_tile_class)
+	{
+		sz_cur_tile = min(sz_tile_class, sz_max_class - idx_tile);
 
 		/* ----------------------- */
 		barrier(CLK_LOCAL_MEM_FENCE);
 		/* ----------------------- */
-		
-		for(class_i = 0 ; class_i < sz_max_class ; class_i++)
+
+		for(idx_elem = get_local_id(0) ; idx_elem < sz_cur_tile * DIM ; idx_elem += get_local_size(0))
 		{
-            src_data_f32x2x2 = g_src_data_arr_f32x2x2[pos_cur_src];
-            cur_cent_f32x2x2 = l_tmp_cent_buf[class_i];
-            
-			cent4.xyzw = cur_cent_f32x2x2.xyxy;
-			diff4 = src_data_f32x2x2 - cent4;
-			dist = dot(diff4.lo, diff4.lo);
-			
-			if(dist < min_dist_x)
-			{
-				min_class_x = class_i << 1;
-				min_dist_x = dist;
-			}
+			l_tmp_cent_buf[idx_elem] = g_src_cent_arr[(size_t)idx_tile * DIM + idx_elem];
+		}
 
-			dist = dot(diff4.hi, diff4.hi);
+		/* ----------------------- */
+		barrier(CLK_LOCAL_MEM_FENCE);
+		/* ----------------------- */
 
-			if(dist < min_dist_y)
-			{
-				min_class_y = class_i << 1;
-				min_dist_y = dist;
-			}
+		if(!is_valid)
+		{
+			continue;
+		}
 
-			cent4.xyzw = cur_cent_f32x2x2.zwzw;
-			diff4 = src_data_f32x2x2 - cent4;
-			dist = dot(diff4.lo, diff4.lo);
+		/* ascending class order with a strict compare: ties keep the lowest index */
+		for(idx_class = 0 ; idx_class < sz_cur_tile ; idx_class++)
+		{
+			dist = 0;
 
-			if(dist < min_dist_x)
+			for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
 			{
-				min_class_x = (class_i << 1) + 1;
-				min_dist_x = dist;
+#if (0 < KM_DIM)
+				diff = p_cur_data[idx_dim] - l_tmp_cent_buf[idx_class * KM_DIM + idx_dim];
+#else
+				diff = g_src_data_arr[(size_t)idx_dim * sz_data_stride + pos_cur_src] - l_tmp_cent_buf[idx_class * dim + idx_dim];
+#endif
+				dist += diff * diff;
 			}
-			
-			dist = dot(diff4.hi, diff4.hi);
 
-			if(dist < min_dist_y)
+			if(dist < min_dist)
 			{
-				min_class_y = (class_i << 1) + 1;
-				min_dist_y = dist;
+				min_class = idx_tile + idx_class;
+				min_dist  = dist;
 			}
 		}
-		p_res_part_arr_s32x2[pos_cur_src] = (int2)(min_class_x, min_class_y);
+	}
+
+	*p_min_dist = min_dist;
+	return min_class;
+}
+
+/* one work-item per point: index of the nearest centroid, by nearest_cent_tiled */
+__kernel void kmeans_assign(	__global  const float*  g_src_cent_arr,
+								__global  const float*  g_src_data_arr,
+								__global        int*    g_res_part_arr,
+								                int     sz_max_class,
+								                int     sz_max_src_data,
+								                int     dim,
+								                int     sz_data_stride,
+								                int     sz_tile_class,
+								__local         float*  l_tmp_cent_buf,
+								__global        int*    g_status,
+								__local         int*    l_tmp_changed)
+{
+	int pos_cur_src  = get_global_id(0);
+	int is_valid     = (pos_cur_src < sz_max_src_data);
+	int min_class    = 0;
+	float min_dist   = FLT_MAX;
+
+	if(g_status[KM_STATUS_DONE])
+	{
+		return;
+	}
+
+	if(0 == get_local_id(0))
+	{
+		l_tmp_changed[0] = 0;
+	}
+
+	/* the first barrier in nearest_cent_tiled also orders the reset above */
+	min_class = nearest_cent_tiled(g_src_cent_arr, g_src_data_arr, pos_cur_src, is_valid,
+								   sz_max_class, dim, sz_data_stride, sz_tile_class, l_tmp_cent_buf, &min_dist);
+
+	if(is_valid && (g_res_part_arr[pos_cur_src] != min_class))
+	{
+		g_res_part_arr[pos_cur_src] = min_class;
+		atomic_inc(l_tmp_changed);
+	}
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	/* one global atomic per work-group */
+	if((0 == get_local_id(0)) && (0 != l_tmp_changed[0]))
+	{
+		atomic_add(&g_status[KM_STATUS_CHANGED], l_tmp_changed[0]);
+	}
+}
+
+/* kmeans_assign for fixed centroids (kmeans_predict): the label and squared distance of every
+   query point, no status words */
+__kernel void kmeans_predict(	__global  const float*  g_src_cent_arr,
+								__global  const float*  g_src_data_arr,
+								__global        int*    g_res_part_arr,
+								__global        float*  g_res_dist_arr,
+								                int     sz_max_class,
+								                int     sz_max_src_data,
+								                int     dim,
+								                int     sz_data_stride,
+								                int     sz_tile_class,
+								__local         float*  l_tmp_cent_buf)
+{
+	int pos_cur_src  = get_global_id(0);
+	int is_valid     = (pos_cur_src < sz_max_src_data);
+	int min_class    = 0;
+	float min_dist   = FLT_MAX;
+
+	min_class = nearest_cent_tiled(g_src_cent_arr, g_src_data_arr, pos_cur_src, is_valid,
+								   sz_max_class, dim, sz_data_stride, sz_tile_class, l_tmp_cent_buf, &min_dist);
+
+	if(is_valid)
+	{
+		g_res_part_arr[pos_cur_src] = min_class;
+		g_res_dist_arr[pos_cur_src] = min_dist;
 	}
 }
 
-__kernel void kmeans_update(	__global        float2*  g_res_cent_arr, 
-								__global        int*     g_res_count_arr, 
-								__global  const float2*  g_src_data_arr, 
-								__global  const int*     g_src_part_arr, 
-								                int      no_max_class, 
-								                int      sz_src_data, 
-												int      SZ_SLOT_IN_BANK)
+/* small K: per-work-group sums and counts, accumulated in local memory and saved for kmeans_reduct.
+   Sums are KM_ACC floats per centroid element, here and in every kernel below. */
+__kernel void kmeans_update(	__global        float*  g_res_cent_arr,
+								__global        int*    g_res_count_arr,
+								__global  const float*  g_src_data_arr,
+								__global  const int*    g_src_part_arr,
+								                int     no_max_class,
+								                int     sz_src_data,
+								                int     dim,
+								                int     sz_data_stride,
+								__local         float*  l_tmp_data_sum,
+								__local         int*    l_tmp_count_sum,
+								__global  const int*    g_status)
 {
 	/* index variables */
-	int idx_pos_cent    = 0;
-	int idx_pos_data    = 0;
-	int pos_out_to_save = 0;
+	int idx_pos_cent = 0;
+	int idx_pos_data = 0;
+	int idx_dim      = 0;
 
 	/* variables releated to built-in function */
-	int pos_global      = get_global_id(0);
-	int sz_stride       = get_global_size(0);
-	int pos_base_global = pos_global * SZ_SLOT_IN_BANK;//get_group_id(0) * get_local_size(0);
+	int pos_local  = get_local_id(0);
+	int sz_local   = get_local_size(0);
+	int pos_group  = get_group_id(0);
+	int sz_cent    = no_max_class * DIM;
+	int sz_sum     = sz_cent * KM_ACC;
+
+	int cur_part = 0;
+
+	if(g_status[KM_STATUS_DONE])
+	{
+		return;
+	}
+
+	/* init local temp buffer */
+	for(idx_pos_cent = pos_local ; idx_pos_cent < sz_sum ; idx_pos_cent += sz_local)
+	{
+		l_tmp_data_sum[idx_pos_cent] = 0;
+	}
+	for(idx_pos_cent = pos_local ; idx_pos_cent < no_max_class ; idx_pos_cent += sz_local)
+	{
+		l_tmp_count_sum[idx_pos_cent] = 0;
+	}
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	for(idx_pos_data = get_global_id(0) ; idx_pos_data < sz_src_data ; idx_pos_data += get_global_size(0))
+	{
+		cur_part = g_src_part_arr[idx_pos_data];
+
+		atomic_inc(&l_tmp_count_sum[cur_part]);
+		for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+		{
+			local_atomic_acc_f32(&l_tmp_data_sum[(cur_part * DIM + idx_dim) * KM_ACC], g_src_data_arr[(size_t)idx_dim * sz_data_stride + idx_pos_data]);
+		}
+	}
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	/* save in group-major order: [group][(class * dim + d) * KM_ACC] */
+	for(idx_pos_cent = pos_local ; idx_pos_cent < sz_sum ; idx_pos_cent += sz_local)
+	{
+		g_res_cent_arr[pos_group * sz_sum + idx_pos_cent] = l_tmp_data_sum[idx_pos_cent];
+	}
+	for(idx_pos_cent = pos_local ; idx_pos_cent < no_max_class ; idx_pos_cent += sz_local)
+	{
+		g_res_count_arr[pos_group * no_max_class + idx_pos_cent] = l_tmp_count_sum[idx_pos_cent];
+	}
+}
+
+/* an empty cluster keeps its centroid and is flagged in g_cent_empty, for kmeans_reseed_pick */
+void cent_mark_empty(__global int* g_cent_empty, int pos_class, int is_empty, __global int* g_status)
+{
+	g_cent_empty[pos_class] = is_empty;
+	if(is_empty)
+	{
+		atomic_inc(&g_status[KM_STATUS_EMPTY]);
+	}
+}
+
+/* one work-item per centroid element: sum the group partials and divide by the count */
+__kernel void kmeans_reduct(	__global        float*  g_res_cent_arr,
+								__global  const float*  g_src_cent_stream,
+								__global  const int*    g_src_count_stream,
+								                int     no_max_class,
+								                int     dim,
+								                int     sz_group,
+								__global        int*    g_cent_empty,
+								__global        int*    g_status)
+{
+	int pos_res   = get_global_id(0);
+	int sz_cent   = no_max_class * DIM;
+	int pos_class = 0;
+	int idx_group = 0;
+
+	/* private data for accumulation */
+	float acc_tmp_data[KM_ACC] = { 0, 0 };
+	int   acc_tmp_count = 0;
+	float new_cent      = 0;
+
+	if((pos_res >= sz_cent) || g_status[KM_STATUS_DONE])
+	{
+		return;
+	}
+
+	pos_class = pos_res / DIM;
+
+	for(idx_group = 0 ; idx_group < sz_group ; idx_group++)
+	{
+		acc_add(acc_tmp_data, g_src_cent_stream[(idx_group * sz_cent + pos_res) * KM_ACC], g_src_cent_stream[(idx_group * sz_cent + pos_res) * KM_ACC + 1]);
+		acc_tmp_count += g_src_count_stream[idx_group * no_max_class + pos_class];
+	}
+
+	if(0 == pos_res % DIM)
+	{
+		cent_mark_empty(g_cent_empty, pos_class, (0 == acc_tmp_count), g_status);
+	}
+	if(0 == acc_tmp_count)
+	{
+		return;
+	}
+
+	new_cent = (acc_tmp_data[0] + acc_tmp_data[1]) / acc_tmp_count;
+	status_shift_max(g_status, new_cent, g_res_cent_arr[pos_res]);
+	g_res_cent_arr[pos_res] = new_cent;
+}
+
+/* large K: sums and counts accumulated straight into global memory.
+   Contention falls as K grows, since the points spread over more centroids. */
+__kernel void kmeans_update_global(	__global        float*  g_res_sum_arr,
+									__global        int*    g_res_count_arr,
+									__global  const float*  g_src_data_arr,
+									__global  const int*    g_src_part_arr,
+									                int     sz_src_data,
+									                int     dim,
+									                int     sz_data_stride,
+									__global  const int*    g_status)
+{
+	int idx_pos_data = 0;
+	int idx_dim      = 0;
+	int cur_part     = 0;
+
+	if(g_status[KM_STATUS_DONE])
+	{
+		return;
+	}
+
+	for(idx_pos_data = get_global_id(0) ; idx_pos_data < sz_src_data ; idx_pos_data += get_global_size(0))
+	{
+		cur_part = g_src_part_arr[idx_pos_data];
+
+		atomic_inc(&g_res_count_arr[cur_part]);
+		for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+		{
+			global_atomic_acc_f32(&g_res_sum_arr[((size_t)cur_part * DIM + idx_dim) * KM_ACC], g_src_data_arr[(size_t)idx_dim * sz_data_stride + idx_pos_data]);
+		}
+	}
+}
 
-	/* private data for src data fetch */
-	float2 cur_data = 0;
-	int    cur_part = 0;
-	/* private buffers for accumulation */
-	float2 p_tmp_data_sum [SZ_MAX_CENTROID];
-	int    p_tmp_count_sum[SZ_MAX_CENTROID];
+/* large K: one work-item per centroid divides its sums and clears them for the next iteration */
+__kernel void kmeans_divide(	__global        float*  g_res_cent_arr,
+								__global        float*  g_src_sum_arr,
+								__global        int*    g_src_count_arr,
+								                int     no_max_class,
+								                int     dim,
+								__global        int*    g_cent_empty,
+								__global        int*    g_status)
+{
+	int pos_class = get_global_id(0);
+	int idx_dim   = 0;
+	int cur_count = 0;
+	size_t pos_base = 0;
+	float new_cent  = 0;
 
-	/* init private temp buffer */
-	for(idx_pos_cent = 0 ; idx_pos_cent < no_max_class ; idx_pos_cent++)
+	if((pos_class >= no_max_class) || g_status[KM_STATUS_DONE])
 	{
-		p_tmp_data_sum [idx_pos_cent] = 0;
-		p_tmp_count_sum[idx_pos_cent] = 0;
+		return;
 	}
-	
-	/* accumulation size: SZ_SLOT_IN_BANK */
-	for(idx_pos_data = pos_base_global ; idx_pos_data < (pos_base_global + SZ_SLOT_IN_BANK) ; idx_pos_data++)
+
+	cur_count = g_src_count_arr[pos_class];
+	pos_base  = (size_t)pos_class * DIM;
+	cent_mark_empty(g_cent_empty, pos_class, (0 == cur_count), g_status);
+
+	for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
 	{
-		if(idx_pos_data < sz_src_data)
+		if(0 != cur_count)
 		{
-			cur_data = g_src_data_arr[idx_pos_data];
-			cur_part = g_src_part_arr[idx_pos_data];
-			
-			p_tmp_data_sum [cur_part] += cur_data;
-			p_tmp_count_sum[cur_part]++;
+			new_cent = (g_src_sum_arr[(pos_base + idx_dim) * KM_ACC] + g_src_sum_arr[(pos_base + idx_dim) * KM_ACC + 1]) / cur_count;
+			status_shift_max(g_status, new_cent, g_res_cent_arr[pos_base + idx_dim]);
+			g_res_cent_arr[pos_base + idx_dim] = new_cent;
 		}
+		g_src_sum_arr[(pos_base + idx_dim) * KM_ACC]     = 0;
+		g_src_sum_arr[(pos_base + idx_dim) * KM_ACC + 1] = 0;
 	}
-	
-	/* save with conversion to plannar type from the view point of centroid order */
-	for(idx_pos_cent = 0 ; idx_pos_cent < no_max_class ; idx_pos_cent++)
+	g_src_count_arr[pos_class] = 0;
+}
+
+/* mini-batch: one work-item per centroid moves it towards the batch mean by count / seen, the
+   running mean of every point it has taken. Sums come from sz_group slices as for kmeans_reduct;
+   clear_sum zeroes them afterwards for the single global slice of kmeans_update_global. A centroid
+   without batch points keeps its place, but one that has not taken a point yet is flagged empty
+   in g_cent_empty, for kmeans_reseed_pick over the batch. */
+__kernel void kmeans_minibatch_step(	__global        float*  g_res_cent_arr,
+										__global        float*  g_src_sum_stream,
+										__global        int*    g_src_count_stream,
+										__global        float*  g_seen_arr,
+										                int     no_max_class,
+										                int     dim,
+										                int     sz_group,
+										                int     clear_sum,
+										__global        int*    g_cent_empty,
+										__global        int*    g_status)
+{
+	int pos_class = get_global_id(0);
+	int sz_cent   = no_max_class * DIM;
+	int idx_group = 0;
+	int idx_dim   = 0;
+	int cur_count = 0;
+	size_t pos_base = 0;
+	float seen      = 0;
+	float acc_tmp_data[KM_ACC] = { 0, 0 };
+	float old_cent  = 0;
+	float new_cent  = 0;
+
+	if((pos_class >= no_max_class) || g_status[KM_STATUS_DONE])
 	{
-		pos_out_to_save = (idx_pos_cent * sz_stride) + pos_global;
+		return;
+	}
 
-		g_res_cent_arr [pos_out_to_save] = p_tmp_data_sum [idx_pos_cent];
-		g_res_count_arr[pos_out_to_save] = p_tmp_count_sum[idx_pos_cent];
+	for(idx_group = 0 ; idx_group < sz_group ; idx_group++)
+	{
+		cur_count += g_src_count_stream[idx_group * no_max_class + pos_class];
+	}
+	if(clear_sum)
+	{
+		g_src_count_stream[pos_class] = 0;
+	}
+	cent_mark_empty(g_cent_empty, pos_class, (0 == cur_count) && (0 == g_seen_arr[pos_class]), g_status);
+	if(0 == cur_count)
+	{
+		return;
 	}
 
-	/* divide the sum with number of class for mean point */
-	/* ==> move to kernel_reduct with plannar order (from the view point of centroid order) */
+	/* a float count stops growing past 2^24, where the rate is already below 1e-7 */
+	seen = g_seen_arr[pos_class] + cur_count;
+	g_seen_arr[pos_class] = seen;
+	pos_base = (size_t)pos_class * DIM;
+
+	for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+	{
+		acc_tmp_data[0] = 0;
+		acc_tmp_data[1] = 0;
+		for(idx_group = 0 ; idx_group < sz_group ; idx_group++)
+		{
+			acc_add(acc_tmp_data, g_src_sum_stream[(idx_group * sz_cent + pos_base + idx_dim) * KM_ACC],
+			                      g_src_sum_stream[(idx_group * sz_cent + pos_base + idx_dim) * KM_ACC + 1]);
+		}
+		if(clear_sum)
+		{
+			g_src_sum_stream[(pos_base + idx_dim) * KM_ACC]     = 0;
+			g_src_sum_stream[(pos_base + idx_dim) * KM_ACC + 1] = 0;
+		}
+
+		old_cent = g_res_cent_arr[pos_base + idx_dim];
+		new_cent = old_cent + ((acc_tmp_data[0] + acc_tmp_data[1]) - cur_count * old_cent) / seen;
+		status_shift_max(g_status, new_cent, old_cent);
+		g_res_cent_arr[pos_base + idx_dim] = new_cent;
+	}
 }
 
-__kernel void kmeans_reduct(	__global        float2*  g_res_cent_arr, 
-								__global  const float2*  g_src_cent_stream, 
-								__global  const int*     g_src_count_stream, 
-								                int      no_max_class, 
-                                                int      sz_src_data, 
-                                                int      SZ_SRC_STRIDE, 
-												int      SZ_SLOT_IN_BANK)
+/* reservoir sampling for kmeans_online_add: point g_src_pos_arr[i] of the batch takes slot
+   g_res_pos_arr[i] of the reservoir, one work-item per kept point. The host drops the earlier of
+   two points bound for one slot, so no two work-items write the same point. */
+__kernel void kmeans_reservoir_keep(	__global        float*  g_res_data_arr,
+										__global  const float*  g_src_data_arr,
+										__global  const int*    g_src_pos_arr,
+										__global  const int*    g_res_pos_arr,
+										                int     no_keep,
+										                int     dim,
+										                int     sz_src_stride,
+										                int     sz_res_stride)
 {
-	/* variables releated to built-in function */
-	int pos_res_cent  = get_group_id(0);
-    int pos_sub_id    = get_local_id(0);
-    int sz_local_item = get_local_size(0);
+	int pos_keep = get_global_id(0);
+	int pos_src  = 0;
+	int pos_res  = 0;
+	int idx_dim  = 0;
+
+	if(pos_keep >= no_keep)
+	{
+		return;
+	}
+
+	pos_src = g_src_pos_arr[pos_keep];
+	pos_res = g_res_pos_arr[pos_keep];
+	for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+	{
+		g_res_data_arr[(size_t)idx_dim * sz_res_stride + pos_res] = g_src_data_arr[(size_t)idx_dim * sz_src_stride + pos_src];
+	}
+}
 
-	/* position variables */
-    int pos_base_global   = (SZ_SRC_STRIDE   * pos_res_cent);
-    int pos_base_local    = (SZ_SLOT_IN_BANK * pos_sub_id);
-    int pos_base_src      = pos_base_global + pos_base_local;
+/* one work-item per centroid sums its sz_group slices into g_res_sum_arr and g_res_count_arr
+   without dividing: multi-device runs add up the devices on the host, streaming runs (add_res)
+   add every chunk to the sums so far and finish with kmeans_divide. clear_sum as for
+   kmeans_minibatch_step. */
+__kernel void kmeans_reduct_sum(	__global        float*  g_res_sum_arr,
+									__global        int*    g_res_count_arr,
+									__global        float*  g_src_sum_stream,
+									__global        int*    g_src_count_stream,
+									                int     no_max_class,
+									                int     dim,
+									                int     sz_group,
+									                int     clear_sum,
+									                int     add_res)
+{
+	int pos_class = get_global_id(0);
+	int sz_cent   = no_max_class * DIM;
+	int idx_group = 0;
+	int idx_dim   = 0;
+	int cur_count = 0;
+	size_t pos_base = 0;
+	float acc_tmp_data[KM_ACC] = { 0, 0 };
 
-    /* index variables */
-    int idx_pos_data = 0;
-    int idx_step     = 0;
+	if(pos_class >= no_max_class)
+	{
+		return;
+	}
 
-	/* private data for src data fetch */
-	__private float2 acc_tmp_data  = 0;
-	__private int    acc_tmp_count = 0;
+	if(add_res)
+	{
+		cur_count = g_res_count_arr[pos_class];
+	}
+	for(idx_group = 0 ; idx_group < sz_group ; idx_group++)
+	{
+		cur_count += g_src_count_stream[idx_group * no_max_class + pos_class];
+	}
+	g_res_count_arr[pos_class] = cur_count;
+	if(clear_sum)
+	{
+		g_src_count_stream[pos_class] = 0;
+	}
 
-	/* local buffers for accumulation */
-	__local float2 l_tmp_data_sum [256];
-	__local int    l_tmp_count_sum[256];
+	pos_base = (size_t)pos_class * DIM;
+	for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+	{
+		acc_tmp_data[0] = add_res ? g_res_sum_arr[(pos_base + idx_dim) * KM_ACC]     : 0;
+		acc_tmp_data[1] = add_res ? g_res_sum_arr[(pos_base + idx_dim) * KM_ACC + 1] : 0;
+		for(idx_group = 0 ; idx_group < sz_group ; idx_group++)
+		{
+			acc_add(acc_tmp_data, g_src_sum_stream[(idx_group * sz_cent + pos_base + idx_dim) * KM_ACC],
+			                      g_src_sum_stream[(idx_group * sz_cent + pos_base + idx_dim) * KM_ACC + 1]);
+		}
+		g_res_sum_arr[(pos_base + idx_dim) * KM_ACC]     = acc_tmp_data[0];
+		g_res_sum_arr[(pos_base + idx_dim) * KM_ACC + 1] = acc_tmp_data[1];
+		if(clear_sum)
+		{
+			g_src_sum_stream[(pos_base + idx_dim) * KM_ACC]     = 0;
+			g_src_sum_stream[(pos_base + idx_dim) * KM_ACC + 1] = 0;
+		}
+	}
+}
 
+/* squared distance of point pos_cur_src to centroid cur_class for the reseed, NaN as -1 so that
+   it is taken last */
+float reseed_point_dist(	__global  const float*  g_src_cent_arr,
+							__global  const float*  g_src_data_arr,
+							                int     cur_class,
+							                int     pos_cur_src,
+							                int     dim,
+							                int     sz_data_stride)
+{
+	int idx_dim     = 0;
+	size_t pos_base = (size_t)cur_class * DIM;
+	float dist      = 0;
+	float diff      = 0;
 
+	for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+	{
+		diff  = g_src_data_arr[(size_t)idx_dim * sz_data_stride + pos_cur_src] - g_src_cent_arr[pos_base + idx_dim];
+		dist += diff * diff;
+	}
+	return isnan(dist) ? -1.0f : dist;
+}
 
-    /* accumulation with size SZ_SLOT_IN_BANK */
-    for(idx_pos_data = pos_base_src ; idx_pos_data < (pos_base_src + SZ_SLOT_IN_BANK) ; idx_pos_data++)
-    {
-        if(idx_pos_data < sz_src_data)
-        {
-            acc_tmp_data  += g_src_cent_stream [idx_pos_data];
-            acc_tmp_count += g_src_count_stream[idx_pos_data];
-        }
-    }
+/* The empty clusters of one run, in index order, move onto the points farthest from their
+   centroids, farthest first and ties to the lowest point index, as km_reseed_empty does on the
+   host. A point taken is marked -FLT_MAX. The clusters moved count as changed, so the run does
+   not stop on a centroid that has not been through an assignment yet. One work-group per run. */
+void reseed_pick_run(	__global        float*  g_res_cent_arr,
+						__global  const float*  g_src_data_arr,
+						__global        float*  g_dist_arr,
+						__global  const int*    g_cent_empty,
+						                int     no_max_class,
+						                int     sz_src_data,
+						                int     dim,
+						                int     sz_data_stride,
+						__local         float*  l_tmp_dist,
+						__local         int*    l_tmp_pos,
+						__global        int*    g_status)
+{
+	int pos_local  = get_local_id(0);
+	int sz_local   = get_local_size(0);
+	int idx_class  = 0;
+	int idx_data   = 0;
+	int idx_dim    = 0;
+	int best_pos   = 0;
+	float best_dist = 0;
+	float new_cent  = 0;
 
-    /* initialize local buffers */
-    l_tmp_data_sum [pos_sub_id] = acc_tmp_data;
-    l_tmp_count_sum[pos_sub_id] = acc_tmp_count;
+	for(idx_class = 0 ; idx_class < no_max_class ; idx_class++)
+	{
+		if(!g_cent_empty[idx_class])
+		{
+			continue;
+		}
 
-	/* ----------------------- */
-	barrier(CLK_LOCAL_MEM_FENCE);
-	/* ----------------------- */
+		/* each work-item walks its points in ascending order, so a strict compare keeps the lowest index */
+		best_dist = -FLT_MAX;
+		best_pos  = -1;
+		for(idx_data = pos_local ; idx_data < sz_src_data ; idx_data += sz_local)
+		{
+			if(g_dist_arr[idx_data] > best_dist)
+			{
+				best_dist = g_dist_arr[idx_data];
+				best_pos  = idx_data;
+			}
+		}
+		l_tmp_dist[pos_local] = best_dist;
+		l_tmp_pos [pos_local] = best_pos;
 
+		/* ----------------------- */
+		barrier(CLK_LOCAL_MEM_FENCE);
+		/* ----------------------- */
 
-    /* hand-maded reduction */
-    for(idx_step = (sz_local_item / 2) ; idx_step >= 1 ; idx_step = idx_step >> 1)
-    {
-        if(pos_sub_id < idx_step)
+		if(0 == pos_local)
 		{
-			l_tmp_data_sum [pos_sub_id] += l_tmp_data_sum [pos_sub_id + idx_step];
-			l_tmp_count_sum[pos_sub_id] += l_tmp_count_sum[pos_sub_id + idx_step];
+			for(idx_data = 1 ; idx_data < sz_local ; idx_data++)
+			{
+				if((l_tmp_dist[idx_data] > l_tmp_dist[0]) ||
+				   ((l_tmp_dist[idx_data] == l_tmp_dist[0]) && (0 <= l_tmp_pos[idx_data]) && (l_tmp_pos[idx_data] < l_tmp_pos[0])))
+				{
+					l_tmp_dist[0] = l_tmp_dist[idx_data];
+					l_tmp_pos [0] = l_tmp_pos [idx_data];
+				}
+			}
 		}
+
 		/* ----------------------- */
 		barrier(CLK_LOCAL_MEM_FENCE);
 		/* ----------------------- */
-    }
 
-	if(0 == pos_sub_id)
+		best_pos = l_tmp_pos[0];
+		/* more empty clusters than points: the rest keep their centroids */
+		if(0 <= best_pos)
+		{
+			for(idx_dim = pos_local ; idx_dim < DIM ; idx_dim += sz_local)
+			{
+				new_cent = g_src_data_arr[(size_t)idx_dim * sz_data_stride + best_pos];
+				status_shift_max(g_status, new_cent, g_res_cent_arr[(size_t)idx_class * DIM + idx_dim]);
+				g_res_cent_arr[(size_t)idx_class * DIM + idx_dim] = new_cent;
+			}
+			if(0 == pos_local)
+			{
+				g_dist_arr[best_pos] = -FLT_MAX;
+				atomic_inc(&g_status[KM_STATUS_CHANGED]);
+			}
+		}
+
+		/* ----------------------------------------------- */
+		barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+		/* ----------------------------------------------- */
+	}
+}
+
+/* Empty clusters, after kmeans_reduct, kmeans_divide or kmeans_minibatch_step: every point's
+   squared distance to its new centroid, for kmeans_reseed_pick. Returns at once in the usual
+   iteration, where no cluster is empty. */
+__kernel void kmeans_reseed_dist(	__global  const float*  g_src_cent_arr,
+									__global  const float*  g_src_data_arr,
+									__global  const int*    g_src_part_arr,
+									__global        float*  g_res_dist_arr,
+									                int     sz_src_data,
+									                int     dim,
+									                int     sz_data_stride,
+									__global  const int*    g_status)
+{
+	int pos_cur_src = get_global_id(0);
+
+	if((pos_cur_src >= sz_src_data) || g_status[KM_STATUS_DONE] || (0 == g_status[KM_STATUS_EMPTY]))
+	{
+		return;
+	}
+
+	g_res_dist_arr[pos_cur_src] = reseed_point_dist(g_src_cent_arr, g_src_data_arr, g_src_part_arr[pos_cur_src], pos_cur_src, dim, sz_data_stride);
+}
+
+/* one work-group: reseed_pick_run over the flagged clusters */
+__kernel void kmeans_reseed_pick(	__global        float*  g_res_cent_arr,
+									__global  const float*  g_src_data_arr,
+									__global        float*  g_dist_arr,
+									__global  const int*    g_cent_empty,
+									                int     no_max_class,
+									                int     sz_src_data,
+									                int     dim,
+									                int     sz_data_stride,
+									__local         float*  l_tmp_dist,
+									__local         int*    l_tmp_pos,
+									__global        int*    g_status)
+{
+	if(g_status[KM_STATUS_DONE] || (0 == g_status[KM_STATUS_EMPTY]))
+	{
+		return;
+	}
+
+	reseed_pick_run(g_res_cent_arr, g_src_data_arr, g_dist_arr, g_cent_empty, no_max_class, sz_src_data, dim, sz_data_stride,
+	                l_tmp_dist, l_tmp_pos, g_status);
+}
+
+/* single work-item: close the iteration. A negative tolerance never converges.
+   check_changed is 0 for mini-batch, where a batch's labels say nothing about the last batch. */
+__kernel void kmeans_check(		__global        int*    g_status,
+								                float   tolerance,
+								                int     check_changed)
+{
+	if((0 != get_global_id(0)) || g_status[KM_STATUS_DONE])
+	{
+		return;
+	}
+
+	g_status[KM_STATUS_ITER]++;
+
+	if((0 <= tolerance) &&
+	   ((check_changed && (0 == g_status[KM_STATUS_CHANGED])) || (as_float(g_status[KM_STATUS_SHIFT]) <= tolerance)))
 	{
-		g_res_cent_arr[pos_res_cent] = l_tmp_data_sum[0] / l_tmp_count_sum[0];
+		g_status[KM_STATUS_DONE] = 1;
 	}
+
+	g_status[KM_STATUS_CHANGED] = 0;
+	g_status[KM_STATUS_SHIFT]   = 0;
+	g_status[KM_STATUS_BOUND]   = 0;
+	g_status[KM_STATUS_EMPTY]   = 0;
 }
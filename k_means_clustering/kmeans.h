@@ -1,15 +1,200 @@
+#ifndef __KMEANS_H__
+#define __KMEANS_H__
 
+// Points and centroids are row-major float arrays of dim floats each:
+// dimension d of point i is data[i * dim + d].
 
-#ifndef __KMENAS_H__
-#define __KMEANS_H__
+// Pruning of the assignment step (engines without pruning ignore it). Hamerly and Elkan use
+// the triangle inequality: both keep an upper bound on each point's distance to its centroid;
+// Hamerly adds one lower bound per point, Elkan one per point and centroid (data_n * class_n
+// floats). The kd-tree filters whole boxes of points at once (CPU only, the OpenCL engine
+// runs Hamerly for it); it pays off in a few dimensions.
+enum KmeansPrune
+{
+    KMEANS_PRUNE_AUTO = 0,  // engine default: on the CPU the kd-tree for low dimensions, else brute force; Hamerly on OpenCL
+    KMEANS_PRUNE_NONE,      // brute force
+    KMEANS_PRUNE_HAMERLY,
+    KMEANS_PRUNE_ELKAN,
+    KMEANS_PRUNE_KDTREE,
+};
+
+// Where the initial centroids come from. The seeded modes overwrite the centroids passed in
+// (only class_n is used) and draw from seed, so a run is reproducible.
+enum KmeansInit
+{
+    KMEANS_INIT_FILE = 0,   // as given by the caller
+    KMEANS_INIT_PLUSPLUS,   // k-means++: one pass over the data per centroid
+    KMEANS_INIT_PARALLEL,   // k-means||: a few oversampling passes, for large class_n
+};
 
-struct Point {
-    float x, y;
+// How the OpenCL kmeans() gets its iterations to the device. Every iteration runs the same
+// kernels with the same arguments; on small problems launching them costs as much as running
+// them.
+enum KmeansLaunch
+{
+    KMEANS_LAUNCH_AUTO = 0,     // record if the device has command buffers, else persistent if it fits, else enqueue
+    KMEANS_LAUNCH_ENQUEUE,      // every kernel of every iteration enqueued on its own
+    KMEANS_LAUNCH_RECORD,       // the iterations between two status reads recorded once in a cl_khr_command_buffer and replayed
+    KMEANS_LAUNCH_PERSISTENT,   // one work-group runs every iteration in a single launch, for small problems
 };
 
+// Stopping rule, checked after every iteration: the run has converged when no point changed
+// cluster, or when no centroid coordinate moved by more than tolerance. A negative tolerance
+// disables the check and always runs iteration_n iterations.
+struct KmeansConfig
+{
+    int   iteration_n;      // upper bound on iterations
+    float tolerance;        // largest centroid coordinate shift still counted as converged
+    int   check_interval;   // iterations between host reads of the device convergence flag
+    int   prune;            // KmeansPrune
+    int   init;             // KmeansInit
+    int   fused;            // OpenCL: assign and accumulate in one kernel when the centroids fit in local memory
+    int   device_n;         // OpenCL: devices to shard the points over, 0 for all found (see kmeans_opencl.cpp)
+    int   launch;           // OpenCL: KmeansLaunch, single-device kmeans() only
+    unsigned seed;          // seeding and batch sampling seed
 
-// Kmean algorighm
-void kmeans(int iteration_n, int class_n, int data_n, Point* centroids, Point* data, int* clsfy_result);
+    // kmeans_minibatch only
+    int      batch_n;       // points per mini-batch
+    int      holdout_n;     // points kept out of training to measure inertia on
 
-#endif // __KMEANS_H__
+    // kmeans_stream only
+    int      chunk_n;       // points per chunk walked (and uploaded) at a time
+
+    // kmeans_bisect only
+    int      refine_n;      // Lloyd iterations over all class_n centroids after the splits
+
+    // kmeans_online only
+    int      reservoir_n;   // points kept for kmeans_online_refine
+};
+
+struct KmeansResult
+{
+    int    iteration_n;     // iterations run, including the one that converged
+    int    converged;       // 1 when the stopping rule fired before iteration_n
+    double inertia;         // sum of squared distances from the points to their centroids
+    long long distance_n;   // point-centroid distances computed, 0 when the engine does not count
+};
+
+// Kmean algorighm. The centroid sums are accumulated in double on the host and as compensated
+// float pairs (sum, rounding error) on the device, so a centroid of millions of points is still
+// its mean to float precision. A cluster left without points keeps its centroid and then moves
+// onto the point farthest from its own centroid, several empty clusters taking the farthest
+// points in index order; that move counts as a change for the stopping rule.
+void kmeans(const KmeansConfig* config, int class_n, int data_n, int dim, float* centroids, const float* data, int* clsfy_result, KmeansResult* result);
+
+// Mini-batch k-means (Sculley 2010). Every iteration assigns batch_n randomly drawn points and
+// moves each centroid towards the mean of its batch points with learning rate
+// (batch points of the centroid) / (all points it has seen so far), so only the sampled points
+// are read and data may be an mmap'ed file far larger than memory. holdout_n points spread over
+// the file never enter training; result->inertia is measured on them (on every point when
+// holdout_n is 0). The tolerance applies to
+// the centroid shift of one batch. clsfy_result (data_n labels, or NULL to skip) is filled by a
+// final assignment pass. A seeded init runs on a sample of the training points. A centroid that
+// has not taken a point yet moves onto the batch point farthest from its own centroid.
+void kmeans_minibatch(const KmeansConfig* config, int class_n, long long data_n, int dim, float* centroids, const float* data, int* clsfy_result, KmeansResult* result);
+
+// Streaming k-means for data larger than host or device memory: data and clsfy_result may be
+// mmap'ed files. Every Lloyd iteration walks the points in chunks of chunk_n; the OpenCL engine
+// uploads the next chunk while the device assigns and accumulates the current one, the host
+// engines run kmeans() on the mapping in place. The labels are those of kmeans() for the same
+// centroids; the centroid sums differ from it only in float summation order. A seeded init
+// scans the whole file on the host. The OpenCL engine does not prune, its bounds would be per
+// point; the host engines prune with Hamerly.
+void kmeans_stream(const KmeansConfig* config, int class_n, long long data_n, int dim, float* centroids, const float* data, int* clsfy_result, KmeansResult* result);
+
+// Bisecting k-means for large class_n. Starting from one cluster of all points, every round
+// splits the clusters with the largest sum of squared distances, as many as are still missing
+// and at most all of them, each by a 2-means run of up to iteration_n iterations on its own
+// points, seeded as config->init asks (k-means++ for KMEANS_INIT_FILE: the initial centroids
+// are not read). A round reads every point at most once, so the splits cost
+// O(data_n log class_n) distances in place of O(data_n class_n) per Lloyd iteration. The splits
+// run on the host thread pool, small clusters concurrently, each one on a worker. refine_n
+// Lloyd iterations of kmeans() then start from the split centroids; with refine_n 0 the labels
+// are the leaves of the split tree, which need not be the nearest centroids. result reports the
+// refinement's iterations and the final inertia.
+void kmeans_bisect(const KmeansConfig* config, int class_n, int data_n, int dim, float* centroids, const float* data, int* clsfy_result, KmeansResult* result);
+
+// Weighted k-means: kmeans() with point i counting weight[i] >= 0 times, as if it were repeated;
+// a NULL weight runs kmeans(). Every centroid is the weighted mean of its points and
+// result->inertia the weighted sum of squared distances; the labels are the nearest centroids,
+// as for kmeans(). A cluster whose points weigh nothing is empty and moves as in kmeans(). Both
+// seeded inits run weighted k-means++ on the host. The OpenCL engine does not prune and adds the weighted sums with global
+// atomics; the host engines run the blocked SIMD assignment of kmeans_simd.
+void kmeans_weighted(const KmeansConfig* config, int class_n, int data_n, int dim, float* centroids, const float* data, const float* weight,
+                     int* clsfy_result, KmeansResult* result);
 
+// Coreset for kmeans_weighted: the data_n points merged, in one pass on the host thread pool,
+// into at most coreset_n weighted points. Space is cut into a grid of cubes whose side is a power
+// of two, the finest grid with at most coreset_n non-empty cubes; the points of a cube become one
+// point at their mean, weighing as many points as it holds. Returns the number of points written
+// to coreset (row-major) and weight, in grid order, and sets *merge_sse to the sum of squared
+// distances from the points to their cube's mean. For any centroids C, with cost the (weighted)
+// sum of squared distances to the nearest centroid of C,
+//     cost(data) <= cost(coreset) + merge_sse  and  cost(coreset) <= (sqrt(cost(data)) + sqrt(merge_sse))^2
+// so centroids fit to the coreset are as good on the data up to merge_sse. A grid cube holds few
+// points in many dimensions: there the coreset only shrinks the data as the cubes grow coarse.
+// data may be an mmap'ed file.
+int kmeans_coreset(int coreset_n, long long data_n, int dim, const float* data, float* coreset, float* weight, double* merge_sse);
+
+// One problem of kmeans_batch
+struct KmeansRun
+{
+    int      class_n;
+    unsigned seed;          // in place of config->seed for this run's init
+    float*   centroids;     // class_n * dim: initial (KMEANS_INIT_FILE) and final
+    int*     clsfy_result;  // data_n labels, or NULL to skip
+    KmeansResult result;
+};
+
+// run_n independent k-means problems over the same data, e.g. restarts with different seeds
+// and/or several values of K, each as kmeans() would run it; compare run_arr[r].result.inertia
+// to pick one. The OpenCL engine uploads the data once and its assignment kernel evaluates the
+// centroids of every run in one pass over each point, without pruning and with the sums
+// accumulated by atomics (so in another float order than kmeans()); the host engines run one
+// after another.
+void kmeans_batch(const KmeansConfig* config, int run_n, KmeansRun* run_arr, int data_n, int dim, const float* data);
+
+// Trained centroids kept ready for assigning new points. The OpenCL engine holds them on the
+// device with its program, buffers and pinned staging memory, which grow with the largest
+// batch seen and are reused by every call; batches too small to pay for a launch stay on the
+// host. The host engines copy them for the blocked SIMD loop of kmeans_simd.cpp.
+struct KmeansModel;
+
+KmeansModel* kmeans_model_create(int class_n, int dim, const float* centroids);
+
+// Nearest centroid of each of the query_n points: the same labels as kmeans() for these
+// centroids, into label, and the squared distance into dist unless it is NULL. Calls on one
+// model must not overlap.
+void kmeans_predict(KmeansModel* model, int query_n, const float* query, int* label, float* dist);
+
+void kmeans_model_release(KmeansModel* model);
+
+// Online k-means for points that keep arriving. kmeans_online_add assigns a batch to the
+// nearest centroids and moves each centroid that took points to the running mean of every point
+// it has taken, the update of kmeans_minibatch, in O(batch_n * class_n). A uniform sample of up
+// to config->reservoir_n of the points added so far (all of them while they fit), drawn with
+// config->seed, is kept for kmeans_online_refine: up to iteration_n Lloyd iterations of kmeans()
+// over the sample, from the current centroids, with config's stopping rule; the running counts
+// are then rescaled to the sample's cluster sizes, so later batches move the centroids no faster
+// than before. The OpenCL engine keeps the centroids, the counts and the sample on the device
+// and only moves the batches and their labels; the host engines keep them in memory.
+struct KmeansOnline;
+
+// centroids: the initial class_n centroids, as KMEANS_INIT_FILE; config->init is not used
+KmeansOnline* kmeans_online_create(const KmeansConfig* config, int class_n, int dim, const float* centroids);
+
+// The label each of the batch_n points got, into clsfy_result unless it is NULL
+void kmeans_online_add(KmeansOnline* online, int batch_n, const float* batch, int* clsfy_result);
+
+// result reports the iterations run and the inertia of the sample
+void kmeans_online_refine(KmeansOnline* online, int iteration_n, KmeansResult* result);
+
+// The current class_n centroids, into centroids
+void kmeans_online_centroids(KmeansOnline* online, float* centroids);
+
+void kmeans_online_release(KmeansOnline* online);
+
+// Sum of squared distances from every point to its assigned centroid, accumulated in double
+double kmeans_inertia(int class_n, int data_n, int dim, const float* centroids, const float* data, const int* clsfy_result);
+
+#endif // __KMEANS_H__
@@ -0,0 +1,313 @@
+/*
+
+ Several independent k-means problems (restarts and/or values of K) over one copy of the data,
+ built together with kmeans.cl (it uses DIM, the g_status words and the atomic helpers from there).
+
+ The centroids of every run are concatenated, run r owning [g_run_begin[r], g_run_begin[r + 1]),
+ and g_cent_run gives the run of each centroid. Labels are run-major, g_part[r * sz_data_stride + i],
+ and hold the index within the run. Each run has its own KM_STATUS_SIZE status words at
+ g_status[r * KM_STATUS_SIZE], so the runs converge and stop one by one.
+
+ kmeans_assign_batch reads every point once and walks all centroids of all runs in tiles, as
+ kmeans_assign does, keeping the nearest one per run; the point then goes into the sums of each
+ of its nearest centroids with global atomics, as in kmeans_update_global. kmeans_divide_batch,
+ kmeans_reseed_dist_batch, kmeans_reseed_pick_batch and kmeans_check_batch close the iteration
+ per run.
+
+*/
+
+/* as in kmeans.cl: distances round as on the host */
+#pragma OPENCL FP_CONTRACT OFF
+
+/* runs per launch, keep in sync with MAX_NO_RUN in kmeans_opencl.cpp */
+#define KM_MAX_RUN (32)
+
+__kernel void kmeans_assign_batch(	__global  const float*  g_src_cent_arr,
+									__global  const int*    g_cent_run,
+									__global  const int*    g_run_begin,
+									__global  const float*  g_src_data_arr,
+									__global        int*    g_res_part_arr,
+									__global        float*  g_res_sum_arr,
+									__global        int*    g_res_count_arr,
+									                int     sz_max_class,
+									                int     no_run,
+									                int     sz_max_src_data,
+									                int     dim,
+									                int     sz_data_stride,
+									                int     sz_tile_class,
+									__local         float*  l_tmp_cent_buf,
+									__local         int*    l_tmp_cent_run,
+									__global        int*    g_status,
+									__local         int*    l_tmp_done,
+									__local         int*    l_tmp_changed)
+{
+	int pos_cur_src  = get_global_id(0);
+	int is_valid     = (pos_cur_src < sz_max_src_data);
+	int idx_elem     = 0;
+	int idx_tile     = 0;
+	int idx_class    = 0;
+	int idx_run      = 0;
+	int idx_dim      = 0;
+	int sz_cur_tile  = 0;
+	int cur_run      = 0;
+	int cur_class    = 0;
+	int min_class[KM_MAX_RUN];
+	float min_dist[KM_MAX_RUN];
+	float dist       = 0;
+	float diff       = 0;
+	size_t pos_part  = 0;
+#if (0 < KM_DIM)
+	float p_cur_data[KM_DIM];
+#endif
+
+	for(idx_run = get_local_id(0) ; idx_run < no_run ; idx_run += get_local_size(0))
+	{
+		l_tmp_done[idx_run]    = g_status[idx_run * KM_STATUS_SIZE + KM_STATUS_DONE];
+		l_tmp_changed[idx_run] = 0;
+	}
+	for(idx_run = 0 ; idx_run < no_run ; idx_run++)
+	{
+		min_class[idx_run] = 0;
+		min_dist[idx_run]  = FLT_MAX;
+	}
+
+#if (0 < KM_DIM)
+	for(idx_dim = 0 ; idx_dim < KM_DIM ; idx_dim++)
+	{
+		p_cur_data[idx_dim] = is_valid ? g_src_data_arr[(size_t)idx_dim * sz_data_stride + pos_cur_src] : 0;
+	}
+#define CUR_DATA(d) (p_cur_data[(d)])
+#else
+#define CUR_DATA(d) (g_src_data_arr[(size_t)(d) * sz_data_stride + pos_cur_src])
+#endif
+
+	for(idx_tile = 0 ; idx_tile < sz_max_class ; idx_tile += sz_tile_class)
+	{
+		sz_cur_tile = min(sz_tile_class, sz_max_class - idx_tile);
+
+		/* ----------------------- */
+		barrier(CLK_LOCAL_MEM_FENCE);
+		/* ----------------------- */
+
+		for(idx_elem = get_local_id(0) ; idx_elem < sz_cur_tile * DIM ; idx_elem += get_local_size(0))
+		{
+			l_tmp_cent_buf[idx_elem] = g_src_cent_arr[(size_t)idx_tile * DIM + idx_elem];
+		}
+		for(idx_elem = get_local_id(0) ; idx_elem < sz_cur_tile ; idx_elem += get_local_size(0))
+		{
+			l_tmp_cent_run[idx_elem] = g_cent_run[idx_tile + idx_elem];
+		}
+
+		/* ----------------------- */
+		barrier(CLK_LOCAL_MEM_FENCE);
+		/* ----------------------- */
+
+		if(!is_valid)
+		{
+			continue;
+		}
+
+		/* ascending order within each run with a strict compare: ties keep the lowest index */
+		for(idx_class = 0 ; idx_class < sz_cur_tile ; idx_class++)
+		{
+			cur_run = l_tmp_cent_run[idx_class];
+			if(l_tmp_done[cur_run])
+			{
+				continue;
+			}
+
+			dist = 0;
+			for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+			{
+				diff  = CUR_DATA(idx_dim) - l_tmp_cent_buf[idx_class * DIM + idx_dim];
+				dist += diff * diff;
+			}
+
+			if(dist < min_dist[cur_run])
+			{
+				min_class[cur_run] = idx_tile + idx_class;
+				min_dist[cur_run]  = dist;
+			}
+		}
+	}
+
+	if(is_valid)
+	{
+		for(idx_run = 0 ; idx_run < no_run ; idx_run++)
+		{
+			if(l_tmp_done[idx_run])
+			{
+				continue;
+			}
+
+			cur_class = min_class[idx_run];
+			pos_part  = (size_t)idx_run * sz_data_stride + pos_cur_src;
+			if(g_res_part_arr[pos_part] != cur_class - g_run_begin[idx_run])
+			{
+				g_res_part_arr[pos_part] = cur_class - g_run_begin[idx_run];
+				atomic_inc(&l_tmp_changed[idx_run]);
+			}
+
+			atomic_inc(&g_res_count_arr[cur_class]);
+			for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+			{
+				global_atomic_acc_f32(&g_res_sum_arr[((size_t)cur_class * DIM + idx_dim) * KM_ACC], CUR_DATA(idx_dim));
+			}
+		}
+	}
+#undef CUR_DATA
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	/* one global atomic per work-group and run */
+	for(idx_run = get_local_id(0) ; idx_run < no_run ; idx_run += get_local_size(0))
+	{
+		if(0 != l_tmp_changed[idx_run])
+		{
+			atomic_add(&g_status[idx_run * KM_STATUS_SIZE + KM_STATUS_CHANGED], l_tmp_changed[idx_run]);
+		}
+	}
+}
+
+/* one work-item per centroid, as kmeans_divide, with the status words of its run;
+   an empty centroid keeps its position and is flagged for kmeans_reseed_pick_batch */
+__kernel void kmeans_divide_batch(	__global        float*  g_res_cent_arr,
+									__global        float*  g_src_sum_arr,
+									__global        int*    g_src_count_arr,
+									__global  const int*    g_cent_run,
+									                int     sz_max_class,
+									                int     dim,
+									__global        int*    g_cent_empty,
+									__global        int*    g_status)
+{
+	int pos_class = get_global_id(0);
+	int idx_dim   = 0;
+	int cur_count = 0;
+	size_t pos_base = 0;
+	float new_cent  = 0;
+	__global int* g_run_status = NULL;
+
+	if(pos_class >= sz_max_class)
+	{
+		return;
+	}
+	g_run_status = &g_status[g_cent_run[pos_class] * KM_STATUS_SIZE];
+	if(g_run_status[KM_STATUS_DONE])
+	{
+		return;
+	}
+
+	cur_count = g_src_count_arr[pos_class];
+	pos_base  = (size_t)pos_class * DIM;
+	cent_mark_empty(g_cent_empty, pos_class, (0 == cur_count), g_run_status);
+
+	for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+	{
+		if(0 != cur_count)
+		{
+			new_cent = (g_src_sum_arr[(pos_base + idx_dim) * KM_ACC] + g_src_sum_arr[(pos_base + idx_dim) * KM_ACC + 1]) / cur_count;
+			status_shift_max(g_run_status, new_cent, g_res_cent_arr[pos_base + idx_dim]);
+			g_res_cent_arr[pos_base + idx_dim] = new_cent;
+		}
+		g_src_sum_arr[(pos_base + idx_dim) * KM_ACC]     = 0;
+		g_src_sum_arr[(pos_base + idx_dim) * KM_ACC + 1] = 0;
+	}
+	g_src_count_arr[pos_class] = 0;
+}
+
+/* kmeans_reseed_dist for every run with an empty cluster: one work-item per point, the
+   distances run-major like the labels */
+__kernel void kmeans_reseed_dist_batch(	__global  const float*  g_src_cent_arr,
+										__global  const int*    g_run_begin,
+										__global  const float*  g_src_data_arr,
+										__global  const int*    g_src_part_arr,
+										__global        float*  g_res_dist_arr,
+										                int     no_run,
+										                int     sz_src_data,
+										                int     dim,
+										                int     sz_data_stride,
+										__global  const int*    g_status)
+{
+	int pos_cur_src = get_global_id(0);
+	int idx_run     = 0;
+	size_t pos_part = 0;
+	__global const int* g_run_status = NULL;
+
+	if(pos_cur_src >= sz_src_data)
+	{
+		return;
+	}
+
+	for(idx_run = 0 ; idx_run < no_run ; idx_run++)
+	{
+		g_run_status = &g_status[idx_run * KM_STATUS_SIZE];
+		if(g_run_status[KM_STATUS_DONE] || (0 == g_run_status[KM_STATUS_EMPTY]))
+		{
+			continue;
+		}
+
+		pos_part = (size_t)idx_run * sz_data_stride + pos_cur_src;
+		g_res_dist_arr[pos_part] = reseed_point_dist(g_src_cent_arr, g_src_data_arr, g_run_begin[idx_run] + g_src_part_arr[pos_part],
+		                                             pos_cur_src, dim, sz_data_stride);
+	}
+}
+
+/* kmeans_reseed_pick with one work-group per run, on the run's centroids, distances and status words */
+__kernel void kmeans_reseed_pick_batch(	__global        float*  g_res_cent_arr,
+										__global  const int*    g_run_begin,
+										__global  const float*  g_src_data_arr,
+										__global        float*  g_dist_arr,
+										__global  const int*    g_cent_empty,
+										                int     sz_src_data,
+										                int     dim,
+										                int     sz_data_stride,
+										__local         float*  l_tmp_dist,
+										__local         int*    l_tmp_pos,
+										__global        int*    g_status)
+{
+	int pos_run   = get_group_id(0);
+	int run_begin = g_run_begin[pos_run];
+	__global int* g_run_status = &g_status[pos_run * KM_STATUS_SIZE];
+
+	if(g_run_status[KM_STATUS_DONE] || (0 == g_run_status[KM_STATUS_EMPTY]))
+	{
+		return;
+	}
+
+	reseed_pick_run(&g_res_cent_arr[(size_t)run_begin * DIM], g_src_data_arr, &g_dist_arr[(size_t)pos_run * sz_data_stride], &g_cent_empty[run_begin],
+	                g_run_begin[pos_run + 1] - run_begin, sz_src_data, dim, sz_data_stride, l_tmp_dist, l_tmp_pos, g_run_status);
+}
+
+/* one work-item per run: kmeans_check on the run's status words */
+__kernel void kmeans_check_batch(	__global        int*    g_status,
+									                int     no_run,
+									                float   tolerance)
+{
+	int pos_run = get_global_id(0);
+	__global int* g_run_status = NULL;
+
+	if(pos_run >= no_run)
+	{
+		return;
+	}
+	g_run_status = &g_status[pos_run * KM_STATUS_SIZE];
+	if(g_run_status[KM_STATUS_DONE])
+	{
+		return;
+	}
+
+	g_run_status[KM_STATUS_ITER]++;
+
+	if((0 <= tolerance) &&
+	   ((0 == g_run_status[KM_STATUS_CHANGED]) || (as_float(g_run_status[KM_STATUS_SHIFT]) <= tolerance)))
+	{
+		g_run_status[KM_STATUS_DONE] = 1;
+	}
+
+	g_run_status[KM_STATUS_CHANGED] = 0;
+	g_run_status[KM_STATUS_SHIFT]   = 0;
+	g_run_status[KM_STATUS_BOUND]   = 0;
+	g_run_status[KM_STATUS_EMPTY]   = 0;
+}
@@ -0,0 +1,24 @@
+/*
+  Batched KMeans for the host engines: one kmeans() per run, each with its own seed
+*/
+
+#include "kmeans.h"
+
+#include <stdlib.h>
+
+
+void kmeans_batch(const KmeansConfig* config, int run_n, KmeansRun* run_arr, int data_n, int dim, const float* data)
+{
+    int* labels = (int*)malloc(sizeof(int) * data_n);
+
+    for (int run_i = 0; run_i < run_n; run_i++) {
+        KmeansRun* run = &run_arr[run_i];
+        KmeansConfig run_config = *config;
+
+        run_config.seed = run->seed;
+        kmeans(&run_config, run->class_n, data_n, dim, run->centroids, data,
+               (NULL != run->clsfy_result) ? run->clsfy_result : labels, &run->result);
+    }
+
+    free(labels);
+}
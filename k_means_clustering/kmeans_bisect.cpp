@@ -0,0 +1,271 @@
+/*
+  Bisecting KMeans on the host thread pool, refined by the build's kmeans()
+
+  The points are copied once into cluster order: every cluster owns a contiguous range of the
+  copy, and of perm, the original index of each position. A split hands its range to
+  kmeans_simd as is, then partitions it in place by the 2-means labels, left child first.
+
+  Each round picks the clusters to split, largest sum of squared distances first, and runs them
+  largest first: a cluster holding more than one worker's share of the points left in the round
+  runs alone on the whole pool, the rest run side by side, each worker taking a run of them with
+  kmeans_simd's loops on its own thread. The new clusters are numbered after the round, in the
+  order the clusters were picked, so the result does not depend on the number of workers beyond
+  kmeans_simd's summation order.
+
+  The OpenCL build splits on the host too: a 2-means run on one cluster is far too small to pay
+  for the device program kmeans() builds on every call. Only the refinement runs on the device.
+*/
+
+#include "kmeans.h"
+#include "kmeans_common.h"
+#include "kmeans_thread.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+
+struct BisectCluster
+{
+    int begin;      // positions [begin, end) of the cluster order
+    int end;
+    double sse;     // sum of squared distances to its centroid, -1 once a split failed
+};
+
+// One split of a round, filled by the worker running it
+struct BisectTask
+{
+    int cluster;
+    int left_n;                 // points of the left child, 0 when the split failed
+    std::vector<float> cent;    // left and right centroids
+    double sse[2];
+    long long distance_n;
+};
+
+struct BisectState
+{
+    const KmeansConfig* config;
+    int dim;
+    std::vector<float> point;           // the points in cluster order
+    std::vector<int> perm;              // position -> point index
+    std::vector<BisectCluster> cluster; // cluster i has centroid i
+};
+
+
+static double bisect_sse(const float* point, int n, int dim, const float* centroid)
+{
+    double sse = 0.0;
+
+    for (int i = 0; i < n; i++) {
+        for (int d = 0; d < dim; d++) {
+            double t = (double)point[(size_t)i * dim + d] - (double)centroid[d];
+
+            sse += t * t;
+        }
+    }
+
+    return sse;
+}
+
+// 2-means on the points of task->cluster, then its range partitioned by label
+static void bisect_split(BisectState* st, BisectTask* task, unsigned seed)
+{
+    const BisectCluster* c = &st->cluster[task->cluster];
+    int n = c->end - c->begin;
+    int dim = st->dim;
+    float* point = &st->point[(size_t)c->begin * dim];
+    int* perm = &st->perm[c->begin];
+    KmeansConfig split_config = *st->config;
+    KmeansResult split_result;
+    std::vector<int> label(n);
+
+    split_config.prune = KMEANS_PRUNE_NONE;
+    split_config.init = (KMEANS_INIT_FILE == st->config->init) ? KMEANS_INIT_PLUSPLUS : st->config->init;
+    split_config.seed = seed;
+    // a split always runs to its fixed point, whatever the refinement's stopping rule
+    if (split_config.tolerance < 0) {
+        split_config.tolerance = 0.0f;
+    }
+
+    task->cent.resize((size_t)2 * dim);
+    kmeans_simd(&split_config, 2, n, dim, &task->cent[0], point, &label[0], &split_result);
+    task->distance_n = split_result.distance_n;
+
+    task->left_n = (int)std::count(label.begin(), label.end(), 0);
+    if (0 == task->left_n || n == task->left_n) {
+        task->left_n = 0;
+        return;
+    }
+
+    // stable: each child keeps the points in their previous order
+    std::vector<float> tmp_point((size_t)n * dim);
+    std::vector<int> tmp_perm(n);
+    int pos[2] = { 0, task->left_n };
+
+    for (int i = 0; i < n; i++) {
+        int p = pos[label[i]]++;
+
+        memcpy(&tmp_point[(size_t)p * dim], point + (size_t)i * dim, sizeof(float) * dim);
+        tmp_perm[p] = perm[i];
+    }
+    memcpy(point, &tmp_point[0], sizeof(float) * n * dim);
+    memcpy(perm, &tmp_perm[0], sizeof(int) * n);
+
+    task->sse[0] = bisect_sse(point, task->left_n, dim, &task->cent[0]);
+    task->sse[1] = bisect_sse(point + (size_t)task->left_n * dim, n - task->left_n, dim, &task->cent[dim]);
+}
+
+
+void kmeans_bisect(const KmeansConfig* config, int class_n, int data_n, int dim, float* centroids, const float* data, int* partitioned, KmeansResult* result)
+{
+    BisectState st;
+    long long distance_n = 0;
+    const int thread_n = km_thread_count();
+
+    st.config = config;
+    st.dim = dim;
+    st.point.resize((size_t)data_n * dim);
+    st.perm.resize(data_n);
+    km_parallel_for((size_t)data_n * dim, [&](size_t begin_sz, size_t end_sz)
+    {
+        memcpy(&st.point[begin_sz], data + begin_sz, sizeof(float) * (end_sz - begin_sz));
+    });
+    std::iota(st.perm.begin(), st.perm.end(), 0);
+
+    // one cluster of every point, at their mean
+    {
+        std::vector<double> sum(dim, 0.0);
+        BisectCluster all = { 0, data_n, 0.0 };
+
+        for (int i = 0; i < data_n; i++) {
+            for (int d = 0; d < dim; d++) {
+                sum[d] += data[(size_t)i * dim + d];
+            }
+        }
+        for (int d = 0; d < dim; d++) {
+            centroids[d] = (data_n > 0) ? (float)(sum[d] / data_n) : 0.0f;
+        }
+        all.sse = bisect_sse(data, data_n, dim, centroids);
+        st.cluster.push_back(all);
+    }
+
+    while ((int)st.cluster.size() < class_n) {
+        std::vector<int> pick;
+        std::vector<BisectTask> task;
+
+        for (int cluster_i = 0; cluster_i < (int)st.cluster.size(); cluster_i++) {
+            if (st.cluster[cluster_i].sse > 0.0 && st.cluster[cluster_i].end - st.cluster[cluster_i].begin > 1) {
+                pick.push_back(cluster_i);
+            }
+        }
+        if (pick.empty()) {
+            break;
+        }
+
+        std::stable_sort(pick.begin(), pick.end(), [&](int a, int b) { return st.cluster[a].sse > st.cluster[b].sse; });
+        pick.resize(std::min(pick.size(), (size_t)class_n - st.cluster.size()));
+
+        // run largest first; the seed of a split is fixed by its place in pick
+        std::vector<int> order(pick.size());
+        long long left_points = 0;
+
+        task.resize(pick.size());
+        for (size_t task_i = 0; task_i < pick.size(); task_i++) {
+            task[task_i].cluster = pick[task_i];
+            order[task_i] = (int)task_i;
+            left_points += st.cluster[pick[task_i]].end - st.cluster[pick[task_i]].begin;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b)
+        {
+            const BisectCluster* ca = &st.cluster[task[a].cluster];
+            const BisectCluster* cb = &st.cluster[task[b].cluster];
+
+            return ca->end - ca->begin > cb->end - cb->begin;
+        });
+
+        auto split_seed = [&](int task_i) { return config->seed + (unsigned)(st.cluster.size() + task_i); };
+
+        size_t alone_n = 0;
+
+        while (alone_n < order.size()) {
+            const BisectCluster* c = &st.cluster[task[order[alone_n]].cluster];
+            long long n = c->end - c->begin;
+
+            if (n * thread_n <= left_points) {
+                break;
+            }
+            bisect_split(&st, &task[order[alone_n]], split_seed(order[alone_n]));
+            left_points -= n;
+            alone_n++;
+        }
+
+        // the rest side by side: worker w takes the tasks starting in its share of the points
+        std::vector<long long> first(order.size() + 1, 0);
+
+        for (size_t k = alone_n; k < order.size(); k++) {
+            const BisectCluster* c = &st.cluster[task[order[k]].cluster];
+
+            first[k + 1] = first[k] + (c->end - c->begin);
+        }
+        km_parallel_run((size_t)left_points * 2 * dim, [&](int thread_idx, int width)
+        {
+            long long begin = left_points * thread_idx / width;
+            long long end = left_points * (thread_idx + 1) / width;
+
+            for (size_t k = alone_n; k < order.size(); k++) {
+                if (first[k] >= begin && first[k] < end) {
+                    bisect_split(&st, &task[order[k]], split_seed(order[k]));
+                }
+            }
+        });
+
+        // number the new clusters in pick order
+        for (size_t task_i = 0; task_i < task.size(); task_i++) {
+            BisectTask* t = &task[task_i];
+            BisectCluster* c = &st.cluster[t->cluster];
+
+            distance_n += t->distance_n;
+            if (0 == t->left_n) {
+                c->sse = -1.0;
+                continue;
+            }
+
+            BisectCluster right = { c->begin + t->left_n, c->end, t->sse[1] };
+            int right_i = (int)st.cluster.size();
+
+            c->end = right.begin;
+            c->sse = t->sse[0];
+            memcpy(centroids + (size_t)t->cluster * dim, &t->cent[0], sizeof(float) * dim);
+            memcpy(centroids + (size_t)right_i * dim, &t->cent[dim], sizeof(float) * dim);
+            st.cluster.push_back(right);
+        }
+    }
+
+    // fewer distinct points than class_n: the rest repeat centroid 0 and stay empty
+    for (int class_i = (int)st.cluster.size(); class_i < class_n; class_i++) {
+        memcpy(centroids + (size_t)class_i * dim, centroids, sizeof(float) * dim);
+    }
+
+    if (config->refine_n > 0) {
+        KmeansConfig refine_config = *config;
+
+        refine_config.init = KMEANS_INIT_FILE;
+        refine_config.iteration_n = config->refine_n;
+        kmeans(&refine_config, class_n, data_n, dim, centroids, data, partitioned, result);
+        result->distance_n += distance_n;
+        return;
+    }
+
+    for (int cluster_i = 0; cluster_i < (int)st.cluster.size(); cluster_i++) {
+        for (int pos = st.cluster[cluster_i].begin; pos < st.cluster[cluster_i].end; pos++) {
+            partitioned[st.perm[pos]] = cluster_i;
+        }
+    }
+
+    result->iteration_n = 0;
+    result->converged = 0;
+    result->inertia = kmeans_inertia(class_n, data_n, dim, centroids, data, partitioned);
+    result->distance_n = distance_n;
+}
@@ -0,0 +1,172 @@
+
+#include "kmeans.h"
+#include "kmeans_common.h"
+#include "kmeans_thread.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+
+double kmeans_inertia(int class_n, int data_n, int dim, const float* centroids, const float* data, const int* partitioned)
+{
+    double inertia = 0.0;
+    int data_i, d;
+
+    for (data_i = 0; data_i < data_n; data_i++) {
+        const float* point = data + (size_t)data_i * dim;
+        int class_i = partitioned[data_i];
+
+        if (class_i < 0 || class_i >= class_n) {
+            continue;
+        }
+
+        const float* centroid = centroids + (size_t)class_i * dim;
+
+        for (d = 0; d < dim; d++) {
+            double t = (double)point[d] - (double)centroid[d];
+
+            inertia += t * t;
+        }
+    }
+
+    return inertia;
+}
+
+
+int km_nearest(int class_n, int dim, const float* centroids, const float* point, float* min_dist_p)
+{
+    float min_dist = FLT_MAX;
+    int min_class = 0;
+
+    for (int class_i = 0; class_i < class_n; class_i++) {
+        const float* centroid = centroids + (size_t)class_i * dim;
+        float dist = 0.0f;
+
+        for (int d = 0; d < dim; d++) {
+            float t = point[d] - centroid[d];
+
+            dist += t * t;
+        }
+
+        if (dist < min_dist) {
+            min_class = class_i;
+            min_dist = dist;
+        }
+    }
+
+    if (min_dist_p != NULL) {
+        *min_dist_p = min_dist;
+    }
+    return min_class;
+}
+
+
+void km_holdout_init(KmHoldout* holdout, long long data_n, int holdout_n, KmRng* rng)
+{
+    // keep at least half of the points for training
+    holdout->stride = (holdout_n > 0) ? data_n / holdout_n : 0;
+    if (holdout->stride < 2) {
+        holdout->stride = 0;
+        holdout->offset = 0;
+        holdout->n = 0;
+        return;
+    }
+
+    holdout->offset = (long long)(km_rng_next(rng) % (uint64_t)holdout->stride);
+    holdout->n = (data_n - holdout->offset + holdout->stride - 1) / holdout->stride;
+}
+
+void km_sample_batch(KmRng* rng, const KmHoldout* holdout, long long data_n, int batch_n, long long* idx)
+{
+    for (int batch_i = 0; batch_i < batch_n; batch_i++) {
+        long long data_i;
+
+        do {
+            data_i = (long long)(km_rng_next(rng) % (uint64_t)data_n);
+        } while (holdout->stride != 0 && data_i % holdout->stride == holdout->offset);
+
+        idx[batch_i] = data_i;
+    }
+
+    std::sort(idx, idx + batch_n);
+}
+
+double km_holdout_inertia(const KmHoldout* holdout, long long data_n, int class_n, int dim, const float* centroids, const float* data)
+{
+    long long stride = (holdout->n > 0) ? holdout->stride : 1;
+    long long offset = (holdout->n > 0) ? holdout->offset : 0;
+    long long hold_n = (holdout->n > 0) ? holdout->n : data_n;
+    double inertia = 0.0;
+
+    for (long long hold_i = 0; hold_i < hold_n; hold_i++) {
+        const float* point = data + (size_t)(offset + hold_i * stride) * dim;
+        int class_i = km_nearest(class_n, dim, centroids, point, NULL);
+        const float* centroid = centroids + (size_t)class_i * dim;
+
+        for (int d = 0; d < dim; d++) {
+            double t = (double)point[d] - (double)centroid[d];
+
+            inertia += t * t;
+        }
+    }
+
+    return inertia;
+}
+
+void km_assign_all(int class_n, long long data_n, int dim, const float* centroids, const float* data, int* partitioned)
+{
+    km_parallel_for((size_t)data_n, [&](size_t begin_sz, size_t end_sz)
+    {
+        for (size_t data_i = begin_sz; data_i < end_sz; data_i++) {
+            partitioned[data_i] = km_nearest(class_n, dim, centroids, data + data_i * dim, NULL);
+        }
+    });
+}
+
+int km_reseed_empty(int empty_n, const int* empty_class, long long data_n, int dim, const float* data, const int* partitioned, float* centroids)
+{
+    int take_n = (int)std::min((long long)empty_n, data_n);
+    std::vector<float> dist;
+    std::vector<long long> order;
+
+    if (take_n <= 0) {
+        return 0;
+    }
+
+    // distance of each point to its own centroid, the float expression of km_nearest
+    dist.resize((size_t)data_n);
+    km_parallel_for((size_t)data_n, [&](size_t begin_sz, size_t end_sz)
+    {
+        for (size_t data_i = begin_sz; data_i < end_sz; data_i++) {
+            const float* point = data + data_i * dim;
+            const float* centroid = centroids + (size_t)partitioned[data_i] * dim;
+            float d2 = 0.0f;
+
+            for (int d = 0; d < dim; d++) {
+                float t = point[d] - centroid[d];
+
+                d2 += t * t;
+            }
+            dist[data_i] = isnan(d2) ? -1.0f : d2;
+        }
+    });
+
+    order.resize((size_t)data_n);
+    std::iota(order.begin(), order.end(), 0LL);
+    std::partial_sort(order.begin(), order.begin() + take_n, order.end(), [&](long long a, long long b)
+    {
+        return (dist[a] > dist[b]) || (dist[a] == dist[b] && a < b);
+    });
+
+    for (int empty_i = 0; empty_i < take_n; empty_i++) {
+        memcpy(centroids + (size_t)empty_class[empty_i] * dim, data + (size_t)order[empty_i] * dim, sizeof(float) * dim);
+    }
+
+    return take_n;
+}
@@ -0,0 +1,148 @@
+#ifndef __KMEANS_COMMON_H__
+#define __KMEANS_COMMON_H__
+
+// Helpers shared by the k-means engines; not part of the kmeans.h API.
+
+#include "kmeans.h"
+
+#include <stdint.h>
+
+// splitmix64: seedable, one add and two multiplies per draw
+struct KmRng
+{
+    uint64_t state;
+};
+
+static inline void km_rng_seed(KmRng* rng, uint64_t seed)
+{
+    rng->state = seed;
+}
+
+static inline uint64_t km_rng_next(KmRng* rng)
+{
+    uint64_t z = (rng->state += 0x9E3779B97F4A7C15ull);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// uniform in [0, 1) with 53 random bits
+static inline double km_rng_uniform(KmRng* rng)
+{
+    return (double)(km_rng_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Stateless draw in [0, 1) for point data_i in k-means|| pass round, so the picks do not depend on
+// how the points are split over threads. kmeans_seed.cl computes the same bits.
+static inline double km_hash_uniform(uint64_t seed, int round, long long data_i)
+{
+    KmRng rng;
+
+    km_rng_seed(&rng, seed + ((uint64_t)round << 40));
+    rng.state = km_rng_next(&rng) + (uint64_t)data_i;
+    return km_rng_uniform(&rng);
+}
+
+// Nearest centroid by the brute-force loop of kmeans_seq.cpp: same float expression, ties keep
+// the lowest index. The squared distance goes to *min_dist_p when it is not NULL.
+int km_nearest(int class_n, int dim, const float* centroids, const float* point, float* min_dist_p);
+
+// Mini-batch hold-out set: every stride-th point from offset on. Spread evenly over the file,
+// and a training draw can reject it with one modulo.
+struct KmHoldout
+{
+    long long stride;   // 0 when there is no hold-out set
+    long long offset;
+    long long n;
+};
+
+void km_holdout_init(KmHoldout* holdout, long long data_n, int holdout_n, KmRng* rng);
+
+// batch_n training point indices drawn with replacement outside the hold-out set, sorted so that
+// the reads walk an mmap'ed file forwards
+void km_sample_batch(KmRng* rng, const KmHoldout* holdout, long long data_n, int batch_n, long long* idx);
+
+// Sum of squared distances from the hold-out points to their nearest centroid; over all data_n
+// points when there is no hold-out set
+double km_holdout_inertia(const KmHoldout* holdout, long long data_n, int class_n, int dim, const float* centroids, const float* data);
+
+// Nearest centroid of every point on the host thread pool; data may be an mmap'ed file
+void km_assign_all(int class_n, long long data_n, int dim, const float* centroids, const float* data, int* clsfy_result);
+
+// Empty clusters after an update step: the empty_n classes of empty_class, in order, move onto
+// the points farthest from their own centroids, farthest first and ties to the lowest index.
+// A NaN distance counts as -1, so those points go last. Returns how many clusters moved, fewer
+// than empty_n only when there are fewer points. kmeans_reseed_pick in kmeans.cl does the same.
+int km_reseed_empty(int empty_n, const int* empty_class, long long data_n, int dim, const float* data, const int* partitioned, float* centroids);
+
+// Blocked SIMD brute force on the host thread pool (kmeans_simd.cpp): kmeans_cpu's engine
+// without pruning, and the OpenCL build's when there is no device. Same labels as the
+// brute-force loop of kmeans_seq.cpp; the centroid sums are kept per thread, in double.
+void kmeans_simd(const KmeansConfig* config, int class_n, int data_n, int dim, float* centroids, const float* data, int* clsfy_result, KmeansResult* result);
+
+// Filtering over a kd-tree of the points (kmeans_kdtree.cpp): kmeans_cpu's engine for low
+// dimensions. Same labels as the brute-force loop of kmeans_seq.cpp; the centroid sums are
+// added per subtree, in double.
+void kmeans_kdtree(const KmeansConfig* config, int class_n, int data_n, int dim, float* centroids, const float* data, int* clsfy_result, KmeansResult* result);
+
+// kmeans_simd's assignment against fixed centroids, for kmeans_predict: a copy of the centroids,
+// walked in L1-sized tiles, and one query staging block per worker, allocated once
+struct KmSimdModel;
+
+KmSimdModel* km_simd_model_create(int class_n, int dim, const float* centroids);
+void km_simd_predict(KmSimdModel* model, int query_n, const float* query, int* label, float* dist);
+void km_simd_model_release(KmSimdModel* model);
+
+// Reservoir sampling (Vitter's algorithm R) for kmeans_online: the slot of a reservoir of
+// reservoir_n points that point added_i (0-based over every point added) takes, or -1 when it is
+// left out. Slots repeat, a later point replacing an earlier one.
+static inline int km_reservoir_slot(KmRng* rng, long long added_i, int reservoir_n)
+{
+    if (added_i < reservoir_n) {
+        return (int)added_i;
+    }
+
+    uint64_t pick = km_rng_next(rng) % (uint64_t)(added_i + 1);
+
+    return (pick < (uint64_t)reservoir_n) ? (int)pick : -1;
+}
+
+// kmeans_online on the host (kmeans_online.cpp): the host engines' kmeans_online_*, and the
+// OpenCL build's when there is no device. The refinement runs the build's kmeans().
+struct KmOnline;
+
+KmOnline* km_online_create(const KmeansConfig* config, int class_n, int dim, const float* centroids);
+void km_online_add(KmOnline* online, int batch_n, const float* batch, int* clsfy_result);
+void km_online_refine(KmOnline* online, int iteration_n, KmeansResult* result);
+void km_online_centroids(const KmOnline* online, float* centroids);
+void km_online_release(KmOnline* online);
+
+// kmeans_weighted on the host (kmeans_weighted.cpp): kmeans_simd's assignment with per-thread
+// weighted sums in double. The host engines' kmeans_weighted, and the OpenCL build's when there
+// is no device.
+void kmeans_weighted_simd(const KmeansConfig* config, int class_n, int data_n, int dim, float* centroids, const float* data, const float* weight,
+                          int* clsfy_result, KmeansResult* result);
+
+// Weighted k-means++ (km_seed_reduce over every point) for both seeded inits; nothing happens
+// for KMEANS_INIT_FILE
+void km_weighted_seed(const KmeansConfig* config, int class_n, int data_n, int dim, const float* data, const float* weight, float* centroids);
+
+// kmeans_inertia with point i counting weight[i] times
+double km_weighted_inertia(int class_n, int data_n, int dim, const float* centroids, const float* data, const float* weight, const int* clsfy_result);
+
+// k-means|| passes and candidates kept per pass, as a multiple of class_n
+#define KM_SEED_ROUNDS     (5)
+#define KM_SEED_OVERSAMPLE (2)
+
+// Seeding (kmeans_seed.cpp): k-means++ or k-means|| as config->init asks, into centroids.
+// Nothing happens for KMEANS_INIT_FILE.
+void km_seed(const KmeansConfig* config, int class_n, long long data_n, int dim, const float* data, float* centroids);
+
+// km_seed on a sample of the training points drawn like a mini-batch, for data too large to scan
+void km_seed_sample(const KmeansConfig* config, int class_n, long long data_n, int dim, const float* data, const KmHoldout* holdout, KmRng* rng, float* centroids);
+
+// k-means|| reduction: class_n centroids out of cand_n weighted candidates by weighted k-means++
+void km_seed_reduce(int cand_n, int dim, const float* cand, const double* weight, int class_n, KmRng* rng, float* centroids);
+
+#endif // __KMEANS_COMMON_H__
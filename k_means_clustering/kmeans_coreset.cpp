@@ -0,0 +1,288 @@
+/*
+  Grid coreset for kmeans_weighted, one pass on the host thread pool
+
+  Cube c of level L holds the points x with floor(x[d] / 2^L) == c[d] in every dimension, so the
+  cubes of level L + 1 are unions of cubes of level L, and halving the coordinates (rounding
+  down) coarsens a grid without reading the points again. A cube keeps the number of its points,
+  their mean and the sum of squared distances to the mean, updated point by point and merged as
+  Welford and Chan et al. do, which stays accurate where sum(x^2) - n * mean^2 would cancel.
+
+  Every worker walks its share of the points from the finest level, in an open-addressing table
+  of cubes, and coarsens its grid whenever it holds more than coreset_n cubes. The grids are then
+  merged at the coarsest of their levels and coarsened again until coreset_n cubes remain. A
+  worker's points never need a finer level than all the points do, so the final level, the finest
+  that fits, does not depend on the number of workers; the means and sums only differ in
+  rounding.
+*/
+
+#include "kmeans.h"
+#include "kmeans_thread.h"
+
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+
+// Finest cube side 2^CORESET_MIN_LEVEL; a key stays below 2^CORESET_KEY_BITS, coarsening first
+#define CORESET_MIN_LEVEL (-64)
+#define CORESET_KEY_BITS  (62)
+// Past the last level whose cubes split space at the origin: one cube of everything
+#define CORESET_TOP_LEVEL (INT_MAX)
+
+
+struct CoresetGrid
+{
+    int dim;
+    int level;
+    int cube_n;
+    std::vector<long long> key;     // dim per cube
+    std::vector<double> mean;       // dim per cube
+    std::vector<double> weight;     // points per cube
+    std::vector<double> sse;        // squared distances to the mean per cube
+    std::vector<int> table;         // cube index or -1, a power of two in size
+};
+
+
+static inline uint64_t coreset_mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static uint64_t coreset_hash(const long long* key, int dim)
+{
+    uint64_t h = 0;
+
+    for (int d = 0; d < dim; d++) {
+        h = coreset_mix(h + (uint64_t)key[d] + 0x9E3779B97F4A7C15ull);
+    }
+    return h;
+}
+
+// floor(key / 2^shift) for either sign
+static inline long long coreset_shift(long long key, int shift)
+{
+    if (shift >= 63) {
+        return (key < 0) ? -1 : 0;
+    }
+    return (key >= 0) ? (key >> shift) : ~((~key) >> shift);
+}
+
+static void coreset_grid_init(CoresetGrid* grid, int dim, int level)
+{
+    grid->dim = dim;
+    grid->level = level;
+    grid->cube_n = 0;
+    grid->key.clear();
+    grid->mean.clear();
+    grid->weight.clear();
+    grid->sse.clear();
+    grid->table.assign(64, -1);
+}
+
+static void coreset_grid_rehash(CoresetGrid* grid)
+{
+    size_t mask = grid->table.size() * 2 - 1;
+
+    grid->table.assign(mask + 1, -1);
+    for (int cube_i = 0; cube_i < grid->cube_n; cube_i++) {
+        size_t pos = coreset_hash(&grid->key[(size_t)cube_i * grid->dim], grid->dim) & mask;
+
+        while (grid->table[pos] >= 0) {
+            pos = (pos + 1) & mask;
+        }
+        grid->table[pos] = cube_i;
+    }
+}
+
+// The cube of key, added empty when it is new
+static int coreset_grid_find(CoresetGrid* grid, const long long* key)
+{
+    const int dim = grid->dim;
+    size_t mask = grid->table.size() - 1;
+    size_t pos = coreset_hash(key, dim) & mask;
+
+    for (; grid->table[pos] >= 0; pos = (pos + 1) & mask) {
+        if (memcmp(&grid->key[(size_t)grid->table[pos] * dim], key, sizeof(long long) * dim) == 0) {
+            return grid->table[pos];
+        }
+    }
+
+    int cube_i = grid->cube_n++;
+
+    grid->key.insert(grid->key.end(), key, key + dim);
+    grid->mean.resize((size_t)grid->cube_n * dim, 0.0);
+    grid->weight.push_back(0.0);
+    grid->sse.push_back(0.0);
+    grid->table[pos] = cube_i;
+    if ((size_t)grid->cube_n * 2 > grid->table.size()) {
+        coreset_grid_rehash(grid);
+    }
+    return cube_i;
+}
+
+// Chan et al.: the cube of key takes weight points of mean and sse
+static void coreset_grid_merge(CoresetGrid* grid, const long long* key, double weight, const double* mean, double sse)
+{
+    const int dim = grid->dim;
+    int cube_i = coreset_grid_find(grid, key);
+    double* p_mean = &grid->mean[(size_t)cube_i * dim];
+    double total = grid->weight[cube_i] + weight;
+    double delta_sq = 0.0;
+
+    for (int d = 0; d < dim; d++) {
+        double delta = mean[d] - p_mean[d];
+
+        delta_sq += delta * delta;
+        p_mean[d] += delta * weight / total;
+    }
+    grid->sse[cube_i] += sse + delta_sq * grid->weight[cube_i] * weight / total;
+    grid->weight[cube_i] = total;
+}
+
+// The same cubes at level, a coarser one than grid's
+static void coreset_grid_coarsen(CoresetGrid* grid, int level)
+{
+    const int dim = grid->dim;
+    CoresetGrid coarse;
+    std::vector<long long> key(dim);
+
+    coreset_grid_init(&coarse, dim, level);
+    for (int cube_i = 0; cube_i < grid->cube_n; cube_i++) {
+        for (int d = 0; d < dim; d++) {
+            key[d] = (CORESET_TOP_LEVEL == level) ? 0 : coreset_shift(grid->key[(size_t)cube_i * dim + d], level - grid->level);
+        }
+        coreset_grid_merge(&coarse, &key[0], grid->weight[cube_i], &grid->mean[(size_t)cube_i * dim], grid->sse[cube_i]);
+    }
+    std::swap(*grid, coarse);
+}
+
+// One level up, or to the top once every key is -1 or 0 and halving merges nothing more
+static void coreset_grid_coarsen_step(CoresetGrid* grid)
+{
+    for (size_t elem_i = 0; elem_i < grid->key.size(); elem_i++) {
+        if (grid->key[elem_i] < -1 || grid->key[elem_i] > 0) {
+            coreset_grid_coarsen(grid, grid->level + 1);
+            return;
+        }
+    }
+    coreset_grid_coarsen(grid, CORESET_TOP_LEVEL);
+}
+
+static void coreset_grid_fit(CoresetGrid* grid, int coreset_n)
+{
+    while (grid->cube_n > coreset_n && CORESET_TOP_LEVEL != grid->level) {
+        coreset_grid_coarsen_step(grid);
+    }
+}
+
+// Welford: one point into its cube, after coarsening far enough for its key to fit
+static void coreset_grid_add(CoresetGrid* grid, const float* point, long long* key)
+{
+    const int dim = grid->dim;
+
+    for (int d = 0; d < dim; d++) {
+        int exp = 0;
+
+        frexp((double)point[d], &exp);
+        if (CORESET_TOP_LEVEL != grid->level && exp - CORESET_KEY_BITS > grid->level) {
+            coreset_grid_coarsen(grid, exp - CORESET_KEY_BITS);
+        }
+    }
+    for (int d = 0; d < dim; d++) {
+        key[d] = (CORESET_TOP_LEVEL == grid->level) ? 0 : (long long)floor(ldexp((double)point[d], -grid->level));
+    }
+
+    int cube_i = coreset_grid_find(grid, key);
+    double* p_mean = &grid->mean[(size_t)cube_i * dim];
+    double total = grid->weight[cube_i] + 1.0;
+
+    for (int d = 0; d < dim; d++) {
+        double delta = point[d] - p_mean[d];
+
+        p_mean[d] += delta / total;
+        grid->sse[cube_i] += delta * (point[d] - p_mean[d]);
+    }
+    grid->weight[cube_i] = total;
+}
+
+
+int kmeans_coreset(int coreset_n, long long data_n, int dim, const float* data, float* coreset, float* weight, double* merge_sse)
+{
+    const int thread_n = km_parallel_width((size_t)data_n * dim);
+    std::vector<CoresetGrid> part(thread_n);
+    CoresetGrid grid;
+    int level = CORESET_MIN_LEVEL;
+
+    km_parallel_run((size_t)data_n * dim, [&](int thread_idx, int width)
+    {
+        long long begin = data_n * thread_idx / width;
+        long long end = data_n * (thread_idx + 1) / width;
+        CoresetGrid* p_grid = &part[thread_idx];
+        std::vector<long long> key(dim);
+
+        coreset_grid_init(p_grid, dim, CORESET_MIN_LEVEL);
+        for (long long data_i = begin; data_i < end; data_i++) {
+            const float* point = data + (size_t)data_i * dim;
+            bool finite = true;
+
+            for (int d = 0; d < dim; d++) {
+                finite = finite && isfinite(point[d]);
+            }
+            // a point with a NaN or infinite coordinate is left out
+            if (!finite) {
+                continue;
+            }
+            coreset_grid_add(p_grid, point, &key[0]);
+            if (p_grid->cube_n > coreset_n) {
+                coreset_grid_fit(p_grid, coreset_n);
+            }
+        }
+    });
+
+    // every worker's cubes at the coarsest level, then the finest level that fits
+    for (int thread_idx = 0; thread_idx < thread_n; thread_idx++) {
+        level = std::max(level, part[thread_idx].level);
+    }
+    coreset_grid_init(&grid, dim, level);
+    for (int thread_idx = 0; thread_idx < thread_n; thread_idx++) {
+        if (part[thread_idx].level != level) {
+            coreset_grid_coarsen(&part[thread_idx], level);
+        }
+        for (int cube_i = 0; cube_i < part[thread_idx].cube_n; cube_i++) {
+            coreset_grid_merge(&grid, &part[thread_idx].key[(size_t)cube_i * dim], part[thread_idx].weight[cube_i],
+                               &part[thread_idx].mean[(size_t)cube_i * dim], part[thread_idx].sse[cube_i]);
+        }
+        part[thread_idx] = CoresetGrid();
+    }
+    coreset_grid_fit(&grid, coreset_n);
+
+    // grid order: the keys sorted, so the output does not depend on the workers either
+    std::vector<int> order(grid.cube_n);
+
+    for (int cube_i = 0; cube_i < grid.cube_n; cube_i++) {
+        order[cube_i] = cube_i;
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b)
+    {
+        return std::lexicographical_compare(&grid.key[(size_t)a * dim], &grid.key[(size_t)(a + 1) * dim],
+                                            &grid.key[(size_t)b * dim], &grid.key[(size_t)(b + 1) * dim]);
+    });
+
+    *merge_sse = 0.0;
+    for (int out_i = 0; out_i < grid.cube_n; out_i++) {
+        int cube_i = order[out_i];
+
+        for (int d = 0; d < dim; d++) {
+            coreset[(size_t)out_i * dim + d] = (float)grid.mean[(size_t)cube_i * dim + d];
+        }
+        weight[out_i] = (float)grid.weight[cube_i];
+        *merge_sse += grid.sse[cube_i];
+    }
+    return grid.cube_n;
+}
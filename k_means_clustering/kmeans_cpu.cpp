@@ -0,0 +1,451 @@
+/*
+  Multithreaded CPU implementation of KMeans with triangle-inequality pruning
+
+  The assignment step keeps distance bounds per point (Hamerly: one upper and one lower bound,
+  Elkan: one upper bound and a lower bound per centroid) and only computes the distances the
+  bounds cannot rule out. With pruning off it runs kmeans_simd.cpp instead, and with the kd-tree
+  kmeans_kdtree.cpp; the labels of both match kmeans_seq.cpp, but their centroid sums are added
+  in another order. AUTO takes the kd-tree in a few dimensions and kmeans_simd.cpp above them:
+  the bounded loops compute one distance at a time and lose to the blocked SIMD brute force
+  even when they skip most of them.
+
+  With Hamerly or Elkan, the labels are the ones the brute-force loop of kmeans_seq.cpp picks
+  for the same centroids:
+  - every distance that is computed uses the same float expression, and ties keep the lowest
+    centroid index, as in the brute-force loop;
+  - bounds are widened by the rounding error of a float distance and moved outwards whenever
+    they are updated, so a centroid is only skipped when the brute-force compare could not
+    have picked it.
+  Once its labels are final, each thread adds its points into its own double sums, which are
+  merged per centroid in thread order; as in kmeans_simd.cpp, the centroids can differ from
+  kmeans_seq.cpp in the last bit. Empty clusters are reseeded by the same km_reseed_empty.
+*/
+
+#include "kmeans.h"
+#include "kmeans_common.h"
+#include "kmeans_thread.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#include <vector>
+
+
+// Elkan runs while its bounds (data_n * class_n floats) and centroid table (class_n^2) stay below this
+#define KM_ELKAN_MAX_BYTES (1ull << 30)
+// AUTO picks the kd-tree up to this dimension: beyond it the boxes are too wide to rule much out
+#define KM_KDTREE_MAX_DIM 4
+
+
+// Squared distance, written exactly as the assignment loop in kmeans_seq.cpp
+static inline float km_dist2(const float* point, const float* centroid, int dim)
+{
+    float dist = 0.0f;
+
+    for (int d = 0; d < dim; d++) {
+        float t = point[d] - centroid[d];
+
+        dist += t * t;
+    }
+
+    return dist;
+}
+
+// Relative error of sqrt(km_dist2) against the exact distance, with slack for the bound arithmetic
+static inline float km_dist_eps(int dim)
+{
+    return (float)(dim + 8) * FLT_EPSILON;
+}
+
+// Round a non-negative bound away from the value it bounds
+static inline float km_round_up(float x)
+{
+    return x * (1.0f + 2.0f * FLT_EPSILON);
+}
+
+static inline float km_round_down(float x)
+{
+    return (x > 0.0f) ? x * (1.0f - 2.0f * FLT_EPSILON) : 0.0f;
+}
+
+// True when the upper bound u proves the assigned centroid beats one whose distance is at least m.
+// NaN fails the test and falls back to computing the distance.
+static inline bool km_bound_skip(float u, float m, float eps)
+{
+    return u * (1.0f + eps) < m * (1.0f - eps);
+}
+
+static int km_prune_mode(const KmeansConfig* config, int class_n, int data_n, int dim)
+{
+    bool elkan_fits = ((unsigned long long)data_n * class_n * sizeof(float) <= KM_ELKAN_MAX_BYTES) &&
+                      ((unsigned long long)class_n * class_n * sizeof(float) <= KM_ELKAN_MAX_BYTES);
+
+    switch (config->prune) {
+    case KMEANS_PRUNE_NONE:
+        return KMEANS_PRUNE_NONE;
+    case KMEANS_PRUNE_ELKAN:
+        // too many bounds to keep: Hamerly is the memory-light fallback
+        return elkan_fits ? KMEANS_PRUNE_ELKAN : KMEANS_PRUNE_HAMERLY;
+    case KMEANS_PRUNE_HAMERLY:
+        return KMEANS_PRUNE_HAMERLY;
+    case KMEANS_PRUNE_KDTREE:
+        return KMEANS_PRUNE_KDTREE;
+    default:
+        // the bounded loops are scalar: above the kd-tree's range the SIMD brute force is faster
+        return (dim <= KM_KDTREE_MAX_DIM) ? KMEANS_PRUNE_KDTREE : KMEANS_PRUNE_NONE;
+    }
+}
+
+
+// Per-thread tallies, padded so that neighbouring workers do not share a cache line
+struct KmTally
+{
+    int changed;
+    long long distance_n;
+    char pad[64 - sizeof(int) - sizeof(long long)];
+};
+
+// Per-thread centroid sums of the update step
+struct KmThreadSum
+{
+    std::vector<double> sum;
+    std::vector<int> count;
+};
+
+
+void kmeans(const KmeansConfig* config, int class_n, int data_n, int dim, float* centroids, const float* data, int* partitioned, KmeansResult* result)
+{
+    const int prune = km_prune_mode(config, class_n, data_n, dim);
+    const float eps = km_dist_eps(dim);
+    const size_t cent_sz = (size_t)class_n * dim;
+    const int thread_n = km_parallel_width(data_n);
+    // the merge reads every thread's sums of a centroid element
+    const size_t merge_sz = cent_sz * thread_n;
+    const int merge_n = km_parallel_width(merge_sz);
+
+    // Centroids of the previous iteration, for the shift check and the bound updates
+    std::vector<float> prev(cent_sz);
+    // Count number of data in each class, summed per thread in double and merged
+    std::vector<KmThreadSum> thread_sum(thread_n);
+    std::vector<int> count(class_n);
+    std::vector<float> merge_shift(merge_n);
+    // Classes left without points by the update step
+    std::vector<int> empty_class;
+    // Upper bound on each point's distance to its centroid
+    std::vector<float> upper;
+    // Hamerly: lower bound on the distance to any other centroid. Elkan: one per centroid.
+    std::vector<float> lower;
+    // Upper bound on how far each centroid moved in the last update, and the largest one
+    std::vector<float> cent_shift(class_n, 0.0f);
+    float shift_max = 0.0f;
+    // Hamerly: half the distance to the nearest other centroid. Elkan: half of every pair.
+    std::vector<float> cent_half;
+    std::vector<KmTally> tally(thread_n);
+    int i, changed, converged = 0;
+    float shift;
+    long long distance_n = 0;
+
+    // Nothing to prune: the blocked SIMD loop is the faster brute force
+    if (KMEANS_PRUNE_NONE == prune) {
+        kmeans_simd(config, class_n, data_n, dim, centroids, data, partitioned, result);
+        return;
+    }
+    if (KMEANS_PRUNE_KDTREE == prune) {
+        kmeans_kdtree(config, class_n, data_n, dim, centroids, data, partitioned, result);
+        return;
+    }
+
+    if (KMEANS_PRUNE_NONE != prune) {
+        upper.assign(data_n, 0.0f);
+    }
+    if (KMEANS_PRUNE_HAMERLY == prune) {
+        lower.assign(data_n, 0.0f);
+        cent_half.assign(class_n, 0.0f);
+    }
+    if (KMEANS_PRUNE_ELKAN == prune) {
+        lower.assign((size_t)data_n * class_n, 0.0f);
+        cent_half.assign((size_t)class_n * class_n, 0.0f);
+    }
+
+    km_seed(config, class_n, data_n, dim, data, centroids);
+
+    // No point starts in a cluster, so the first iteration scans every centroid
+    for (int data_i = 0; data_i < data_n; data_i++) {
+        partitioned[data_i] = -1;
+    }
+
+
+    for (i = 0; i < config->iteration_n && !converged; i++) {
+
+        // Assignment step
+        km_parallel_run(data_n, [&](int thread_idx, int width)
+        {
+            size_t begin_sz, end_sz;
+            KmTally* p_tally = &tally[thread_idx];
+
+            km_thread_range(data_n, thread_idx, width, &begin_sz, &end_sz);
+            p_tally->changed = 0;
+            p_tally->distance_n = 0;
+
+            for (size_t data_i = begin_sz; data_i < end_sz; data_i++) {
+                const float* point = data + data_i * dim;
+                int cur_class = partitioned[data_i];
+                int min_class = 0;
+
+                if (KMEANS_PRUNE_HAMERLY == prune && cur_class >= 0) {
+                    float u = km_round_up(upper[data_i] + cent_shift[cur_class]);
+                    float l = km_round_down(lower[data_i] - shift_max);
+                    float m = (cent_half[cur_class] > l) ? cent_half[cur_class] : l;
+
+                    upper[data_i] = u;
+                    lower[data_i] = l;
+                    if (km_bound_skip(u, m, eps)) {
+                        continue;
+                    }
+
+                    // tighten the upper bound before paying for a full scan
+                    u = km_round_up(sqrtf(km_dist2(point, centroids + (size_t)cur_class * dim, dim)) * (1.0f + eps));
+                    p_tally->distance_n++;
+                    upper[data_i] = u;
+                    if (km_bound_skip(u, m, eps)) {
+                        continue;
+                    }
+                }
+
+                if (KMEANS_PRUNE_ELKAN == prune && cur_class >= 0) {
+                    float* l = &lower[data_i * class_n];
+                    const float* half = &cent_half[(size_t)cur_class * class_n];
+                    float u = km_round_up(upper[data_i] + cent_shift[cur_class]);
+                    float min_dist = 0.0f;
+                    bool tight = false;
+
+                    for (int class_i = 0; class_i < class_n; class_i++) {
+                        l[class_i] = km_round_down(l[class_i] - cent_shift[class_i]);
+                    }
+
+                    min_class = cur_class;
+                    for (int class_i = 0; class_i < class_n; class_i++) {
+                        float m = (half[class_i] > l[class_i]) ? half[class_i] : l[class_i];
+                        float dist;
+
+                        if (class_i == min_class || km_bound_skip(u, m, eps)) {
+                            continue;
+                        }
+                        if (!tight) {
+                            min_dist = km_dist2(point, centroids + (size_t)min_class * dim, dim);
+                            u = km_round_up(sqrtf(min_dist) * (1.0f + eps));
+                            l[min_class] = km_round_down(sqrtf(min_dist) * (1.0f - eps));
+                            p_tally->distance_n++;
+                            tight = true;
+                            if (km_bound_skip(u, m, eps)) {
+                                continue;
+                            }
+                        }
+
+                        dist = km_dist2(point, centroids + (size_t)class_i * dim, dim);
+                        l[class_i] = km_round_down(sqrtf(dist) * (1.0f - eps));
+                        p_tally->distance_n++;
+
+                        // lowest (distance, index) pair, as the ascending strict compare picks
+                        if (dist < min_dist || (dist == min_dist && class_i < min_class)) {
+                            min_class = class_i;
+                            min_dist = dist;
+                            u = km_round_up(sqrtf(dist) * (1.0f + eps));
+                            half = &cent_half[(size_t)min_class * class_n];
+                        }
+                    }
+
+                    upper[data_i] = u;
+                    if (cur_class != min_class) {
+                        partitioned[data_i] = min_class;
+                        p_tally->changed++;
+                    }
+                    continue;
+                }
+
+                // Full scan, the brute-force loop plus the runner-up for the bounds
+                {
+                    float min_dist = FLT_MAX;
+                    float second_dist = FLT_MAX;
+
+                    for (int class_i = 0; class_i < class_n; class_i++) {
+                        float dist = km_dist2(point, centroids + (size_t)class_i * dim, dim);
+
+                        if (KMEANS_PRUNE_ELKAN == prune) {
+                            lower[data_i * class_n + class_i] = km_round_down(sqrtf(dist) * (1.0f - eps));
+                        }
+                        if (dist < min_dist) {
+                            second_dist = min_dist;
+                            min_class = class_i;
+                            min_dist = dist;
+                        } else if (dist < second_dist) {
+                            second_dist = dist;
+                        }
+                    }
+                    p_tally->distance_n += class_n;
+
+                    if (KMEANS_PRUNE_NONE != prune) {
+                        upper[data_i] = km_round_up(sqrtf(min_dist) * (1.0f + eps));
+                    }
+                    if (KMEANS_PRUNE_HAMERLY == prune) {
+                        lower[data_i] = km_round_down(sqrtf(second_dist) * (1.0f - eps));
+                    }
+                }
+
+                if (cur_class != min_class) {
+                    partitioned[data_i] = min_class;
+                    p_tally->changed++;
+                }
+            }
+
+            // The labels of this range are final: add its points to the thread's sums
+            KmThreadSum* p_sum = &thread_sum[thread_idx];
+
+            p_sum->sum.assign(cent_sz, 0.0);
+            p_sum->count.assign(class_n, 0);
+            for (size_t data_i = begin_sz; data_i < end_sz; data_i++) {
+                int class_i = partitioned[data_i];
+                double* class_sum = &p_sum->sum[(size_t)class_i * dim];
+
+                for (int d = 0; d < dim; d++) {
+                    class_sum[d] += data[data_i * dim + d];
+                }
+                p_sum->count[class_i]++;
+            }
+        });
+
+        changed = 0;
+        for (int thread_idx = 0; thread_idx < thread_n; thread_idx++) {
+            changed += tally[thread_idx].changed;
+            distance_n += tally[thread_idx].distance_n;
+        }
+
+        // Update step: each thread merges the per-thread sums of a range of centroids, in thread order
+        memcpy(prev.data(), centroids, sizeof(float) * cent_sz);
+        km_parallel_run(merge_sz, [&](int thread_idx, int width)
+        {
+            int class_begin = (int)((long long)class_n * thread_idx / width);
+            int class_end = (int)((long long)class_n * (thread_idx + 1) / width);
+            float local_shift = 0.0f;
+
+            for (int class_i = class_begin; class_i < class_end; class_i++) {
+                const float* old_centroid = &prev[(size_t)class_i * dim];
+                float* centroid = centroids + (size_t)class_i * dim;
+
+                count[class_i] = 0;
+                for (int src_idx = 0; src_idx < thread_n; src_idx++) {
+                    count[class_i] += thread_sum[src_idx].count[class_i];
+                }
+                // an empty cluster keeps its centroid until km_reseed_empty below
+                if (0 == count[class_i]) {
+                    cent_shift[class_i] = 0.0f;
+                    continue;
+                }
+                for (int d = 0; d < dim; d++) {
+                    size_t elem_i = (size_t)class_i * dim + d;
+                    double sum = 0.0;
+
+                    for (int src_idx = 0; src_idx < thread_n; src_idx++) {
+                        sum += thread_sum[src_idx].sum[elem_i];
+                    }
+                    centroid[d] = (float)(sum / count[class_i]);
+                }
+
+                for (int d = 0; d < dim; d++) {
+                    float t = fabsf(centroid[d] - old_centroid[d]);
+
+                    // NaN sticks, as in kmeans_seq.cpp
+                    if (t > local_shift || isnan(t)) {
+                        local_shift = t;
+                    }
+                }
+
+                cent_shift[class_i] = km_round_up(sqrtf(km_dist2(centroid, old_centroid, dim)) * (1.0f + eps));
+            }
+
+            merge_shift[thread_idx] = local_shift;
+        });
+
+        shift = 0.0f;
+        for (int thread_idx = 0; thread_idx < merge_n; thread_idx++) {
+            float t = merge_shift[thread_idx];
+
+            if (t > shift || isnan(t)) {
+                shift = t;
+            }
+        }
+
+        // Empty clusters move onto the farthest points, as in kmeans_seq.cpp
+        empty_class.clear();
+        for (int class_i = 0; class_i < class_n; class_i++) {
+            if (0 == count[class_i]) {
+                empty_class.push_back(class_i);
+            }
+        }
+        if (!empty_class.empty()) {
+            changed += km_reseed_empty((int)empty_class.size(), empty_class.data(), data_n, dim, data, partitioned, centroids);
+            for (int class_i : empty_class) {
+                const float* old_centroid = &prev[(size_t)class_i * dim];
+                const float* centroid = centroids + (size_t)class_i * dim;
+
+                for (int d = 0; d < dim; d++) {
+                    float t = fabsf(centroid[d] - old_centroid[d]);
+
+                    if (t > shift || isnan(t)) {
+                        shift = t;
+                    }
+                }
+                cent_shift[class_i] = km_round_up(sqrtf(km_dist2(centroid, old_centroid, dim)) * (1.0f + eps));
+            }
+        }
+
+        // Centroid bounds for the next assignment step
+        if (KMEANS_PRUNE_NONE != prune) {
+            shift_max = 0.0f;
+            for (int class_i = 0; class_i < class_n; class_i++) {
+                if (cent_shift[class_i] > shift_max) {
+                    shift_max = cent_shift[class_i];
+                }
+            }
+        }
+        // Hamerly's centroid table is only worth O(K^2) work while K is below N
+        if ((KMEANS_PRUNE_ELKAN == prune) || (KMEANS_PRUNE_HAMERLY == prune && class_n <= data_n)) {
+            km_parallel_run((size_t)class_n * class_n, [&](int thread_idx, int width)
+            {
+                int class_begin = (int)((long long)class_n * thread_idx / width);
+                int class_end = (int)((long long)class_n * (thread_idx + 1) / width);
+
+                for (int class_i = class_begin; class_i < class_end; class_i++) {
+                    const float* centroid = centroids + (size_t)class_i * dim;
+                    float min_half = FLT_MAX;
+
+                    for (int other_i = 0; other_i < class_n; other_i++) {
+                        float half;
+
+                        if (other_i == class_i) {
+                            continue;
+                        }
+                        half = km_round_down(0.5f * sqrtf(km_dist2(centroid, centroids + (size_t)other_i * dim, dim)) * (1.0f - eps));
+                        if (KMEANS_PRUNE_ELKAN == prune) {
+                            cent_half[(size_t)class_i * class_n + other_i] = half;
+                        } else if (half < min_half) {
+                            min_half = half;
+                        }
+                    }
+                    if (KMEANS_PRUNE_HAMERLY == prune) {
+                        cent_half[class_i] = min_half;
+                    }
+                }
+            });
+        }
+
+        converged = (config->tolerance >= 0) && ((0 == changed) || (shift <= config->tolerance));
+    }
+
+    result->iteration_n = i;
+    result->converged = converged;
+    result->inertia = kmeans_inertia(class_n, data_n, dim, centroids, data, partitioned);
+    result->distance_n = distance_n;
+}
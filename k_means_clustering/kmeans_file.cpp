@@ -0,0 +1,480 @@
+/*
+  Point files: the legacy count + rows format and the chunked KMPT format (see kmeans_file.h)
+
+  Files are mapped read-only. Uncompressed float rows are used in place; other chunks are
+  decoded on the host thread pool, each worker taking a contiguous run of chunks, so a
+  columnar or compressed file loads at the speed of the transpose or of inflate times the
+  workers. The writer encodes in parallel too: uncompressed chunks straight into the mapped
+  output, deflated ones into buffers written out in order afterwards.
+
+  The header fields are read and written with memcpy in host byte order, so the format is
+  little-endian on the x86 and ARM hosts this runs on.
+*/
+
+#include "kmeans_file.h"
+#include "kmeans_thread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <zlib.h>
+
+#include <atomic>
+#include <vector>
+
+
+static const char km_file_magic[4] = { 'K', 'M', 'P', 'T' };
+
+// index entry: uint64 offset, uint64 stored bytes
+#define KM_INDEX_ENTRY (16)
+
+
+static inline uint32_t km_get_u32(const unsigned char* p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t km_get_u64(const unsigned char* p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void km_put_u32(unsigned char* p, uint32_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline void km_put_u64(unsigned char* p, uint64_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline size_t km_align_up(size_t n, size_t align)
+{
+    return (n + align - 1) / align * align;
+}
+
+static inline size_t km_dtype_size(int dtype)
+{
+    return (KM_DTYPE_F64 == dtype) ? sizeof(double) : sizeof(float);
+}
+
+// Points in chunk chunk_i
+static inline long long km_chunk_points(long long point_n, long long chunk_n, long long chunk_i)
+{
+    long long first = chunk_i * chunk_n;
+
+    return (point_n - first < chunk_n) ? point_n - first : chunk_n;
+}
+
+
+// One chunk of n points between the stored values and float rows
+template <typename T>
+static void km_chunk_to_rows(const T* value, int layout, long long n, int dim, float* rows)
+{
+    if (KM_LAYOUT_ROWS == layout) {
+        for (size_t i = 0; i < (size_t)n * dim; i++) {
+            rows[i] = (float)value[i];
+        }
+        return;
+    }
+
+    for (int d = 0; d < dim; d++) {
+        const T* column = value + (size_t)d * n;
+
+        for (long long i = 0; i < n; i++) {
+            rows[(size_t)i * dim + d] = (float)column[i];
+        }
+    }
+}
+
+template <typename T>
+static void km_rows_to_chunk(const float* rows, int layout, long long n, int dim, T* value)
+{
+    if (KM_LAYOUT_ROWS == layout) {
+        for (size_t i = 0; i < (size_t)n * dim; i++) {
+            value[i] = (T)rows[i];
+        }
+        return;
+    }
+
+    for (int d = 0; d < dim; d++) {
+        T* column = value + (size_t)d * n;
+
+        for (long long i = 0; i < n; i++) {
+            column[i] = (T)rows[(size_t)i * dim + d];
+        }
+    }
+}
+
+// Byte planes of value_n values of value_size bytes: plane b holds byte b of every value
+static void km_shuffle(const unsigned char* src, size_t value_n, size_t value_size, unsigned char* dst)
+{
+    for (size_t b = 0; b < value_size; b++) {
+        unsigned char* plane = dst + b * value_n;
+
+        for (size_t i = 0; i < value_n; i++) {
+            plane[i] = src[i * value_size + b];
+        }
+    }
+}
+
+static void km_unshuffle(const unsigned char* src, size_t value_n, size_t value_size, unsigned char* dst)
+{
+    for (size_t b = 0; b < value_size; b++) {
+        const unsigned char* plane = src + b * value_n;
+
+        for (size_t i = 0; i < value_n; i++) {
+            dst[i * value_size + b] = plane[i];
+        }
+    }
+}
+
+
+int km_file_open(const char* path, int dim, KmPointFile* file)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    memset(file, 0, sizeof(*file));
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(uint32_t)) {
+        fprintf(stderr, "File open error %s\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    file->map_len = (size_t)st.st_size;
+    file->map = mmap(NULL, file->map_len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (file->map == MAP_FAILED) {
+        fprintf(stderr, "Error mapping %s\n", path);
+        file->map = NULL;
+        return -1;
+    }
+
+    const unsigned char* base = (const unsigned char*)file->map;
+
+    if (file->map_len < KM_FILE_HEADER_SIZE || memcmp(base, km_file_magic, sizeof(km_file_magic)) != 0) {
+        // legacy: the count, then the rows
+        file->legacy = 1;
+        file->dim = dim;
+        file->point_n = km_get_u32(base);
+        file->spec.dtype = KM_DTYPE_F32;
+        file->spec.layout = KM_LAYOUT_ROWS;
+        file->spec.compression = KM_COMPRESS_NONE;
+        file->spec.align = sizeof(float);
+        file->spec.chunk_n = file->point_n;
+        file->chunk_count = (file->point_n > 0) ? 1 : 0;
+
+        if (file->map_len < sizeof(uint32_t) + sizeof(float) * dim * (size_t)file->point_n) {
+            fprintf(stderr, "Error reading data %s: %lld points of %d floats do not fit in %zu bytes\n", path, file->point_n, dim, file->map_len);
+            km_file_close(file);
+            return -1;
+        }
+        return 0;
+    }
+
+    uint32_t version = km_get_u32(base + 4);
+    uint32_t header_size = km_get_u32(base + 8);
+    uint64_t point_n = km_get_u64(base + 32);
+    uint64_t chunk_n = km_get_u64(base + 40);
+    uint64_t index_offset = km_get_u64(base + 48);
+
+    file->dim = (int)km_get_u32(base + 12);
+    file->spec.dtype = (int)km_get_u32(base + 16);
+    file->spec.layout = (int)km_get_u32(base + 20);
+    file->spec.compression = (int)km_get_u32(base + 24);
+    file->spec.align = (int)km_get_u32(base + 28);
+
+    if (version != KM_FILE_VERSION || header_size != KM_FILE_HEADER_SIZE) {
+        fprintf(stderr, "Error reading data %s: version %u with a %u-byte header, expected %d and %d\n", path, version, header_size, KM_FILE_VERSION, KM_FILE_HEADER_SIZE);
+        km_file_close(file);
+        return -1;
+    }
+    if (file->dim != dim) {
+        fprintf(stderr, "Error reading data %s: %d dimensions, expected %d\n", path, file->dim, dim);
+        km_file_close(file);
+        return -1;
+    }
+    if ((unsigned)file->spec.dtype > KM_DTYPE_F64 || (unsigned)file->spec.layout > KM_LAYOUT_COLUMNS ||
+        (unsigned)file->spec.compression > KM_COMPRESS_ZLIB || file->spec.align < 8 || (file->spec.align & (file->spec.align - 1)) != 0 ||
+        point_n > (uint64_t)LLONG_MAX / ((uint64_t)dim * sizeof(double)) || (point_n > 0 && chunk_n == 0)) {
+        fprintf(stderr, "Error reading data %s: bad header\n", path);
+        km_file_close(file);
+        return -1;
+    }
+
+    file->point_n = (long long)point_n;
+    file->spec.chunk_n = (point_n > 0) ? (long long)(chunk_n < point_n ? chunk_n : point_n) : 1;
+    file->chunk_count = (file->point_n + file->spec.chunk_n - 1) / file->spec.chunk_n;
+
+    if (index_offset > file->map_len || (file->map_len - index_offset) / KM_INDEX_ENTRY < (uint64_t)file->chunk_count) {
+        fprintf(stderr, "Error reading data %s: chunk index past the end of the file\n", path);
+        km_file_close(file);
+        return -1;
+    }
+    file->index = base + index_offset;
+
+    size_t value_size = km_dtype_size(file->spec.dtype);
+
+    for (long long chunk_i = 0; chunk_i < file->chunk_count; chunk_i++) {
+        uint64_t offset = km_get_u64(file->index + chunk_i * KM_INDEX_ENTRY);
+        uint64_t size = km_get_u64(file->index + chunk_i * KM_INDEX_ENTRY + 8);
+        uint64_t raw = (uint64_t)km_chunk_points(file->point_n, file->spec.chunk_n, chunk_i) * dim * value_size;
+
+        if (offset > file->map_len || size > file->map_len - offset ||
+            (KM_COMPRESS_NONE == file->spec.compression && size != raw)) {
+            fprintf(stderr, "Error reading data %s: bad chunk %lld\n", path, chunk_i);
+            km_file_close(file);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+const float* km_file_rows(const KmPointFile* file)
+{
+    const unsigned char* base = (const unsigned char*)file->map;
+
+    if (file->legacy) {
+        return (const float*)(base + sizeof(uint32_t));
+    }
+    if (KM_DTYPE_F32 != file->spec.dtype || KM_LAYOUT_ROWS != file->spec.layout || KM_COMPRESS_NONE != file->spec.compression) {
+        return NULL;
+    }
+    if (0 == file->chunk_count) {
+        return (const float*)(base + KM_FILE_HEADER_SIZE);
+    }
+
+    // one run: every chunk right after the previous one, no padding between them
+    uint64_t first = km_get_u64(file->index);
+    uint64_t chunk_size = (uint64_t)file->spec.chunk_n * file->dim * sizeof(float);
+
+    for (long long chunk_i = 1; chunk_i < file->chunk_count; chunk_i++) {
+        if (km_get_u64(file->index + chunk_i * KM_INDEX_ENTRY) != first + chunk_i * chunk_size) {
+            return NULL;
+        }
+    }
+    return (const float*)(base + first);
+}
+
+int km_file_read(const KmPointFile* file, float* data)
+{
+    const float* rows = km_file_rows(file);
+    int dim = file->dim;
+    std::atomic<int> bad(0);
+
+    if (rows != NULL) {
+        km_parallel_for((size_t)file->point_n * dim, [&](size_t begin_sz, size_t end_sz)
+        {
+            memcpy(data + begin_sz, rows + begin_sz, sizeof(float) * (end_sz - begin_sz));
+        });
+        return 0;
+    }
+
+    size_t value_size = km_dtype_size(file->spec.dtype);
+
+    km_parallel_run((size_t)file->point_n * dim, [&](int thread_idx, int width)
+    {
+        long long chunk_begin = file->chunk_count * thread_idx / width;
+        long long chunk_end = file->chunk_count * (thread_idx + 1) / width;
+        std::vector<unsigned char> buf;
+
+        for (long long chunk_i = chunk_begin; chunk_i < chunk_end; chunk_i++) {
+            long long n = km_chunk_points(file->point_n, file->spec.chunk_n, chunk_i);
+            size_t value_n = (size_t)n * dim;
+            const unsigned char* src = (const unsigned char*)file->map + km_get_u64(file->index + chunk_i * KM_INDEX_ENTRY);
+            uint64_t size = km_get_u64(file->index + chunk_i * KM_INDEX_ENTRY + 8);
+
+            if (KM_COMPRESS_ZLIB == file->spec.compression) {
+                uLongf raw_len = (uLongf)(value_n * value_size);
+
+                buf.resize(2 * value_n * value_size);
+                if (uncompress(&buf[value_n * value_size], &raw_len, src, (uLong)size) != Z_OK || raw_len != value_n * value_size) {
+                    bad = 1;
+                    return;
+                }
+                km_unshuffle(&buf[value_n * value_size], value_n, value_size, &buf[0]);
+                src = &buf[0];
+            }
+
+            float* dst = data + (size_t)chunk_i * file->spec.chunk_n * dim;
+
+            if (KM_DTYPE_F64 == file->spec.dtype) {
+                km_chunk_to_rows((const double*)src, file->spec.layout, n, dim, dst);
+            } else {
+                km_chunk_to_rows((const float*)src, file->spec.layout, n, dim, dst);
+            }
+        }
+    });
+
+    if (bad) {
+        fputs("Error reading data: corrupt chunk\n", stderr);
+        return -1;
+    }
+    return 0;
+}
+
+void km_file_close(KmPointFile* file)
+{
+    if (file->map != NULL) {
+        munmap(file->map, file->map_len);
+    }
+    memset(file, 0, sizeof(*file));
+}
+
+
+static int km_file_write_legacy(const char* path, int dim, long long point_n, const float* data)
+{
+    uint32_t size = (uint32_t)point_n;
+    FILE* f;
+
+    if (point_n > (long long)UINT32_MAX) {
+        fprintf(stderr, "%lld points do not fit in a legacy file, write KMPT\n", point_n);
+        return -1;
+    }
+
+    f = fopen(path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "File open error %s\n", path);
+        return -1;
+    }
+    if (fwrite(&size, sizeof(size), 1, f) != 1 || fwrite(data, sizeof(float) * dim, (size_t)point_n, f) != (size_t)point_n) {
+        fprintf(stderr, "Error writing %s\n", path);
+        fclose(f);
+        return -1;
+    }
+    return (fclose(f) == 0) ? 0 : -1;
+}
+
+// Encode one chunk of n rows as spec stores it, uncompressed, into dst
+static void km_chunk_encode(const float* rows, const KmFileSpec* spec, long long n, int dim, unsigned char* dst)
+{
+    if (KM_DTYPE_F64 == spec->dtype) {
+        km_rows_to_chunk(rows, spec->layout, n, dim, (double*)dst);
+    } else {
+        km_rows_to_chunk(rows, spec->layout, n, dim, (float*)dst);
+    }
+}
+
+int km_file_write(const char* path, int dim, long long point_n, const float* data, const KmFileSpec* spec)
+{
+    if (spec == NULL) {
+        return km_file_write_legacy(path, dim, point_n, data);
+    }
+
+    long long chunk_n = (spec->chunk_n > 0) ? spec->chunk_n : 1;
+    long long chunk_count = (point_n + chunk_n - 1) / chunk_n;
+    size_t value_size = km_dtype_size(spec->dtype);
+    size_t align = (size_t)spec->align;
+    size_t data_begin = km_align_up(KM_FILE_HEADER_SIZE + KM_INDEX_ENTRY * (size_t)chunk_count, align);
+    std::vector<unsigned char> head(data_begin, 0);
+    std::vector<std::vector<unsigned char> > packed;
+    std::vector<size_t> offset(chunk_count + 1, data_begin);
+
+    memcpy(&head[0], km_file_magic, sizeof(km_file_magic));
+    km_put_u32(&head[4], KM_FILE_VERSION);
+    km_put_u32(&head[8], KM_FILE_HEADER_SIZE);
+    km_put_u32(&head[12], (uint32_t)dim);
+    km_put_u32(&head[16], (uint32_t)spec->dtype);
+    km_put_u32(&head[20], (uint32_t)spec->layout);
+    km_put_u32(&head[24], (uint32_t)spec->compression);
+    km_put_u32(&head[28], (uint32_t)spec->align);
+    km_put_u64(&head[32], (uint64_t)point_n);
+    km_put_u64(&head[40], (uint64_t)chunk_n);
+    km_put_u64(&head[48], KM_FILE_HEADER_SIZE);
+
+    if (KM_COMPRESS_ZLIB == spec->compression) {
+        // sizes are known once deflated: every chunk into its own buffer, then written in order
+        packed.resize(chunk_count);
+        km_parallel_run((size_t)point_n * dim, [&](int thread_idx, int width)
+        {
+            long long chunk_begin = chunk_count * thread_idx / width;
+            long long chunk_end = chunk_count * (thread_idx + 1) / width;
+            std::vector<unsigned char> raw, plane;
+
+            for (long long chunk_i = chunk_begin; chunk_i < chunk_end; chunk_i++) {
+                long long n = km_chunk_points(point_n, chunk_n, chunk_i);
+                size_t value_n = (size_t)n * dim;
+                uLongf packed_len = compressBound((uLong)(value_n * value_size));
+
+                raw.resize(value_n * value_size);
+                plane.resize(value_n * value_size);
+                km_chunk_encode(data + (size_t)chunk_i * chunk_n * dim, spec, n, dim, &raw[0]);
+                km_shuffle(&raw[0], value_n, value_size, &plane[0]);
+
+                packed[chunk_i].resize(packed_len);
+                compress2(&packed[chunk_i][0], &packed_len, &plane[0], (uLong)plane.size(), Z_BEST_SPEED);
+                packed[chunk_i].resize(packed_len);
+            }
+        });
+    }
+
+    for (long long chunk_i = 0; chunk_i < chunk_count; chunk_i++) {
+        size_t size = packed.empty() ? (size_t)km_chunk_points(point_n, chunk_n, chunk_i) * dim * value_size : packed[chunk_i].size();
+
+        km_put_u64(&head[KM_FILE_HEADER_SIZE + chunk_i * KM_INDEX_ENTRY], offset[chunk_i]);
+        km_put_u64(&head[KM_FILE_HEADER_SIZE + chunk_i * KM_INDEX_ENTRY + 8], size);
+        offset[chunk_i + 1] = (chunk_i + 1 < chunk_count) ? km_align_up(offset[chunk_i] + size, align) : offset[chunk_i] + size;
+    }
+
+    size_t len = offset[chunk_count];
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0 || ftruncate(fd, (off_t)len) != 0) {
+        fprintf(stderr, "File open error %s\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    // the header, index and padding up to the first chunk, then the chunks: deflated ones are
+    // written out, uncompressed ones encoded in place into the mapped file
+    void* map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error mapping %s\n", path);
+        return -1;
+    }
+    memcpy(map, &head[0], data_begin);
+
+    km_parallel_run((size_t)point_n * dim, [&](int thread_idx, int width)
+    {
+        long long chunk_begin = chunk_count * thread_idx / width;
+        long long chunk_end = chunk_count * (thread_idx + 1) / width;
+
+        for (long long chunk_i = chunk_begin; chunk_i < chunk_end; chunk_i++) {
+            unsigned char* dst = (unsigned char*)map + offset[chunk_i];
+
+            if (!packed.empty()) {
+                memcpy(dst, &packed[chunk_i][0], packed[chunk_i].size());
+            } else {
+                km_chunk_encode(data + (size_t)chunk_i * chunk_n * dim, spec, km_chunk_points(point_n, chunk_n, chunk_i), dim, dst);
+            }
+        }
+    });
+
+    if (munmap(map, len) != 0) {
+        fprintf(stderr, "Error writing %s\n", path);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,93 @@
+#ifndef __KMEANS_FILE_H__
+#define __KMEANS_FILE_H__
+
+// Point files (kmeans_file.cpp), shared by kmeans_main.cpp and kmeans_gen.cpp. Two formats:
+//
+// - legacy: a uint32 count, then count points of dim floats, row-major (gen_data.py's output)
+// - KMPT: a 64-byte header, a chunk index, then the points in chunks of chunk_n points, each
+//   chunk on an align-byte boundary. A chunk holds its points row-major or as one column per
+//   dimension, as float or double, stored as is or deflated with zlib after splitting the
+//   values into byte planes (byte 0 of every value, then byte 1, ...). Little-endian:
+//
+//     offset  field
+//          0  "KMPT"
+//          4  uint32 version, KM_FILE_VERSION
+//          8  uint32 header size, KM_FILE_HEADER_SIZE
+//         12  uint32 dim
+//         16  uint32 dtype        KmFileDtype
+//         20  uint32 layout       KmFileLayout
+//         24  uint32 compression  KmFileCompression
+//         28  uint32 align        a power of two, at least 8
+//         32  uint64 point count
+//         40  uint64 chunk_n      points per chunk, the last chunk may be shorter
+//         48  uint64 index offset one (offset, stored bytes) pair of uint64 per chunk
+//         56  uint64 reserved, 0
+//
+// Both are mapped, never read in whole: float rows stored as is in one run (every legacy file)
+// are handed to the engines in place, anything else is decoded chunk by chunk on the host
+// thread pool.
+
+#include <stddef.h>
+
+#define KM_FILE_VERSION     (1)
+#define KM_FILE_HEADER_SIZE (64)
+
+enum KmFileDtype
+{
+    KM_DTYPE_F32 = 0,
+    KM_DTYPE_F64,
+};
+
+enum KmFileLayout
+{
+    KM_LAYOUT_ROWS = 0,     // point i of a chunk at i * dim
+    KM_LAYOUT_COLUMNS,      // dimension d of a chunk of n points at d * n
+};
+
+enum KmFileCompression
+{
+    KM_COMPRESS_NONE = 0,
+    KM_COMPRESS_ZLIB,       // byte planes, then zlib deflate, per chunk
+};
+
+struct KmFileSpec
+{
+    int dtype;              // KmFileDtype
+    int layout;             // KmFileLayout
+    int compression;        // KmFileCompression
+    int align;              // chunk alignment in bytes
+    long long chunk_n;      // points per chunk
+};
+
+// An open point file: the mapping and what its header says
+struct KmPointFile
+{
+    void* map;
+    size_t map_len;
+    int legacy;             // 1 for the count + rows format, spec is then float rows in one chunk
+    int dim;                // from the header, the caller's for legacy files
+    long long point_n;
+    KmFileSpec spec;
+    long long chunk_count;
+    const unsigned char* index;
+};
+
+// Map path and check its header and chunk index; prints why and returns -1 when it is not a
+// valid point file of dim dimensions
+int km_file_open(const char* path, int dim, KmPointFile* file);
+
+// The points in place, when they are stored as uncompressed float rows in one run; else NULL
+const float* km_file_rows(const KmPointFile* file);
+
+// All points, row-major, into data (point_n * dim floats); chunks are decoded in parallel.
+// Prints why and returns -1 on a corrupt chunk.
+int km_file_read(const KmPointFile* file, float* data);
+
+void km_file_close(KmPointFile* file);
+
+// Write point_n row-major points of data to path, as a KMPT file laid out by spec, or as a
+// legacy file when spec is NULL. Chunks are encoded in parallel. Prints why and returns -1 on
+// an I/O error.
+int km_file_write(const char* path, int dim, long long point_n, const float* data, const KmFileSpec* spec);
+
+#endif // __KMEANS_FILE_H__
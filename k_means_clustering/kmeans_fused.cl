@@ -0,0 +1,204 @@
+/*
+
+ Assignment and accumulation in one pass over the data, built together with kmeans.cl and
+ kmeans_prune.cl (it uses DIM, the g_status words and the bound helpers from there).
+
+ kmeans_assign + kmeans_update read every point twice per iteration and pass the labels through
+ global memory in between. kmeans_assign_update runs as the kmeans_update work-groups do, each
+ striding over the points, with all centroids staged in local memory next to the group's
+ partial sums: every point is read once, assigned and added to its centroid's sums at once.
+ The sums are saved per group in the kmeans_update layout, so kmeans_reduct finishes the
+ iteration as before. Only used while centroids, sums and counts fit in local memory together.
+
+ use_bound applies the Hamerly test of kmeans_assign_hamerly per point; with all centroids in
+ local memory a point that fails it rescans them without waiting for the rest of the group.
+
+*/
+
+/* as in kmeans.cl: distances round as on the host */
+#pragma OPENCL FP_CONTRACT OFF
+
+__kernel void kmeans_assign_update(	__global  const float*  g_src_cent_arr,
+									__global  const float*  g_src_data_arr,
+									__global        int*    g_res_part_arr,
+									__global        float*  g_res_cent_arr,
+									__global        int*    g_res_count_arr,
+									__global        float*  g_upper,
+									__global        float*  g_lower,
+									__global  const float*  g_cent_shift,
+									__global  const float*  g_cent_half,
+									                int     no_max_class,
+									                int     sz_src_data,
+									                int     dim,
+									                int     sz_data_stride,
+									                int     use_bound,
+									                float   eps,
+									__local         float*  l_tmp_cent_buf,
+									__local         float*  l_tmp_data_sum,
+									__local         int*    l_tmp_count_sum,
+									__global        int*    g_status,
+									__local         int*    l_tmp_changed)
+{
+	int idx_pos_cent = 0;
+	int idx_pos_data = 0;
+	int idx_class    = 0;
+	int idx_dim      = 0;
+	int pos_local    = get_local_id(0);
+	int sz_local     = get_local_size(0);
+	int pos_group    = get_group_id(0);
+	int sz_cent      = no_max_class * DIM;
+	int sz_sum       = sz_cent * KM_ACC;
+	int cur_class    = 0;
+	int min_class    = 0;
+	int need_scan    = 0;
+	int no_changed   = 0;
+	float min_dist    = 0;
+	float second_dist = 0;
+	float dist        = 0;
+	float diff        = 0;
+	float upper       = 0;
+	float lower       = 0;
+	float bound       = 0;
+	float bound_shift = 0;
+#if (0 < KM_DIM)
+	float p_cur_data[KM_DIM];
+#endif
+
+	if(g_status[KM_STATUS_DONE])
+	{
+		return;
+	}
+
+	for(idx_pos_cent = pos_local ; idx_pos_cent < sz_cent ; idx_pos_cent += sz_local)
+	{
+		l_tmp_cent_buf[idx_pos_cent] = g_src_cent_arr[idx_pos_cent];
+	}
+	for(idx_pos_cent = pos_local ; idx_pos_cent < sz_sum ; idx_pos_cent += sz_local)
+	{
+		l_tmp_data_sum[idx_pos_cent] = 0;
+	}
+	for(idx_pos_cent = pos_local ; idx_pos_cent < no_max_class ; idx_pos_cent += sz_local)
+	{
+		l_tmp_count_sum[idx_pos_cent] = 0;
+	}
+	if(0 == pos_local)
+	{
+		l_tmp_changed[0] = 0;
+	}
+	bound_shift = as_float(g_status[KM_STATUS_BOUND]);
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	for(idx_pos_data = get_global_id(0) ; idx_pos_data < sz_src_data ; idx_pos_data += get_global_size(0))
+	{
+#if (0 < KM_DIM)
+		for(idx_dim = 0 ; idx_dim < KM_DIM ; idx_dim++)
+		{
+			p_cur_data[idx_dim] = g_src_data_arr[(size_t)idx_dim * sz_data_stride + idx_pos_data];
+		}
+#define CUR_DATA(d) (p_cur_data[(d)])
+#else
+#define CUR_DATA(d) (g_src_data_arr[(size_t)(d) * sz_data_stride + idx_pos_data])
+#endif
+
+		cur_class = g_res_part_arr[idx_pos_data];
+		need_scan = (!use_bound) || (cur_class < 0);
+
+		if(!need_scan)
+		{
+			upper = bound_round_up(g_upper[idx_pos_data] + g_cent_shift[cur_class]);
+			lower = bound_round_down(g_lower[idx_pos_data] - bound_shift);
+			bound = fmax(g_cent_half[cur_class], lower);
+
+			if(!bound_skip(upper, bound, eps))
+			{
+				/* tighten the upper bound before paying for a full scan */
+				dist = 0;
+				for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+				{
+					diff  = CUR_DATA(idx_dim) - l_tmp_cent_buf[cur_class * DIM + idx_dim];
+					dist += diff * diff;
+				}
+				upper     = bound_round_up(sqrt(dist) * (1.0f + eps));
+				need_scan = !bound_skip(upper, bound, eps);
+			}
+
+			g_upper[idx_pos_data] = upper;
+			g_lower[idx_pos_data] = lower;
+		}
+
+		min_class = cur_class;
+		if(need_scan)
+		{
+			/* same order and compare as kmeans_assign */
+			min_class   = 0;
+			min_dist    = FLT_MAX;
+			second_dist = FLT_MAX;
+			for(idx_class = 0 ; idx_class < no_max_class ; idx_class++)
+			{
+				dist = 0;
+				for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+				{
+					diff  = CUR_DATA(idx_dim) - l_tmp_cent_buf[idx_class * DIM + idx_dim];
+					dist += diff * diff;
+				}
+
+				if(dist < min_dist)
+				{
+					second_dist = min_dist;
+					min_class   = idx_class;
+					min_dist    = dist;
+				}
+				else if(dist < second_dist)
+				{
+					second_dist = dist;
+				}
+			}
+
+			if(use_bound)
+			{
+				g_upper[idx_pos_data] = bound_round_up(sqrt(min_dist) * (1.0f + eps));
+				g_lower[idx_pos_data] = bound_round_down(sqrt(second_dist) * (1.0f - eps));
+			}
+			if(cur_class != min_class)
+			{
+				g_res_part_arr[idx_pos_data] = min_class;
+				no_changed++;
+			}
+		}
+
+		atomic_inc(&l_tmp_count_sum[min_class]);
+		for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+		{
+			local_atomic_acc_f32(&l_tmp_data_sum[(min_class * DIM + idx_dim) * KM_ACC], CUR_DATA(idx_dim));
+		}
+#undef CUR_DATA
+	}
+
+	if(0 != no_changed)
+	{
+		atomic_add(l_tmp_changed, no_changed);
+	}
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	/* save in group-major order for kmeans_reduct: [group][(class * dim + d) * KM_ACC] */
+	for(idx_pos_cent = pos_local ; idx_pos_cent < sz_sum ; idx_pos_cent += sz_local)
+	{
+		g_res_cent_arr[pos_group * sz_sum + idx_pos_cent] = l_tmp_data_sum[idx_pos_cent];
+	}
+	for(idx_pos_cent = pos_local ; idx_pos_cent < no_max_class ; idx_pos_cent += sz_local)
+	{
+		g_res_count_arr[pos_group * no_max_class + idx_pos_cent] = l_tmp_count_sum[idx_pos_cent];
+	}
+
+	/* one global atomic per work-group */
+	if((0 == pos_local) && (0 != l_tmp_changed[0]))
+	{
+		atomic_add(&g_status[KM_STATUS_CHANGED], l_tmp_changed[0]);
+	}
+}
@@ -0,0 +1,297 @@
+/*
+  Point generator: gen_data.py's distributions on the host thread pool
+
+  centroid draws every coordinate uniformly in [DATA_MIN, DATA_MAX). data draws drifting
+  Gaussian clusters: a cluster starts at a uniform point and goes on with about
+  data size / cluster num points (normal, sigma 5), each the cluster's current centre plus
+  N(0, 1) noise per dimension. With probability PERTURBATION a point becomes the centre, and,
+  as in gen_data.py, whose start_p and new_p are one list from then on, so does every point
+  after it: the rest of the cluster is a random walk.
+
+  The cluster sizes are drawn first, one after the other; the clusters are then generated in
+  parallel, each worker taking the clusters that start in its share of the points, and the
+  uniform points in blocks of GEN_BLOCK. Every cluster and block draws from its own stream of
+  the seed, so the output depends on the seed only, not on the number of workers. The points
+  are written as a KMPT file (kmeans_file.h), columnar by default, or as gen_data.py's file.
+*/
+
+#include "kmeans_common.h"
+#include "kmeans_file.h"
+#include "kmeans_thread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#define DEFAULT_DIM 2
+#define DEFAULT_SEED 1
+#define DEFAULT_CHUNK (1 << 16)
+#define DEFAULT_ALIGN 4096
+
+#define DATA_MIN 0.0
+#define DATA_MAX 100.0
+#define SIGMA 1.0
+#define PERTURBATION 0.05
+#define CLUSTER_SIGMA 5.0
+
+// uniform points per stream
+#define GEN_BLOCK (1 << 12)
+
+
+// One stream of the seed per cluster or block; the cluster sizes use stream 0
+struct GenRng
+{
+    KmRng rng;
+    int has_spare;
+    double spare;
+};
+
+static void gen_rng_init(GenRng* gen, uint64_t seed, uint64_t stream)
+{
+    km_rng_seed(&gen->rng, seed);
+    gen->rng.state = km_rng_next(&gen->rng) ^ (stream * 0xD1B54A32D192ED03ull);
+    gen->has_spare = 0;
+    gen->spare = 0.0;
+}
+
+static inline double gen_uniform(GenRng* gen, double lo, double hi)
+{
+    return lo + (hi - lo) * km_rng_uniform(&gen->rng);
+}
+
+// Marsaglia's polar method, both values of a pair used: no sin or cos
+static inline double gen_gauss(GenRng* gen, double mu, double sigma)
+{
+    if (gen->has_spare) {
+        gen->has_spare = 0;
+        return mu + sigma * gen->spare;
+    }
+
+    double u, v, s;
+
+    do {
+        u = 2.0 * km_rng_uniform(&gen->rng) - 1.0;
+        v = 2.0 * km_rng_uniform(&gen->rng) - 1.0;
+        s = u * u + v * v;
+    } while (s >= 1.0 || s == 0.0);
+
+    double r = sqrt(-2.0 * log(s) / s);
+
+    gen->spare = v * r;
+    gen->has_spare = 1;
+    return mu + sigma * u * r;
+}
+
+
+static void gen_uniform_points(uint64_t seed, long long point_n, int dim, float* data)
+{
+    long long block_count = (point_n + GEN_BLOCK - 1) / GEN_BLOCK;
+
+    km_parallel_run((size_t)point_n * dim, [&](int thread_idx, int width)
+    {
+        long long block_begin = block_count * thread_idx / width;
+        long long block_end = block_count * (thread_idx + 1) / width;
+
+        for (long long block_i = block_begin; block_i < block_end; block_i++) {
+            long long end = std::min(point_n, (block_i + 1) * GEN_BLOCK);
+            GenRng gen;
+
+            gen_rng_init(&gen, seed, (uint64_t)block_i + 1);
+            for (size_t i = (size_t)block_i * GEN_BLOCK * dim; i < (size_t)end * dim; i++) {
+                data[i] = (float)gen_uniform(&gen, DATA_MIN, DATA_MAX);
+            }
+        }
+    });
+}
+
+static void gen_cluster_points(uint64_t seed, long long point_n, int dim, int cluster_num, float* data)
+{
+    double cluster_size = (double)point_n / cluster_num;
+    std::vector<long long> begin;
+    GenRng gen;
+
+    // first point of every cluster, and point_n at the end
+    gen_rng_init(&gen, seed, 0);
+    for (long long count = 0; count < point_n; ) {
+        long long walk_n = (long long)gen_gauss(&gen, cluster_size, CLUSTER_SIGMA);
+
+        begin.push_back(count);
+        count += 1 + std::max(walk_n, 0LL);
+    }
+    begin.push_back(point_n);
+
+    long long cluster_count = (long long)begin.size() - 1;
+
+    km_parallel_run((size_t)point_n * dim, [&](int thread_idx, int width)
+    {
+        long long cluster_begin = std::lower_bound(begin.begin(), begin.end() - 1, point_n * thread_idx / width) - begin.begin();
+        long long cluster_end = std::lower_bound(begin.begin(), begin.end() - 1, point_n * (thread_idx + 1) / width) - begin.begin();
+        std::vector<double> centre(dim), next(dim);
+
+        if (thread_idx + 1 == width) {
+            cluster_end = cluster_count;
+        }
+
+        for (long long cluster_i = cluster_begin; cluster_i < cluster_end; cluster_i++) {
+            long long end = std::min(begin[cluster_i + 1], point_n);
+            float* point = data + (size_t)begin[cluster_i] * dim;
+            int walking = 0;
+            GenRng cluster_gen;
+
+            gen_rng_init(&cluster_gen, seed, (uint64_t)cluster_i + 1);
+            for (int d = 0; d < dim; d++) {
+                centre[d] = gen_uniform(&cluster_gen, DATA_MIN, DATA_MAX);
+                point[d] = (float)centre[d];
+            }
+
+            for (long long data_i = begin[cluster_i] + 1; data_i < end; data_i++) {
+                point += dim;
+                for (int d = 0; d < dim; d++) {
+                    next[d] = centre[d] + gen_gauss(&cluster_gen, 0.0, SIGMA);
+                    point[d] = (float)next[d];
+                }
+                if (walking || km_rng_uniform(&cluster_gen.rng) < PERTURBATION) {
+                    centre.swap(next);
+                    walking = 1;
+                }
+            }
+        }
+    });
+}
+
+
+int main(int argc, char** argv)
+{
+    KmFileSpec spec;
+    int legacy = 0;
+    int dim = DEFAULT_DIM;
+    int cluster_num = 0;
+    unsigned seed = DEFAULT_SEED;
+    long long point_n;
+    float* data;
+    struct timespec start, end;
+    const char* prog = argv[0];
+    const char* mode;
+    KmPointFile src;
+    int convert = 0;
+    int opt, bad_opt = 0;
+
+    spec.dtype = KM_DTYPE_F32;
+    spec.layout = KM_LAYOUT_COLUMNS;
+    spec.compression = KM_COMPRESS_NONE;
+    spec.align = DEFAULT_ALIGN;
+    spec.chunk_n = DEFAULT_CHUNK;
+
+    // Options come before the positional arguments, which are gen_data.py's
+    while ((opt = getopt(argc, argv, "f:t:zn:a:s:")) != -1) {
+        switch (opt) {
+        case 'f':
+            if (strcmp(optarg, "columns") == 0) {
+                spec.layout = KM_LAYOUT_COLUMNS;
+            } else if (strcmp(optarg, "rows") == 0) {
+                spec.layout = KM_LAYOUT_ROWS;
+            } else if (strcmp(optarg, "legacy") == 0) {
+                legacy = 1;
+            } else {
+                bad_opt = 1;
+            }
+            break;
+        case 't':
+            if (strcmp(optarg, "f32") == 0) {
+                spec.dtype = KM_DTYPE_F32;
+            } else if (strcmp(optarg, "f64") == 0) {
+                spec.dtype = KM_DTYPE_F64;
+            } else {
+                bad_opt = 1;
+            }
+            break;
+        case 'z':
+            spec.compression = KM_COMPRESS_ZLIB;
+            break;
+        case 'n':
+            spec.chunk_n = atoll(optarg);
+            break;
+        case 'a':
+            spec.align = atoi(optarg);
+            break;
+        case 's':
+            seed = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            bad_opt = 1;
+            break;
+        }
+    }
+    // From here on argv[1] is the first positional argument
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    mode = (argc > 1) ? argv[1] : "";
+    if (strcmp(mode, "centroid") == 0 && argc > 4) {
+        dim = atoi(argv[4]);
+    } else if (strcmp(mode, "data") == 0 && argc > 4) {
+        cluster_num = atoi(argv[4]);
+        if (argc > 5) {
+            dim = atoi(argv[5]);
+        }
+    } else if (strcmp(mode, "convert") == 0 && argc > 3) {
+        convert = 1;
+        if (argc > 4) {
+            dim = atoi(argv[4]);
+        }
+    } else if (strcmp(mode, "centroid") != 0 || argc < 4) {
+        bad_opt = 1;
+    }
+    point_n = (argc > 2 && !convert) ? atoll(argv[2]) : 0;
+
+    if (bad_opt || point_n < 0 || dim < 1 || (strcmp(mode, "data") == 0 && cluster_num < 1) || spec.chunk_n < 1 ||
+        spec.align < 8 || (spec.align & (spec.align - 1)) != 0) {
+        fprintf(stderr, "usage: %s [-f columns|rows|legacy] [-t f32|f64] [-z, deflate the chunks] [-n <points per chunk>] [-a <chunk alignment>] [-s <seed>] "
+                        "centroid <data size> <output file> [<dimension>]\n"
+                        "       %s [options] data <data size> <output file> <cluster num> [<dimension>]\n"
+                        "       %s [options] convert <point file> <output file> [<dimension>]\n", prog, prog, prog);
+        exit(EXIT_FAILURE);
+    }
+
+    // convert rewrites a legacy or KMPT file with the options given
+    if (convert) {
+        if (km_file_open(argv[2], dim, &src) != 0) {
+            exit(EXIT_FAILURE);
+        }
+        point_n = src.point_n;
+    }
+
+    data = (float*)malloc(sizeof(float) * dim * (size_t)(point_n > 0 ? point_n : 1));
+    if (data == NULL) {
+        fprintf(stderr, "Out of memory for %lld points\n", point_n);
+        exit(EXIT_FAILURE);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (convert) {
+        if (km_file_read(&src, data) != 0) {
+            exit(EXIT_FAILURE);
+        }
+        km_file_close(&src);
+    } else if (cluster_num > 0) {
+        gen_cluster_points(seed, point_n, dim, cluster_num, data);
+    } else {
+        gen_uniform_points(seed, point_n, dim, data);
+    }
+    if (km_file_write(argv[3], dim, point_n, data, legacy ? NULL : &spec) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    fprintf(stderr, "%lld points of %d dimensions in %.3f s\n", point_n, dim,
+            (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9);
+
+    free(data);
+    return 0;
+}
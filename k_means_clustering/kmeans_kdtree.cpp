@@ -0,0 +1,537 @@
+/*
+  Filtering k-means over a kd-tree (Kanungo et al. 2002) on the host thread pool
+
+  The tree is built once: each node splits its points at the median of the widest side of
+  their bounding box, down to leaves of at most KD_LEAF_POINTS. Nodes sit in one flat array in
+  preorder, a left child right after its parent, and keep their bounding box, the double sum of
+  their points and their range in a copy of the points laid out in tree order. The subtrees below
+  the top levels are built in parallel, each into its own range of the array.
+
+  Every iteration walks the tree from those subtree roots with the list of candidate centroids.
+  At each node the candidate nearest the middle of the box, z*, rules out every candidate z that
+  is farther than z* from every point of the box. Once one candidate is left, the whole subtree
+  belongs to it: its sum and count go into the centroid at once, and its labels are only
+  rewritten when its owner changed. Leaves with several candidates left scan their points.
+
+  The labels match the brute-force loop of kmeans_seq.cpp. A candidate is ruled out only when
+  its float distance, computed as the brute-force loop does, must come out strictly larger than
+  z*'s for every point of the box: the test works on exact bounds over the box and leaves a
+  margin of the float rounding error of a squared distance. So a candidate ruled out never ties
+  the nearest one, and the leaf scans, in ascending index order with a strict <, pick the same
+  centroid as a scan over all of them. The centroid sums are in double, as in kmeans_seq.cpp,
+  but added per subtree, so the centroids can differ from it in the last bit.
+*/
+
+#include "kmeans.h"
+#include "kmeans_common.h"
+#include "kmeans_thread.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+
+// points per leaf: enough to amortise a node visit, few enough that a box is still tight
+#define KD_LEAF_POINTS (32)
+// subtrees built and walked in parallel, per worker
+#define KD_TASK_PER_THREAD (8)
+
+
+// Squared distance, written exactly as the assignment loop in kmeans_seq.cpp
+static inline float kd_dist2(const float* point, const float* centroid, int dim)
+{
+    float dist = 0.0f;
+
+    for (int d = 0; d < dim; d++) {
+        float t = point[d] - centroid[d];
+
+        dist += t * t;
+    }
+
+    return dist;
+}
+
+struct KdNode
+{
+    int begin;      // points [begin, end) of the tree order
+    int end;
+    int right;      // right child, -1 for a leaf; the left child is the next node
+    int owner;      // the centroid every point of the subtree is labelled with, -1 when mixed
+};
+
+struct KdTree
+{
+    int dim;
+    std::vector<KdNode> node;
+    std::vector<float> lo;      // bounding box, node * dim + d
+    std::vector<float> hi;
+    std::vector<double> sum;    // sum of the points, node * dim + d
+    std::vector<int> perm;      // tree order -> point index
+    std::vector<float> point;   // the points in tree order
+    std::vector<int> task;      // subtree roots walked in parallel
+    int depth;                  // levels below a task root, leaves included
+};
+
+// Nodes of a subtree of n points, with the split of kd_build
+static int kd_node_count(int n)
+{
+    if (n <= KD_LEAF_POINTS) {
+        return 1;
+    }
+    return 1 + kd_node_count(n / 2) + kd_node_count(n - n / 2);
+}
+
+// Node node_i over perm[begin, end); task_depth levels down the subtree roots are only recorded
+// in tree->task, to be built in parallel afterwards. Returns the depth of the subtree built.
+static int kd_build(KdTree* tree, const float* data, int node_i, int begin, int end, int level, int task_depth)
+{
+    const int dim = tree->dim;
+    KdNode* node = &tree->node[node_i];
+    float* lo = &tree->lo[(size_t)node_i * dim];
+    float* hi = &tree->hi[(size_t)node_i * dim];
+    double* sum = &tree->sum[(size_t)node_i * dim];
+    int split_d = 0;
+    int mid = begin + (end - begin) / 2;
+    int left_depth, right_depth;
+
+    node->begin = begin;
+    node->end = end;
+    node->right = -1;
+    node->owner = -1;
+
+    if (level == task_depth) {
+        tree->task.push_back(node_i);
+        return 0;
+    }
+
+    for (int d = 0; d < dim; d++) {
+        lo[d] = FLT_MAX;
+        hi[d] = -FLT_MAX;
+    }
+    for (int i = begin; i < end; i++) {
+        const float* point = data + (size_t)tree->perm[i] * dim;
+
+        for (int d = 0; d < dim; d++) {
+            lo[d] = std::min(lo[d], point[d]);
+            hi[d] = std::max(hi[d], point[d]);
+        }
+    }
+
+    if (end - begin <= KD_LEAF_POINTS) {
+        for (int d = 0; d < dim; d++) {
+            sum[d] = 0.0;
+        }
+        for (int i = begin; i < end; i++) {
+            const float* point = data + (size_t)tree->perm[i] * dim;
+
+            for (int d = 0; d < dim; d++) {
+                sum[d] += point[d];
+            }
+        }
+        return 1;
+    }
+
+    for (int d = 1; d < dim; d++) {
+        if ((double)hi[d] - lo[d] > (double)hi[split_d] - lo[split_d]) {
+            split_d = d;
+        }
+    }
+    // ties broken by point index, so the tree does not depend on the nth_element implementation
+    std::nth_element(tree->perm.begin() + begin, tree->perm.begin() + mid, tree->perm.begin() + end, [&](int a, int b)
+    {
+        float va = data[(size_t)a * dim + split_d];
+        float vb = data[(size_t)b * dim + split_d];
+
+        return (va < vb) || (va == vb && a < b);
+    });
+
+    node->right = node_i + 1 + kd_node_count(mid - begin);
+    left_depth = kd_build(tree, data, node_i + 1, begin, mid, level + 1, task_depth);
+    right_depth = kd_build(tree, data, node->right, mid, end, level + 1, task_depth);
+
+    // above the task roots the children are not built yet, kd_sum_top sums these nodes later
+    if (level + 1 != task_depth) {
+        for (int d = 0; d < dim; d++) {
+            sum[d] = tree->sum[(size_t)(node_i + 1) * dim + d] + tree->sum[(size_t)node->right * dim + d];
+        }
+    }
+
+    return 1 + std::max(left_depth, right_depth);
+}
+
+// The sums of the nodes above the task roots, from their children
+static void kd_sum_top(KdTree* tree, int node_i, int level, int task_depth)
+{
+    const int dim = tree->dim;
+    const KdNode* node = &tree->node[node_i];
+
+    if (level == task_depth || node->right < 0) {
+        return;
+    }
+    kd_sum_top(tree, node_i + 1, level + 1, task_depth);
+    kd_sum_top(tree, node->right, level + 1, task_depth);
+    for (int d = 0; d < dim; d++) {
+        tree->sum[(size_t)node_i * dim + d] = tree->sum[(size_t)(node_i + 1) * dim + d] + tree->sum[(size_t)node->right * dim + d];
+    }
+}
+
+static void kd_tree_init(KdTree* tree, int data_n, int dim, const float* data)
+{
+    const int thread_n = km_parallel_width((size_t)data_n);
+    const int node_n = kd_node_count(data_n);
+    int task_depth = 0;
+    std::vector<int> task_depth_arr;
+
+    tree->dim = dim;
+    tree->node.resize(node_n);
+    tree->lo.resize((size_t)node_n * dim);
+    tree->hi.resize((size_t)node_n * dim);
+    tree->sum.resize((size_t)node_n * dim);
+    tree->perm.resize(data_n);
+    for (int i = 0; i < data_n; i++) {
+        tree->perm[i] = i;
+    }
+
+    // top levels on this thread, until there are enough subtrees to share out
+    while ((1 << task_depth) < thread_n * KD_TASK_PER_THREAD && ((long long)data_n >> task_depth) > KD_LEAF_POINTS) {
+        task_depth++;
+    }
+    kd_build(tree, data, 0, 0, data_n, 0, task_depth);
+
+    // the levels above the task roots hold more than a leaf, so every point is under a task root
+    task_depth_arr.assign(tree->task.size(), 0);
+    km_parallel_run((size_t)data_n, [&](int thread_idx, int width)
+    {
+        size_t begin_sz = tree->task.size() * thread_idx / width;
+        size_t end_sz = tree->task.size() * (thread_idx + 1) / width;
+
+        for (size_t task_i = begin_sz; task_i < end_sz; task_i++) {
+            const KdNode* node = &tree->node[tree->task[task_i]];
+
+            task_depth_arr[task_i] = kd_build(tree, data, tree->task[task_i], node->begin, node->end, 0, -1);
+        }
+    });
+    kd_sum_top(tree, 0, 0, task_depth);
+    tree->depth = tree->task.empty() ? 1 : *std::max_element(task_depth_arr.begin(), task_depth_arr.end());
+
+    tree->point.resize((size_t)data_n * dim);
+    km_parallel_for((size_t)data_n, [&](size_t begin_sz, size_t end_sz)
+    {
+        for (size_t i = begin_sz; i < end_sz; i++) {
+            memcpy(&tree->point[i * dim], data + (size_t)tree->perm[i] * dim, sizeof(float) * dim);
+        }
+    });
+}
+
+
+// Per-thread sums and tallies of one iteration
+struct KdThread
+{
+    std::vector<double> sum;
+    std::vector<long long> count;
+    std::vector<int> cand;      // candidate lists, class_n per level
+    int changed;
+    long long distance_n;
+};
+
+struct KdWalk
+{
+    KdTree* tree;
+    int class_n;
+    const float* centroids;
+    int* partitioned;
+    double eps;
+};
+
+// True when z is farther than zs from every point of the box by more than the rounding error of
+// the float squared distances: the difference |x - z|^2 - |x - zs|^2 is linear in x, so its
+// minimum is at the corner towards z - zs, and |x - z|^2 + |x - zs|^2 is at most the sum of the
+// farthest corners per dimension.
+static inline bool kd_ruled_out(const float* lo, const float* hi, const float* z, const float* zs, int dim, double eps)
+{
+    double diff_min = 0.0;
+    double far_sum = 0.0;
+
+    for (int d = 0; d < dim; d++) {
+        double v = (zs[d] > z[d]) ? lo[d] : hi[d];
+        double tz = v - z[d];
+        double ts = v - zs[d];
+        double lz = std::max(fabs((double)lo[d] - z[d]), fabs((double)hi[d] - z[d]));
+        double ls = std::max(fabs((double)lo[d] - zs[d]), fabs((double)hi[d] - zs[d]));
+
+        diff_min += tz * tz - ts * ts;
+        far_sum += lz * lz + ls * ls;
+    }
+
+    // NaN fails the compare, and the candidate stays
+    return diff_min > eps * far_sum;
+}
+
+// Every point of node_i goes to class_i; the labels are only walked when prev, the owner the
+// points had after the last iteration (-1 when mixed), is another centroid
+static void kd_take(const KdWalk* walk, KdThread* p_thread, int node_i, int class_i, int prev)
+{
+    KdTree* tree = walk->tree;
+    const int dim = tree->dim;
+    KdNode* node = &tree->node[node_i];
+    double* p_sum = &p_thread->sum[(size_t)class_i * dim];
+    const double* node_sum = &tree->sum[(size_t)node_i * dim];
+
+    for (int d = 0; d < dim; d++) {
+        p_sum[d] += node_sum[d];
+    }
+    p_thread->count[class_i] += node->end - node->begin;
+
+    if (prev != class_i) {
+        for (int i = node->begin; i < node->end; i++) {
+            int data_i = tree->perm[i];
+
+            if (walk->partitioned[data_i] != class_i) {
+                walk->partitioned[data_i] = class_i;
+                p_thread->changed++;
+            }
+        }
+    }
+    node->owner = class_i;
+}
+
+// Filter the cand_n candidates (ascending) at node_i; inherit is the owner of an ancestor whose
+// points were all labelled alike after the last iteration, -1 when there is none
+static void kd_filter(const KdWalk* walk, KdThread* p_thread, int node_i, const int* cand, int cand_n, int level, int inherit)
+{
+    KdTree* tree = walk->tree;
+    const int dim = tree->dim;
+    KdNode* node = &tree->node[node_i];
+    const float* lo = &tree->lo[(size_t)node_i * dim];
+    const float* hi = &tree->hi[(size_t)node_i * dim];
+    int* keep = &p_thread->cand[(size_t)(level + 1) * walk->class_n];
+    int keep_n = 0;
+    int prev = (inherit >= 0) ? inherit : node->owner;
+    int best = cand[0];
+    double best_dist = DBL_MAX;
+
+    // z*: the candidate nearest the middle of the box
+    for (int cand_i = 0; cand_i < cand_n; cand_i++) {
+        const float* z = walk->centroids + (size_t)cand[cand_i] * dim;
+        double dist = 0.0;
+
+        for (int d = 0; d < dim; d++) {
+            double t = 0.5 * ((double)lo[d] + hi[d]) - z[d];
+
+            dist += t * t;
+        }
+        if (dist < best_dist) {
+            best_dist = dist;
+            best = cand[cand_i];
+        }
+    }
+
+    for (int cand_i = 0; cand_i < cand_n; cand_i++) {
+        if (cand[cand_i] == best ||
+            !kd_ruled_out(lo, hi, walk->centroids + (size_t)cand[cand_i] * dim, walk->centroids + (size_t)best * dim, dim, walk->eps)) {
+            keep[keep_n++] = cand[cand_i];
+        }
+    }
+
+    if (1 == keep_n) {
+        kd_take(walk, p_thread, node_i, keep[0], prev);
+        return;
+    }
+
+    if (node->right >= 0) {
+        node->owner = -1;
+        kd_filter(walk, p_thread, node_i + 1, keep, keep_n, level + 1, prev);
+        kd_filter(walk, p_thread, node->right, keep, keep_n, level + 1, prev);
+        return;
+    }
+
+    // a leaf with several candidates left: the brute-force loop over them
+    {
+        int owner = -2;
+
+        for (int i = node->begin; i < node->end; i++) {
+            const float* point = &tree->point[(size_t)i * dim];
+            int data_i = tree->perm[i];
+            float min_dist = FLT_MAX;
+            int min_class = keep[0];
+
+            for (int keep_i = 0; keep_i < keep_n; keep_i++) {
+                float dist = kd_dist2(point, walk->centroids + (size_t)keep[keep_i] * dim, dim);
+
+                if (dist < min_dist) {
+                    min_dist = dist;
+                    min_class = keep[keep_i];
+                }
+            }
+            p_thread->distance_n += keep_n;
+
+            double* p_sum = &p_thread->sum[(size_t)min_class * dim];
+
+            for (int d = 0; d < dim; d++) {
+                p_sum[d] += point[d];
+            }
+            p_thread->count[min_class]++;
+
+            if (walk->partitioned[data_i] != min_class) {
+                walk->partitioned[data_i] = min_class;
+                p_thread->changed++;
+            }
+            owner = (-2 == owner || owner == min_class) ? min_class : -1;
+        }
+        node->owner = owner;
+    }
+}
+
+
+void kmeans_kdtree(const KmeansConfig* config, int class_n, int data_n, int dim, float* centroids, const float* data, int* partitioned, KmeansResult* result)
+{
+    const size_t cent_sz = (size_t)class_n * dim;
+    KdTree tree;
+    KdWalk walk;
+    int thread_n;
+    // the merge reads every thread's sums of a centroid element
+    int merge_n;
+    // Centroids of the previous iteration, for the shift check
+    std::vector<float> prev(cent_sz);
+    std::vector<KdThread> thread;
+    std::vector<float> merge_shift;
+    // Merged count of each class, and the classes left empty
+    std::vector<long long> merge_count(class_n);
+    std::vector<int> empty_class;
+    long long distance_n = 0;
+    int i, changed, converged = 0;
+    float shift;
+
+    km_seed(config, class_n, data_n, dim, data, centroids);
+
+    // No point starts in a cluster, so the first iteration counts every point as changed
+    for (int data_i = 0; data_i < data_n; data_i++) {
+        partitioned[data_i] = -1;
+    }
+
+    kd_tree_init(&tree, data_n, dim, data);
+
+    thread_n = km_parallel_width((size_t)data_n);
+    merge_n = km_parallel_width(cent_sz * thread_n);
+    thread.resize(thread_n);
+    merge_shift.resize(merge_n);
+
+    walk.tree = &tree;
+    walk.class_n = class_n;
+    walk.centroids = centroids;
+    walk.partitioned = partitioned;
+    // relative rounding error of a float squared distance, with slack for the double bounds
+    walk.eps = (double)(dim + 8) * FLT_EPSILON;
+
+    for (i = 0; i < config->iteration_n && !converged; i++) {
+
+        // Assignment and sums: each worker filters its own share of the subtrees
+        km_parallel_run((size_t)data_n, [&](int thread_idx, int width)
+        {
+            KdThread* p_thread = &thread[thread_idx];
+            size_t begin_sz = tree.task.size() * thread_idx / width;
+            size_t end_sz = tree.task.size() * (thread_idx + 1) / width;
+
+            p_thread->sum.assign(cent_sz, 0.0);
+            p_thread->count.assign(class_n, 0);
+            p_thread->cand.resize((size_t)(tree.depth + 1) * class_n);
+            p_thread->changed = 0;
+            p_thread->distance_n = 0;
+            for (int class_i = 0; class_i < class_n; class_i++) {
+                p_thread->cand[class_i] = class_i;
+            }
+
+            for (size_t task_i = begin_sz; task_i < end_sz; task_i++) {
+                kd_filter(&walk, p_thread, tree.task[task_i], p_thread->cand.data(), class_n, 0, -1);
+            }
+        });
+
+        changed = 0;
+        for (int thread_idx = 0; thread_idx < thread_n; thread_idx++) {
+            changed += thread[thread_idx].changed;
+            distance_n += thread[thread_idx].distance_n;
+        }
+
+        // Update step: each thread merges the per-thread sums of a range of centroids, in thread order
+        memcpy(prev.data(), centroids, sizeof(float) * cent_sz);
+        km_parallel_run(cent_sz * thread_n, [&](int thread_idx, int width)
+        {
+            int class_begin = (int)((long long)class_n * thread_idx / width);
+            int class_end = (int)((long long)class_n * (thread_idx + 1) / width);
+            float local_shift = 0.0f;
+
+            for (int class_i = class_begin; class_i < class_end; class_i++) {
+                long long count = 0;
+
+                for (int src_idx = 0; src_idx < thread_n; src_idx++) {
+                    count += thread[src_idx].count[class_i];
+                }
+                merge_count[class_i] = count;
+                // an empty cluster keeps its centroid until km_reseed_empty below
+                if (0 == count) {
+                    continue;
+                }
+
+                for (int d = 0; d < dim; d++) {
+                    size_t elem_i = (size_t)class_i * dim + d;
+                    double sum = 0.0;
+                    float t;
+
+                    for (int src_idx = 0; src_idx < thread_n; src_idx++) {
+                        sum += thread[src_idx].sum[elem_i];
+                    }
+                    centroids[elem_i] = (float)(sum / (double)count);
+
+                    // NaN sticks, as in kmeans_seq.cpp
+                    t = fabsf(centroids[elem_i] - prev[elem_i]);
+                    if (t > local_shift || isnan(t)) {
+                        local_shift = t;
+                    }
+                }
+            }
+
+            merge_shift[thread_idx] = local_shift;
+        });
+
+        shift = 0.0f;
+        for (int thread_idx = 0; thread_idx < merge_n; thread_idx++) {
+            float t = merge_shift[thread_idx];
+
+            if (t > shift || isnan(t)) {
+                shift = t;
+            }
+        }
+
+        // Empty clusters move onto the farthest points, as in kmeans_seq.cpp
+        empty_class.clear();
+        for (int class_i = 0; class_i < class_n; class_i++) {
+            if (0 == merge_count[class_i]) {
+                empty_class.push_back(class_i);
+            }
+        }
+        if (!empty_class.empty()) {
+            changed += km_reseed_empty((int)empty_class.size(), empty_class.data(), data_n, dim, data, partitioned, centroids);
+            for (int class_i : empty_class) {
+                for (int d = 0; d < dim; d++) {
+                    size_t elem_i = (size_t)class_i * dim + d;
+                    float t = fabsf(centroids[elem_i] - prev[elem_i]);
+
+                    if (t > shift || isnan(t)) {
+                        shift = t;
+                    }
+                }
+            }
+        }
+
+        converged = (config->tolerance >= 0) && ((0 == changed) || (shift <= config->tolerance));
+    }
+
+    result->iteration_n = i;
+    result->converged = converged;
+    result->inertia = kmeans_inertia(class_n, data_n, dim, centroids, data, partitioned);
+    result->distance_n = distance_n;
+}
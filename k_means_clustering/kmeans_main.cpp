@@ -3,88 +3,446 @@
 */
 
 #include "kmeans.h"
+#include "kmeans_file.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
-#define DATA_DIM 2
+#define DEFAULT_DIM 2
 #define DEFAULT_ITERATION 1024
+#define DEFAULT_TOLERANCE (-1.0f)
+#define DEFAULT_CHECK_INTERVAL 16
+#define DEFAULT_HOLDOUT 10000
+#define DEFAULT_SEED 1
+#define DEFAULT_RESERVOIR 65536
+#define MAX_CLASS_OPT 64
 
 #define GET_TIME(T) __asm__ __volatile__ ("rdtsc\n" : "=A" (T))
 
 
-// Read data from file
-unsigned int read_data(FILE* f, float** data_p);
+// Read a point file (legacy or KMPT, see kmeans_file.h)
+int read_data(const char* path, int dim, float** data_p);
+// Map a point file read-only, for mini-batch and streaming modes
+const float* map_data(const char* path, int dim, long long* data_n_p, KmPointFile* file, float** decoded_p);
+// Create partition file at its final size and map it, for mini-batch and streaming modes
+int* map_partition(const char* path, long long data_n, void** map_p, size_t* map_len_p);
 int timespec_subtract(struct timespec*, struct timespec*, struct timespec*);
 
 
 int main(int argc, char** argv)
 {
-    int class_n, data_n, iteration_n;
-    float *centroids, *data;
+    int class_n, data_n;
+    int class_opt[MAX_CLASS_OPT];
+    int class_opt_n = 0;
+    int run_opt = 1;
+    int predict_n = 0;
+    int bisect = 0;
+    int online_n = 0;
+    int refine_every = 0;
+    int coreset_max = 0;
+    int coreset_n = 0;
+    double merge_sse = 0.0;
+    long long data_ll = 0;
+    int dim = DEFAULT_DIM;
+    KmeansConfig config;
+    KmeansResult result;
+    KmeansRun* run_arr = NULL;
+    int run_n = 0;
+    float *centroids, *data = NULL;
+    const float* data_mapped = NULL;
     int* partitioned;
+    KmPointFile data_file;
+    float* data_decoded = NULL;
+    void* part_map = NULL;
+    size_t part_map_len = 0;
     FILE *io_file;
     struct timespec start, end, spent;
+    const char* prog = argv[0];
+    int opt, bad_opt = 0;
 
-    // Check parameters
-    if (argc < 4) {
-        fprintf(stderr, "usage: %s <centroid file> <data file> <paritioned result> [<final centroids>] [<iteration number>]\n", argv[0]);
-        exit(EXIT_FAILURE);
+    config.tolerance = DEFAULT_TOLERANCE;
+    config.check_interval = DEFAULT_CHECK_INTERVAL;
+    config.prune = KMEANS_PRUNE_AUTO;
+    config.init = KMEANS_INIT_FILE;
+    config.fused = 1;
+    config.device_n = 1;
+    config.launch = KMEANS_LAUNCH_AUTO;
+    config.batch_n = 0;
+    config.holdout_n = DEFAULT_HOLDOUT;
+    config.chunk_n = 0;
+    config.refine_n = 0;
+    config.reservoir_n = DEFAULT_RESERVOIR;
+    config.seed = DEFAULT_SEED;
+
+    // Options come before the positional arguments
+    while ((opt = getopt(argc, argv, "d:t:c:p:i:k:r:f:g:l:m:H:S:s:q:b:o:R:e:w:")) != -1) {
+        switch (opt) {
+        case 'd':
+            dim = atoi(optarg);
+            break;
+        case 't':
+            config.tolerance = (float)atof(optarg);
+            break;
+        case 'c':
+            config.check_interval = atoi(optarg);
+            break;
+        case 'p':
+            if (strcmp(optarg, "auto") == 0) {
+                config.prune = KMEANS_PRUNE_AUTO;
+            } else if (strcmp(optarg, "none") == 0) {
+                config.prune = KMEANS_PRUNE_NONE;
+            } else if (strcmp(optarg, "hamerly") == 0) {
+                config.prune = KMEANS_PRUNE_HAMERLY;
+            } else if (strcmp(optarg, "elkan") == 0) {
+                config.prune = KMEANS_PRUNE_ELKAN;
+            } else if (strcmp(optarg, "kdtree") == 0) {
+                config.prune = KMEANS_PRUNE_KDTREE;
+            } else {
+                bad_opt = 1;
+            }
+            break;
+        case 'i':
+            if (strcmp(optarg, "file") == 0) {
+                config.init = KMEANS_INIT_FILE;
+            } else if (strcmp(optarg, "kmeans++") == 0) {
+                config.init = KMEANS_INIT_PLUSPLUS;
+            } else if (strcmp(optarg, "kmeans||") == 0) {
+                config.init = KMEANS_INIT_PARALLEL;
+            } else {
+                bad_opt = 1;
+            }
+            break;
+        case 'k': {
+            // One or more cluster counts, comma separated
+            char* pos = optarg;
+            char* end;
+            class_opt_n = 0;
+            while (!bad_opt) {
+                long k = strtol(pos, &end, 10);
+                if (end == pos || k < 1 || k > 0x7fffffff || class_opt_n == MAX_CLASS_OPT) {
+                    bad_opt = 1;
+                    break;
+                }
+                class_opt[class_opt_n++] = (int)k;
+                if (*end == '\0') {
+                    break;
+                }
+                bad_opt = (*end != ',');
+                pos = end + 1;
+            }
+            break;
+        }
+        case 'r':
+            run_opt = atoi(optarg);
+            break;
+        case 'f':
+            if (strcmp(optarg, "fused") == 0) {
+                config.fused = 1;
+            } else if (strcmp(optarg, "split") == 0) {
+                config.fused = 0;
+            } else {
+                bad_opt = 1;
+            }
+            break;
+        case 'g':
+            config.device_n = atoi(optarg);
+            break;
+        case 'l':
+            if (strcmp(optarg, "auto") == 0) {
+                config.launch = KMEANS_LAUNCH_AUTO;
+            } else if (strcmp(optarg, "enqueue") == 0) {
+                config.launch = KMEANS_LAUNCH_ENQUEUE;
+            } else if (strcmp(optarg, "record") == 0) {
+                config.launch = KMEANS_LAUNCH_RECORD;
+            } else if (strcmp(optarg, "persistent") == 0) {
+                config.launch = KMEANS_LAUNCH_PERSISTENT;
+            } else {
+                bad_opt = 1;
+            }
+            break;
+        case 'm':
+            config.batch_n = atoi(optarg);
+            break;
+        case 'H':
+            config.holdout_n = atoi(optarg);
+            break;
+        case 'S':
+            config.chunk_n = atoi(optarg);
+            break;
+        case 's':
+            config.seed = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        case 'q':
+            predict_n = atoi(optarg);
+            break;
+        case 'b':
+            bisect = 1;
+            config.refine_n = atoi(optarg);
+            break;
+        case 'o':
+            online_n = atoi(optarg);
+            break;
+        case 'R':
+            config.reservoir_n = atoi(optarg);
+            break;
+        case 'e':
+            refine_every = atoi(optarg);
+            break;
+        case 'w':
+            coreset_max = atoi(optarg);
+            break;
+        default:
+            bad_opt = 1;
+            break;
+        }
     }
+    // From here on argv[1] is the first positional argument
+    argc -= optind - 1;
+    argv += optind - 1;
 
-    // Read initial centroid data
-    io_file = fopen(argv[1], "rb");
-    if (io_file == NULL) {
-        fprintf(stderr, "File open error %s\n", argv[1]);
+    // Check parameters
+    if (bad_opt || argc < 4 || dim < 1 || config.check_interval < 1 || config.batch_n < 0 || config.holdout_n < 0 || config.device_n < 0 ||
+        config.chunk_n < 0 || (config.chunk_n > 0 && config.batch_n > 0) ||
+        run_opt < 1 || ((class_opt_n > 0 || run_opt > 1) && config.init == KMEANS_INIT_FILE && !bisect) ||
+        ((class_opt_n > 1 || run_opt > 1) && (config.batch_n > 0 || config.chunk_n > 0)) || predict_n < 0 ||
+        (predict_n > 0 && (config.init != KMEANS_INIT_FILE || run_opt > 1 || config.batch_n > 0 || config.chunk_n > 0)) ||
+        (bisect && (config.refine_n < 0 || class_opt_n > 1 || run_opt > 1 || config.batch_n > 0 || config.chunk_n > 0 || predict_n > 0)) ||
+        online_n < 0 || config.reservoir_n < 0 || refine_every < 0 ||
+        (online_n > 0 && (config.init != KMEANS_INIT_FILE || run_opt > 1 || config.batch_n > 0 || config.chunk_n > 0 || predict_n > 0 || bisect)) ||
+        coreset_max < 0 ||
+        (coreset_max > 0 && (class_opt_n > 1 || run_opt > 1 || config.batch_n > 0 || config.chunk_n > 0 || predict_n > 0 || bisect || online_n > 0))) {
+        fprintf(stderr, "usage: %s [-d <dimension>] [-t <tolerance, stops early when >=0; the default -1 runs every iteration>] [-c <check interval>] [-p auto|none|hamerly|elkan|kdtree] "
+                        "[-i file|kmeans++|kmeans|| [-k <clusters[,clusters...], the centroid file is not read>] [-r <runs per clusters>]] "
+                        "[-f fused|split] [-g <devices, 0 for all>] [-l auto|enqueue|record|persistent] "
+                        "[-m <mini-batch size> [-H <hold-out points>] | -S <stream chunk size>] [-s <seed>] "
+                        "[-q <predict batch size, assigns the data to the centroids without training>] "
+                        "[-b <refine iterations, bisecting k-means: only the number of centroids is used, -k needs no -i>] "
+                        "[-o <online batch size> [-R <reservoir points>] [-e <batches between refinements, 0 for one at the end>]] "
+                        "[-w <coreset points, trains weighted k-means on a grid coreset of the data>] "
+                        "<centroid file> <data file> <paritioned result> [<final centroids>] [<iteration number>]\n", prog);
         exit(EXIT_FAILURE);
     }
-    class_n = read_data(io_file, &centroids);
-    fclose(io_file);
 
-    // Read input data
-    io_file = fopen(argv[2], "rb");
-    if (io_file == NULL) {
-        fprintf(stderr, "File open error %s\n", argv[2]);
-        exit(EXIT_FAILURE);
+    // Read initial centroid data; a seeded init and bisecting k-means only need their number
+    if (class_opt_n > 0) {
+        class_n = class_opt[0];
+        centroids = (float*)calloc((size_t)class_n * dim, sizeof(float));
+    } else {
+        class_n = read_data(argv[1], dim, &centroids);
     }
-    data_n = read_data(io_file, &data);
-    fclose(io_file);
 
-    iteration_n = argc > 5 ? atoi(argv[5]) : DEFAULT_ITERATION;
-        
+    config.iteration_n = argc > 5 ? atoi(argv[5]) : DEFAULT_ITERATION;
+
+    if (config.batch_n > 0) {
+        // Mini-batch mode: the data and partition files are mapped, never read in whole
+        data_mapped = map_data(argv[2], dim, &data_ll, &data_file, &data_decoded);
+        partitioned = map_partition(argv[3], data_ll, &part_map, &part_map_len);
+        data_n = (int)data_ll;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        kmeans_minibatch(&config, class_n, data_ll, dim, centroids, data_mapped, partitioned, &result);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+    } else if (config.chunk_n > 0) {
+        // Streaming mode: mapped the same way, walked in chunks every iteration
+        data_mapped = map_data(argv[2], dim, &data_ll, &data_file, &data_decoded);
+        partitioned = map_partition(argv[3], data_ll, &part_map, &part_map_len);
+        data_n = (int)data_ll;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        kmeans_stream(&config, class_n, data_ll, dim, centroids, data_mapped, partitioned, &result);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+    } else {
+        // Read input data
+        data_n = read_data(argv[2], dim, &data);
+
+        partitioned = (int*)malloc(sizeof(int)*data_n);
+
+        if (predict_n > 0) {
+            // Predict mode: the data goes through the resident model in batches, as queries would
+            KmeansModel* model = kmeans_model_create(class_n, dim, centroids);
+            float* dist = (float*)malloc(sizeof(float)*data_n);
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int i = 0; i < data_n; i += predict_n) {
+                int query_n = (data_n - i < predict_n) ? data_n - i : predict_n;
+                kmeans_predict(model, query_n, data + (size_t)i * dim, partitioned + i, dist + i);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            result.iteration_n = 0;
+            result.converged = 0;
+            result.inertia = 0.0;
+            for (int i = 0; i < data_n; i++) {
+                result.inertia += dist[i];
+            }
+            result.distance_n = (long long)data_n * class_n;
+            free(dist);
+            kmeans_model_release(model);
+        } else if (online_n > 0) {
+            // Online mode: the data arrives in batches, refined every -e batches and once at the end
+            // over the reservoir; the labels are then those of the final centroids
+            KmeansOnline* online = kmeans_online_create(&config, class_n, dim, centroids);
+            KmeansModel* model;
+            float* dist = (float*)malloc(sizeof(float)*data_n);
+            int batch_i = 0;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int i = 0; i < data_n; i += online_n) {
+                int add_n = (data_n - i < online_n) ? data_n - i : online_n;
+                kmeans_online_add(online, add_n, data + (size_t)i * dim, NULL);
+                if (refine_every > 0 && ++batch_i % refine_every == 0 && i + add_n < data_n) {
+                    kmeans_online_refine(online, config.iteration_n, &result);
+                }
+            }
+            kmeans_online_refine(online, config.iteration_n, &result);
+            kmeans_online_centroids(online, centroids);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            kmeans_online_release(online);
 
-    partitioned = (int*)malloc(sizeof(int)*data_n);
+            model = kmeans_model_create(class_n, dim, centroids);
+            kmeans_predict(model, data_n, data, partitioned, dist);
+            kmeans_model_release(model);
+            result.inertia = 0.0;
+            for (int i = 0; i < data_n; i++) {
+                result.inertia += dist[i];
+            }
+            free(dist);
+        } else if (coreset_max > 0) {
+            // Coreset mode: weighted k-means on the grid coreset, then the labels and inertia of
+            // every point against the final centroids
+            float* coreset = (float*)malloc(sizeof(float)*coreset_max*dim);
+            float* weight = (float*)malloc(sizeof(float)*coreset_max);
+            int* coreset_part = (int*)malloc(sizeof(int)*coreset_max);
+            float* dist = (float*)malloc(sizeof(float)*data_n);
+            KmeansModel* model;
 
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            coreset_n = kmeans_coreset(coreset_max, data_n, dim, data, coreset, weight, &merge_sse);
+            kmeans_weighted(&config, class_n, coreset_n, dim, centroids, coreset, weight, coreset_part, &result);
+            clock_gettime(CLOCK_MONOTONIC, &end);
 
-    clock_gettime(CLOCK_MONOTONIC, &start);
-    // Run Kmeans algorithm
-    kmeans(iteration_n, class_n, data_n, (Point*)centroids, (Point*)data, partitioned);
-    clock_gettime(CLOCK_MONOTONIC, &end);
+            model = kmeans_model_create(class_n, dim, centroids);
+            kmeans_predict(model, data_n, data, partitioned, dist);
+            kmeans_model_release(model);
+            result.inertia = 0.0;
+            for (int i = 0; i < data_n; i++) {
+                result.inertia += dist[i];
+            }
+            free(dist);
+            free(coreset_part);
+            free(weight);
+            free(coreset);
+        } else if (class_opt_n > 1 || run_opt > 1) {
+            // Batch mode: every cluster count with seeds seed .. seed + runs - 1, one result per run
+            if (class_opt_n == 0) {
+                class_opt[class_opt_n++] = class_n;
+            }
+            run_n = class_opt_n * run_opt;
+            run_arr = (KmeansRun*)calloc(run_n, sizeof(KmeansRun));
+            for (int i = 0; i < run_n; i++) {
+                run_arr[i].class_n = class_opt[i / run_opt];
+                run_arr[i].seed = config.seed + (unsigned)(i % run_opt);
+                run_arr[i].centroids = (float*)calloc((size_t)run_arr[i].class_n * dim, sizeof(float));
+                run_arr[i].clsfy_result = (int*)malloc(sizeof(int)*data_n);
+            }
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            kmeans_batch(&config, run_n, run_arr, data_n, dim, data);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+        } else if (bisect) {
+            // Bisecting mode: splits up to class_n clusters, then -b Lloyd iterations over all of them
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            kmeans_bisect(&config, class_n, data_n, dim, centroids, data, partitioned, &result);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+        } else {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            // Run Kmeans algorithm
+            kmeans(&config, class_n, data_n, dim, centroids, data, partitioned, &result);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+        }
+    }
+
+    // Batch mode reports every run and keeps the one with the lowest inertia
+    if (run_n > 0) {
+        int best = 0;
+        for (int i = 0; i < run_n; i++) {
+            printf("Run %d: clusters %d, seed %u, iterations %d%s, inertia %.6f\n", i, run_arr[i].class_n, run_arr[i].seed,
+                   run_arr[i].result.iteration_n, run_arr[i].result.converged ? " (converged)" : "", run_arr[i].result.inertia);
+            if (run_arr[i].result.inertia < run_arr[best].result.inertia) {
+                best = i;
+            }
+        }
+        printf("Best run: %d\n", best);
+
+        free(centroids);
+        free(partitioned);
+        class_n = run_arr[best].class_n;
+        centroids = run_arr[best].centroids;
+        partitioned = run_arr[best].clsfy_result;
+        result = run_arr[best].result;
+        for (int i = 0; i < run_n; i++) {
+            if (i != best) {
+                free(run_arr[i].centroids);
+                free(run_arr[i].clsfy_result);
+            }
+        }
+        free(run_arr);
+    }
 
     timespec_subtract(&spent, &end, &start);
     printf("Time spent: %ld.%09ld\n", spent.tv_sec, spent.tv_nsec);
+    if (predict_n > 0) {
+        double secs = spent.tv_sec + spent.tv_nsec * 1e-9;
+        int batches = (data_n + predict_n - 1) / predict_n;
+        printf("Batches: %d of %d points, %.3f us per batch, %.0f points per second\n", batches, predict_n,
+               batches > 0 ? secs * 1e6 / batches : 0.0, secs > 0 ? data_n / secs : 0.0);
+    } else {
+        printf("Iterations: %d%s\n", result.iteration_n, result.converged ? " (converged)" : "");
+    }
+    if (config.batch_n > 0 && config.holdout_n > 0) {
+        printf("Inertia (hold-out): %.6f\n", result.inertia);
+    } else {
+        printf("Inertia: %.6f\n", result.inertia);
+    }
+    if (result.distance_n > 0) {
+        printf("Distances: %lld\n", result.distance_n);
+    }
+    if (coreset_max > 0) {
+        printf("Coreset: %d of %d points, merge error %.6f\n", coreset_n, data_n, merge_sse);
+    }
 
     // Write classified result
-    io_file = fopen(argv[3], "wb");
-    fwrite(&data_n, sizeof(data_n), 1, io_file);
-    fwrite(partitioned, sizeof(int), data_n, io_file); 
-    fclose(io_file);
+    if (config.batch_n > 0 || config.chunk_n > 0) {
+        munmap(part_map, part_map_len);
+        km_file_close(&data_file);
+        free(data_decoded);
+    } else {
+        io_file = fopen(argv[3], "wb");
+        fwrite(&data_n, sizeof(data_n), 1, io_file);
+        fwrite(partitioned, sizeof(int), data_n, io_file); 
+        fclose(io_file);
+        free(data);
+        free(partitioned);
+    }
 
 
     // Write final centroid data
     if (argc > 4) {
         io_file = fopen(argv[4], "wb");
         fwrite(&class_n, sizeof(class_n), 1, io_file);
-        fwrite(centroids, sizeof(Point), class_n, io_file); 
+        fwrite(centroids, sizeof(float) * dim, class_n, io_file); 
         fclose(io_file);
     }
 
 
     // Free allocated buffers
     free(centroids);
-    free(data);
-    free(partitioned);
 
     return 0;
 }
@@ -115,25 +473,77 @@ int timespec_subtract (struct timespec* result, struct timespec *x, struct times
 }
 
 
-unsigned int read_data(FILE* f, float** data_p)
+// A legacy or KMPT point file, decoded into row-major floats
+int read_data(const char* path, int dim, float** data_p)
 {
-    unsigned int size;
-    size_t r;
+    KmPointFile file;
 
-    r = fread(&size, sizeof(size), 1, f);
-    if (r < 1) {
-        fputs("Error reading file size", stderr);
+    if (km_file_open(path, dim, &file) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (file.point_n > INT_MAX) {
+        fprintf(stderr, "%s has %lld points, more than INT_MAX: use -m or -S\n", path, file.point_n);
         exit(EXIT_FAILURE);
     }
-    
-    *data_p = (float*)malloc(sizeof(float) * DATA_DIM * size);
 
-    r = fread(*data_p, sizeof(float), DATA_DIM*size, f);
-    if (r < DATA_DIM*size) {
-        fputs("Error reading data", stderr);
+    *data_p = (float*)malloc(sizeof(float) * dim * (size_t)(file.point_n > 0 ? file.point_n : 1));
+    if (km_file_read(&file, *data_p) != 0) {
         exit(EXIT_FAILURE);
     }
 
+    int size = (int)file.point_n;
+
+    km_file_close(&file);
     return size;
 }
 
+
+// Float rows stored as is are used in the mapping: pages are loaded as the batches touch them.
+// Columnar, double or compressed files are decoded into *decoded_p first, so they must fit in memory.
+const float* map_data(const char* path, int dim, long long* data_n_p, KmPointFile* file, float** decoded_p)
+{
+    const float* rows;
+
+    if (km_file_open(path, dim, file) != 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    *data_n_p = file->point_n;
+    *decoded_p = NULL;
+    rows = km_file_rows(file);
+    if (rows != NULL) {
+        return rows;
+    }
+
+    *decoded_p = (float*)malloc(sizeof(float) * dim * (size_t)(file->point_n > 0 ? file->point_n : 1));
+    if (*decoded_p == NULL || km_file_read(file, *decoded_p) != 0) {
+        fprintf(stderr, "Error reading data %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    return *decoded_p;
+}
+
+
+// The count, then one int per point; the labels are written straight into the page cache
+int* map_partition(const char* path, long long data_n, void** map_p, size_t* map_len_p)
+{
+    unsigned int size = (unsigned int)data_n;
+    size_t len = sizeof(size) + sizeof(int) * (size_t)data_n;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0 || ftruncate(fd, (off_t)len) != 0) {
+        fprintf(stderr, "File open error %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    *map_p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (*map_p == MAP_FAILED) {
+        fprintf(stderr, "Error mapping %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    *map_len_p = len;
+
+    memcpy(*map_p, &size, sizeof(size));
+    return (int*)((char*)*map_p + sizeof(size));
+}
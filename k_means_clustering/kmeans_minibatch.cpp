@@ -0,0 +1,141 @@
+/*
+  Multithreaded CPU implementation of mini-batch KMeans
+
+  Each iteration draws a sorted batch of point indices, assigns the batch on the thread pool with
+  per-thread centroid sums, merges the sums in thread order and moves every centroid that got
+  batch points by
+      c += (batch_sum - batch_count * c) / seen_count
+  where seen_count includes this batch: the running mean of every point the centroid has taken.
+  A centroid that has not taken a point yet is an empty cluster: km_reseed_empty moves it onto
+  the batch point farthest from its own centroid.
+*/
+
+#include "kmeans.h"
+#include "kmeans_common.h"
+#include "kmeans_thread.h"
+
+#include <string.h>
+#include <math.h>
+
+#include <vector>
+
+
+void kmeans_minibatch(const KmeansConfig* config, int class_n, long long data_n, int dim, float* centroids, const float* data, int* partitioned, KmeansResult* result)
+{
+    const size_t cent_sz = (size_t)class_n * dim;
+    const int batch_n = config->batch_n;
+    // the assignment costs class_n distances per point, so size the pool by that work
+    const int thread_n = km_parallel_width((size_t)batch_n * class_n);
+
+    KmRng rng;
+    KmHoldout holdout;
+    std::vector<long long> batch_idx(batch_n);
+    std::vector<int> batch_label(batch_n);
+    std::vector<float> batch_data;
+    std::vector<int> empty_class;
+    // Points each centroid has taken so far
+    std::vector<long long> seen(class_n, 0);
+    // Per-thread batch sums and counts, merged into slice 0
+    std::vector<double> sum((size_t)thread_n * cent_sz);
+    std::vector<long long> count((size_t)thread_n * class_n);
+    int i, converged = 0;
+
+    km_rng_seed(&rng, config->seed);
+    km_holdout_init(&holdout, data_n, config->holdout_n, &rng);
+    km_seed_sample(config, class_n, data_n, dim, data, &holdout, &rng, centroids);
+
+    for (i = 0; i < config->iteration_n && !converged; i++) {
+        float shift = 0.0f;
+
+        km_sample_batch(&rng, &holdout, data_n, batch_n, batch_idx.data());
+
+        // Assignment step, accumulating into this thread's slice
+        km_parallel_run((size_t)batch_n * class_n, [&](int thread_idx, int width)
+        {
+            int batch_begin = (int)((long long)batch_n * thread_idx / width);
+            int batch_end = (int)((long long)batch_n * (thread_idx + 1) / width);
+            double* p_sum = &sum[(size_t)thread_idx * cent_sz];
+            long long* p_count = &count[(size_t)thread_idx * class_n];
+
+            memset(p_sum, 0, sizeof(double) * cent_sz);
+            memset(p_count, 0, sizeof(long long) * class_n);
+
+            for (int batch_i = batch_begin; batch_i < batch_end; batch_i++) {
+                const float* point = data + (size_t)batch_idx[batch_i] * dim;
+                int class_i = km_nearest(class_n, dim, centroids, point, NULL);
+
+                batch_label[batch_i] = class_i;
+                for (int d = 0; d < dim; d++) {
+                    p_sum[(size_t)class_i * dim + d] += point[d];
+                }
+                p_count[class_i]++;
+            }
+        });
+
+        for (int thread_idx = 1; thread_idx < thread_n; thread_idx++) {
+            for (size_t elem_i = 0; elem_i < cent_sz; elem_i++) {
+                sum[elem_i] += sum[(size_t)thread_idx * cent_sz + elem_i];
+            }
+            for (int class_i = 0; class_i < class_n; class_i++) {
+                count[class_i] += count[(size_t)thread_idx * class_n + class_i];
+            }
+        }
+
+        // Update step: per-centroid learning rate count / seen
+        empty_class.clear();
+        for (int class_i = 0; class_i < class_n; class_i++) {
+            if (0 == count[class_i]) {
+                if (0 == seen[class_i]) {
+                    empty_class.push_back(class_i);
+                }
+                continue;
+            }
+            seen[class_i] += count[class_i];
+
+            for (int d = 0; d < dim; d++) {
+                float* p_cent = &centroids[(size_t)class_i * dim + d];
+                float new_cent = (float)(*p_cent + (sum[(size_t)class_i * dim + d] - (double)count[class_i] * *p_cent) / (double)seen[class_i]);
+                float t = fabsf(new_cent - *p_cent);
+
+                if (t > shift || isnan(t)) {
+                    shift = t;
+                }
+                *p_cent = new_cent;
+            }
+        }
+
+        // Empty clusters move onto the farthest batch points, gathered in batch order for km_reseed_empty
+        if (!empty_class.empty()) {
+            std::vector<float> prev((size_t)empty_class.size() * dim);
+
+            batch_data.resize((size_t)batch_n * dim);
+            for (int batch_i = 0; batch_i < batch_n; batch_i++) {
+                memcpy(&batch_data[(size_t)batch_i * dim], data + (size_t)batch_idx[batch_i] * dim, sizeof(float) * dim);
+            }
+            for (size_t empty_i = 0; empty_i < empty_class.size(); empty_i++) {
+                memcpy(&prev[empty_i * dim], &centroids[(size_t)empty_class[empty_i] * dim], sizeof(float) * dim);
+            }
+            km_reseed_empty((int)empty_class.size(), empty_class.data(), batch_n, dim, batch_data.data(), batch_label.data(), centroids);
+            for (size_t empty_i = 0; empty_i < empty_class.size(); empty_i++) {
+                for (int d = 0; d < dim; d++) {
+                    float t = fabsf(centroids[(size_t)empty_class[empty_i] * dim + d] - prev[empty_i * dim + d]);
+
+                    if (t > shift || isnan(t)) {
+                        shift = t;
+                    }
+                }
+            }
+        }
+
+        converged = (config->tolerance >= 0) && (shift <= config->tolerance);
+    }
+
+    result->iteration_n = i;
+    result->converged = converged;
+    result->inertia = km_holdout_inertia(&holdout, data_n, class_n, dim, centroids, data);
+    result->distance_n = (long long)i * batch_n * class_n;
+
+    if (partitioned != NULL) {
+        km_assign_all(class_n, data_n, dim, centroids, data, partitioned);
+    }
+}
@@ -0,0 +1,167 @@
+/*
+  Online KMeans on the host
+
+  kmeans_online_add assigns a batch on the thread pool with per-thread centroid sums, as
+  kmeans_minibatch does a mini-batch, and moves every centroid that got batch points by
+      c += (batch_sum - batch_count * c) / seen_count
+  where seen_count counts every point the centroid has taken, this batch included. The points
+  also go through reservoir sampling into a copy of up to reservoir_n of them, which
+  kmeans_online_refine clusters with the build's kmeans() from the current centroids.
+*/
+
+#include "kmeans.h"
+#include "kmeans_common.h"
+#include "kmeans_thread.h"
+
+#include <string.h>
+#include <math.h>
+
+#include <vector>
+
+
+struct KmOnline
+{
+    KmeansConfig config;
+    int class_n;
+    int dim;
+    std::vector<float> centroids;
+    // Points each centroid has taken, rescaled by every refinement
+    std::vector<long long> seen;
+    // Per-thread batch sums and counts, merged into slice 0
+    std::vector<double> sum;
+    std::vector<long long> count;
+
+    KmRng rng;
+    long long added_n;          // points added so far
+    int reservoir_n;            // points in reservoir, up to config.reservoir_n
+    std::vector<float> reservoir;
+    std::vector<int> label;     // reservoir labels of the last refinement
+};
+
+KmOnline* km_online_create(const KmeansConfig* config, int class_n, int dim, const float* centroids)
+{
+    KmOnline* online = new KmOnline;
+
+    online->config = *config;
+    online->class_n = class_n;
+    online->dim = dim;
+    online->centroids.assign(centroids, centroids + (size_t)class_n * dim);
+    online->seen.assign(class_n, 0);
+    km_rng_seed(&online->rng, config->seed);
+    online->added_n = 0;
+    online->reservoir_n = 0;
+    online->reservoir.resize((size_t)config->reservoir_n * dim);
+    online->label.resize(config->reservoir_n);
+    return online;
+}
+
+void km_online_add(KmOnline* online, int batch_n, const float* batch, int* partitioned)
+{
+    const int class_n = online->class_n;
+    const int dim = online->dim;
+    const size_t cent_sz = (size_t)class_n * dim;
+    const int thread_n = km_parallel_width((size_t)batch_n * class_n);
+    float* centroids = &online->centroids[0];
+
+    online->sum.resize((size_t)thread_n * cent_sz);
+    online->count.resize((size_t)thread_n * class_n);
+
+    // Assignment step, accumulating into this thread's slice
+    km_parallel_run((size_t)batch_n * class_n, [&](int thread_idx, int width)
+    {
+        int batch_begin = (int)((long long)batch_n * thread_idx / width);
+        int batch_end = (int)((long long)batch_n * (thread_idx + 1) / width);
+        double* p_sum = &online->sum[(size_t)thread_idx * cent_sz];
+        long long* p_count = &online->count[(size_t)thread_idx * class_n];
+
+        memset(p_sum, 0, sizeof(double) * cent_sz);
+        memset(p_count, 0, sizeof(long long) * class_n);
+
+        for (int batch_i = batch_begin; batch_i < batch_end; batch_i++) {
+            const float* point = batch + (size_t)batch_i * dim;
+            int class_i = km_nearest(class_n, dim, centroids, point, NULL);
+
+            for (int d = 0; d < dim; d++) {
+                p_sum[(size_t)class_i * dim + d] += point[d];
+            }
+            p_count[class_i]++;
+            if (partitioned != NULL) {
+                partitioned[batch_i] = class_i;
+            }
+        }
+    });
+
+    for (int thread_idx = 1; thread_idx < thread_n; thread_idx++) {
+        for (size_t elem_i = 0; elem_i < cent_sz; elem_i++) {
+            online->sum[elem_i] += online->sum[(size_t)thread_idx * cent_sz + elem_i];
+        }
+        for (int class_i = 0; class_i < class_n; class_i++) {
+            online->count[class_i] += online->count[(size_t)thread_idx * class_n + class_i];
+        }
+    }
+
+    // Update step: per-centroid learning rate count / seen
+    for (int class_i = 0; class_i < class_n; class_i++) {
+        if (0 == online->count[class_i]) {
+            continue;
+        }
+        online->seen[class_i] += online->count[class_i];
+
+        for (int d = 0; d < dim; d++) {
+            float* p_cent = &centroids[(size_t)class_i * dim + d];
+
+            *p_cent = (float)(*p_cent + (online->sum[(size_t)class_i * dim + d] - (double)online->count[class_i] * *p_cent) /
+                                        (double)online->seen[class_i]);
+        }
+    }
+
+    // Reservoir sampling, in point order so that a later point in the same slot wins
+    for (int batch_i = 0; batch_i < batch_n; batch_i++) {
+        int slot = km_reservoir_slot(&online->rng, online->added_n++, online->config.reservoir_n);
+
+        if (slot < 0) {
+            continue;
+        }
+        memcpy(&online->reservoir[(size_t)slot * dim], batch + (size_t)batch_i * dim, sizeof(float) * dim);
+        if (slot == online->reservoir_n) {
+            online->reservoir_n++;
+        }
+    }
+}
+
+void km_online_refine(KmOnline* online, int iteration_n, KmeansResult* result)
+{
+    KmeansConfig refine_config = online->config;
+
+    if (0 == online->reservoir_n) {
+        result->iteration_n = 0;
+        result->converged = 0;
+        result->inertia = 0.0;
+        result->distance_n = 0;
+        return;
+    }
+
+    refine_config.init = KMEANS_INIT_FILE;
+    refine_config.iteration_n = iteration_n;
+    kmeans(&refine_config, online->class_n, online->reservoir_n, online->dim, &online->centroids[0], &online->reservoir[0], &online->label[0], result);
+
+    // Every reservoir point stands for added_n / reservoir_n points added
+    std::vector<long long> size(online->class_n, 0);
+
+    for (int res_i = 0; res_i < online->reservoir_n; res_i++) {
+        size[online->label[res_i]]++;
+    }
+    for (int class_i = 0; class_i < online->class_n; class_i++) {
+        online->seen[class_i] = llround((double)size[class_i] * online->added_n / online->reservoir_n);
+    }
+}
+
+void km_online_centroids(const KmOnline* online, float* centroids)
+{
+    memcpy(centroids, &online->centroids[0], sizeof(float) * online->class_n * online->dim);
+}
+
+void km_online_release(KmOnline* online)
+{
+    delete online;
+}
@@ -1,14 +1,30 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <limits.h>
 #include "kmeans.h"
+#include "kmeans_common.h"
 
 #include <CL/cl.h>
 
+#include <algorithm>
+#include <vector>
 
-#define RUN_TIME_KERNEL_BUILD   (0) /* 0 ==> bin-run or pre build mode, 1 ==> run-time compile mode */
+
+#define RUN_TIME_KERNEL_BUILD   (1) /* 0 ==> bin-run or pre build mode, 1 ==> run-time compile mode */
+/* kmeans.bin is built for one KM_DIM (see kmeans.cl), so bin-run mode only works for the dimension it was pre-built with */
 #define PRE_BUILD_MODE          (0 & (0 == RUN_TIME_KERNEL_BUILD)) /* 0 ==> bin run mode, 1 ==> pre build mode */
 
 #define FILE_NAME_KERNEL_CODE   "kmeans.cl"
+#define FILE_NAME_KERNEL_PRUNE  "kmeans_prune.cl"
+#define FILE_NAME_KERNEL_SEED   "kmeans_seed.cl"
+#define FILE_NAME_KERNEL_FUSED  "kmeans_fused.cl"
+#define FILE_NAME_KERNEL_BATCH  "kmeans_batch.cl"
+#define FILE_NAME_KERNEL_PERSIST "kmeans_persistent.cl"
+#define FILE_NAME_KERNEL_WEIGHTED "kmeans_weighted.cl"
+#define NO_KERNEL_SRC           (7)
 #define FILE_NAME_KERNEL_BIN    "kmeans.bin"
 
 #define RUN_WITH_CL_CODE   (0)
@@ -33,11 +49,34 @@
 #define NAME_KERNEL_ASSIGN "kmeans_assign"
 #define NAME_KERNEL_UPDATE "kmeans_update"
 #define NAME_KERNEL_REDUCT "kmeans_reduct"
+#define NAME_KERNEL_UPDATE_GLOBAL "kmeans_update_global"
+#define NAME_KERNEL_DIVIDE        "kmeans_divide"
+#define NAME_KERNEL_CHECK         "kmeans_check"
+#define NAME_KERNEL_ASSIGN_HAMERLY "kmeans_assign_hamerly"
+#define NAME_KERNEL_CENT_BOUNDS    "kmeans_cent_bounds"
+#define NAME_KERNEL_MINIBATCH_STEP "kmeans_minibatch_step"
+#define NAME_KERNEL_SEED_DIST       "kmeans_seed_dist"
+#define NAME_KERNEL_SEED_PICK       "kmeans_seed_pick"
+#define NAME_KERNEL_SEED_OVERSAMPLE "kmeans_seed_oversample"
+#define NAME_KERNEL_ASSIGN_UPDATE   "kmeans_assign_update"
+#define NAME_KERNEL_REDUCT_SUM      "kmeans_reduct_sum"
+#define NAME_KERNEL_ASSIGN_BATCH    "kmeans_assign_batch"
+#define NAME_KERNEL_DIVIDE_BATCH    "kmeans_divide_batch"
+#define NAME_KERNEL_CHECK_BATCH     "kmeans_check_batch"
+#define NAME_KERNEL_PREDICT         "kmeans_predict"
+#define NAME_KERNEL_RESEED_DIST     "kmeans_reseed_dist"
+#define NAME_KERNEL_RESEED_PICK     "kmeans_reseed_pick"
+#define NAME_KERNEL_RESEED_DIST_BATCH "kmeans_reseed_dist_batch"
+#define NAME_KERNEL_RESEED_PICK_BATCH "kmeans_reseed_pick_batch"
+#define NAME_KERNEL_PERSISTENT      "kmeans_persistent"
+#define NAME_KERNEL_RESERVOIR_KEEP  "kmeans_reservoir_keep"
+#define NAME_KERNEL_UPDATE_WEIGHTED "kmeans_update_weighted"
+#define NAME_KERNEL_DIVIDE_WEIGHTED "kmeans_divide_weighted"
 
 
 
-#define MAX_PLATFORM          (1)
-#define MAX_DEVICE            (1)
+#define MAX_PLATFORM          (8)
+#define MAX_DEVICE            (16)
 #define MAX_NAME_BUFFER       (2048)
 
 
@@ -72,146 +111,638 @@ char *get_source_code(const char *file_name, size_t *len) {
 }
 
 #define MAX_NO_DATA     (1048576)
-#define SZ_MAX_CENTROID (32)
 
-#define SZ_MAX_CU       (32)
-#define SZ_MAX_PE       (64)
-#define SZ_MAX_PES_ALL  (SZ_MAX_CU * SZ_MAX_PE)
+/* kmeans_assign keeps the dimension in private memory up to this size (KM_DIM build option) */
+#define MAX_DIM_SPECIALIZE (64)
+
+/* SoA rows start on this many floats */
+#define SZ_DATA_ALIGN   (32)
 
 #define MAX_SZ_LOCAL_ASSIGN (256)
+#define MAX_SZ_LOCAL_UPDATE (256)
+#define SZ_LOCAL_REDUCT     (64)
+
+/* kmeans_update work-groups per compute unit */
+#define SZ_UPDATE_GROUP_PER_CU (4)
+
+/* share of local memory used for one centroid tile in kmeans_assign */
+#define LOCAL_MEM_TILE_DIV (2)
+
+#define MAX_NO_CLASS (65536)
+
+#define MAX_BUILD_OPTION (256)
+
+/* status words shared with kmeans.cl */
+#define KM_STATUS_CHANGED (0)
+#define KM_STATUS_SHIFT   (1)
+#define KM_STATUS_DONE    (2)
+#define KM_STATUS_ITER    (3)
+#define KM_STATUS_BOUND   (4)
+#define KM_STATUS_EMPTY   (5)
+#define KM_STATUS_SIZE    (6)
+
+/* floats per centroid sum element (sum and compensation), keep in sync with KM_ACC in kmeans.cl */
+#define KM_ACC_SIZE (2)
 
-#define SZ_NO_TASK_IN_WG (4)
-	
+/* mini-batch: batches in flight, one filling on the host while the other is on the device */
+#define NO_BATCH_SLOT (2)
 
-void kmeans(int iteration_n, int class_n, int data_n, Point* centroids, Point* data, int* partitioned)
+/* kmeans_batch: runs per launch, keep in sync with KM_MAX_RUN in kmeans_batch.cl */
+#define MAX_NO_RUN (32)
+
+/* kmeans_persistent: KMEANS_LAUNCH_AUTO takes it up to this many multiply-adds per iteration
+   (points x centroids x dimensions), about what one compute unit does in the time of an
+   iteration's launches */
+#define PERSISTENT_MAX_WORK (1 << 22)
+
+/* kmeans_predict: below this many distances (queries x centroids) a batch stays on the host,
+   where it costs less than the launch and the two copies */
+#define PREDICT_HOST_WORK (1 << 18)
+
+
+/* one device, its queue and the kmeans program, with the launch shape for class_n x dim centroids */
+struct KmOcl
 {
-	/* ----------------------------------- */
-	/* start of local variable declaration */
-	/* ----------------------------------- */
+	cl_device_id     device;
+	cl_context       context;
+	cl_command_queue queue;
+	cl_program       program;
 
-	/* iteration index */
-	cl_int idx_iter = 0;
-	/* size divided by 2 */
-	cl_int class_n_div2 = class_n >> 1;
-	cl_int data_n_div2  = data_n  >> 1;
-	/* error */
+	/* device limits */
+	cl_uint  max_compute_units;
+	size_t   max_work_group_size;
+	cl_ulong sz_local_mem;
+
+	/* centroids per kmeans_assign tile */
+	cl_int sz_tile_class;
+
+	/* local memory of the centroids, the per-work-group partial sums and counts */
+	size_t sz_local_cent;
+	size_t sz_local_sum;
+	size_t sz_local_cnt;
+	/* small K sums in local memory (kmeans_update + kmeans_reduct),
+	   large K in global memory (kmeans_update_global + kmeans_divide) */
+	bool use_local_update;
+
+	/* kmeans_assign_update also holds every centroid in local memory, next to the sums */
+	bool fit_fused;
+	/* kmeans_persistent holds the centroids, sums and counts, the status words and one reseed
+	   candidate per work-item */
+	bool fit_persistent;
+
+	size_t sz_local_assign;
+	size_t sz_local_update;
+	size_t sz_local_reduct;
+	/* kmeans_update work-groups, each with its own slice of sums; 1 on the global path */
+	cl_int sz_group_update;
+	size_t sz_global_update;
+};
+
+/* Kernel profiling, switched on at run time by KM_OCL_PROFILE=<trace file>. The queues are then
+   created with CL_QUEUE_PROFILING_ENABLE and every launch of the kmeans() loop takes an event;
+   once the run has finished, the events give a per-kernel table with a histogram of launch
+   times (power-of-two microsecond buckets) on stderr, and a trace in the Chrome trace event
+   format, for chrome://tracing or Perfetto, with one slice per launch. Off, the launches pass
+   no event and the queue has no profiling flag, so the loop costs what it did without it. */
+#define PROF_HIST_BUCKET (24)
+#define PROF_HIST_BAR    (40)
+
+struct KmProfLaunch
+{
+	const char* name;
+	cl_int      iter;
+	cl_event    event;
+};
+
+struct KmProf
+{
+	const char* path;   /* NULL when profiling is off */
+	std::vector<KmProfLaunch> launch;
+};
+
+static const char* km_prof_path(void)
+{
+	const char* p_env = getenv("KM_OCL_PROFILE");
+
+	return (NULL != p_env && '\0' != p_env[0]) ? p_env : NULL;
+}
+
+static void km_prof_init(KmProf* prof)
+{
+	prof->path = km_prof_path();
+	prof->launch.clear();
+}
+
+/* the event argument of a launch: NULL when profiling is off */
+static cl_event* km_prof_event(KmProf* prof, const char* name, cl_int iter)
+{
+	KmProfLaunch launch = { name, iter, NULL };
+
+	if(NULL == prof->path)
+	{
+		return NULL;
+	}
+	prof->launch.push_back(launch);
+	return &prof->launch.back().event;
+}
+
+/* reads and releases the events; every launch must have completed */
+static void km_prof_report(KmProf* prof, cl_device_id device)
+{
 	cl_int err = CL_SUCCESS;
-	/* get num of platform */
-	cl_uint num_platforms = 0;
-	/* get num of device */
-	cl_uint num_devices = 0;
+	size_t idx_launch = 0;
+	size_t idx_kernel = 0;
+	char device_name[MAX_NAME_BUFFER] = "";
+	std::vector<cl_ulong> start(prof->launch.size()), end(prof->launch.size());
+	std::vector<const char*> kernel;
+	cl_ulong base = 0;
+	FILE* trace = NULL;
+
+	if(NULL == prof->path)
+	{
+		return;
+	}
+
+	for(idx_launch = 0 ; idx_launch < prof->launch.size() ; idx_launch++)
+	{
+		err = clGetEventProfilingInfo(prof->launch[idx_launch].event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start[idx_launch], NULL);
+		CHECK_ERROR(err);
+		err = clGetEventProfilingInfo(prof->launch[idx_launch].event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end[idx_launch], NULL);
+		CHECK_ERROR(err);
+		clReleaseEvent(prof->launch[idx_launch].event);
+
+		if(0 == idx_launch || start[idx_launch] < base)
+		{
+			base = start[idx_launch];
+		}
+		if(kernel.end() == std::find_if(kernel.begin(), kernel.end(), [&](const char* name) { return 0 == strcmp(name, prof->launch[idx_launch].name); }))
+		{
+			kernel.push_back(prof->launch[idx_launch].name);
+		}
+	}
+
+	/* per kernel: totals, percentiles and the histogram of launch times */
+	fprintf(stderr, "%-24s %9s %12s %10s %10s %10s %10s\n", "kernel", "launches", "total ms", "mean us", "p50 us", "p99 us", "max us");
+	for(idx_kernel = 0 ; idx_kernel < kernel.size() ; idx_kernel++)
+	{
+		std::vector<double> dur_us;
+		long long hist[PROF_HIST_BUCKET] = { 0 };
+		long long hist_max = 0;
+		double total_us = 0;
+		int idx_bucket = 0;
+
+		for(idx_launch = 0 ; idx_launch < prof->launch.size() ; idx_launch++)
+		{
+			if(0 == strcmp(kernel[idx_kernel], prof->launch[idx_launch].name))
+			{
+				double us = (double)(end[idx_launch] - start[idx_launch]) * 1e-3;
+
+				dur_us.push_back(us);
+				total_us += us;
+				/* bucket b holds [2^(b-1), 2^b) us, bucket 0 everything under 1 us */
+				for(idx_bucket = 0 ; idx_bucket < PROF_HIST_BUCKET - 1 && us >= (double)(1LL << idx_bucket) ; idx_bucket++)
+				{
+				}
+				hist[idx_bucket]++;
+				hist_max = std::max(hist_max, hist[idx_bucket]);
+			}
+		}
+		std::sort(dur_us.begin(), dur_us.end());
+
+		fprintf(stderr, "%-24s %9zu %12.3f %10.3f %10.3f %10.3f %10.3f\n", kernel[idx_kernel], dur_us.size(), total_us * 1e-3,
+		        total_us / dur_us.size(), dur_us[dur_us.size() / 2], dur_us[(dur_us.size() - 1) * 99 / 100], dur_us.back());
+		for(idx_bucket = 0 ; idx_bucket < PROF_HIST_BUCKET ; idx_bucket++)
+		{
+			if(0 != hist[idx_bucket])
+			{
+				char range[48];
+
+				if(0 == idx_bucket)
+				{
+					snprintf(range, sizeof(range), "< 1");
+				}
+				else
+				{
+					snprintf(range, sizeof(range), "%lld-%lld", 1LL << (idx_bucket - 1), 1LL << idx_bucket);
+				}
+				fprintf(stderr, "    %14s us %9lld %.*s\n", range, hist[idx_bucket],
+				        (int)((hist[idx_bucket] * PROF_HIST_BAR + hist_max - 1) / hist_max), "########################################");
+			}
+		}
+	}
+
+	/* one complete ("X") event per launch, in microseconds from the first start */
+	trace = fopen(prof->path, "w");
+	if(NULL == trace)
+	{
+		fprintf(stderr, "File open error %s\n", prof->path);
+		prof->launch.clear();
+		return;
+	}
+	clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
+	fprintf(trace, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+	fprintf(trace, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": 0, \"args\": {\"name\": \"");
+	for(const char* p = device_name ; '\0' != *p ; p++)
+	{
+		if('"' != *p && '\\' != *p && (unsigned char)*p >= ' ')
+		{
+			fputc(*p, trace);
+		}
+	}
+	fprintf(trace, "\"}}");
+	for(idx_launch = 0 ; idx_launch < prof->launch.size() ; idx_launch++)
+	{
+		fprintf(trace, ",\n{\"name\": \"%s\", \"cat\": \"kernel\", \"ph\": \"X\", \"pid\": 0, \"tid\": 0, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"iteration\": %d}}",
+		        prof->launch[idx_launch].name, (double)(start[idx_launch] - base) * 1e-3, (double)(end[idx_launch] - start[idx_launch]) * 1e-3,
+		        prof->launch[idx_launch].iter);
+	}
+	fprintf(trace, "\n]}\n");
+	fclose(trace);
+
+	prof->launch.clear();
+}
+
+/* cl_khr_command_buffer. The SDK headers declare it only from 2023 on, and its entry points are
+   not exported by the ICD loader, so the types are spelled out here and the functions looked up
+   on the device's platform. The calls are those of revision 0.9, which every driver shipping the
+   extension implements; earlier revisions take different arguments and are not used. */
+typedef struct _km_command_buffer* km_command_buffer;
+typedef cl_uint km_sync_point;
+
+typedef km_command_buffer (CL_API_CALL *km_create_command_buffer_fn)(cl_uint num_queues, const cl_command_queue* queues, const cl_ulong* properties,
+                                                                     cl_int* errcode_ret);
+typedef cl_int (CL_API_CALL *km_command_ndrange_kernel_fn)(km_command_buffer command_buffer, cl_command_queue command_queue, const cl_ulong* properties,
+                                                           cl_kernel kernel, cl_uint work_dim, const size_t* global_work_offset,
+                                                           const size_t* global_work_size, const size_t* local_work_size,
+                                                           cl_uint num_sync_points, const km_sync_point* sync_point_wait_list,
+                                                           km_sync_point* sync_point, void** mutable_handle);
+typedef cl_int (CL_API_CALL *km_finalize_command_buffer_fn)(km_command_buffer command_buffer);
+typedef cl_int (CL_API_CALL *km_enqueue_command_buffer_fn)(cl_uint num_queues, cl_command_queue* queues, km_command_buffer command_buffer,
+                                                           cl_uint num_events, const cl_event* event_wait_list, cl_event* event);
+typedef cl_int (CL_API_CALL *km_release_command_buffer_fn)(km_command_buffer command_buffer);
+
+#define KM_EXT_COMMAND_BUFFER          "cl_khr_command_buffer"
+#define KM_DEVICE_EXTENSIONS_WITH_VERSION (0x1060)  /* CL_DEVICE_EXTENSIONS_WITH_VERSION, OpenCL 3.0 */
+#define KM_VERSION_MINOR(version)      (((version) >> 12) & 0x3ff)
+#define KM_VERSION_MAJOR(version)      ((version) >> 22)
 
+/* replays queued at once, the next one waits for the one before the last to finish */
+#define NO_REPLAY_SLOT (2)
 
-	/* get platform ID */
+/* the profile's name for a replay of a command buffer */
+#define NAME_COMMAND_BUFFER "command_buffer"
+
+struct KmCommandBuffer
+{
+	km_create_command_buffer_fn   create;
+	km_command_ndrange_kernel_fn  ndrange_kernel;
+	km_finalize_command_buffer_fn finalize;
+	km_enqueue_command_buffer_fn  enqueue;
+	km_release_command_buffer_fn  release;
+};
+
+/* cl_name_version of OpenCL 3.0 */
+struct KmNameVersion
+{
+	cl_uint version;
+	char    name[64];
+};
+
+/* one kernel launch of the iteration body */
+struct KmLaunch
+{
+	cl_kernel   kernel;
+	size_t      sz_global;
+	size_t      sz_local;
+	const char* name;
+};
+
+/* the entry points when the device has cl_khr_command_buffer 0.9 or later; false otherwise */
+static bool km_command_buffer_load(const KmOcl* ocl, KmCommandBuffer* cmd)
+{
+	cl_int err = CL_SUCCESS;
 	cl_platform_id platform = NULL;
-	/* get num of device */
-	cl_device_id device = NULL;
-	/* context */
-	cl_context context = NULL;
-	/* cmd queue */
-	cl_command_queue queue = NULL;
-	/* get kernel source */
-	cl_program program = NULL;
+	size_t sz_ext = 0;
+	size_t idx_ext = 0;
+	bool found = false;
+	KmNameVersion *ext_arr = NULL;
 
-#if (RUN_WITH_CL_CODE == RUN_MODE)
-	size_t sz_kernel_src = 0;
-	char *code_kernel_src = get_source_code(FILE_NAME_KERNEL_CODE, &sz_kernel_src);
-#elif (PRE_BUILD_COMPILE == RUN_MODE)
-	size_t sz_kernel_src = 0;
-	char *code_kernel_src = get_source_code(FILE_NAME_KERNEL_CODE, &sz_kernel_src);
-#else /* RUN_WITH_BINARY == RUN_MODE) */
-#endif 
+	err = clGetDeviceInfo(ocl->device, KM_DEVICE_EXTENSIONS_WITH_VERSION, 0, NULL, &sz_ext);
+	if((CL_SUCCESS != err) || (0 == sz_ext))
+	{
+		return false;
+	}
+	ext_arr = (KmNameVersion *)malloc(sz_ext);
+	err = clGetDeviceInfo(ocl->device, KM_DEVICE_EXTENSIONS_WITH_VERSION, sz_ext, ext_arr, NULL);
+	for(idx_ext = 0 ; (CL_SUCCESS == err) && (idx_ext < sz_ext / sizeof(*ext_arr)) ; idx_ext++)
+	{
+		if(0 == strcmp(ext_arr[idx_ext].name, KM_EXT_COMMAND_BUFFER))
+		{
+			found = (0 < KM_VERSION_MAJOR(ext_arr[idx_ext].version)) || (9 <= KM_VERSION_MINOR(ext_arr[idx_ext].version));
+		}
+	}
+	free(ext_arr);
+	if(!found)
+	{
+		return false;
+	}
 
-	/* kernel object */
-	cl_kernel kernel_assign = NULL;
-	size_t sz_global_assign = (size_t)((((data_n >> 1) + MAX_SZ_LOCAL_ASSIGN - 1) / MAX_SZ_LOCAL_ASSIGN) * MAX_SZ_LOCAL_ASSIGN);
-/*	size_t sz_global_assign = (size_t)((((data_n) + MAX_SZ_LOCAL_ASSIGN - 1) / MAX_SZ_LOCAL_ASSIGN) * MAX_SZ_LOCAL_ASSIGN); */
-	size_t sz_local_assign  = (size_t)MAX_SZ_LOCAL_ASSIGN;
-
-	cl_kernel kernel_update       = NULL;
-	size_t sz_local_update        = SZ_MAX_PE * SZ_NO_TASK_IN_WG;
-	size_t sz_global_update       = SZ_MAX_PES_ALL * SZ_NO_TASK_IN_WG;
-	cl_int SZ_SLOT_IN_BANK_UPDATE = ((data_n + (SZ_MAX_PES_ALL * SZ_NO_TASK_IN_WG) - 1) / (SZ_MAX_PES_ALL * SZ_NO_TASK_IN_WG));
-
-	cl_kernel kernel_reduct       = NULL;
-	size_t sz_local_reduct        = SZ_MAX_PE;
-	size_t sz_global_reduct       = class_n * sz_local_reduct;
-    cl_int sz_max_src_reduct      = class_n * SZ_MAX_PES_ALL * SZ_NO_TASK_IN_WG;
-    cl_int SZ_STRIDE_REDUCT       = SZ_MAX_PES_ALL * SZ_NO_TASK_IN_WG;
-	cl_int SZ_SLOT_IN_BANK_REDUCT = SZ_MAX_CU * SZ_NO_TASK_IN_WG;/* (SZ_MAX_PES_ALL / SZ_MAX_PE); */
+	err = clGetDeviceInfo(ocl->device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, NULL);
+	if(CL_SUCCESS != err)
+	{
+		return false;
+	}
+	cmd->create         = (km_create_command_buffer_fn)  clGetExtensionFunctionAddressForPlatform(platform, "clCreateCommandBufferKHR");
+	cmd->ndrange_kernel = (km_command_ndrange_kernel_fn) clGetExtensionFunctionAddressForPlatform(platform, "clCommandNDRangeKernelKHR");
+	cmd->finalize       = (km_finalize_command_buffer_fn)clGetExtensionFunctionAddressForPlatform(platform, "clFinalizeCommandBufferKHR");
+	cmd->enqueue        = (km_enqueue_command_buffer_fn) clGetExtensionFunctionAddressForPlatform(platform, "clEnqueueCommandBufferKHR");
+	cmd->release        = (km_release_command_buffer_fn) clGetExtensionFunctionAddressForPlatform(platform, "clReleaseCommandBufferKHR");
 
-	/* memory object */
-	cl_mem buf_cen = NULL;
-	cl_mem buf_dat = NULL;
-	cl_mem buf_par = NULL;
-	cl_mem buf_cen_arr = NULL;
-	cl_mem buf_cnt_arr = NULL;
-	/* --------------------------------- */
-	/* end of local variable declaration */
-	/* --------------------------------- */
+	return (NULL != cmd->create) && (NULL != cmd->ndrange_kernel) && (NULL != cmd->finalize) && (NULL != cmd->enqueue) && (NULL != cmd->release);
+}
 
-	if(class_n > SZ_MAX_CENTROID)
+/* body recorded repeat_n times on the queue, each launch after the one before it (commands of a
+   command buffer are not ordered otherwise); NULL if the driver refuses any of it */
+static km_command_buffer km_command_buffer_record(const KmCommandBuffer* cmd, const KmOcl* ocl, const std::vector<KmLaunch>& body, int repeat_n)
+{
+	cl_int err = CL_SUCCESS;
+	km_command_buffer cmd_buf = NULL;
+	km_sync_point sync_prev = 0;
+	km_sync_point sync_cur  = 0;
+	size_t idx_launch = 0;
+	int idx_repeat = 0;
+	cl_uint no_wait = 0;
+
+	cmd_buf = cmd->create(1, &ocl->queue, NULL, &err);
+	if((CL_SUCCESS != err) || (NULL == cmd_buf))
 	{
-		printf("class_n(%d) is larger than SZ_MAX_CENTROID(%d). check it!\n", class_n, SZ_MAX_CENTROID);
-		exit(1);
+		return NULL;
 	}
-	if(data_n > MAX_NO_DATA)
+	for(idx_repeat = 0 ; (CL_SUCCESS == err) && (idx_repeat < repeat_n) ; idx_repeat++)
 	{
-		printf("data_n(%d) is larger than MAX_NO_DATA(%d). check it!\n", data_n, MAX_NO_DATA);
-		exit(1);
-	}		
+		for(idx_launch = 0 ; (CL_SUCCESS == err) && (idx_launch < body.size()) ; idx_launch++)
+		{
+			err = cmd->ndrange_kernel(cmd_buf, NULL, NULL, body[idx_launch].kernel, 1, NULL, &body[idx_launch].sz_global, &body[idx_launch].sz_local,
+			                          no_wait, &sync_prev, &sync_cur, NULL);
+			sync_prev = sync_cur;
+			no_wait   = 1;
+		}
+	}
+	if(CL_SUCCESS == err)
+	{
+		err = cmd->finalize(cmd_buf);
+	}
+	if(CL_SUCCESS != err)
+	{
+		cmd->release(cmd_buf);
+		return NULL;
+	}
+	return cmd_buf;
+}
+
+/* one iteration, kernel by kernel */
+static void km_ocl_enqueue_body(const KmOcl* ocl, const std::vector<KmLaunch>& body, KmProf* prof, cl_int idx_iter)
+{
+	cl_int err = CL_SUCCESS;
+	size_t idx_launch = 0;
+
+	for(idx_launch = 0 ; idx_launch < body.size() ; idx_launch++)
+	{
+		err = clEnqueueNDRangeKernel(ocl->queue, body[idx_launch].kernel, 1, NULL, &body[idx_launch].sz_global, &body[idx_launch].sz_local, 0, NULL,
+		                             km_prof_event(prof, body[idx_launch].name, idx_iter));
+		CHECK_ERROR(err);
+	}
+}
+
+/* Up to device_n devices (all of them for 0) over every platform, of the type named by
+   KM_OCL_DEVICE: gpu (the default), cpu or all. When device_n > 1 and only one device is found,
+   it is split into device_n sub-devices of equal compute units if it can be, so a multi-core CPU
+   device can stand in for several GPUs. Returns how many are in device_arr, 0 for none. */
+static int km_ocl_devices(int device_n, cl_device_id* device_arr)
+{
+	cl_int err = CL_SUCCESS;
+	cl_platform_id platform_arr[MAX_PLATFORM];
+	cl_uint num_platforms = 0;
+	cl_uint num_devices   = 0;
+	cl_uint idx_platform  = 0;
+	cl_uint max_compute_units = 0;
+	cl_device_type device_type = CL_DEVICE_TYPE_GPU;
+	const char* p_env = getenv("KM_OCL_DEVICE");
+	int max_n   = ((0 < device_n) && (device_n < MAX_DEVICE)) ? device_n : MAX_DEVICE;
+	int found_n = 0;
+
+	if(NULL != p_env)
+	{
+		if(0 == strcmp(p_env, "cpu"))
+		{
+			device_type = CL_DEVICE_TYPE_CPU;
+		}
+		else if(0 == strcmp(p_env, "all"))
+		{
+			device_type = CL_DEVICE_TYPE_ALL;
+		}
+	}
 
 	/* ---------------- */
 	/* get platform IDs */
 	/* ---------------- */
-	err = clGetPlatformIDs(1, &platform, &num_platforms);
-	CHECK_ERROR(err);
+	err = clGetPlatformIDs(MAX_PLATFORM, platform_arr, &num_platforms);
+	if((CL_SUCCESS != err) || (0 == num_platforms))
+	{
+		return 0;
+	}
+	if(num_platforms > MAX_PLATFORM)
+	{
+		num_platforms = MAX_PLATFORM;
+	}
 
 	/* -------------- */
 	/* get device IDs */
 	/* -------------- */
-	err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &device, &num_devices);
+	for(idx_platform = 0 ; (idx_platform < num_platforms) && (found_n < max_n) ; idx_platform++)
+	{
+		err = clGetDeviceIDs(platform_arr[idx_platform], device_type, (cl_uint)(max_n - found_n), &device_arr[found_n], &num_devices);
+		if((CL_DEVICE_NOT_FOUND == err) || ((CL_SUCCESS == err) && (0 == num_devices)))
+		{
+			continue;
+		}
+		CHECK_ERROR(err);
+		found_n += std::min((int)num_devices, max_n - found_n);
+	}
+
+	/* ---------------------- */
+	/* split a single device  */
+	/* ---------------------- */
+	if((1 == found_n) && (1 < device_n))
+	{
+		err = clGetDeviceInfo(device_arr[0], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(max_compute_units), &max_compute_units, NULL);
+		CHECK_ERROR(err);
+		if(max_compute_units >= (cl_uint)max_n)
+		{
+			cl_device_partition_property prop[3] = { CL_DEVICE_PARTITION_EQUALLY, (cl_device_partition_property)(max_compute_units / max_n), 0 };
+
+			/* a remainder of compute units can make one sub-device more than asked for */
+			err = clCreateSubDevices(device_arr[0], prop, 0, NULL, &num_devices);
+			if((CL_SUCCESS == err) && (num_devices >= (cl_uint)max_n))
+			{
+				cl_device_id *sub_arr = (cl_device_id *)malloc(sizeof(cl_device_id) * num_devices);
+				cl_uint idx_sub = 0;
+
+				err = clCreateSubDevices(device_arr[0], prop, num_devices, sub_arr, NULL);
+				CHECK_ERROR(err);
+				for(idx_sub = 0 ; idx_sub < num_devices ; idx_sub++)
+				{
+					if(idx_sub < (cl_uint)max_n)
+					{
+						device_arr[idx_sub] = sub_arr[idx_sub];
+					}
+					else
+					{
+						clReleaseDevice(sub_arr[idx_sub]);
+					}
+				}
+				free(sub_arr);
+				found_n = max_n;
+			}
+		}
+		if(1 == found_n)
+		{
+			fprintf(stderr, "one OpenCL device, which can not be split in %d: running on it alone\n", max_n);
+		}
+	}
+
+	return found_n;
+}
+
+/* the device's context, queue and program; device comes from km_ocl_devices */
+static void km_ocl_init(KmOcl* ocl, cl_device_id device, int class_n, int dim)
+{
+	/* error */
+	cl_int err = CL_SUCCESS;
+	/* build options */
+	char build_option[MAX_BUILD_OPTION];
+	cl_int km_dim = (dim <= MAX_DIM_SPECIALIZE) ? dim : 0;
+
+#if (RUN_WITH_CL_CODE == RUN_MODE) || (PRE_BUILD_COMPILE == RUN_MODE)
+	/* the other sources use the macros of kmeans.cl (and kmeans_fused.cl the bound helpers of
+	   kmeans_prune.cl, kmeans_batch.cl the atomic helpers), so all go into one program in this order */
+	size_t sz_kernel_src[NO_KERNEL_SRC] = { 0, 0, 0, 0, 0, 0, 0 };
+	char *code_kernel_src[NO_KERNEL_SRC] = { NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+#else /* RUN_WITH_BINARY == RUN_MODE) */
+#endif 
+
+	if(class_n > MAX_NO_CLASS)
+	{
+		printf("class_n(%d) is larger than MAX_NO_CLASS(%d). check it!\n", class_n, MAX_NO_CLASS);
+		exit(1);
+	}
+
+	ocl->device = device;
+	err = clGetDeviceInfo(ocl->device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(ocl->max_compute_units), &ocl->max_compute_units, NULL);
+	CHECK_ERROR(err);
+	err = clGetDeviceInfo(ocl->device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(ocl->max_work_group_size), &ocl->max_work_group_size, NULL);
 	CHECK_ERROR(err);
+	err = clGetDeviceInfo(ocl->device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(ocl->sz_local_mem), &ocl->sz_local_mem, NULL);
+	CHECK_ERROR(err);
+
+	ocl->sz_tile_class = (cl_int)((ocl->sz_local_mem / LOCAL_MEM_TILE_DIV) / (sizeof(cl_float) * dim));
+	if(ocl->sz_tile_class > class_n)
+	{
+		ocl->sz_tile_class = class_n;
+	}
+	if(ocl->sz_tile_class < 1)
+	{
+		printf("dim(%d) does not fit in local memory(%llu bytes). check it!\n", dim, (unsigned long long)ocl->sz_local_mem);
+		exit(1);
+	}
+
+	ocl->sz_local_cent    = sizeof(cl_float) * class_n * dim;
+	ocl->sz_local_sum     = sizeof(cl_float) * class_n * dim * KM_ACC_SIZE;
+	ocl->sz_local_cnt     = sizeof(cl_int)   * class_n;
+	ocl->use_local_update = ((ocl->sz_local_sum + ocl->sz_local_cnt) <= ocl->sz_local_mem);
+	ocl->fit_fused        = ((ocl->sz_local_cent + ocl->sz_local_sum + ocl->sz_local_cnt + sizeof(cl_int)) <= ocl->sz_local_mem);
+
+	ocl->sz_local_assign = (size_t)MAX_SZ_LOCAL_ASSIGN;
+	ocl->sz_local_update = (size_t)MAX_SZ_LOCAL_UPDATE;
+	ocl->sz_local_reduct = (size_t)SZ_LOCAL_REDUCT;
+	if(ocl->sz_local_assign > ocl->max_work_group_size)
+	{
+		ocl->sz_local_assign = ocl->max_work_group_size;
+	}
+	if(ocl->sz_local_update > ocl->max_work_group_size)
+	{
+		ocl->sz_local_update = ocl->max_work_group_size;
+	}
+	if(ocl->sz_local_reduct > ocl->max_work_group_size)
+	{
+		ocl->sz_local_reduct = ocl->max_work_group_size;
+	}
+	ocl->fit_persistent   = ((ocl->sz_local_cent + ocl->sz_local_sum + ocl->sz_local_cnt + sizeof(cl_int) * KM_STATUS_SIZE +
+	                          ocl->sz_local_update * (sizeof(cl_float) + sizeof(cl_int))) <= ocl->sz_local_mem);
+	ocl->sz_group_update  = (cl_int)(ocl->max_compute_units * SZ_UPDATE_GROUP_PER_CU);
+	ocl->sz_global_update = ocl->sz_group_update * ocl->sz_local_update;
+	/* one slice per work-group (small K) or a single global slice (large K) */
+	if(!ocl->use_local_update)
+	{
+		ocl->sz_group_update = 1;
+	}
 
 	/* -------------- */
 	/* create context */
 	/* -------------- */
-	context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+	ocl->context = clCreateContext(NULL, 1, &ocl->device, NULL, NULL, &err);
 	CHECK_ERROR(err);
 
 	/* ------------------------- */
 	/* create in-order cmd queue */
 	/* ------------------------- */
-	queue = clCreateCommandQueue(context, device, 0, &err);
+	ocl->queue = clCreateCommandQueue(ocl->context, ocl->device, (NULL != km_prof_path()) ? CL_QUEUE_PROFILING_ENABLE : 0, &err);
 	CHECK_ERROR(err);
 
+	snprintf(build_option, sizeof(build_option), "-DKM_DIM=%d", km_dim);
+
+#if (RUN_WITH_CL_CODE == RUN_MODE) || (PRE_BUILD_COMPILE == RUN_MODE)
+	code_kernel_src[0] = get_source_code(FILE_NAME_KERNEL_CODE,  &sz_kernel_src[0]);
+	code_kernel_src[1] = get_source_code(FILE_NAME_KERNEL_PRUNE, &sz_kernel_src[1]);
+	code_kernel_src[2] = get_source_code(FILE_NAME_KERNEL_SEED,  &sz_kernel_src[2]);
+	code_kernel_src[3] = get_source_code(FILE_NAME_KERNEL_FUSED, &sz_kernel_src[3]);
+	code_kernel_src[4] = get_source_code(FILE_NAME_KERNEL_BATCH, &sz_kernel_src[4]);
+	code_kernel_src[5] = get_source_code(FILE_NAME_KERNEL_PERSIST, &sz_kernel_src[5]);
+	code_kernel_src[6] = get_source_code(FILE_NAME_KERNEL_WEIGHTED, &sz_kernel_src[6]);
+#endif
+
 #if (RUN_WITH_CL_CODE == RUN_MODE)
     
 
 	/* --------------------- */
 	/* create program object */
 	/* --------------------- */
-	program = clCreateProgramWithSource(context, 1, (const char **)&code_kernel_src, &sz_kernel_src, &err);
+	ocl->program = clCreateProgramWithSource(ocl->context, NO_KERNEL_SRC, (const char **)code_kernel_src, sz_kernel_src, &err);
 	CHECK_ERROR(err);
+	free(code_kernel_src[0]);
+	free(code_kernel_src[1]);
+	free(code_kernel_src[2]);
+	free(code_kernel_src[3]);
+	free(code_kernel_src[4]);
+	free(code_kernel_src[5]);
+	free(code_kernel_src[6]);
     
 	/* ------------------------ */
 	/* build kernel source code */
 	/* ------------------------ */
-	err = clBuildProgram(program, 1, &device, "", NULL, NULL);
-#if (1 == CHECK_BUILD_ERROR_LOG)
-	//if(CL_BUILD_PROGRAM_FAILURE == err)
+	err = clBuildProgram(ocl->program, 1, &ocl->device, build_option, NULL, NULL);
+	if(CL_SUCCESS != err)
 	{
 		size_t log_size = 0;
 		char *log = NULL;
-		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+		clGetProgramBuildInfo(ocl->program, ocl->device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
 		log = (char *)malloc(log_size + 1);
-		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
+		clGetProgramBuildInfo(ocl->program, ocl->device, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
 		log[log_size] = '\0';
 		printf(":kernel Compile log:\n%s\n", log);
 		free(log);
 		log = NULL;
 	}
-#endif
 	CHECK_ERROR(err);
 
     
@@ -222,21 +753,21 @@ void kmeans(int iteration_n, int class_n, int data_n, Point* centroids, Point* d
 	/* --------------------- */
 	/* create program object */
 	/* --------------------- */
-	program = clCreateProgramWithSource(context, 1, (const char **)&code_kernel_src, &sz_kernel_src, &err);
+	ocl->program = clCreateProgramWithSource(ocl->context, NO_KERNEL_SRC, (const char **)code_kernel_src, sz_kernel_src, &err);
 	CHECK_ERROR(err);
     
 	/* ------------------------ */
 	/* build kernel source code */
 	/* ------------------------ */
-	err = clBuildProgram(program, 1, &device, "", NULL, NULL);
+	err = clBuildProgram(ocl->program, 1, &ocl->device, build_option, NULL, NULL);
 #if (1 == CHECK_BUILD_ERROR_LOG)
 	//if(CL_BUILD_PROGRAM_FAILURE == err)
 	{
 		size_t log_size = 0;
 		char *log = NULL;
-		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+		clGetProgramBuildInfo(ocl->program, ocl->device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
 		log = (char *)malloc(log_size + 1);
-		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
+		clGetProgramBuildInfo(ocl->program, ocl->device, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
 		log[log_size] = '\0';
 		printf(":kernel Compile log:\n%s\n", log);
 		free(log);
@@ -248,14 +779,14 @@ void kmeans(int iteration_n, int class_n, int data_n, Point* centroids, Point* d
     
 	cl_uint nb_devices;
 	size_t nbread;
-    err = clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES, sizeof(size_t), &nb_devices, &nbread);// Return 1 devices  
+    err = clGetProgramInfo(ocl->program, CL_PROGRAM_NUM_DEVICES, sizeof(size_t), &nb_devices, &nbread);// Return 1 devices  
 	CHECK_ERROR(err);
     size_t *np = new size_t[nb_devices];//Create size array   
-    err = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t)*nb_devices, np, &nbread);//Load in np the size of my binary  
+    err = clGetProgramInfo(ocl->program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t)*nb_devices, np, &nbread);//Load in np the size of my binary  
 	CHECK_ERROR(err);
     char** bn = new char* [nb_devices]; //Create the binary array
     for(int i =0; i < nb_devices;i++)  bn[i] = new char[np[i]]; // I know... it's bad... but if i use new char[np[i]], i have a segfault... :/  
-    err = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(unsigned char *)*nb_devices, bn, &nbread); //Load the binary itself  
+    err = clGetProgramInfo(ocl->program, CL_PROGRAM_BINARIES, sizeof(unsigned char *)*nb_devices, bn, &nbread); //Load the binary itself  
 	CHECK_ERROR(err);
     printf("%s\n", bn[0]); //Print the first binary. But here, I have some curious characters  
     FILE *fp = fopen(FILE_NAME_KERNEL_BIN, "wb");  
@@ -265,7 +796,7 @@ void kmeans(int iteration_n, int class_n, int data_n, Point* centroids, Point* d
 	delete np;
 	delete bn;
 
-    printf("\n pre-build done !\n change PRE_BUILD_MODE mode as 0\n");
+    printf("\n pre-build done for %s !\n change PRE_BUILD_MODE mode as 0\n", build_option);
     exit(-1);
 
 
@@ -279,22 +810,22 @@ void kmeans(int iteration_n, int class_n, int data_n, Point* centroids, Point* d
     rewind(fp);
 	unsigned char *programBinary = (unsigned char *)malloc(binarySize);
     fread(programBinary, 1, binarySize, fp);
-	program = clCreateProgramWithBinary(context, 1, &device, &binarySize, (const unsigned char**)&programBinary, NULL, &err);
+	ocl->program = clCreateProgramWithBinary(ocl->context, 1, &ocl->device, &binarySize, (const unsigned char**)&programBinary, NULL, &err);
 	CHECK_ERROR(err);
 	fclose(fp);
 
 	/* ------------------------ */
 	/* build kernel source code */
 	/* ------------------------ */
-	err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
+	err = clBuildProgram(ocl->program, 0, NULL, NULL, NULL, NULL);
 #if (1 == CHECK_BUILD_ERROR_LOG)
 	//if(CL_BUILD_PROGRAM_FAILURE == err)
 	{
 		size_t log_size = 0;
 		char *log = NULL;
-		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+		clGetProgramBuildInfo(ocl->program, ocl->device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
 		log = (char *)malloc(log_size + 1);
-		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
+		clGetProgramBuildInfo(ocl->program, ocl->device, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
 		log[log_size] = '\0';
 		printf(":kernel Compile log:\n%s\n", log);
 		free(log);
@@ -309,189 +840,3737 @@ void kmeans(int iteration_n, int class_n, int data_n, Point* centroids, Point* d
 
 
 
+}
 
+static void km_ocl_release(KmOcl* ocl)
+{
+	clReleaseProgram(ocl->program);
+	clReleaseCommandQueue(ocl->queue);
+	clReleaseContext(ocl->context);
+	/* drops a sub-device, a no-op for a root device */
+	clReleaseDevice(ocl->device);
+}
 
-	/* -------------------- */
-	/* create kernel object */
-	/* -------------------- */
-	kernel_assign = clCreateKernel(program, NAME_KERNEL_ASSIGN, &err);
-	CHECK_ERROR(err);
-	kernel_update = clCreateKernel(program, NAME_KERNEL_UPDATE, &err);
-	CHECK_ERROR(err);
-	kernel_reduct = clCreateKernel(program, NAME_KERNEL_REDUCT, &err);
-	CHECK_ERROR(err);
-
-	/* -------------------- */
-	/* create buffer object */
-	/* -------------------- */
-	buf_cen     = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(Point)  * class_n,                          NULL, &err);
-	CHECK_ERROR(err);
-	buf_dat     = clCreateBuffer(context, CL_MEM_READ_ONLY,  sizeof(Point)  * data_n,                           NULL, &err);
-	CHECK_ERROR(err);
-	buf_par     = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_int) * data_n,                           NULL, &err);
-	CHECK_ERROR(err);
-	buf_cnt_arr = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_int) * SZ_MAX_CENTROID * SZ_NO_TASK_IN_WG * SZ_MAX_PES_ALL, NULL, &err);
-	CHECK_ERROR(err);
-	buf_cen_arr = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(Point)  * SZ_MAX_CENTROID * SZ_NO_TASK_IN_WG * SZ_MAX_PES_ALL, NULL, &err);
-	CHECK_ERROR(err);
+static size_t km_ocl_round_up(size_t sz, size_t sz_local)
+{
+	return ((sz + sz_local - 1) / sz_local) * sz_local;
+}
 
-	/* ------------ */
-	/* write buffer */
-	/* ------------ */
-	err = clEnqueueWriteBuffer(queue, buf_dat, CL_FALSE, 0, sizeof(Point) * data_n,  data,      0, NULL, NULL);
-	CHECK_ERROR(err);
-	err = clEnqueueWriteBuffer(queue, buf_cen, CL_TRUE,  0, sizeof(Point) * class_n, centroids, 0, NULL, NULL);
-	CHECK_ERROR(err);
+/* kmeans_assign, brute force */
+static void km_ocl_set_assign_args(const KmOcl* ocl, cl_kernel kernel_assign, cl_mem buf_cen, cl_mem buf_dat, cl_mem buf_par, cl_mem buf_status,
+                                   cl_int class_n, cl_int data_n, cl_int dim, cl_int sz_data_stride)
+{
+	cl_int err = CL_SUCCESS;
 
-	/* ----------------------- */
-	/* kernel argument setting */
-	/* ----------------------- */
-	/* kernel_assign */
 	err = clSetKernelArg(kernel_assign, 0, sizeof(cl_mem), &buf_cen);
 	CHECK_ERROR(err);
 	err = clSetKernelArg(kernel_assign, 1, sizeof(cl_mem), &buf_dat);
 	CHECK_ERROR(err);
 	err = clSetKernelArg(kernel_assign, 2, sizeof(cl_mem), &buf_par);
 	CHECK_ERROR(err);
-	err = clSetKernelArg(kernel_assign, 3, sizeof(cl_int), &class_n_div2);//class_n);//
+	err = clSetKernelArg(kernel_assign, 3, sizeof(cl_int), &class_n);
 	CHECK_ERROR(err);
-	err = clSetKernelArg(kernel_assign, 4, sizeof(cl_int), &data_n_div2);//data_n);//
+	err = clSetKernelArg(kernel_assign, 4, sizeof(cl_int), &data_n);
 	CHECK_ERROR(err);
-	
-	/* kernel_update */
-	err = clSetKernelArg(kernel_update, 0, sizeof(cl_mem), &buf_cen_arr);
+	err = clSetKernelArg(kernel_assign, 5, sizeof(cl_int), &dim);
 	CHECK_ERROR(err);
-	err = clSetKernelArg(kernel_update, 1, sizeof(cl_mem), &buf_cnt_arr);
+	err = clSetKernelArg(kernel_assign, 6, sizeof(cl_int), &sz_data_stride);
 	CHECK_ERROR(err);
-	err = clSetKernelArg(kernel_update, 2, sizeof(cl_mem), &buf_dat);
+	err = clSetKernelArg(kernel_assign, 7, sizeof(cl_int), &ocl->sz_tile_class);
 	CHECK_ERROR(err);
-	err = clSetKernelArg(kernel_update, 3, sizeof(cl_mem), &buf_par);
+	err = clSetKernelArg(kernel_assign, 8, sizeof(cl_float) * ocl->sz_tile_class * dim, NULL);
 	CHECK_ERROR(err);
-	err = clSetKernelArg(kernel_update, 4, sizeof(cl_int), &class_n);
+	err = clSetKernelArg(kernel_assign, 9, sizeof(cl_mem), &buf_status);
 	CHECK_ERROR(err);
-	err = clSetKernelArg(kernel_update, 5, sizeof(cl_int), &data_n);
+	err = clSetKernelArg(kernel_assign, 10, sizeof(cl_int), NULL);
 	CHECK_ERROR(err);
-	err = clSetKernelArg(kernel_update, 6, sizeof(cl_int), &SZ_SLOT_IN_BANK_UPDATE);
+}
+
+/* kmeans_update or kmeans_update_global, whichever ocl->use_local_update picked */
+static void km_ocl_set_update_args(const KmOcl* ocl, cl_kernel kernel_update, cl_mem buf_cen_arr, cl_mem buf_cnt_arr, cl_mem buf_dat, cl_mem buf_par, cl_mem buf_status,
+                                   cl_int class_n, cl_int data_n, cl_int dim, cl_int sz_data_stride)
+{
+	cl_int err = CL_SUCCESS;
+	cl_uint idx_arg = 0;
+
+	err = clSetKernelArg(kernel_update, idx_arg++, sizeof(cl_mem), &buf_cen_arr);
 	CHECK_ERROR(err);
-	
-	
-	/* kernel_reduct */
-	err = clSetKernelArg(kernel_reduct, 0, sizeof(cl_mem), &buf_cen);
+	err = clSetKernelArg(kernel_update, idx_arg++, sizeof(cl_mem), &buf_cnt_arr);
 	CHECK_ERROR(err);
-	err = clSetKernelArg(kernel_reduct, 1, sizeof(cl_mem), &buf_cen_arr);
+	err = clSetKernelArg(kernel_update, idx_arg++, sizeof(cl_mem), &buf_dat);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_update, idx_arg++, sizeof(cl_mem), &buf_par);
+	CHECK_ERROR(err);
+	if(ocl->use_local_update)
+	{
+		err = clSetKernelArg(kernel_update, idx_arg++, sizeof(cl_int), &class_n);
+		CHECK_ERROR(err);
+	}
+	err = clSetKernelArg(kernel_update, idx_arg++, sizeof(cl_int), &data_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_update, idx_arg++, sizeof(cl_int), &dim);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_update, idx_arg++, sizeof(cl_int), &sz_data_stride);
+	CHECK_ERROR(err);
+	if(ocl->use_local_update)
+	{
+		err = clSetKernelArg(kernel_update, idx_arg++, ocl->sz_local_sum, NULL);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_update, idx_arg++, ocl->sz_local_cnt, NULL);
+		CHECK_ERROR(err);
+	}
+	err = clSetKernelArg(kernel_update, idx_arg++, sizeof(cl_mem), &buf_status);
+	CHECK_ERROR(err);
+}
+
+/* kmeans_assign_update; buf_upper .. buf_cen_half are only read with use_bound and may be NULL without */
+static void km_ocl_set_fused_args(const KmOcl* ocl, cl_kernel kernel_fused, cl_mem buf_cen, cl_mem buf_dat, cl_mem buf_par, cl_mem buf_cen_arr, cl_mem buf_cnt_arr,
+                                  cl_mem buf_upper, cl_mem buf_lower, cl_mem buf_cen_shift, cl_mem buf_cen_half, cl_mem buf_status,
+                                  cl_int class_n, cl_int data_n, cl_int dim, cl_int sz_data_stride, cl_int use_bound, cl_float eps)
+{
+	cl_int err = CL_SUCCESS;
+
+	err = clSetKernelArg(kernel_fused, 0, sizeof(cl_mem), &buf_cen);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_fused, 1, sizeof(cl_mem), &buf_dat);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_fused, 2, sizeof(cl_mem), &buf_par);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_fused, 3, sizeof(cl_mem), &buf_cen_arr);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_fused, 4, sizeof(cl_mem), &buf_cnt_arr);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_fused, 5, sizeof(cl_mem), &buf_upper);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_fused, 6, sizeof(cl_mem), &buf_lower);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_fused, 7, sizeof(cl_mem), &buf_cen_shift);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_fused, 8, sizeof(cl_mem), &buf_cen_half);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_fused, 9, sizeof(cl_int), &class_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_fused, 10, sizeof(cl_int), &data_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_fused, 11, sizeof(cl_int), &dim);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_fused, 12, sizeof(cl_int), &sz_data_stride);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_fused, 13, sizeof(cl_int), &use_bound);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_fused, 14, sizeof(cl_float), &eps);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_fused, 15, ocl->sz_local_cent, NULL);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_fused, 16, ocl->sz_local_sum, NULL);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_fused, 17, ocl->sz_local_cnt, NULL);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_fused, 18, sizeof(cl_mem), &buf_status);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_fused, 19, sizeof(cl_int), NULL);
+	CHECK_ERROR(err);
+}
+
+/* kmeans_assign_hamerly */
+static void km_ocl_set_hamerly_args(const KmOcl* ocl, cl_kernel kernel_assign, cl_mem buf_cen, cl_mem buf_dat, cl_mem buf_par,
+                                    cl_mem buf_upper, cl_mem buf_lower, cl_mem buf_cen_shift, cl_mem buf_cen_half, cl_mem buf_status,
+                                    cl_int class_n, cl_int data_n, cl_int dim, cl_int sz_data_stride, cl_float eps)
+{
+	cl_int err = CL_SUCCESS;
+
+	err = clSetKernelArg(kernel_assign, 0, sizeof(cl_mem), &buf_cen);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_assign, 1, sizeof(cl_mem), &buf_dat);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_assign, 2, sizeof(cl_mem), &buf_par);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_assign, 3, sizeof(cl_mem), &buf_upper);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_assign, 4, sizeof(cl_mem), &buf_lower);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_assign, 5, sizeof(cl_mem), &buf_cen_shift);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_assign, 6, sizeof(cl_mem), &buf_cen_half);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_assign, 7, sizeof(cl_int), &class_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_assign, 8, sizeof(cl_int), &data_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_assign, 9, sizeof(cl_int), &dim);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_assign, 10, sizeof(cl_int), &sz_data_stride);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_assign, 11, sizeof(cl_int), &ocl->sz_tile_class);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_assign, 12, sizeof(cl_float) * ocl->sz_tile_class * dim, NULL);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_assign, 13, sizeof(cl_mem), &buf_status);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_assign, 14, sizeof(cl_int) * 2, NULL);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_assign, 15, sizeof(cl_float), &eps);
+	CHECK_ERROR(err);
+}
+
+/* kmeans_cent_bounds */
+static void km_ocl_set_bounds_args(cl_kernel kernel_bounds, cl_mem buf_cen, cl_mem buf_cen_prev, cl_mem buf_cen_shift, cl_mem buf_cen_half, cl_mem buf_status,
+                                   cl_int class_n, cl_int dim, cl_int use_half, cl_float eps)
+{
+	cl_int err = CL_SUCCESS;
+
+	err = clSetKernelArg(kernel_bounds, 0, sizeof(cl_mem), &buf_cen);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_bounds, 1, sizeof(cl_mem), &buf_cen_prev);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_bounds, 2, sizeof(cl_mem), &buf_cen_shift);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_bounds, 3, sizeof(cl_mem), &buf_cen_half);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_bounds, 4, sizeof(cl_mem), &buf_status);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_bounds, 5, sizeof(cl_int), &class_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_bounds, 6, sizeof(cl_int), &dim);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_bounds, 7, sizeof(cl_int), &use_half);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_bounds, 8, sizeof(cl_float), &eps);
+	CHECK_ERROR(err);
+}
+
+/* kmeans_check; check_changed is 0 for mini-batch */
+/* kmeans_reseed_dist and kmeans_reseed_pick; pick runs as one work-group of sz_local_reduct */
+static void km_ocl_set_reseed_args(const KmOcl* ocl, cl_kernel kernel_dist, cl_kernel kernel_pick, cl_mem buf_cen, cl_mem buf_dat, cl_mem buf_par,
+                                   cl_mem buf_dist, cl_mem buf_cen_empty, cl_mem buf_status, cl_int class_n, cl_int data_n, cl_int dim, cl_int sz_data_stride)
+{
+	cl_int err = CL_SUCCESS;
+
+	err = clSetKernelArg(kernel_dist, 0, sizeof(cl_mem), &buf_cen);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_dist, 1, sizeof(cl_mem), &buf_dat);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_dist, 2, sizeof(cl_mem), &buf_par);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_dist, 3, sizeof(cl_mem), &buf_dist);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_dist, 4, sizeof(cl_int), &data_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_dist, 5, sizeof(cl_int), &dim);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_dist, 6, sizeof(cl_int), &sz_data_stride);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_dist, 7, sizeof(cl_mem), &buf_status);
+	CHECK_ERROR(err);
+
+	err = clSetKernelArg(kernel_pick, 0, sizeof(cl_mem), &buf_cen);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_pick, 1, sizeof(cl_mem), &buf_dat);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_pick, 2, sizeof(cl_mem), &buf_dist);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_pick, 3, sizeof(cl_mem), &buf_cen_empty);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_pick, 4, sizeof(cl_int), &class_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_pick, 5, sizeof(cl_int), &data_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_pick, 6, sizeof(cl_int), &dim);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_pick, 7, sizeof(cl_int), &sz_data_stride);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_pick, 8, sizeof(cl_float) * ocl->sz_local_reduct, NULL);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_pick, 9, sizeof(cl_int) * ocl->sz_local_reduct, NULL);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_pick, 10, sizeof(cl_mem), &buf_status);
+	CHECK_ERROR(err);
+}
+
+static void km_ocl_set_check_args(cl_kernel kernel_check, cl_mem buf_status, cl_float tolerance, cl_int check_changed)
+{
+	cl_int err = CL_SUCCESS;
+
+	err = clSetKernelArg(kernel_check, 0, sizeof(cl_mem), &buf_status);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_check, 1, sizeof(cl_float), &tolerance);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_check, 2, sizeof(cl_int), &check_changed);
+	CHECK_ERROR(err);
+}
+
+/* kmeans_persistent: one work-group of sz_local_update work-items */
+static void km_ocl_set_persistent_args(const KmOcl* ocl, cl_kernel kernel_persistent, cl_mem buf_cen, cl_mem buf_dat, cl_mem buf_par, cl_mem buf_dist,
+                                       cl_mem buf_status, cl_int class_n, cl_int data_n, cl_int dim, cl_int sz_data_stride,
+                                       cl_int iteration_n, cl_float tolerance)
+{
+	cl_int err = CL_SUCCESS;
+
+	err = clSetKernelArg(kernel_persistent,  0, sizeof(cl_mem), &buf_cen);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_persistent,  1, sizeof(cl_mem), &buf_dat);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_persistent,  2, sizeof(cl_mem), &buf_par);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_persistent,  3, sizeof(cl_mem), &buf_dist);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_persistent,  4, sizeof(cl_int), &class_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_persistent,  5, sizeof(cl_int), &data_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_persistent,  6, sizeof(cl_int), &dim);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_persistent,  7, sizeof(cl_int), &sz_data_stride);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_persistent,  8, sizeof(cl_int), &iteration_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_persistent,  9, sizeof(cl_float), &tolerance);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_persistent, 10, ocl->sz_local_cent, NULL);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_persistent, 11, ocl->sz_local_sum, NULL);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_persistent, 12, ocl->sz_local_cnt, NULL);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_persistent, 13, sizeof(cl_float) * ocl->sz_local_update, NULL);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_persistent, 14, sizeof(cl_int) * ocl->sz_local_update, NULL);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_persistent, 15, sizeof(cl_int) * KM_STATUS_SIZE, NULL);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_persistent, 16, sizeof(cl_mem), &buf_status);
+	CHECK_ERROR(err);
+}
+
+/* Every check_interval iterations: wait for the status read queued one interval ago, which has
+   normally finished by now so waiting does not drain the queue, then queue the next one.
+   Returns 1 once the device has set the done flag of all no_run status blocks (1 but for
+   kmeans_batch); kernels queued past it return at once. */
+static int km_ocl_poll_status(const KmOcl* ocl, cl_mem buf_status, cl_int* status, cl_int no_run, cl_event* ev_status)
+{
+	cl_int err = CL_SUCCESS;
+	cl_int idx_run = 0;
+
+	if(NULL != *ev_status)
+	{
+		err = clWaitForEvents(1, ev_status);
+		CHECK_ERROR(err);
+		clReleaseEvent(*ev_status);
+		*ev_status = NULL;
+		for(idx_run = 0 ; idx_run < no_run ; idx_run++)
+		{
+			if(!status[idx_run * KM_STATUS_SIZE + KM_STATUS_DONE])
+			{
+				break;
+			}
+		}
+		if(idx_run == no_run)
+		{
+			return 1;
+		}
+	}
+	err = clEnqueueReadBuffer(ocl->queue, buf_status, CL_FALSE, 0, sizeof(cl_int) * KM_STATUS_SIZE * no_run, status, 0, NULL, ev_status);
+	CHECK_ERROR(err);
+	err = clFlush(ocl->queue);
+	CHECK_ERROR(err);
+	return 0;
+}
+
+
+/* km_reseed_empty for the runs whose points are never whole on one device (sharded, streamed):
+   the empty clusters move on the host, and *shift_max takes their moves as status_shift_max
+   would. Returns how many moved, to count as changed. */
+static int km_ocl_reseed_host(const std::vector<int>& empty_class, long long data_n, int dim, const float* data, const int* partitioned,
+                              float* centroids, float* shift_max)
+{
+	std::vector<float> prev(empty_class.size() * dim);
+	size_t idx_empty = 0;
+	int idx_dim = 0;
+	int no_moved = 0;
+
+	for(idx_empty = 0 ; idx_empty < empty_class.size() ; idx_empty++)
+	{
+		memcpy(&prev[idx_empty * dim], &centroids[(size_t)empty_class[idx_empty] * dim], sizeof(float) * dim);
+	}
+	no_moved = km_reseed_empty((int)empty_class.size(), empty_class.data(), data_n, dim, data, partitioned, centroids);
+	for(idx_empty = 0 ; idx_empty < empty_class.size() ; idx_empty++)
+	{
+		for(idx_dim = 0 ; idx_dim < dim ; idx_dim++)
+		{
+			float shift = fabsf(centroids[(size_t)empty_class[idx_empty] * dim + idx_dim] - prev[idx_empty * dim + idx_dim]);
+
+			/* NaN sorts above every shift */
+			if((shift != shift) || (shift > *shift_max))
+			{
+				*shift_max = shift;
+			}
+		}
+	}
+	return no_moved;
+}
+
+
+/* k-means++ or k-means|| over the SoA data already in buf_dat, with the random draws of
+   kmeans_seed.cpp; the centroids come back to the host. k-means++ queues one dist/pick pair per
+   centroid and reads nothing until the end. k-means|| reads the D^2 block sums and the kept
+   indices once per pass and does the weighted reduction on the host, like the CPU engines. */
+static void km_ocl_seed(const KmeansConfig* config, const KmOcl* ocl, cl_mem buf_dat, cl_int class_n, cl_int data_n, cl_int dim, cl_int sz_data_stride,
+                        const float* data, float* centroids)
+{
+	cl_int err = CL_SUCCESS;
+	cl_int idx_class = 0;
+	cl_int idx_round = 0;
+	cl_int idx_pick  = 0;
+	cl_int idx_block = 0;
+	cl_int idx_data  = 0;
+	KmRng rng;
+
+	bool   use_parallel   = (KMEANS_INIT_PARALLEL == config->init);
+	size_t sz_global_dist = km_ocl_round_up((size_t)data_n, ocl->sz_local_assign);
+	size_t sz_local_pick  = ocl->sz_local_assign;
+	cl_int sz_block       = (cl_int)ocl->sz_local_assign;
+	cl_int no_block       = (cl_int)(sz_global_dist / ocl->sz_local_assign);
+	/* k-means|| keeps about oversample points per pass; past twice that they are dropped */
+	cl_float oversample   = (cl_float)KM_SEED_OVERSAMPLE * class_n;
+	cl_int sz_pick_cap    = 2 * KM_SEED_OVERSAMPLE * class_n + 64;
+	cl_int sz_cent_cap    = use_parallel ? (1 + KM_SEED_ROUNDS * sz_pick_cap) : class_n;
+	cl_int cand_n         = 1;
+	cl_int class_begin    = 1;
+	cl_int cent_begin     = 0;
+	cl_int cent_end       = 1;
+	cl_int first          = 1;
+	cl_int pick_n         = 0;
+	cl_ulong seed         = config->seed;
+	long long pos_first   = 0;
+
+	float  *cand      = NULL;
+	float  *rand_arr  = NULL;
+	float  *block_sum = NULL;
+	int    *pick_arr  = NULL;
+
+	cl_kernel kernel_dist       = NULL;
+	cl_kernel kernel_pick       = NULL;
+	cl_kernel kernel_oversample = NULL;
+
+	cl_mem buf_cent      = NULL;
+	cl_mem buf_d2        = NULL;
+	cl_mem buf_label     = NULL;
+	cl_mem buf_block_sum = NULL;
+	cl_mem buf_rand      = NULL;
+	cl_mem buf_pick      = NULL;
+	cl_mem buf_pick_n    = NULL;
+
+	km_rng_seed(&rng, config->seed);
+
+	if(sz_cent_cap < class_n)
+	{
+		sz_cent_cap = class_n;
+	}
+	cand      = (float *)malloc(sizeof(float) * sz_cent_cap * dim);
+	rand_arr  = (float *)calloc((size_t)class_n, sizeof(float));
+	block_sum = (float *)malloc(sizeof(float) * no_block);
+	pick_arr  = (int   *)malloc(sizeof(int)   * sz_pick_cap);
+
+	kernel_dist = clCreateKernel(ocl->program, NAME_KERNEL_SEED_DIST, &err);
+	CHECK_ERROR(err);
+	kernel_pick = clCreateKernel(ocl->program, NAME_KERNEL_SEED_PICK, &err);
+	CHECK_ERROR(err);
+	kernel_oversample = clCreateKernel(ocl->program, NAME_KERNEL_SEED_OVERSAMPLE, &err);
+	CHECK_ERROR(err);
+
+	buf_cent      = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_float) * sz_cent_cap * dim, NULL, &err);
+	CHECK_ERROR(err);
+	buf_d2        = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_float) * data_n,            NULL, &err);
+	CHECK_ERROR(err);
+	buf_label     = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_int)   * data_n,            NULL, &err);
+	CHECK_ERROR(err);
+	buf_block_sum = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_float) * no_block,          NULL, &err);
+	CHECK_ERROR(err);
+	buf_rand      = clCreateBuffer(ocl->context, CL_MEM_READ_ONLY,  sizeof(cl_float) * class_n,           NULL, &err);
+	CHECK_ERROR(err);
+	buf_pick      = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_int)   * sz_pick_cap,       NULL, &err);
+	CHECK_ERROR(err);
+	buf_pick_n    = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_int),                      NULL, &err);
+	CHECK_ERROR(err);
+
+	/* kmeans_seed_dist: 5..7 (the centroid range and first) are set per launch */
+	err = clSetKernelArg(kernel_dist, 0, sizeof(cl_mem), &buf_cent);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_dist, 1, sizeof(cl_mem), &buf_dat);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_dist, 2, sizeof(cl_mem), &buf_d2);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_dist, 3, sizeof(cl_mem), &buf_label);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_dist, 4, sizeof(cl_mem), &buf_block_sum);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_dist, 8, sizeof(cl_int), &data_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_dist, 9, sizeof(cl_int), &dim);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_dist, 10, sizeof(cl_int), &sz_data_stride);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_dist, 11, sizeof(cl_float) * ocl->sz_local_assign, NULL);
+	CHECK_ERROR(err);
+
+	/* kmeans_seed_pick: 5 (the centroid to fill) is set per launch */
+	err = clSetKernelArg(kernel_pick, 0, sizeof(cl_mem), &buf_dat);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_pick, 1, sizeof(cl_mem), &buf_d2);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_pick, 2, sizeof(cl_mem), &buf_block_sum);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_pick, 3, sizeof(cl_mem), &buf_rand);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_pick, 4, sizeof(cl_mem), &buf_cent);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_pick, 6, sizeof(cl_int), &no_block);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_pick, 7, sizeof(cl_int), &sz_block);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_pick, 8, sizeof(cl_int), &data_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_pick, 9, sizeof(cl_int), &dim);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_pick, 10, sizeof(cl_int), &sz_data_stride);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_pick, 11, sizeof(cl_float) * sz_local_pick, NULL);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_pick, 12, sizeof(cl_int) * 2, NULL);
+	CHECK_ERROR(err);
+
+	/* kmeans_seed_oversample: 5 (the D^2 total) and 8 (the pass) are set per pass */
+	err = clSetKernelArg(kernel_oversample, 0, sizeof(cl_mem), &buf_d2);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_oversample, 1, sizeof(cl_mem), &buf_pick);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_oversample, 2, sizeof(cl_mem), &buf_pick_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_oversample, 3, sizeof(cl_int), &sz_pick_cap);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_oversample, 4, sizeof(cl_int), &data_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_oversample, 6, sizeof(cl_float), &oversample);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_oversample, 7, sizeof(cl_ulong), &seed);
+	CHECK_ERROR(err);
+
+	/* the first centroid (or candidate) is a uniform draw */
+	pos_first = (long long)(km_rng_next(&rng) % (uint64_t)data_n);
+	memcpy(cand, data + (size_t)pos_first * dim, sizeof(float) * dim);
+	err = clEnqueueWriteBuffer(ocl->queue, buf_cent, CL_TRUE, 0, sizeof(cl_float) * dim, cand, 0, NULL, NULL);
+	CHECK_ERROR(err);
+
+	for(idx_round = 0 ; idx_round <= (use_parallel ? KM_SEED_ROUNDS : 0) ; idx_round++)
+	{
+		/* ----------------------------------------- */
+		/* fold the newest centroids into D^2        */
+		/* ----------------------------------------- */
+		err = clSetKernelArg(kernel_dist, 5, sizeof(cl_int), &cent_begin);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_dist, 6, sizeof(cl_int), &cent_end);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_dist, 7, sizeof(cl_int), &first);
+		CHECK_ERROR(err);
+		err = clEnqueueNDRangeKernel(ocl->queue, kernel_dist, 1, NULL, &sz_global_dist, &ocl->sz_local_assign, 0, NULL, NULL);
+		CHECK_ERROR(err);
+		first = 0;
+
+		if(!use_parallel || (KM_SEED_ROUNDS == idx_round))
+		{
+			break;
+		}
+
+		/* ----------------------------------------- */
+		/* k-means|| pass: keep points by D^2        */
+		/* ----------------------------------------- */
+		{
+			double total = 0.0;
+			cl_float total_f = 0;
+			cl_int zero = 0;
+
+			err = clEnqueueReadBuffer(ocl->queue, buf_block_sum, CL_TRUE, 0, sizeof(cl_float) * no_block, block_sum, 0, NULL, NULL);
+			CHECK_ERROR(err);
+			for(idx_block = 0 ; idx_block < no_block ; idx_block++)
+			{
+				total += block_sum[idx_block];
+			}
+			if(!(total > 0.0))
+			{
+				break;
+			}
+			total_f = (cl_float)total;
+
+			err = clEnqueueWriteBuffer(ocl->queue, buf_pick_n, CL_FALSE, 0, sizeof(cl_int), &zero, 0, NULL, NULL);
+			CHECK_ERROR(err);
+			err = clSetKernelArg(kernel_oversample, 5, sizeof(cl_float), &total_f);
+			CHECK_ERROR(err);
+			err = clSetKernelArg(kernel_oversample, 8, sizeof(cl_int), &idx_round);
+			CHECK_ERROR(err);
+			err = clEnqueueNDRangeKernel(ocl->queue, kernel_oversample, 1, NULL, &sz_global_dist, &ocl->sz_local_assign, 0, NULL, NULL);
+			CHECK_ERROR(err);
+			err = clEnqueueReadBuffer(ocl->queue, buf_pick_n, CL_TRUE, 0, sizeof(cl_int), &pick_n, 0, NULL, NULL);
+			CHECK_ERROR(err);
+		}
+
+		if(pick_n > sz_pick_cap)
+		{
+			pick_n = sz_pick_cap;
+		}
+		cent_begin = cand_n;
+		cent_end   = cand_n;
+		if(0 == pick_n)
+		{
+			continue;
+		}
+
+		/* candidates in index order, as the CPU engines take them */
+		err = clEnqueueReadBuffer(ocl->queue, buf_pick, CL_TRUE, 0, sizeof(cl_int) * pick_n, pick_arr, 0, NULL, NULL);
+		CHECK_ERROR(err);
+		std::sort(pick_arr, pick_arr + pick_n);
+		for(idx_pick = 0 ; idx_pick < pick_n ; idx_pick++)
+		{
+			memcpy(&cand[(size_t)(cand_n + idx_pick) * dim], data + (size_t)pick_arr[idx_pick] * dim, sizeof(float) * dim);
+		}
+		err = clEnqueueWriteBuffer(ocl->queue, buf_cent, CL_TRUE, sizeof(cl_float) * cand_n * dim, sizeof(cl_float) * pick_n * dim, &cand[(size_t)cand_n * dim], 0, NULL, NULL);
+		CHECK_ERROR(err);
+		cand_n  += pick_n;
+		cent_end = cand_n;
+	}
+
+	if(use_parallel && (cand_n > class_n))
+	{
+		/* --------------------------------------------------- */
+		/* weighted k-means++ over the candidates, on the host */
+		/* --------------------------------------------------- */
+		int    *label  = (int    *)malloc(sizeof(int) * data_n);
+		double *weight = (double *)calloc((size_t)cand_n, sizeof(double));
+
+		err = clEnqueueReadBuffer(ocl->queue, buf_label, CL_TRUE, 0, sizeof(cl_int) * data_n, label, 0, NULL, NULL);
+		CHECK_ERROR(err);
+		for(idx_data = 0 ; idx_data < data_n ; idx_data++)
+		{
+			weight[label[idx_data]] += 1.0;
+		}
+		km_seed_reduce(cand_n, dim, cand, weight, class_n, &rng, centroids);
+
+		free(label);
+		free(weight);
+	}
+	else
+	{
+		/* -------------------------------------------------------- */
+		/* k-means++ after the first centroid or the few candidates */
+		/* -------------------------------------------------------- */
+		class_begin = cand_n;
+		for(idx_class = class_begin ; idx_class < class_n ; idx_class++)
+		{
+			rand_arr[idx_class] = (float)km_rng_uniform(&rng);
+		}
+		err = clEnqueueWriteBuffer(ocl->queue, buf_rand, CL_TRUE, 0, sizeof(cl_float) * class_n, rand_arr, 0, NULL, NULL);
+		CHECK_ERROR(err);
+
+		for(idx_class = class_begin ; idx_class < class_n ; idx_class++)
+		{
+			if(idx_class > class_begin)
+			{
+				cent_begin = idx_class - 1;
+				cent_end   = idx_class;
+				err = clSetKernelArg(kernel_dist, 5, sizeof(cl_int), &cent_begin);
+				CHECK_ERROR(err);
+				err = clSetKernelArg(kernel_dist, 6, sizeof(cl_int), &cent_end);
+				CHECK_ERROR(err);
+				err = clSetKernelArg(kernel_dist, 7, sizeof(cl_int), &first);
+				CHECK_ERROR(err);
+				err = clEnqueueNDRangeKernel(ocl->queue, kernel_dist, 1, NULL, &sz_global_dist, &ocl->sz_local_assign, 0, NULL, NULL);
+				CHECK_ERROR(err);
+			}
+			err = clSetKernelArg(kernel_pick, 5, sizeof(cl_int), &idx_class);
+			CHECK_ERROR(err);
+			err = clEnqueueNDRangeKernel(ocl->queue, kernel_pick, 1, NULL, &sz_local_pick, &sz_local_pick, 0, NULL, NULL);
+			CHECK_ERROR(err);
+		}
+
+		err = clEnqueueReadBuffer(ocl->queue, buf_cent, CL_TRUE, 0, sizeof(cl_float) * class_n * dim, centroids, 0, NULL, NULL);
+		CHECK_ERROR(err);
+	}
+
+	clReleaseMemObject(buf_cent);
+	clReleaseMemObject(buf_d2);
+	clReleaseMemObject(buf_label);
+	clReleaseMemObject(buf_block_sum);
+	clReleaseMemObject(buf_rand);
+	clReleaseMemObject(buf_pick);
+	clReleaseMemObject(buf_pick_n);
+	clReleaseKernel(kernel_dist);
+	clReleaseKernel(kernel_pick);
+	clReleaseKernel(kernel_oversample);
+	free(cand);
+	free(rand_arr);
+	free(block_sum);
+	free(pick_arr);
+}
+
+
+/* one device of a multi-device run: its contiguous share of the points, kernels and buffers */
+struct KmShard
+{
+	KmOcl  ocl;
+	cl_int data_begin;
+	cl_int data_n;
+	cl_int sz_data_stride;
+	bool   use_fused;
+
+	cl_kernel kernel_assign;
+	cl_kernel kernel_update;
+	cl_kernel kernel_fused;
+	cl_kernel kernel_sum;
+	cl_kernel kernel_bounds;
+
+	cl_mem buf_cen;
+	cl_mem buf_dat;
+	cl_mem buf_par;
+	cl_mem buf_cen_arr;
+	cl_mem buf_cnt_arr;
+	cl_mem buf_sum;
+	cl_mem buf_cnt;
+	cl_mem buf_status;
+	cl_mem buf_upper;
+	cl_mem buf_lower;
+	cl_mem buf_cen_prev;
+	cl_mem buf_cen_shift;
+	cl_mem buf_cen_half;
+
+	/* this shard's centroid sums, counts and status words of the last iteration */
+	float  *sum_arr;
+	cl_int *cnt_arr;
+	cl_int status[KM_STATUS_SIZE];
+	cl_event ev_read;
+};
+
+/* Lloyd iterations with the points sharded over device_n devices, shares in proportion to their
+   compute units. Each device assigns its points and sums them per centroid with the kernels of
+   the single-device run, and kmeans_reduct_sum folds its work-group slices into one class_n x dim
+   slice. The host all-reduces the slices in double, in device order, so the result does not
+   depend on which device finishes first, divides, reseeds empty clusters, applies the stopping
+   rule and writes the new centroids back to every device. All queues are filled before any is waited on. Every shard
+   gets at least one point, so device_n must not exceed data_n (kmeans() drops the devices past
+   it); MAX_NO_DATA bounds each shard, not the whole data set. */
+static void kmeans_multi(const KmeansConfig* config, int device_n, const cl_device_id* device_arr, int class_n, int data_n, int dim,
+                         float* centroids, const float* data, int* partitioned, KmeansResult* result)
+{
+	cl_int idx_iter  = 0;
+	cl_int idx_class = 0;
+	cl_int idx_dim   = 0;
+	int    idx_shard = 0;
+	size_t idx_data  = 0;
+	cl_int err = CL_SUCCESS;
+
+	KmShard *shard_arr = (KmShard *)calloc((size_t)device_n, sizeof(KmShard));
+	long long cu_total = 0;
+	long long cu_begin = 0;
+
+	bool use_prune = (KMEANS_PRUNE_NONE != config->prune);
+	cl_float prune_eps = (cl_float)(dim + 8) * FLT_EPSILON;
+	cl_int use_half = (class_n <= data_n);
+	/* every iteration starts from zeroed status words; the host keeps the iteration count */
+	const cl_int status_zero[KM_STATUS_SIZE] = { 0, 0, 0, 0, 0, 0 };
+	cl_int no_changed = 0;
+	float  shift_max  = 0;
+	bool   done       = false;
+	std::vector<int> empty_class;
+
+	for(idx_shard = 0 ; idx_shard < device_n ; idx_shard++)
+	{
+		km_ocl_init(&shard_arr[idx_shard].ocl, device_arr[idx_shard], class_n, dim);
+		cu_total += shard_arr[idx_shard].ocl.max_compute_units;
+	}
+
+	/* the seeded inits run on the host, over every point */
+	km_seed(config, class_n, data_n, dim, data, centroids);
+
+	for(idx_data = 0 ; idx_data < (size_t)data_n ; idx_data++)
+	{
+		partitioned[idx_data] = -1;
+	}
+
+	for(idx_shard = 0 ; idx_shard < device_n ; idx_shard++)
+	{
+		KmShard *sh  = &shard_arr[idx_shard];
+		KmOcl   *ocl = &sh->ocl;
+		cl_int clear_sum = !ocl->use_local_update;
+		cl_int add_res   = 0;
+		float *data_soa = NULL;
+
+		/* at least one point per shard, the rest by compute units */
+		sh->data_begin = (cl_int)(idx_shard + (data_n - device_n) * cu_begin / cu_total);
+		cu_begin += ocl->max_compute_units;
+		sh->data_n = (cl_int)(idx_shard + 1 + (data_n - device_n) * cu_begin / cu_total) - sh->data_begin;
+		/* the limit is per device: a data set too large for one is what sharding is for */
+		if(sh->data_n > MAX_NO_DATA)
+		{
+			printf("shard %d has %d points, more than MAX_NO_DATA(%d). check it!\n", idx_shard, sh->data_n, MAX_NO_DATA);
+			exit(1);
+		}
+		sh->sz_data_stride = ((sh->data_n + SZ_DATA_ALIGN - 1) / SZ_DATA_ALIGN) * SZ_DATA_ALIGN;
+		sh->use_fused = config->fused && ocl->fit_fused;
+		sh->sum_arr = (float  *)malloc(sizeof(float)  * class_n * dim * KM_ACC_SIZE);
+		sh->cnt_arr = (cl_int *)malloc(sizeof(cl_int) * class_n);
+
+		/* -------------------- */
+		/* create kernel object */
+		/* -------------------- */
+		if(sh->use_fused)
+		{
+			sh->kernel_fused = clCreateKernel(ocl->program, NAME_KERNEL_ASSIGN_UPDATE, &err);
+			CHECK_ERROR(err);
+		}
+		else
+		{
+			sh->kernel_assign = clCreateKernel(ocl->program, use_prune ? NAME_KERNEL_ASSIGN_HAMERLY : NAME_KERNEL_ASSIGN, &err);
+			CHECK_ERROR(err);
+			sh->kernel_update = clCreateKernel(ocl->program, ocl->use_local_update ? NAME_KERNEL_UPDATE : NAME_KERNEL_UPDATE_GLOBAL, &err);
+			CHECK_ERROR(err);
+		}
+		sh->kernel_sum = clCreateKernel(ocl->program, NAME_KERNEL_REDUCT_SUM, &err);
+		CHECK_ERROR(err);
+		if(use_prune)
+		{
+			sh->kernel_bounds = clCreateKernel(ocl->program, NAME_KERNEL_CENT_BOUNDS, &err);
+			CHECK_ERROR(err);
+		}
+
+		/* -------------------- */
+		/* create buffer object */
+		/* -------------------- */
+		sh->buf_cen     = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n * dim,                        NULL, &err);
+		CHECK_ERROR(err);
+		sh->buf_dat     = clCreateBuffer(ocl->context, CL_MEM_READ_ONLY,  sizeof(cl_float) * sh->sz_data_stride * dim,             NULL, &err);
+		CHECK_ERROR(err);
+		sh->buf_par     = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_int)   * sh->data_n,                           NULL, &err);
+		CHECK_ERROR(err);
+		sh->buf_cnt_arr = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_int)   * class_n * ocl->sz_group_update,       NULL, &err);
+		CHECK_ERROR(err);
+		sh->buf_cen_arr = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n * dim * KM_ACC_SIZE * ocl->sz_group_update, NULL, &err);
+		CHECK_ERROR(err);
+		sh->buf_sum     = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n * dim * KM_ACC_SIZE,          NULL, &err);
+		CHECK_ERROR(err);
+		sh->buf_cnt     = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_int)   * class_n,                              NULL, &err);
+		CHECK_ERROR(err);
+		sh->buf_status  = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_int)   * KM_STATUS_SIZE,                       NULL, &err);
+		CHECK_ERROR(err);
+		if(use_prune)
+		{
+			sh->buf_upper     = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_float) * sh->data_n,    NULL, &err);
+			CHECK_ERROR(err);
+			sh->buf_lower     = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_float) * sh->data_n,    NULL, &err);
+			CHECK_ERROR(err);
+			sh->buf_cen_prev  = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n * dim, NULL, &err);
+			CHECK_ERROR(err);
+			sh->buf_cen_shift = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n,       NULL, &err);
+			CHECK_ERROR(err);
+			sh->buf_cen_half  = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n,       NULL, &err);
+			CHECK_ERROR(err);
+		}
+
+		/* ---------------------------------------- */
+		/* this shard's points in SoA, then upload  */
+		/* ---------------------------------------- */
+		data_soa = (float *)calloc((size_t)sh->sz_data_stride * dim, sizeof(float));
+		for(idx_data = 0 ; idx_data < (size_t)sh->data_n ; idx_data++)
+		{
+			for(idx_dim = 0 ; idx_dim < dim ; idx_dim++)
+			{
+				data_soa[(size_t)idx_dim * sh->sz_data_stride + idx_data] = data[(sh->data_begin + idx_data) * dim + idx_dim];
+			}
+		}
+		err = clEnqueueWriteBuffer(ocl->queue, sh->buf_dat, CL_FALSE, 0, sizeof(cl_float) * sh->sz_data_stride * dim, data_soa,                       0, NULL, NULL);
+		CHECK_ERROR(err);
+		err = clEnqueueWriteBuffer(ocl->queue, sh->buf_par, CL_FALSE, 0, sizeof(cl_int) * sh->data_n,                partitioned + sh->data_begin,   0, NULL, NULL);
+		CHECK_ERROR(err);
+		err = clEnqueueWriteBuffer(ocl->queue, sh->buf_cen, CL_FALSE, 0, sizeof(cl_float) * class_n * dim,           centroids,                      0, NULL, NULL);
+		CHECK_ERROR(err);
+		{
+			void *zero_arr = calloc((size_t)class_n * dim * KM_ACC_SIZE, sizeof(cl_float));
+
+			if(use_prune)
+			{
+				err = clEnqueueWriteBuffer(ocl->queue, sh->buf_cen_prev, CL_FALSE, 0, sizeof(cl_float) * class_n * dim, centroids, 0, NULL, NULL);
+				CHECK_ERROR(err);
+				err = clEnqueueWriteBuffer(ocl->queue, sh->buf_cen_half, CL_FALSE, 0, sizeof(cl_float) * class_n,       zero_arr,  0, NULL, NULL);
+				CHECK_ERROR(err);
+			}
+			if(clear_sum)
+			{
+				/* the single global slice starts at zero, kmeans_reduct_sum clears it */
+				err = clEnqueueWriteBuffer(ocl->queue, sh->buf_cen_arr, CL_FALSE, 0, sizeof(cl_float) * class_n * dim * KM_ACC_SIZE, zero_arr, 0, NULL, NULL);
+				CHECK_ERROR(err);
+				err = clEnqueueWriteBuffer(ocl->queue, sh->buf_cnt_arr, CL_FALSE, 0, sizeof(cl_int)   * class_n,       zero_arr, 0, NULL, NULL);
+				CHECK_ERROR(err);
+			}
+			err = clFinish(ocl->queue);
+			CHECK_ERROR(err);
+			free(zero_arr);
+		}
+		free(data_soa);
+
+		/* ----------------------- */
+		/* kernel argument setting */
+		/* ----------------------- */
+		if(sh->use_fused)
+		{
+			km_ocl_set_fused_args(ocl, sh->kernel_fused, sh->buf_cen, sh->buf_dat, sh->buf_par, sh->buf_cen_arr, sh->buf_cnt_arr,
+			                      sh->buf_upper, sh->buf_lower, sh->buf_cen_shift, sh->buf_cen_half, sh->buf_status,
+			                      class_n, sh->data_n, dim, sh->sz_data_stride, use_prune ? 1 : 0, prune_eps);
+		}
+		else
+		{
+			if(use_prune)
+			{
+				km_ocl_set_hamerly_args(ocl, sh->kernel_assign, sh->buf_cen, sh->buf_dat, sh->buf_par, sh->buf_upper, sh->buf_lower, sh->buf_cen_shift, sh->buf_cen_half, sh->buf_status,
+				                        class_n, sh->data_n, dim, sh->sz_data_stride, prune_eps);
+			}
+			else
+			{
+				km_ocl_set_assign_args(ocl, sh->kernel_assign, sh->buf_cen, sh->buf_dat, sh->buf_par, sh->buf_status, class_n, sh->data_n, dim, sh->sz_data_stride);
+			}
+			km_ocl_set_update_args(ocl, sh->kernel_update, sh->buf_cen_arr, sh->buf_cnt_arr, sh->buf_dat, sh->buf_par, sh->buf_status, class_n, sh->data_n, dim, sh->sz_data_stride);
+		}
+		if(use_prune)
+		{
+			km_ocl_set_bounds_args(sh->kernel_bounds, sh->buf_cen, sh->buf_cen_prev, sh->buf_cen_shift, sh->buf_cen_half, sh->buf_status, class_n, dim, use_half, prune_eps);
+		}
+
+		/* kmeans_reduct_sum */
+		err = clSetKernelArg(sh->kernel_sum, 0, sizeof(cl_mem), &sh->buf_sum);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(sh->kernel_sum, 1, sizeof(cl_mem), &sh->buf_cnt);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(sh->kernel_sum, 2, sizeof(cl_mem), &sh->buf_cen_arr);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(sh->kernel_sum, 3, sizeof(cl_mem), &sh->buf_cnt_arr);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(sh->kernel_sum, 4, sizeof(cl_int), &class_n);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(sh->kernel_sum, 5, sizeof(cl_int), &dim);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(sh->kernel_sum, 6, sizeof(cl_int), &ocl->sz_group_update);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(sh->kernel_sum, 7, sizeof(cl_int), &clear_sum);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(sh->kernel_sum, 8, sizeof(cl_int), &add_res);
+		CHECK_ERROR(err);
+	}
+
+	/* ---------- */
+	/* run kernel */
+	/* ---------- */
+	for(idx_iter = 0 ; (idx_iter < config->iteration_n) && !done ; idx_iter++)
+	{
+		/* ------------------------------------------- */
+		/* every device: assign, accumulate, read back */
+		/* ------------------------------------------- */
+		for(idx_shard = 0 ; idx_shard < device_n ; idx_shard++)
+		{
+			KmShard *sh  = &shard_arr[idx_shard];
+			KmOcl   *ocl = &sh->ocl;
+			size_t sz_global_assign = km_ocl_round_up((size_t)sh->data_n, ocl->sz_local_assign);
+			size_t sz_global_sum    = km_ocl_round_up((size_t)class_n, ocl->sz_local_reduct);
+
+			err = clEnqueueWriteBuffer(ocl->queue, sh->buf_status, CL_FALSE, 0, sizeof(status_zero), status_zero, 0, NULL, NULL);
+			CHECK_ERROR(err);
+			if(use_prune)
+			{
+				err = clEnqueueNDRangeKernel(ocl->queue, sh->kernel_bounds, 1, NULL, &sz_global_sum, &ocl->sz_local_reduct, 0, NULL, NULL);
+				CHECK_ERROR(err);
+			}
+			if(sh->use_fused)
+			{
+				err = clEnqueueNDRangeKernel(ocl->queue, sh->kernel_fused, 1, NULL, &ocl->sz_global_update, &ocl->sz_local_update, 0, NULL, NULL);
+				CHECK_ERROR(err);
+			}
+			else
+			{
+				err = clEnqueueNDRangeKernel(ocl->queue, sh->kernel_assign, 1, NULL, &sz_global_assign, &ocl->sz_local_assign, 0, NULL, NULL);
+				CHECK_ERROR(err);
+				err = clEnqueueNDRangeKernel(ocl->queue, sh->kernel_update, 1, NULL, &ocl->sz_global_update, &ocl->sz_local_update, 0, NULL, NULL);
+				CHECK_ERROR(err);
+			}
+			err = clEnqueueNDRangeKernel(ocl->queue, sh->kernel_sum, 1, NULL, &sz_global_sum, &ocl->sz_local_reduct, 0, NULL, NULL);
+			CHECK_ERROR(err);
+
+			err = clEnqueueReadBuffer(ocl->queue, sh->buf_sum,    CL_FALSE, 0, sizeof(cl_float) * class_n * dim * KM_ACC_SIZE, sh->sum_arr, 0, NULL, NULL);
+			CHECK_ERROR(err);
+			err = clEnqueueReadBuffer(ocl->queue, sh->buf_cnt,    CL_FALSE, 0, sizeof(cl_int)   * class_n,       sh->cnt_arr, 0, NULL, NULL);
+			CHECK_ERROR(err);
+			err = clEnqueueReadBuffer(ocl->queue, sh->buf_status, CL_FALSE, 0, sizeof(sh->status),               sh->status,  0, NULL, &sh->ev_read);
+			CHECK_ERROR(err);
+			err = clFlush(ocl->queue);
+			CHECK_ERROR(err);
+		}
+
+		/* --------------------------------------- */
+		/* all-reduce on the host, in device order */
+		/* --------------------------------------- */
+		no_changed = 0;
+		shift_max  = 0;
+		empty_class.clear();
+		for(idx_shard = 0 ; idx_shard < device_n ; idx_shard++)
+		{
+			err = clWaitForEvents(1, &shard_arr[idx_shard].ev_read);
+			CHECK_ERROR(err);
+			clReleaseEvent(shard_arr[idx_shard].ev_read);
+			shard_arr[idx_shard].ev_read = NULL;
+			no_changed += shard_arr[idx_shard].status[KM_STATUS_CHANGED];
+		}
+		for(idx_class = 0 ; idx_class < class_n ; idx_class++)
+		{
+			long long count = 0;
+
+			for(idx_shard = 0 ; idx_shard < device_n ; idx_shard++)
+			{
+				count += shard_arr[idx_shard].cnt_arr[idx_class];
+			}
+			/* an empty cluster keeps its centroid until the reseed below */
+			if(0 == count)
+			{
+				empty_class.push_back(idx_class);
+				continue;
+			}
+			for(idx_dim = 0 ; idx_dim < dim ; idx_dim++)
+			{
+				size_t pos = (size_t)idx_class * dim + idx_dim;
+				double sum = 0.0;
+				float new_cent = 0;
+				float shift = 0;
+
+				for(idx_shard = 0 ; idx_shard < device_n ; idx_shard++)
+				{
+					sum += (double)shard_arr[idx_shard].sum_arr[pos * KM_ACC_SIZE] + (double)shard_arr[idx_shard].sum_arr[pos * KM_ACC_SIZE + 1];
+				}
+				new_cent = (float)(sum / (double)count);
+				shift = fabsf(new_cent - centroids[pos]);
+				/* NaN sorts above every shift, as in status_shift_max */
+				if((shift != shift) || (shift > shift_max))
+				{
+					shift_max = shift;
+				}
+				centroids[pos] = new_cent;
+			}
+		}
+
+		/* no device holds every point, so empty clusters move on the host, with every shard's labels */
+		if(!empty_class.empty())
+		{
+			for(idx_shard = 0 ; idx_shard < device_n ; idx_shard++)
+			{
+				KmShard *sh = &shard_arr[idx_shard];
+
+				err = clEnqueueReadBuffer(sh->ocl.queue, sh->buf_par, CL_TRUE, 0, sizeof(cl_int) * sh->data_n, partitioned + sh->data_begin, 0, NULL, NULL);
+				CHECK_ERROR(err);
+			}
+			no_changed += km_ocl_reseed_host(empty_class, data_n, dim, data, partitioned, centroids, &shift_max);
+		}
+
+		done = (0 <= config->tolerance) && ((0 == no_changed) || (shift_max <= config->tolerance));
+		if(!done)
+		{
+			for(idx_shard = 0 ; idx_shard < device_n ; idx_shard++)
+			{
+				err = clEnqueueWriteBuffer(shard_arr[idx_shard].ocl.queue, shard_arr[idx_shard].buf_cen, CL_FALSE, 0, sizeof(cl_float) * class_n * dim, centroids, 0, NULL, NULL);
+				CHECK_ERROR(err);
+				err = clFlush(shard_arr[idx_shard].ocl.queue);
+				CHECK_ERROR(err);
+			}
+		}
+	}
+
+	/* ----------- */
+	/* read buffer */
+	/* ----------- */
+	for(idx_shard = 0 ; idx_shard < device_n ; idx_shard++)
+	{
+		KmShard *sh = &shard_arr[idx_shard];
+
+		err = clEnqueueReadBuffer(sh->ocl.queue, sh->buf_par, CL_TRUE, 0, sizeof(cl_int) * sh->data_n, partitioned + sh->data_begin, 0, NULL, NULL);
+		CHECK_ERROR(err);
+	}
+
+	result->iteration_n = idx_iter;
+	result->converged   = done ? 1 : 0;
+	result->inertia     = kmeans_inertia(class_n, data_n, dim, centroids, data, partitioned);
+	result->distance_n  = 0;
+
+	/* ------------- */
+	/* release stage */
+	/* ------------- */
+	for(idx_shard = 0 ; idx_shard < device_n ; idx_shard++)
+	{
+		KmShard *sh = &shard_arr[idx_shard];
+
+		clReleaseMemObject(sh->buf_cen);
+		clReleaseMemObject(sh->buf_dat);
+		clReleaseMemObject(sh->buf_par);
+		clReleaseMemObject(sh->buf_cen_arr);
+		clReleaseMemObject(sh->buf_cnt_arr);
+		clReleaseMemObject(sh->buf_sum);
+		clReleaseMemObject(sh->buf_cnt);
+		clReleaseMemObject(sh->buf_status);
+		if(use_prune)
+		{
+			clReleaseMemObject(sh->buf_upper);
+			clReleaseMemObject(sh->buf_lower);
+			clReleaseMemObject(sh->buf_cen_prev);
+			clReleaseMemObject(sh->buf_cen_shift);
+			clReleaseMemObject(sh->buf_cen_half);
+			clReleaseKernel(sh->kernel_bounds);
+		}
+		if(sh->use_fused)
+		{
+			clReleaseKernel(sh->kernel_fused);
+		}
+		else
+		{
+			clReleaseKernel(sh->kernel_assign);
+			clReleaseKernel(sh->kernel_update);
+		}
+		clReleaseKernel(sh->kernel_sum);
+		km_ocl_release(&sh->ocl);
+		free(sh->sum_arr);
+		free(sh->cnt_arr);
+	}
+	free(shard_arr);
+}
+
+
+void kmeans(const KmeansConfig* config, int class_n, int data_n, int dim, float* centroids, const float* data, int* partitioned, KmeansResult* result)
+{
+	/* ----------------------------------- */
+	/* start of local variable declaration */
+	/* ----------------------------------- */
+
+	/* iteration index */
+	cl_int idx_iter = 0;
+	/* data index */
+	size_t idx_data = 0;
+	cl_int idx_dim  = 0;
+	/* error */
+	cl_int err = CL_SUCCESS;
+
+	/* device, queue and program */
+	KmOcl ocl;
+	cl_device_id device_arr[MAX_DEVICE];
+	int device_n = 0;
+
+	/* data in SoA order: dimension d of point i at [d * sz_data_stride + i] */
+	cl_int sz_data_stride = ((data_n + SZ_DATA_ALIGN - 1) / SZ_DATA_ALIGN) * SZ_DATA_ALIGN;
+	float *data_soa = NULL;
+
+	/* kernel object */
+	cl_kernel kernel_assign = NULL;
+	size_t sz_global_assign = 0;
+
+	cl_kernel kernel_update = NULL;
+
+	/* kmeans_assign_update in place of kmeans_assign + kmeans_update: one read of the data per
+	   iteration instead of two, and no label round trip between the kernels */
+	bool use_fused = false;
+	cl_kernel kernel_fused = NULL;
+
+	cl_kernel kernel_reduct = NULL;
+	size_t sz_global_reduct = 0;
+
+	/* empty clusters move onto the points farthest from their centroids (kmeans_reseed_*);
+	   both kernels return at once while no cluster is empty */
+	cl_kernel kernel_reseed_dist = NULL;
+	cl_kernel kernel_reseed_pick = NULL;
+
+	cl_kernel kernel_check = NULL;
+	size_t sz_work_check   = 1;
+
+	/* Hamerly pruning (kmeans_prune.cl). Elkan's per-centroid bounds are data_n * class_n floats
+	   with a divergent inner loop, so the device always uses Hamerly when pruning is on. */
+	bool use_prune = (KMEANS_PRUNE_NONE != config->prune);
+	cl_kernel kernel_bounds = NULL;
+	size_t sz_global_bounds = 0;
+	/* relative rounding error of a float distance, with slack for the bound arithmetic */
+	cl_float prune_eps = (cl_float)(dim + 8) * FLT_EPSILON;
+	/* the O(K^2) nearest-centroid table only pays while K is below N */
+	cl_int use_half = (class_n <= data_n);
+
+	/* convergence status, read back without blocking every check_interval iterations */
+	cl_int status[KM_STATUS_SIZE] = { 0, 0, 0, 0, 0, 0 };
+	cl_event ev_status = NULL;
+
+	/* KM_OCL_PROFILE: one event per launch, named as in the program */
+	KmProf prof;
+	const char* name_assign = NULL;
+	const char* name_update = NULL;
+	const char* name_reduct = NULL;
+
+	/* how the iterations reach the device (KmeansLaunch): the launches of one iteration in body,
+	   enqueued one by one, or recorded replay_n iterations at a time into command buffers
+	   replayed from NO_REPLAY_SLOT slots; or kmeans_persistent alone */
+	int launch = KMEANS_LAUNCH_ENQUEUE;
+	std::vector<KmLaunch> body;
+	KmCommandBuffer cmd = { NULL, NULL, NULL, NULL, NULL };
+	km_command_buffer cmd_buf[NO_REPLAY_SLOT] = { NULL, NULL };
+	cl_event ev_replay[NO_REPLAY_SLOT] = { NULL, NULL };
+	cl_int replay_n = 0;
+	cl_int idx_slot = 0;
+	cl_kernel kernel_persistent = NULL;
+	bool done = false;
+
+	/* memory object */
+	cl_mem buf_cen = NULL;
+	cl_mem buf_dat = NULL;
+	cl_mem buf_par = NULL;
+	cl_mem buf_cen_arr = NULL;
+	cl_mem buf_cnt_arr = NULL;
+	cl_mem buf_status  = NULL;
+	cl_mem buf_cen_empty = NULL;
+	cl_mem buf_dist      = NULL;
+	cl_mem buf_upper     = NULL;
+	cl_mem buf_lower     = NULL;
+	cl_mem buf_cen_prev  = NULL;
+	cl_mem buf_cen_shift = NULL;
+	cl_mem buf_cen_half  = NULL;
+	/* --------------------------------- */
+	/* end of local variable declaration */
+	/* --------------------------------- */
+
+	device_n = km_ocl_devices(std::min(config->device_n, data_n), device_arr);
+	if(0 == device_n)
+	{
+		/* no GPU: the blocked SIMD engine on the host threads */
+		fprintf(stderr, "no OpenCL GPU found, running on the CPU\n");
+		kmeans_simd(config, class_n, data_n, dim, centroids, data, partitioned, result);
+		return;
+	}
+	/* one shard per point at most, also when all devices were asked for */
+	while(device_n > std::max(data_n, 1))
+	{
+		clReleaseDevice(device_arr[--device_n]);
+	}
+	if(1 < device_n)
+	{
+		kmeans_multi(config, device_n, device_arr, class_n, data_n, dim, centroids, data, partitioned, result);
+		return;
+	}
+	if(data_n > MAX_NO_DATA)
+	{
+		printf("data_n(%d) is larger than MAX_NO_DATA(%d). check it!\n", data_n, MAX_NO_DATA);
+		exit(1);
+	}
+	km_ocl_init(&ocl, device_arr[0], class_n, dim);
+	use_fused = config->fused && ocl.fit_fused;
+
+	/* command buffers where the driver has them; else, on a problem small enough that one
+	   work-group runs an iteration in about the time of its launches, the persistent kernel */
+	if(((KMEANS_LAUNCH_AUTO == config->launch) || (KMEANS_LAUNCH_RECORD == config->launch)) && km_command_buffer_load(&ocl, &cmd))
+	{
+		launch   = KMEANS_LAUNCH_RECORD;
+		replay_n = std::min(config->check_interval, config->iteration_n);
+	}
+	else if(((KMEANS_LAUNCH_PERSISTENT == config->launch) ||
+	         ((KMEANS_LAUNCH_AUTO == config->launch) && ((double)data_n * class_n * dim <= PERSISTENT_MAX_WORK))) && ocl.fit_persistent)
+	{
+		launch = KMEANS_LAUNCH_PERSISTENT;
+	}
+	if((KMEANS_LAUNCH_AUTO != config->launch) && (launch != config->launch))
+	{
+		fprintf(stderr, "%s: running the iterations kernel by kernel\n",
+		        (KMEANS_LAUNCH_RECORD == config->launch) ? "no " KM_EXT_COMMAND_BUFFER " 0.9 on the OpenCL device" : "the centroids do not fit one work-group's local memory");
+	}
+
+	/* kmeans_reduct runs per centroid element, kmeans_divide per centroid */
+	sz_global_reduct = km_ocl_round_up(ocl.use_local_update ? ((size_t)class_n * dim) : (size_t)class_n, ocl.sz_local_reduct);
+	sz_global_assign = km_ocl_round_up((size_t)data_n, ocl.sz_local_assign);
+	sz_global_bounds = km_ocl_round_up((size_t)class_n, ocl.sz_local_reduct);
+	km_prof_init(&prof);
+
+	/* -------------------- */
+	/* create kernel object */
+	/* -------------------- */
+	name_assign = use_prune ? NAME_KERNEL_ASSIGN_HAMERLY : NAME_KERNEL_ASSIGN;
+	name_update = ocl.use_local_update ? NAME_KERNEL_UPDATE : NAME_KERNEL_UPDATE_GLOBAL;
+	name_reduct = ocl.use_local_update ? NAME_KERNEL_REDUCT : NAME_KERNEL_DIVIDE;
+	if(use_fused)
+	{
+		kernel_fused = clCreateKernel(ocl.program, NAME_KERNEL_ASSIGN_UPDATE, &err);
+		CHECK_ERROR(err);
+	}
+	else
+	{
+		kernel_assign = clCreateKernel(ocl.program, name_assign, &err);
+		CHECK_ERROR(err);
+		kernel_update = clCreateKernel(ocl.program, name_update, &err);
+		CHECK_ERROR(err);
+	}
+	kernel_reduct = clCreateKernel(ocl.program, name_reduct, &err);
+	CHECK_ERROR(err);
+	kernel_reseed_dist = clCreateKernel(ocl.program, NAME_KERNEL_RESEED_DIST, &err);
+	CHECK_ERROR(err);
+	kernel_reseed_pick = clCreateKernel(ocl.program, NAME_KERNEL_RESEED_PICK, &err);
+	CHECK_ERROR(err);
+	kernel_check  = clCreateKernel(ocl.program, NAME_KERNEL_CHECK, &err);
+	CHECK_ERROR(err);
+	if(use_prune)
+	{
+		kernel_bounds = clCreateKernel(ocl.program, NAME_KERNEL_CENT_BOUNDS, &err);
+		CHECK_ERROR(err);
+	}
+
+	/* -------------------- */
+	/* create buffer object */
+	/* -------------------- */
+	buf_cen     = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n * dim,                       NULL, &err);
+	CHECK_ERROR(err);
+	buf_dat     = clCreateBuffer(ocl.context, CL_MEM_READ_ONLY,  sizeof(cl_float) * sz_data_stride * dim,                NULL, &err);
+	CHECK_ERROR(err);
+	buf_par     = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_int)   * data_n,                              NULL, &err);
+	CHECK_ERROR(err);
+	buf_cnt_arr = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_int)   * class_n * ocl.sz_group_update,       NULL, &err);
+	CHECK_ERROR(err);
+	buf_cen_arr = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n * dim * KM_ACC_SIZE * ocl.sz_group_update, NULL, &err);
+	CHECK_ERROR(err);
+	buf_status  = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_int)   * KM_STATUS_SIZE,                      NULL, &err);
+	CHECK_ERROR(err);
+	buf_cen_empty = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_int)   * class_n,                           NULL, &err);
+	CHECK_ERROR(err);
+	buf_dist      = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_float) * data_n,                            NULL, &err);
+	CHECK_ERROR(err);
+	if(use_prune)
+	{
+		buf_upper     = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_float) * data_n,        NULL, &err);
+		CHECK_ERROR(err);
+		buf_lower     = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_float) * data_n,        NULL, &err);
+		CHECK_ERROR(err);
+		buf_cen_prev  = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n * dim, NULL, &err);
+		CHECK_ERROR(err);
+		buf_cen_shift = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n,       NULL, &err);
+		CHECK_ERROR(err);
+		buf_cen_half  = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n,       NULL, &err);
+		CHECK_ERROR(err);
+	}
+
+	/* ---------------------------- */
+	/* transpose data to SoA layout */
+	/* ---------------------------- */
+	data_soa = (float *)calloc((size_t)sz_data_stride * dim, sizeof(float));
+	for(idx_data = 0 ; idx_data < (size_t)data_n ; idx_data++)
+	{
+		for(idx_dim = 0 ; idx_dim < dim ; idx_dim++)
+		{
+			data_soa[(size_t)idx_dim * sz_data_stride + idx_data] = data[idx_data * dim + idx_dim];
+		}
+	}
+
+	/* ------------ */
+	/* write buffer */
+	/* ------------ */
+	err = clEnqueueWriteBuffer(ocl.queue, buf_dat, CL_FALSE, 0, sizeof(cl_float) * sz_data_stride * dim, data_soa,  0, NULL, NULL);
+	CHECK_ERROR(err);
+	if(KMEANS_INIT_FILE != config->init)
+	{
+		km_ocl_seed(config, &ocl, buf_dat, class_n, data_n, dim, sz_data_stride, data, centroids);
+	}
+	err = clEnqueueWriteBuffer(ocl.queue, buf_cen, CL_FALSE, 0, sizeof(cl_float) * class_n * dim,        centroids, 0, NULL, NULL);
+	CHECK_ERROR(err);
+	err = clEnqueueWriteBuffer(ocl.queue, buf_status, CL_FALSE, 0, sizeof(status),                        status,    0, NULL, NULL);
+	CHECK_ERROR(err);
+	if(use_prune)
+	{
+		/* no move before the first iteration; the upper and lower bounds are set by its full scan */
+		void *zero_arr = calloc((size_t)class_n, sizeof(cl_float));
+
+		err = clEnqueueWriteBuffer(ocl.queue, buf_cen_prev, CL_FALSE, 0, sizeof(cl_float) * class_n * dim, centroids, 0, NULL, NULL);
+		CHECK_ERROR(err);
+		err = clEnqueueWriteBuffer(ocl.queue, buf_cen_half, CL_TRUE,  0, sizeof(cl_float) * class_n,       zero_arr,  0, NULL, NULL);
+		CHECK_ERROR(err);
+		free(zero_arr);
+	}
+	/* no point starts in a cluster, so the first iteration counts every point as changed */
+	for(idx_data = 0 ; idx_data < (size_t)data_n ; idx_data++)
+	{
+		partitioned[idx_data] = -1;
+	}
+	err = clEnqueueWriteBuffer(ocl.queue, buf_par, CL_TRUE,  0, sizeof(cl_int) * data_n,                  partitioned, 0, NULL, NULL);
+	CHECK_ERROR(err);
+	free(data_soa);
+
+	if(!ocl.use_local_update)
+	{
+		/* the global sums start at zero, kmeans_divide clears them after every iteration */
+		void *zero_arr = calloc((size_t)class_n * dim * KM_ACC_SIZE, sizeof(cl_float));
+
+		err = clEnqueueWriteBuffer(ocl.queue, buf_cen_arr, CL_FALSE, 0, sizeof(cl_float) * class_n * dim * KM_ACC_SIZE, zero_arr, 0, NULL, NULL);
+		CHECK_ERROR(err);
+		err = clEnqueueWriteBuffer(ocl.queue, buf_cnt_arr, CL_TRUE,  0, sizeof(cl_int)   * class_n,                     zero_arr, 0, NULL, NULL);
+		CHECK_ERROR(err);
+		free(zero_arr);
+	}
+
+	/* ----------------------- */
+	/* kernel argument setting */
+	/* ----------------------- */
+	if(use_fused)
+	{
+		km_ocl_set_fused_args(&ocl, kernel_fused, buf_cen, buf_dat, buf_par, buf_cen_arr, buf_cnt_arr, buf_upper, buf_lower, buf_cen_shift, buf_cen_half, buf_status,
+		                      class_n, data_n, dim, sz_data_stride, use_prune ? 1 : 0, prune_eps);
+	}
+	else if(!use_prune)
+	{
+		km_ocl_set_assign_args(&ocl, kernel_assign, buf_cen, buf_dat, buf_par, buf_status, class_n, data_n, dim, sz_data_stride);
+	}
+	else
+	{
+		km_ocl_set_hamerly_args(&ocl, kernel_assign, buf_cen, buf_dat, buf_par, buf_upper, buf_lower, buf_cen_shift, buf_cen_half, buf_status,
+		                        class_n, data_n, dim, sz_data_stride, prune_eps);
+	}
+
+	if(use_prune)
+	{
+		km_ocl_set_bounds_args(kernel_bounds, buf_cen, buf_cen_prev, buf_cen_shift, buf_cen_half, buf_status, class_n, dim, use_half, prune_eps);
+	}
+
+	if(!use_fused)
+	{
+		km_ocl_set_update_args(&ocl, kernel_update, buf_cen_arr, buf_cnt_arr, buf_dat, buf_par, buf_status, class_n, data_n, dim, sz_data_stride);
+	}
+
+	/* kmeans_reduct or kmeans_divide */
+	err = clSetKernelArg(kernel_reduct, 0, sizeof(cl_mem), &buf_cen);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_reduct, 1, sizeof(cl_mem), &buf_cen_arr);
 	CHECK_ERROR(err);
 	err = clSetKernelArg(kernel_reduct, 2, sizeof(cl_mem), &buf_cnt_arr);
 	CHECK_ERROR(err);
-	err = clSetKernelArg(kernel_reduct, 3, sizeof(cl_int), &class_n);
+	err = clSetKernelArg(kernel_reduct, 3, sizeof(cl_int), &class_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_reduct, 4, sizeof(cl_int), &dim);
+	CHECK_ERROR(err);
+	if(ocl.use_local_update)
+	{
+		err = clSetKernelArg(kernel_reduct, 5, sizeof(cl_int), &ocl.sz_group_update);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reduct, 6, sizeof(cl_mem), &buf_cen_empty);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reduct, 7, sizeof(cl_mem), &buf_status);
+		CHECK_ERROR(err);
+	}
+	else
+	{
+		err = clSetKernelArg(kernel_reduct, 5, sizeof(cl_mem), &buf_cen_empty);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reduct, 6, sizeof(cl_mem), &buf_status);
+		CHECK_ERROR(err);
+	}
+
+	km_ocl_set_reseed_args(&ocl, kernel_reseed_dist, kernel_reseed_pick, buf_cen, buf_dat, buf_par, buf_dist, buf_cen_empty, buf_status,
+	                       class_n, data_n, dim, sz_data_stride);
+
+	km_ocl_set_check_args(kernel_check, buf_status, config->tolerance, 1);
+
+	if(KMEANS_LAUNCH_PERSISTENT == launch)
+	{
+		kernel_persistent = clCreateKernel(ocl.program, NAME_KERNEL_PERSISTENT, &err);
+		CHECK_ERROR(err);
+		km_ocl_set_persistent_args(&ocl, kernel_persistent, buf_cen, buf_dat, buf_par, buf_dist, buf_status,
+		                           class_n, data_n, dim, sz_data_stride, config->iteration_n, config->tolerance);
+	}
+
+
+	/* -------------- */
+	/* iteration body */
+	/* -------------- */
+	if(use_prune)
+	{
+		/* centroid movement */
+		KmLaunch launch_bounds = { kernel_bounds, sz_global_bounds, ocl.sz_local_reduct, NAME_KERNEL_CENT_BOUNDS };
+		body.push_back(launch_bounds);
+	}
+	if(use_fused)
+	{
+		/* assignment with update */
+		KmLaunch launch_fused = { kernel_fused, ocl.sz_global_update, ocl.sz_local_update, NAME_KERNEL_ASSIGN_UPDATE };
+		body.push_back(launch_fused);
+	}
+	else
+	{
+		/* assignment, then update */
+		KmLaunch launch_assign = { kernel_assign, sz_global_assign, ocl.sz_local_assign, name_assign };
+		KmLaunch launch_update = { kernel_update, ocl.sz_global_update, ocl.sz_local_update, name_update };
+		body.push_back(launch_assign);
+		body.push_back(launch_update);
+	}
+	{
+		/* reduction, reseed of empty clusters and convergence flag */
+		KmLaunch launch_reduct      = { kernel_reduct, sz_global_reduct, ocl.sz_local_reduct, name_reduct };
+		KmLaunch launch_reseed_dist = { kernel_reseed_dist, sz_global_assign, ocl.sz_local_assign, NAME_KERNEL_RESEED_DIST };
+		KmLaunch launch_reseed_pick = { kernel_reseed_pick, ocl.sz_local_reduct, ocl.sz_local_reduct, NAME_KERNEL_RESEED_PICK };
+		KmLaunch launch_check       = { kernel_check, sz_work_check, sz_work_check, NAME_KERNEL_CHECK };
+		body.push_back(launch_reduct);
+		body.push_back(launch_reseed_dist);
+		body.push_back(launch_reseed_pick);
+		body.push_back(launch_check);
+	}
+
+	if(KMEANS_LAUNCH_RECORD == launch)
+	{
+		for(idx_slot = 0 ; idx_slot < NO_REPLAY_SLOT ; idx_slot++)
+		{
+			cmd_buf[idx_slot] = km_command_buffer_record(&cmd, &ocl, body, replay_n);
+			if(NULL == cmd_buf[idx_slot])
+			{
+				fprintf(stderr, "the OpenCL driver did not record the iterations: running them kernel by kernel\n");
+				launch = KMEANS_LAUNCH_ENQUEUE;
+				break;
+			}
+		}
+	}
+
+
+	/* ---------- */
+	/* run kernel */
+	/* ---------- */
+	idx_iter = 0;
+	if(KMEANS_LAUNCH_PERSISTENT == launch)
+	{
+		/* one work-group, every iteration */
+		err = clEnqueueNDRangeKernel(ocl.queue, kernel_persistent, 1, NULL, &ocl.sz_local_update, &ocl.sz_local_update, 0, NULL,
+		                             km_prof_event(&prof, NAME_KERNEL_PERSISTENT, 0));
+		CHECK_ERROR(err);
+		done = true;
+	}
+	else if(KMEANS_LAUNCH_RECORD == launch)
+	{
+		/* replay_n iterations per replay, each followed by a status read */
+		for( ; (idx_iter + replay_n <= config->iteration_n) && !done ; idx_iter += replay_n)
+		{
+			cl_event* ev_prof = km_prof_event(&prof, NAME_COMMAND_BUFFER, idx_iter);
+
+			idx_slot = (idx_iter / replay_n) % NO_REPLAY_SLOT;
+			if(NULL != ev_replay[idx_slot])
+			{
+				err = clWaitForEvents(1, &ev_replay[idx_slot]);
+				CHECK_ERROR(err);
+				clReleaseEvent(ev_replay[idx_slot]);
+			}
+			err = cmd.enqueue(0, NULL, cmd_buf[idx_slot], 0, NULL, &ev_replay[idx_slot]);
+			CHECK_ERROR(err);
+			if(NULL != ev_prof)
+			{
+				clRetainEvent(ev_replay[idx_slot]);
+				*ev_prof = ev_replay[idx_slot];
+			}
+			done = (0 != km_ocl_poll_status(&ocl, buf_status, status, 1, &ev_status));
+		}
+	}
+
+	/* kernel by kernel, and the iterations the replays leave over */
+	for( ; (idx_iter < config->iteration_n) && !done ; idx_iter++)
+	{
+		km_ocl_enqueue_body(&ocl, body, &prof, idx_iter);
+
+		if((0 == ((idx_iter + 1) % config->check_interval)) && km_ocl_poll_status(&ocl, buf_status, status, 1, &ev_status))
+		{
+			break;
+		}
+	}
+
+	/* ----------- */
+	/* read buffer */
+	/* ----------- */
+	err = clEnqueueReadBuffer(ocl.queue, buf_par, CL_FALSE, 0, sizeof(cl_int) * data_n,  partitioned, 0, NULL, NULL);
+	CHECK_ERROR(err);
+	err = clEnqueueReadBuffer(ocl.queue, buf_cen, CL_FALSE, 0, sizeof(cl_float) * class_n * dim, centroids,   0, NULL, NULL);
+	CHECK_ERROR(err);
+	if(NULL != ev_status)
+	{
+		clReleaseEvent(ev_status);
+	}
+	err = clEnqueueReadBuffer(ocl.queue, buf_status, CL_TRUE, 0, sizeof(status), status, 0, NULL, NULL);
+	CHECK_ERROR(err);
+	km_prof_report(&prof, ocl.device);
+
+	result->iteration_n = status[KM_STATUS_ITER];
+	result->converged   = status[KM_STATUS_DONE];
+	result->inertia     = kmeans_inertia(class_n, data_n, dim, centroids, data, partitioned);
+	/* the pruned kernels do not count the distances they skip */
+	result->distance_n  = 0;
+
+	/* ------------- */
+	/* release stage */
+	/* ------------- */
+	clReleaseMemObject(buf_cen);
+	clReleaseMemObject(buf_dat);
+	clReleaseMemObject(buf_par);
+	clReleaseMemObject(buf_cen_arr);
+	clReleaseMemObject(buf_cnt_arr);
+	clReleaseMemObject(buf_status);
+	clReleaseMemObject(buf_cen_empty);
+	clReleaseMemObject(buf_dist);
+	if(use_prune)
+	{
+		clReleaseMemObject(buf_upper);
+		clReleaseMemObject(buf_lower);
+		clReleaseMemObject(buf_cen_prev);
+		clReleaseMemObject(buf_cen_shift);
+		clReleaseMemObject(buf_cen_half);
+		clReleaseKernel(kernel_bounds);
+	}
+	if(use_fused)
+	{
+		clReleaseKernel(kernel_fused);
+	}
+	else
+	{
+		clReleaseKernel(kernel_assign);
+		clReleaseKernel(kernel_update);
+	}
+	clReleaseKernel(kernel_reduct);
+	clReleaseKernel(kernel_reseed_dist);
+	clReleaseKernel(kernel_reseed_pick);
+	clReleaseKernel(kernel_check);
+	if(NULL != kernel_persistent)
+	{
+		clReleaseKernel(kernel_persistent);
+	}
+	for(idx_slot = 0 ; idx_slot < NO_REPLAY_SLOT ; idx_slot++)
+	{
+		if(NULL != ev_replay[idx_slot])
+		{
+			clReleaseEvent(ev_replay[idx_slot]);
+		}
+		if(NULL != cmd_buf[idx_slot])
+		{
+			cmd.release(cmd_buf[idx_slot]);
+		}
+	}
+	km_ocl_release(&ocl);
+
+}
+
+
+/* Mini-batch k-means: the host draws each batch (the same sampler as the CPU engine), gathers it
+   into pinned staging memory in SoA order and queues the write; the device assigns the batch,
+   moves the centroids with kmeans_minibatch_step and reseeds the ones that have not taken a point
+   yet on the batch with kmeans_reseed_*. Two staging slots let the host gather batch i + 1
+   while the device works on batch i. data may be an mmap'ed file of any size. */
+void kmeans_minibatch(const KmeansConfig* config, int class_n, long long data_n, int dim, float* centroids, const float* data, int* partitioned, KmeansResult* result)
+{
+	cl_int idx_iter = 0;
+	cl_int idx_slot = 0;
+	cl_int idx_batch = 0;
+	cl_int idx_dim  = 0;
+	cl_int err = CL_SUCCESS;
+
+	KmOcl ocl;
+	cl_device_id device = NULL;
+	KmRng rng;
+	KmHoldout holdout;
+
+	cl_int batch_n = config->batch_n;
+	cl_int sz_data_stride = ((batch_n + SZ_DATA_ALIGN - 1) / SZ_DATA_ALIGN) * SZ_DATA_ALIGN;
+	size_t sz_batch_soa = sizeof(cl_float) * sz_data_stride * dim;
+	long long *batch_idx = NULL;
+
+	cl_kernel kernel_assign = NULL;
+	size_t sz_global_assign = 0;
+	cl_kernel kernel_update = NULL;
+	cl_kernel kernel_fused  = NULL;
+	bool use_fused          = false;
+	cl_kernel kernel_step   = NULL;
+	size_t sz_global_step   = 0;
+	cl_kernel kernel_reseed_dist = NULL;
+	cl_kernel kernel_reseed_pick = NULL;
+	cl_kernel kernel_check  = NULL;
+	size_t sz_work_check    = 1;
+	cl_int clear_sum = 0;
+
+	cl_int status[KM_STATUS_SIZE] = { 0, 0, 0, 0, 0, 0 };
+	cl_event ev_status = NULL;
+
+	/* staging: pinned host memory mapped once, one device buffer per slot */
+	cl_mem buf_stage[NO_BATCH_SLOT] = { NULL, NULL };
+	float *stage_ptr[NO_BATCH_SLOT] = { NULL, NULL };
+	cl_event ev_write[NO_BATCH_SLOT] = { NULL, NULL };
+	cl_mem buf_dat[NO_BATCH_SLOT] = { NULL, NULL };
+
+	cl_mem buf_cen = NULL;
+	cl_mem buf_par = NULL;
+	cl_mem buf_cen_arr = NULL;
+	cl_mem buf_cnt_arr = NULL;
+	cl_mem buf_seen    = NULL;
+	cl_mem buf_status  = NULL;
+	/* a centroid that has taken no point yet moves onto the batch point farthest from its own */
+	cl_mem buf_dist    = NULL;
+	cl_mem buf_cen_empty = NULL;
+
+	if(batch_n > MAX_NO_DATA)
+	{
+		printf("batch_n(%d) is larger than MAX_NO_DATA(%d). check it!\n", batch_n, MAX_NO_DATA);
+		exit(1);
+	}
+
+	if(0 == km_ocl_devices(1, &device))
+	{
+		printf("no OpenCL GPU found. check it!\n");
+		exit(1);
+	}
+	km_ocl_init(&ocl, device, class_n, dim);
+	km_rng_seed(&rng, config->seed);
+	km_holdout_init(&holdout, data_n, config->holdout_n, &rng);
+	km_seed_sample(config, class_n, data_n, dim, data, &holdout, &rng, centroids);
+	batch_idx = (long long *)malloc(sizeof(long long) * batch_n);
+
+	sz_global_assign = km_ocl_round_up((size_t)batch_n, ocl.sz_local_assign);
+	sz_global_step   = km_ocl_round_up((size_t)class_n, ocl.sz_local_reduct);
+	clear_sum        = !ocl.use_local_update;
+	use_fused        = config->fused && ocl.fit_fused;
+
+	if(use_fused)
+	{
+		kernel_fused = clCreateKernel(ocl.program, NAME_KERNEL_ASSIGN_UPDATE, &err);
+		CHECK_ERROR(err);
+	}
+	else
+	{
+		kernel_assign = clCreateKernel(ocl.program, NAME_KERNEL_ASSIGN, &err);
+		CHECK_ERROR(err);
+		kernel_update = clCreateKernel(ocl.program, ocl.use_local_update ? NAME_KERNEL_UPDATE : NAME_KERNEL_UPDATE_GLOBAL, &err);
+		CHECK_ERROR(err);
+	}
+	kernel_step   = clCreateKernel(ocl.program, NAME_KERNEL_MINIBATCH_STEP, &err);
+	CHECK_ERROR(err);
+	kernel_reseed_dist = clCreateKernel(ocl.program, NAME_KERNEL_RESEED_DIST, &err);
+	CHECK_ERROR(err);
+	kernel_reseed_pick = clCreateKernel(ocl.program, NAME_KERNEL_RESEED_PICK, &err);
+	CHECK_ERROR(err);
+	kernel_check  = clCreateKernel(ocl.program, NAME_KERNEL_CHECK, &err);
+	CHECK_ERROR(err);
+
+	for(idx_slot = 0 ; idx_slot < NO_BATCH_SLOT ; idx_slot++)
+	{
+		buf_stage[idx_slot] = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, sz_batch_soa, NULL, &err);
+		CHECK_ERROR(err);
+		stage_ptr[idx_slot] = (float *)clEnqueueMapBuffer(ocl.queue, buf_stage[idx_slot], CL_TRUE, CL_MAP_WRITE, 0, sz_batch_soa, 0, NULL, NULL, &err);
+		CHECK_ERROR(err);
+		/* the padding past batch_n is never read, but keep it defined */
+		memset(stage_ptr[idx_slot], 0, sz_batch_soa);
+		buf_dat[idx_slot] = clCreateBuffer(ocl.context, CL_MEM_READ_ONLY, sz_batch_soa, NULL, &err);
+		CHECK_ERROR(err);
+	}
+	buf_cen     = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n * dim,                       NULL, &err);
+	CHECK_ERROR(err);
+	buf_par     = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_int)   * batch_n,                             NULL, &err);
+	CHECK_ERROR(err);
+	buf_cnt_arr = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_int)   * class_n * ocl.sz_group_update,       NULL, &err);
+	CHECK_ERROR(err);
+	buf_cen_arr = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n * dim * KM_ACC_SIZE * ocl.sz_group_update, NULL, &err);
+	CHECK_ERROR(err);
+	buf_seen    = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n,                             NULL, &err);
+	CHECK_ERROR(err);
+	buf_status  = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_int)   * KM_STATUS_SIZE,                      NULL, &err);
+	CHECK_ERROR(err);
+	buf_dist    = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_float) * batch_n,                             NULL, &err);
+	CHECK_ERROR(err);
+	buf_cen_empty = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_int) * class_n,                             NULL, &err);
+	CHECK_ERROR(err);
+
+	err = clEnqueueWriteBuffer(ocl.queue, buf_cen,    CL_FALSE, 0, sizeof(cl_float) * class_n * dim, centroids, 0, NULL, NULL);
+	CHECK_ERROR(err);
+	err = clEnqueueWriteBuffer(ocl.queue, buf_status, CL_FALSE, 0, sizeof(status),                  status,    0, NULL, NULL);
+	CHECK_ERROR(err);
+	{
+		/* no point seen yet; the global sums start at zero and kmeans_minibatch_step clears them */
+		void *zero_arr = calloc((size_t)class_n * dim * KM_ACC_SIZE, sizeof(cl_float));
+
+		err = clEnqueueWriteBuffer(ocl.queue, buf_seen, CL_FALSE, 0, sizeof(cl_float) * class_n, zero_arr, 0, NULL, NULL);
+		CHECK_ERROR(err);
+		if(clear_sum)
+		{
+			err = clEnqueueWriteBuffer(ocl.queue, buf_cen_arr, CL_FALSE, 0, sizeof(cl_float) * class_n * dim * KM_ACC_SIZE, zero_arr, 0, NULL, NULL);
+			CHECK_ERROR(err);
+			err = clEnqueueWriteBuffer(ocl.queue, buf_cnt_arr, CL_FALSE, 0, sizeof(cl_int)   * class_n,       zero_arr, 0, NULL, NULL);
+			CHECK_ERROR(err);
+		}
+		err = clFinish(ocl.queue);
+		CHECK_ERROR(err);
+		free(zero_arr);
+	}
+
+	/* buffer 1 of kmeans_assign and kmeans_assign_update and 2 of the update kernel follow the
+	   slot, set per batch */
+	if(use_fused)
+	{
+		km_ocl_set_fused_args(&ocl, kernel_fused, buf_cen, buf_dat[0], buf_par, buf_cen_arr, buf_cnt_arr, NULL, NULL, NULL, NULL, buf_status,
+		                      class_n, batch_n, dim, sz_data_stride, 0, 0.0f);
+	}
+	else
+	{
+		km_ocl_set_assign_args(&ocl, kernel_assign, buf_cen, buf_dat[0], buf_par, buf_status, class_n, batch_n, dim, sz_data_stride);
+		km_ocl_set_update_args(&ocl, kernel_update, buf_cen_arr, buf_cnt_arr, buf_dat[0], buf_par, buf_status, class_n, batch_n, dim, sz_data_stride);
+	}
+
+	err = clSetKernelArg(kernel_step, 0, sizeof(cl_mem), &buf_cen);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_step, 1, sizeof(cl_mem), &buf_cen_arr);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_step, 2, sizeof(cl_mem), &buf_cnt_arr);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_step, 3, sizeof(cl_mem), &buf_seen);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_step, 4, sizeof(cl_int), &class_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_step, 5, sizeof(cl_int), &dim);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_step, 6, sizeof(cl_int), &ocl.sz_group_update);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_step, 7, sizeof(cl_int), &clear_sum);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_step, 8, sizeof(cl_mem), &buf_cen_empty);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_step, 9, sizeof(cl_mem), &buf_status);
+	CHECK_ERROR(err);
+
+	/* over the batch; buffer 1 follows the slot as above */
+	km_ocl_set_reseed_args(&ocl, kernel_reseed_dist, kernel_reseed_pick, buf_cen, buf_dat[0], buf_par, buf_dist, buf_cen_empty, buf_status,
+	                       class_n, batch_n, dim, sz_data_stride);
+
+	km_ocl_set_check_args(kernel_check, buf_status, config->tolerance, 0);
+
+	for(idx_iter = 0 ; idx_iter < config->iteration_n ; idx_iter++)
+	{
+		idx_slot = idx_iter % NO_BATCH_SLOT;
+
+		/* the write that last read this slot must be done before it is refilled */
+		if(NULL != ev_write[idx_slot])
+		{
+			err = clWaitForEvents(1, &ev_write[idx_slot]);
+			CHECK_ERROR(err);
+			clReleaseEvent(ev_write[idx_slot]);
+			ev_write[idx_slot] = NULL;
+		}
+
+		km_sample_batch(&rng, &holdout, data_n, batch_n, batch_idx);
+		for(idx_batch = 0 ; idx_batch < batch_n ; idx_batch++)
+		{
+			const float *point = data + (size_t)batch_idx[idx_batch] * dim;
+
+			for(idx_dim = 0 ; idx_dim < dim ; idx_dim++)
+			{
+				stage_ptr[idx_slot][(size_t)idx_dim * sz_data_stride + idx_batch] = point[idx_dim];
+			}
+		}
+
+		err = clEnqueueWriteBuffer(ocl.queue, buf_dat[idx_slot], CL_FALSE, 0, sz_batch_soa, stage_ptr[idx_slot], 0, NULL, &ev_write[idx_slot]);
+		CHECK_ERROR(err);
+
+		if(use_fused)
+		{
+			err = clSetKernelArg(kernel_fused, 1, sizeof(cl_mem), &buf_dat[idx_slot]);
+			CHECK_ERROR(err);
+			err = clEnqueueNDRangeKernel(ocl.queue, kernel_fused, 1, NULL, &ocl.sz_global_update, &ocl.sz_local_update, 0, NULL, NULL);
+			CHECK_ERROR(err);
+		}
+		else
+		{
+			err = clSetKernelArg(kernel_assign, 1, sizeof(cl_mem), &buf_dat[idx_slot]);
+			CHECK_ERROR(err);
+			err = clSetKernelArg(kernel_update, 2, sizeof(cl_mem), &buf_dat[idx_slot]);
+			CHECK_ERROR(err);
+
+			err = clEnqueueNDRangeKernel(ocl.queue, kernel_assign, 1, NULL, &sz_global_assign, &ocl.sz_local_assign, 0, NULL, NULL);
+			CHECK_ERROR(err);
+			err = clEnqueueNDRangeKernel(ocl.queue, kernel_update, 1, NULL, &ocl.sz_global_update, &ocl.sz_local_update, 0, NULL, NULL);
+			CHECK_ERROR(err);
+		}
+		err = clEnqueueNDRangeKernel(ocl.queue, kernel_step, 1, NULL, &sz_global_step, &ocl.sz_local_reduct, 0, NULL, NULL);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reseed_dist, 1, sizeof(cl_mem), &buf_dat[idx_slot]);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reseed_pick, 1, sizeof(cl_mem), &buf_dat[idx_slot]);
+		CHECK_ERROR(err);
+		err = clEnqueueNDRangeKernel(ocl.queue, kernel_reseed_dist, 1, NULL, &sz_global_assign, &ocl.sz_local_assign, 0, NULL, NULL);
+		CHECK_ERROR(err);
+		err = clEnqueueNDRangeKernel(ocl.queue, kernel_reseed_pick, 1, NULL, &ocl.sz_local_reduct, &ocl.sz_local_reduct, 0, NULL, NULL);
+		CHECK_ERROR(err);
+		err = clEnqueueNDRangeKernel(ocl.queue, kernel_check, 1, NULL, &sz_work_check, &sz_work_check, 0, NULL, NULL);
+		CHECK_ERROR(err);
+
+		if((0 == ((idx_iter + 1) % config->check_interval)) && km_ocl_poll_status(&ocl, buf_status, status, 1, &ev_status))
+		{
+			break;
+		}
+		/* start the write while the host gathers the next batch */
+		err = clFlush(ocl.queue);
+		CHECK_ERROR(err);
+	}
+
+	err = clEnqueueReadBuffer(ocl.queue, buf_cen, CL_FALSE, 0, sizeof(cl_float) * class_n * dim, centroids, 0, NULL, NULL);
+	CHECK_ERROR(err);
+	if(NULL != ev_status)
+	{
+		clReleaseEvent(ev_status);
+	}
+	err = clEnqueueReadBuffer(ocl.queue, buf_status, CL_TRUE, 0, sizeof(status), status, 0, NULL, NULL);
+	CHECK_ERROR(err);
+
+	result->iteration_n = status[KM_STATUS_ITER];
+	result->converged   = status[KM_STATUS_DONE];
+	result->inertia     = km_holdout_inertia(&holdout, data_n, class_n, dim, centroids, data);
+	result->distance_n  = (long long)result->iteration_n * batch_n * class_n;
+
+	/* the whole file does not fit on the device, so the final labels come from the host */
+	if(NULL != partitioned)
+	{
+		km_assign_all(class_n, data_n, dim, centroids, data, partitioned);
+	}
+
+	for(idx_slot = 0 ; idx_slot < NO_BATCH_SLOT ; idx_slot++)
+	{
+		if(NULL != ev_write[idx_slot])
+		{
+			clReleaseEvent(ev_write[idx_slot]);
+		}
+		clEnqueueUnmapMemObject(ocl.queue, buf_stage[idx_slot], stage_ptr[idx_slot], 0, NULL, NULL);
+	}
+	clFinish(ocl.queue);
+	for(idx_slot = 0 ; idx_slot < NO_BATCH_SLOT ; idx_slot++)
+	{
+		clReleaseMemObject(buf_stage[idx_slot]);
+		clReleaseMemObject(buf_dat[idx_slot]);
+	}
+	clReleaseMemObject(buf_cen);
+	clReleaseMemObject(buf_par);
+	clReleaseMemObject(buf_cen_arr);
+	clReleaseMemObject(buf_cnt_arr);
+	clReleaseMemObject(buf_seen);
+	clReleaseMemObject(buf_status);
+	clReleaseMemObject(buf_dist);
+	clReleaseMemObject(buf_cen_empty);
+	if(use_fused)
+	{
+		clReleaseKernel(kernel_fused);
+	}
+	else
+	{
+		clReleaseKernel(kernel_assign);
+		clReleaseKernel(kernel_update);
+	}
+	clReleaseKernel(kernel_step);
+	clReleaseKernel(kernel_reseed_dist);
+	clReleaseKernel(kernel_reseed_pick);
+	clReleaseKernel(kernel_check);
+	km_ocl_release(&ocl);
+	free(batch_idx);
+}
+
+
+/* Streaming k-means: every iteration walks the file in chunks of chunk_n points. The host
+   transposes chunk i + 1 from the mapping into pinned staging while the device assigns and
+   accumulates chunk i; each chunk's labels go up with it and come back straight into
+   partitioned, so neither the points nor the labels are ever whole on the device. The sums are
+   carried across chunks (kmeans_update_global adds into its global slice, the work-group slices
+   of kmeans_update and kmeans_assign_update are added up by kmeans_reduct_sum), and kmeans_divide
+   and kmeans_check close the iteration on the device as usual. Empty clusters, which need every
+   point, are reseeded on the host between the two. */
+void kmeans_stream(const KmeansConfig* config, int class_n, long long data_n, int dim, float* centroids, const float* data, int* partitioned, KmeansResult* result)
+{
+	cl_int idx_iter  = 0;
+	cl_int idx_slot  = 0;
+	cl_int idx_class = 0;
+	cl_int idx_dim   = 0;
+	long long idx_chunk = 0;
+	long long idx_data  = 0;
+	long long no_chunk  = 0;
+	long long no_launch = 0;
+	cl_int err = CL_SUCCESS;
+
+	KmOcl ocl;
+	cl_device_id device = NULL;
+
+	cl_int chunk_n = (cl_int)std::min((long long)config->chunk_n, data_n);
+	cl_int sz_data_stride = ((chunk_n + SZ_DATA_ALIGN - 1) / SZ_DATA_ALIGN) * SZ_DATA_ALIGN;
+	size_t sz_chunk_soa = sizeof(cl_float) * sz_data_stride * dim;
+
+	cl_kernel kernel_assign = NULL;
+	cl_kernel kernel_update = NULL;
+	cl_kernel kernel_fused  = NULL;
+	bool use_fused          = false;
+	cl_kernel kernel_sum    = NULL;
+	cl_kernel kernel_divide = NULL;
+	size_t sz_global_divide = 0;
+	cl_kernel kernel_check  = NULL;
+	size_t sz_work_check    = 1;
+	cl_int clear_sum = 0;
+	cl_int add_res   = 1;
+
+	cl_int status[KM_STATUS_SIZE] = { 0, 0, 0, 0, 0, 0 };
+	cl_event ev_status = NULL;
+
+	/* staging: pinned host memory mapped once, one device buffer per slot */
+	cl_mem buf_stage[NO_BATCH_SLOT] = { NULL, NULL };
+	float *stage_ptr[NO_BATCH_SLOT] = { NULL, NULL };
+	cl_event ev_write[NO_BATCH_SLOT] = { NULL, NULL };
+	cl_mem buf_dat[NO_BATCH_SLOT] = { NULL, NULL };
+	cl_mem buf_par[NO_BATCH_SLOT] = { NULL, NULL };
+
+	cl_mem buf_cen = NULL;
+	cl_mem buf_cen_arr = NULL;
+	cl_mem buf_cnt_arr = NULL;
+	/* the sums carried across chunks: a slice of their own on the local path, the global slice otherwise */
+	cl_mem buf_sum = NULL;
+	cl_mem buf_cnt = NULL;
+	cl_mem buf_status  = NULL;
+	/* kmeans_divide flags the empty clusters; they move on the host, which holds every point */
+	cl_mem buf_cen_empty = NULL;
+	cl_int reseed_status[KM_STATUS_SIZE] = { 0, 0, 0, 0, 0, 0 };
+	std::vector<cl_int> cent_empty(class_n);
+	std::vector<int> empty_class;
+
+	if(config->chunk_n > MAX_NO_DATA)
+	{
+		printf("chunk_n(%d) is larger than MAX_NO_DATA(%d). check it!\n", config->chunk_n, MAX_NO_DATA);
+		exit(1);
+	}
+
+	if(0 == km_ocl_devices(1, &device))
+	{
+		printf("no OpenCL GPU found. check it!\n");
+		exit(1);
+	}
+	km_ocl_init(&ocl, device, class_n, dim);
+	km_seed(config, class_n, data_n, dim, data, centroids);
+
+	no_chunk         = (data_n + chunk_n - 1) / chunk_n;
+	sz_global_divide = km_ocl_round_up((size_t)class_n, ocl.sz_local_reduct);
+	use_fused        = config->fused && ocl.fit_fused;
+
+	if(use_fused)
+	{
+		kernel_fused = clCreateKernel(ocl.program, NAME_KERNEL_ASSIGN_UPDATE, &err);
+		CHECK_ERROR(err);
+	}
+	else
+	{
+		kernel_assign = clCreateKernel(ocl.program, NAME_KERNEL_ASSIGN, &err);
+		CHECK_ERROR(err);
+		kernel_update = clCreateKernel(ocl.program, ocl.use_local_update ? NAME_KERNEL_UPDATE : NAME_KERNEL_UPDATE_GLOBAL, &err);
+		CHECK_ERROR(err);
+	}
+	if(ocl.use_local_update)
+	{
+		kernel_sum = clCreateKernel(ocl.program, NAME_KERNEL_REDUCT_SUM, &err);
+		CHECK_ERROR(err);
+	}
+	kernel_divide = clCreateKernel(ocl.program, NAME_KERNEL_DIVIDE, &err);
+	CHECK_ERROR(err);
+	kernel_check  = clCreateKernel(ocl.program, NAME_KERNEL_CHECK, &err);
+	CHECK_ERROR(err);
+
+	for(idx_slot = 0 ; idx_slot < NO_BATCH_SLOT ; idx_slot++)
+	{
+		buf_stage[idx_slot] = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, sz_chunk_soa, NULL, &err);
+		CHECK_ERROR(err);
+		stage_ptr[idx_slot] = (float *)clEnqueueMapBuffer(ocl.queue, buf_stage[idx_slot], CL_TRUE, CL_MAP_WRITE, 0, sz_chunk_soa, 0, NULL, NULL, &err);
+		CHECK_ERROR(err);
+		/* the padding past the last point of a chunk is never read, but keep it defined */
+		memset(stage_ptr[idx_slot], 0, sz_chunk_soa);
+		buf_dat[idx_slot] = clCreateBuffer(ocl.context, CL_MEM_READ_ONLY,  sz_chunk_soa,              NULL, &err);
+		CHECK_ERROR(err);
+		buf_par[idx_slot] = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_int) * chunk_n, NULL, &err);
+		CHECK_ERROR(err);
+	}
+	buf_cen     = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n * dim,                       NULL, &err);
+	CHECK_ERROR(err);
+	buf_cnt_arr = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_int)   * class_n * ocl.sz_group_update,       NULL, &err);
+	CHECK_ERROR(err);
+	buf_cen_arr = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n * dim * KM_ACC_SIZE * ocl.sz_group_update, NULL, &err);
+	CHECK_ERROR(err);
+	buf_status  = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_int)   * KM_STATUS_SIZE,                      NULL, &err);
+	CHECK_ERROR(err);
+	buf_cen_empty = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_int) * class_n,                             NULL, &err);
+	CHECK_ERROR(err);
+	if(ocl.use_local_update)
+	{
+		buf_sum = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n * dim * KM_ACC_SIZE, NULL, &err);
+		CHECK_ERROR(err);
+		buf_cnt = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_int)   * class_n,       NULL, &err);
+		CHECK_ERROR(err);
+	}
+	else
+	{
+		buf_sum = buf_cen_arr;
+		buf_cnt = buf_cnt_arr;
+	}
+
+	err = clEnqueueWriteBuffer(ocl.queue, buf_cen,    CL_FALSE, 0, sizeof(cl_float) * class_n * dim, centroids, 0, NULL, NULL);
+	CHECK_ERROR(err);
+	err = clEnqueueWriteBuffer(ocl.queue, buf_status, CL_FALSE, 0, sizeof(status),                  status,    0, NULL, NULL);
+	CHECK_ERROR(err);
+	{
+		/* the carried sums start at zero, kmeans_divide clears them after every iteration */
+		void *zero_arr = calloc((size_t)class_n * dim * KM_ACC_SIZE, sizeof(cl_float));
+
+		err = clEnqueueWriteBuffer(ocl.queue, buf_sum, CL_FALSE, 0, sizeof(cl_float) * class_n * dim * KM_ACC_SIZE, zero_arr, 0, NULL, NULL);
+		CHECK_ERROR(err);
+		err = clEnqueueWriteBuffer(ocl.queue, buf_cnt, CL_FALSE, 0, sizeof(cl_int)   * class_n,       zero_arr, 0, NULL, NULL);
+		CHECK_ERROR(err);
+		err = clFinish(ocl.queue);
+		CHECK_ERROR(err);
+		free(zero_arr);
+	}
+	/* no point starts in a cluster, so the first iteration counts every point as changed */
+	for(idx_data = 0 ; idx_data < data_n ; idx_data++)
+	{
+		partitioned[idx_data] = -1;
+	}
+
+	/* the data and label buffers (and the point count) follow the chunk, set per launch */
+	if(use_fused)
+	{
+		km_ocl_set_fused_args(&ocl, kernel_fused, buf_cen, buf_dat[0], buf_par[0], buf_cen_arr, buf_cnt_arr, NULL, NULL, NULL, NULL, buf_status,
+		                      class_n, chunk_n, dim, sz_data_stride, 0, 0.0f);
+	}
+	else
+	{
+		km_ocl_set_assign_args(&ocl, kernel_assign, buf_cen, buf_dat[0], buf_par[0], buf_status, class_n, chunk_n, dim, sz_data_stride);
+		km_ocl_set_update_args(&ocl, kernel_update, buf_cen_arr, buf_cnt_arr, buf_dat[0], buf_par[0], buf_status, class_n, chunk_n, dim, sz_data_stride);
+	}
+
+	if(ocl.use_local_update)
+	{
+		/* kmeans_reduct_sum */
+		err = clSetKernelArg(kernel_sum, 0, sizeof(cl_mem), &buf_sum);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_sum, 1, sizeof(cl_mem), &buf_cnt);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_sum, 2, sizeof(cl_mem), &buf_cen_arr);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_sum, 3, sizeof(cl_mem), &buf_cnt_arr);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_sum, 4, sizeof(cl_int), &class_n);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_sum, 5, sizeof(cl_int), &dim);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_sum, 6, sizeof(cl_int), &ocl.sz_group_update);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_sum, 7, sizeof(cl_int), &clear_sum);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_sum, 8, sizeof(cl_int), &add_res);
+		CHECK_ERROR(err);
+	}
+
+	/* kmeans_divide */
+	err = clSetKernelArg(kernel_divide, 0, sizeof(cl_mem), &buf_cen);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_divide, 1, sizeof(cl_mem), &buf_sum);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_divide, 2, sizeof(cl_mem), &buf_cnt);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_divide, 3, sizeof(cl_int), &class_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_divide, 4, sizeof(cl_int), &dim);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_divide, 5, sizeof(cl_mem), &buf_cen_empty);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_divide, 6, sizeof(cl_mem), &buf_status);
+	CHECK_ERROR(err);
+
+	km_ocl_set_check_args(kernel_check, buf_status, config->tolerance, 1);
+
+	for(idx_iter = 0 ; idx_iter < config->iteration_n ; idx_iter++)
+	{
+		for(idx_chunk = 0 ; idx_chunk < no_chunk ; idx_chunk++, no_launch++)
+		{
+			long long data_begin = idx_chunk * chunk_n;
+			cl_int cur_n = (cl_int)std::min((long long)chunk_n, data_n - data_begin);
+			size_t sz_global_cur = km_ocl_round_up((size_t)cur_n, ocl.sz_local_assign);
+
+			idx_slot = (cl_int)(no_launch % NO_BATCH_SLOT);
+
+			/* the write that last read this slot must be done before it is refilled */
+			if(NULL != ev_write[idx_slot])
+			{
+				err = clWaitForEvents(1, &ev_write[idx_slot]);
+				CHECK_ERROR(err);
+				clReleaseEvent(ev_write[idx_slot]);
+				ev_write[idx_slot] = NULL;
+			}
+
+			for(idx_data = 0 ; idx_data < cur_n ; idx_data++)
+			{
+				const float *point = data + (size_t)(data_begin + idx_data) * dim;
+
+				for(idx_dim = 0 ; idx_dim < dim ; idx_dim++)
+				{
+					stage_ptr[idx_slot][(size_t)idx_dim * sz_data_stride + idx_data] = point[idx_dim];
+				}
+			}
+
+			/* the labels go up from partitioned and come back into it; the queue keeps them in order */
+			err = clEnqueueWriteBuffer(ocl.queue, buf_dat[idx_slot], CL_FALSE, 0, sz_chunk_soa, stage_ptr[idx_slot], 0, NULL, &ev_write[idx_slot]);
+			CHECK_ERROR(err);
+			err = clEnqueueWriteBuffer(ocl.queue, buf_par[idx_slot], CL_FALSE, 0, sizeof(cl_int) * cur_n, partitioned + data_begin, 0, NULL, NULL);
+			CHECK_ERROR(err);
+
+			if(use_fused)
+			{
+				err = clSetKernelArg(kernel_fused, 1, sizeof(cl_mem), &buf_dat[idx_slot]);
+				CHECK_ERROR(err);
+				err = clSetKernelArg(kernel_fused, 2, sizeof(cl_mem), &buf_par[idx_slot]);
+				CHECK_ERROR(err);
+				err = clSetKernelArg(kernel_fused, 10, sizeof(cl_int), &cur_n);
+				CHECK_ERROR(err);
+				err = clEnqueueNDRangeKernel(ocl.queue, kernel_fused, 1, NULL, &ocl.sz_global_update, &ocl.sz_local_update, 0, NULL, NULL);
+				CHECK_ERROR(err);
+			}
+			else
+			{
+				err = clSetKernelArg(kernel_assign, 1, sizeof(cl_mem), &buf_dat[idx_slot]);
+				CHECK_ERROR(err);
+				err = clSetKernelArg(kernel_assign, 2, sizeof(cl_mem), &buf_par[idx_slot]);
+				CHECK_ERROR(err);
+				err = clSetKernelArg(kernel_assign, 4, sizeof(cl_int), &cur_n);
+				CHECK_ERROR(err);
+				/* kmeans_update takes the point count after class_n, kmeans_update_global without it */
+				err = clSetKernelArg(kernel_update, 2, sizeof(cl_mem), &buf_dat[idx_slot]);
+				CHECK_ERROR(err);
+				err = clSetKernelArg(kernel_update, 3, sizeof(cl_mem), &buf_par[idx_slot]);
+				CHECK_ERROR(err);
+				err = clSetKernelArg(kernel_update, ocl.use_local_update ? 5 : 4, sizeof(cl_int), &cur_n);
+				CHECK_ERROR(err);
+
+				err = clEnqueueNDRangeKernel(ocl.queue, kernel_assign, 1, NULL, &sz_global_cur, &ocl.sz_local_assign, 0, NULL, NULL);
+				CHECK_ERROR(err);
+				err = clEnqueueNDRangeKernel(ocl.queue, kernel_update, 1, NULL, &ocl.sz_global_update, &ocl.sz_local_update, 0, NULL, NULL);
+				CHECK_ERROR(err);
+			}
+			if(ocl.use_local_update)
+			{
+				err = clEnqueueNDRangeKernel(ocl.queue, kernel_sum, 1, NULL, &sz_global_divide, &ocl.sz_local_reduct, 0, NULL, NULL);
+				CHECK_ERROR(err);
+			}
+
+			err = clEnqueueReadBuffer(ocl.queue, buf_par[idx_slot], CL_FALSE, 0, sizeof(cl_int) * cur_n, partitioned + data_begin, 0, NULL, NULL);
+			CHECK_ERROR(err);
+			/* start the upload while the host stages the next chunk */
+			err = clFlush(ocl.queue);
+			CHECK_ERROR(err);
+		}
+
+		err = clEnqueueNDRangeKernel(ocl.queue, kernel_divide, 1, NULL, &sz_global_divide, &ocl.sz_local_reduct, 0, NULL, NULL);
+		CHECK_ERROR(err);
+
+		/* empty clusters: the points are never whole on the device, so kmeans_reseed_* cannot run;
+		   they move on the host, with the labels of this pass, before kmeans_check counts them */
+		err = clEnqueueReadBuffer(ocl.queue, buf_status, CL_TRUE, 0, sizeof(reseed_status), reseed_status, 0, NULL, NULL);
+		CHECK_ERROR(err);
+		if(!reseed_status[KM_STATUS_DONE] && (0 != reseed_status[KM_STATUS_EMPTY]))
+		{
+			float shift = 0;
+
+			err = clEnqueueReadBuffer(ocl.queue, buf_cen_empty, CL_FALSE, 0, sizeof(cl_int) * class_n, cent_empty.data(), 0, NULL, NULL);
+			CHECK_ERROR(err);
+			err = clEnqueueReadBuffer(ocl.queue, buf_cen, CL_TRUE, 0, sizeof(cl_float) * class_n * dim, centroids, 0, NULL, NULL);
+			CHECK_ERROR(err);
+			empty_class.clear();
+			for(idx_class = 0 ; idx_class < class_n ; idx_class++)
+			{
+				if(cent_empty[idx_class])
+				{
+					empty_class.push_back(idx_class);
+				}
+			}
+			memcpy(&shift, &reseed_status[KM_STATUS_SHIFT], sizeof(shift));
+			reseed_status[KM_STATUS_CHANGED] += km_ocl_reseed_host(empty_class, data_n, dim, data, partitioned, centroids, &shift);
+			memcpy(&reseed_status[KM_STATUS_SHIFT], &shift, sizeof(shift));
+			err = clEnqueueWriteBuffer(ocl.queue, buf_cen,    CL_TRUE, 0, sizeof(cl_float) * class_n * dim, centroids,     0, NULL, NULL);
+			CHECK_ERROR(err);
+			err = clEnqueueWriteBuffer(ocl.queue, buf_status, CL_TRUE, 0, sizeof(reseed_status),          reseed_status, 0, NULL, NULL);
+			CHECK_ERROR(err);
+		}
+		err = clEnqueueNDRangeKernel(ocl.queue, kernel_check, 1, NULL, &sz_work_check, &sz_work_check, 0, NULL, NULL);
+		CHECK_ERROR(err);
+
+		/* an iteration is a pass over the whole file, so the status is polled after every one */
+		if(km_ocl_poll_status(&ocl, buf_status, status, 1, &ev_status))
+		{
+			break;
+		}
+	}
+
+	err = clEnqueueReadBuffer(ocl.queue, buf_cen, CL_FALSE, 0, sizeof(cl_float) * class_n * dim, centroids, 0, NULL, NULL);
+	CHECK_ERROR(err);
+	if(NULL != ev_status)
+	{
+		clReleaseEvent(ev_status);
+	}
+	err = clEnqueueReadBuffer(ocl.queue, buf_status, CL_TRUE, 0, sizeof(status), status, 0, NULL, NULL);
+	CHECK_ERROR(err);
+
+	result->iteration_n = status[KM_STATUS_ITER];
+	result->converged   = status[KM_STATUS_DONE];
+	result->inertia     = 0.0;
+	for(idx_data = 0 ; idx_data < data_n ; idx_data += INT_MAX)
+	{
+		result->inertia += kmeans_inertia(class_n, (int)std::min((long long)INT_MAX, data_n - idx_data), dim, centroids,
+		                                  data + (size_t)idx_data * dim, partitioned + idx_data);
+	}
+	result->distance_n  = (long long)result->iteration_n * data_n * class_n;
+
+	for(idx_slot = 0 ; idx_slot < NO_BATCH_SLOT ; idx_slot++)
+	{
+		if(NULL != ev_write[idx_slot])
+		{
+			clReleaseEvent(ev_write[idx_slot]);
+		}
+		clEnqueueUnmapMemObject(ocl.queue, buf_stage[idx_slot], stage_ptr[idx_slot], 0, NULL, NULL);
+	}
+	clFinish(ocl.queue);
+	for(idx_slot = 0 ; idx_slot < NO_BATCH_SLOT ; idx_slot++)
+	{
+		clReleaseMemObject(buf_stage[idx_slot]);
+		clReleaseMemObject(buf_dat[idx_slot]);
+		clReleaseMemObject(buf_par[idx_slot]);
+	}
+	clReleaseMemObject(buf_cen);
+	clReleaseMemObject(buf_cen_arr);
+	clReleaseMemObject(buf_cnt_arr);
+	clReleaseMemObject(buf_status);
+	clReleaseMemObject(buf_cen_empty);
+	if(ocl.use_local_update)
+	{
+		clReleaseMemObject(buf_sum);
+		clReleaseMemObject(buf_cnt);
+		clReleaseKernel(kernel_sum);
+	}
+	if(use_fused)
+	{
+		clReleaseKernel(kernel_fused);
+	}
+	else
+	{
+		clReleaseKernel(kernel_assign);
+		clReleaseKernel(kernel_update);
+	}
+	clReleaseKernel(kernel_divide);
+	clReleaseKernel(kernel_check);
+	km_ocl_release(&ocl);
+}
+
+
+/* Batched runs: the data goes up once and stays; the runs are taken MAX_NO_RUN at a time, with
+   their centroids concatenated for kmeans_assign_batch. Seeded runs are seeded one by one with
+   km_ocl_seed on the resident data. */
+void kmeans_batch(const KmeansConfig* config, int run_n, KmeansRun* run_arr, int data_n, int dim, const float* data)
+{
+	cl_int idx_iter  = 0;
+	cl_int idx_run   = 0;
+	cl_int idx_class = 0;
+	cl_int idx_dim   = 0;
+	int    run_begin = 0;
+	size_t idx_data  = 0;
+	cl_int err = CL_SUCCESS;
+
+	KmOcl ocl;
+	cl_device_id device = NULL;
+
+	cl_int sz_data_stride = ((data_n + SZ_DATA_ALIGN - 1) / SZ_DATA_ALIGN) * SZ_DATA_ALIGN;
+	float *data_soa = NULL;
+	int   *label    = (int *)malloc(sizeof(int) * data_n);
+	cl_int sz_max_group_class = 0;
+
+	cl_mem buf_dat = NULL;
+
+	if(data_n > MAX_NO_DATA)
+	{
+		printf("data_n(%d) is larger than MAX_NO_DATA(%d). check it!\n", data_n, MAX_NO_DATA);
+		exit(1);
+	}
+
+	if(0 == km_ocl_devices(1, &device))
+	{
+		/* no GPU: one run after another on the host threads */
+		fprintf(stderr, "no OpenCL GPU found, running on the CPU\n");
+		for(idx_run = 0 ; idx_run < run_n ; idx_run++)
+		{
+			KmeansConfig run_config = *config;
+
+			run_config.seed = run_arr[idx_run].seed;
+			kmeans_simd(&run_config, run_arr[idx_run].class_n, data_n, dim, run_arr[idx_run].centroids, data,
+			            (NULL != run_arr[idx_run].clsfy_result) ? run_arr[idx_run].clsfy_result : label, &run_arr[idx_run].result);
+		}
+		free(label);
+		return;
+	}
+
+	/* the tile size comes from the largest launch */
+	for(run_begin = 0 ; run_begin < run_n ; run_begin += MAX_NO_RUN)
+	{
+		cl_int sz_group_class = 0;
+
+		for(idx_run = run_begin ; idx_run < std::min(run_n, run_begin + MAX_NO_RUN) ; idx_run++)
+		{
+			sz_group_class += run_arr[idx_run].class_n;
+		}
+		sz_max_group_class = std::max(sz_max_group_class, sz_group_class);
+	}
+	km_ocl_init(&ocl, device, sz_max_group_class, dim);
+
+	/* ------------------------------------ */
+	/* the data in SoA order, uploaded once */
+	/* ------------------------------------ */
+	buf_dat = clCreateBuffer(ocl.context, CL_MEM_READ_ONLY, sizeof(cl_float) * sz_data_stride * dim, NULL, &err);
+	CHECK_ERROR(err);
+	data_soa = (float *)calloc((size_t)sz_data_stride * dim, sizeof(float));
+	for(idx_data = 0 ; idx_data < (size_t)data_n ; idx_data++)
+	{
+		for(idx_dim = 0 ; idx_dim < dim ; idx_dim++)
+		{
+			data_soa[(size_t)idx_dim * sz_data_stride + idx_data] = data[idx_data * dim + idx_dim];
+		}
+	}
+	err = clEnqueueWriteBuffer(ocl.queue, buf_dat, CL_TRUE, 0, sizeof(cl_float) * sz_data_stride * dim, data_soa, 0, NULL, NULL);
+	CHECK_ERROR(err);
+	free(data_soa);
+
+	for(run_begin = 0 ; run_begin < run_n ; run_begin += MAX_NO_RUN)
+	{
+		cl_int no_run = std::min(run_n - run_begin, MAX_NO_RUN);
+		KmeansRun *group = run_arr + run_begin;
+		cl_int sz_class  = 0;
+		cl_int sz_tile_class = 0;
+		cl_int *cent_run  = NULL;
+		cl_int *cent_begin = (cl_int *)malloc(sizeof(cl_int) * (no_run + 1));
+		float  *cent_arr  = NULL;
+		cl_int *part_arr  = NULL;
+		cl_int *status    = (cl_int *)calloc((size_t)no_run * KM_STATUS_SIZE, sizeof(cl_int));
+		cl_event ev_status = NULL;
+
+		cl_kernel kernel_assign = NULL;
+		cl_kernel kernel_divide = NULL;
+		cl_kernel kernel_reseed_dist = NULL;
+		cl_kernel kernel_reseed_pick = NULL;
+		cl_kernel kernel_check  = NULL;
+		size_t sz_global_assign = km_ocl_round_up((size_t)data_n, ocl.sz_local_assign);
+		size_t sz_global_divide = 0;
+		size_t sz_global_pick   = (size_t)no_run * ocl.sz_local_reduct;
+		size_t sz_global_check  = km_ocl_round_up((size_t)no_run, ocl.sz_local_reduct);
+
+		cl_mem buf_cen        = NULL;
+		cl_mem buf_cen_run    = NULL;
+		cl_mem buf_cen_begin  = NULL;
+		cl_mem buf_par        = NULL;
+		cl_mem buf_sum        = NULL;
+		cl_mem buf_cnt        = NULL;
+		cl_mem buf_status     = NULL;
+		/* empty clusters move onto the farthest points of their run, as in kmeans() */
+		cl_mem buf_cen_empty  = NULL;
+		cl_mem buf_dist       = NULL;
+
+		/* ------------------------------------------------ */
+		/* seed each run and concatenate its centroids      */
+		/* ------------------------------------------------ */
+		for(idx_run = 0 ; idx_run < no_run ; idx_run++)
+		{
+			cent_begin[idx_run] = sz_class;
+			sz_class += group[idx_run].class_n;
+		}
+		cent_begin[no_run] = sz_class;
+		cent_run = (cl_int *)malloc(sizeof(cl_int) * sz_class);
+		cent_arr = (float  *)malloc(sizeof(float)  * sz_class * dim);
+		for(idx_run = 0 ; idx_run < no_run ; idx_run++)
+		{
+			if(KMEANS_INIT_FILE != config->init)
+			{
+				KmeansConfig run_config = *config;
+
+				run_config.seed = group[idx_run].seed;
+				km_ocl_seed(&run_config, &ocl, buf_dat, group[idx_run].class_n, data_n, dim, sz_data_stride, data, group[idx_run].centroids);
+			}
+			memcpy(&cent_arr[(size_t)cent_begin[idx_run] * dim], group[idx_run].centroids, sizeof(float) * group[idx_run].class_n * dim);
+			for(idx_class = cent_begin[idx_run] ; idx_class < cent_begin[idx_run + 1] ; idx_class++)
+			{
+				cent_run[idx_class] = idx_run;
+			}
+		}
+
+		/* the centroid run ids share the tile's local memory with the centroids */
+		sz_tile_class = std::min(sz_class, std::max((cl_int)1, (cl_int)((size_t)ocl.sz_tile_class * dim / (dim + 1))));
+		sz_global_divide = km_ocl_round_up((size_t)sz_class, ocl.sz_local_reduct);
+
+		/* no point starts in a cluster, so the first iteration counts every point as changed */
+		part_arr = (cl_int *)malloc(sizeof(cl_int) * no_run * sz_data_stride);
+		for(idx_data = 0 ; idx_data < (size_t)no_run * sz_data_stride ; idx_data++)
+		{
+			part_arr[idx_data] = -1;
+		}
+
+		/* -------------------- */
+		/* create kernel object */
+		/* -------------------- */
+		kernel_assign = clCreateKernel(ocl.program, NAME_KERNEL_ASSIGN_BATCH, &err);
+		CHECK_ERROR(err);
+		kernel_divide = clCreateKernel(ocl.program, NAME_KERNEL_DIVIDE_BATCH, &err);
+		CHECK_ERROR(err);
+		kernel_reseed_dist = clCreateKernel(ocl.program, NAME_KERNEL_RESEED_DIST_BATCH, &err);
+		CHECK_ERROR(err);
+		kernel_reseed_pick = clCreateKernel(ocl.program, NAME_KERNEL_RESEED_PICK_BATCH, &err);
+		CHECK_ERROR(err);
+		kernel_check  = clCreateKernel(ocl.program, NAME_KERNEL_CHECK_BATCH, &err);
+		CHECK_ERROR(err);
+
+		/* -------------------- */
+		/* create buffer object */
+		/* -------------------- */
+		buf_cen       = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(cl_float) * sz_class * dim,         cent_arr,   &err);
+		CHECK_ERROR(err);
+		buf_cen_run   = clCreateBuffer(ocl.context, CL_MEM_READ_ONLY  | CL_MEM_COPY_HOST_PTR, sizeof(cl_int)   * sz_class,               cent_run,   &err);
+		CHECK_ERROR(err);
+		buf_cen_begin = clCreateBuffer(ocl.context, CL_MEM_READ_ONLY  | CL_MEM_COPY_HOST_PTR, sizeof(cl_int)   * (no_run + 1),           cent_begin, &err);
+		CHECK_ERROR(err);
+		buf_par       = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(cl_int)   * no_run * sz_data_stride, part_arr,   &err);
+		CHECK_ERROR(err);
+		buf_status    = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(cl_int)   * no_run * KM_STATUS_SIZE, status,     &err);
+		CHECK_ERROR(err);
+		buf_cen_empty = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE,                        sizeof(cl_int)   * sz_class,               NULL,       &err);
+		CHECK_ERROR(err);
+		buf_dist      = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE,                        sizeof(cl_float) * no_run * sz_data_stride, NULL,       &err);
+		CHECK_ERROR(err);
+		{
+			/* the sums start at zero, kmeans_divide_batch clears them after every iteration */
+			void *zero_arr = calloc((size_t)sz_class * dim * KM_ACC_SIZE, sizeof(cl_float));
+
+			buf_sum = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(cl_float) * sz_class * dim * KM_ACC_SIZE, zero_arr, &err);
+			CHECK_ERROR(err);
+			buf_cnt = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(cl_int)   * sz_class,       zero_arr, &err);
+			CHECK_ERROR(err);
+			free(zero_arr);
+		}
+
+		/* ----------------------- */
+		/* kernel argument setting */
+		/* ----------------------- */
+		err = clSetKernelArg(kernel_assign, 0, sizeof(cl_mem), &buf_cen);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_assign, 1, sizeof(cl_mem), &buf_cen_run);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_assign, 2, sizeof(cl_mem), &buf_cen_begin);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_assign, 3, sizeof(cl_mem), &buf_dat);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_assign, 4, sizeof(cl_mem), &buf_par);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_assign, 5, sizeof(cl_mem), &buf_sum);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_assign, 6, sizeof(cl_mem), &buf_cnt);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_assign, 7, sizeof(cl_int), &sz_class);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_assign, 8, sizeof(cl_int), &no_run);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_assign, 9, sizeof(cl_int), &data_n);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_assign, 10, sizeof(cl_int), &dim);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_assign, 11, sizeof(cl_int), &sz_data_stride);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_assign, 12, sizeof(cl_int), &sz_tile_class);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_assign, 13, sizeof(cl_float) * sz_tile_class * dim, NULL);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_assign, 14, sizeof(cl_int) * sz_tile_class, NULL);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_assign, 15, sizeof(cl_mem), &buf_status);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_assign, 16, sizeof(cl_int) * no_run, NULL);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_assign, 17, sizeof(cl_int) * no_run, NULL);
+		CHECK_ERROR(err);
+
+		err = clSetKernelArg(kernel_divide, 0, sizeof(cl_mem), &buf_cen);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_divide, 1, sizeof(cl_mem), &buf_sum);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_divide, 2, sizeof(cl_mem), &buf_cnt);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_divide, 3, sizeof(cl_mem), &buf_cen_run);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_divide, 4, sizeof(cl_int), &sz_class);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_divide, 5, sizeof(cl_int), &dim);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_divide, 6, sizeof(cl_mem), &buf_cen_empty);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_divide, 7, sizeof(cl_mem), &buf_status);
+		CHECK_ERROR(err);
+
+		err = clSetKernelArg(kernel_reseed_dist, 0, sizeof(cl_mem), &buf_cen);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reseed_dist, 1, sizeof(cl_mem), &buf_cen_begin);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reseed_dist, 2, sizeof(cl_mem), &buf_dat);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reseed_dist, 3, sizeof(cl_mem), &buf_par);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reseed_dist, 4, sizeof(cl_mem), &buf_dist);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reseed_dist, 5, sizeof(cl_int), &no_run);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reseed_dist, 6, sizeof(cl_int), &data_n);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reseed_dist, 7, sizeof(cl_int), &dim);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reseed_dist, 8, sizeof(cl_int), &sz_data_stride);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reseed_dist, 9, sizeof(cl_mem), &buf_status);
+		CHECK_ERROR(err);
+
+		err = clSetKernelArg(kernel_reseed_pick, 0, sizeof(cl_mem), &buf_cen);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reseed_pick, 1, sizeof(cl_mem), &buf_cen_begin);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reseed_pick, 2, sizeof(cl_mem), &buf_dat);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reseed_pick, 3, sizeof(cl_mem), &buf_dist);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reseed_pick, 4, sizeof(cl_mem), &buf_cen_empty);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reseed_pick, 5, sizeof(cl_int), &data_n);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reseed_pick, 6, sizeof(cl_int), &dim);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reseed_pick, 7, sizeof(cl_int), &sz_data_stride);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reseed_pick, 8, sizeof(cl_float) * ocl.sz_local_reduct, NULL);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reseed_pick, 9, sizeof(cl_int) * ocl.sz_local_reduct, NULL);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_reseed_pick, 10, sizeof(cl_mem), &buf_status);
+		CHECK_ERROR(err);
+
+		err = clSetKernelArg(kernel_check, 0, sizeof(cl_mem), &buf_status);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_check, 1, sizeof(cl_int), &no_run);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(kernel_check, 2, sizeof(cl_float), &config->tolerance);
+		CHECK_ERROR(err);
+
+		/* ---------- */
+		/* run kernel */
+		/* ---------- */
+		for(idx_iter = 0 ; idx_iter < config->iteration_n ; idx_iter++)
+		{
+			err = clEnqueueNDRangeKernel(ocl.queue, kernel_assign, 1, NULL, &sz_global_assign, &ocl.sz_local_assign, 0, NULL, NULL);
+			CHECK_ERROR(err);
+			err = clEnqueueNDRangeKernel(ocl.queue, kernel_divide, 1, NULL, &sz_global_divide, &ocl.sz_local_reduct, 0, NULL, NULL);
+			CHECK_ERROR(err);
+			err = clEnqueueNDRangeKernel(ocl.queue, kernel_reseed_dist, 1, NULL, &sz_global_assign, &ocl.sz_local_assign, 0, NULL, NULL);
+			CHECK_ERROR(err);
+			err = clEnqueueNDRangeKernel(ocl.queue, kernel_reseed_pick, 1, NULL, &sz_global_pick, &ocl.sz_local_reduct, 0, NULL, NULL);
+			CHECK_ERROR(err);
+			err = clEnqueueNDRangeKernel(ocl.queue, kernel_check, 1, NULL, &sz_global_check, &ocl.sz_local_reduct, 0, NULL, NULL);
+			CHECK_ERROR(err);
+
+			/* done once every run is */
+			if((0 == ((idx_iter + 1) % config->check_interval)) && km_ocl_poll_status(&ocl, buf_status, status, no_run, &ev_status))
+			{
+				break;
+			}
+		}
+
+		/* ----------- */
+		/* read buffer */
+		/* ----------- */
+		err = clEnqueueReadBuffer(ocl.queue, buf_cen, CL_FALSE, 0, sizeof(cl_float) * sz_class * dim, cent_arr, 0, NULL, NULL);
+		CHECK_ERROR(err);
+		err = clEnqueueReadBuffer(ocl.queue, buf_par, CL_FALSE, 0, sizeof(cl_int) * no_run * sz_data_stride, part_arr, 0, NULL, NULL);
+		CHECK_ERROR(err);
+		if(NULL != ev_status)
+		{
+			clReleaseEvent(ev_status);
+		}
+		err = clEnqueueReadBuffer(ocl.queue, buf_status, CL_TRUE, 0, sizeof(cl_int) * no_run * KM_STATUS_SIZE, status, 0, NULL, NULL);
+		CHECK_ERROR(err);
+
+		for(idx_run = 0 ; idx_run < no_run ; idx_run++)
+		{
+			KmeansRun *run = &group[idx_run];
+			int *run_label = (NULL != run->clsfy_result) ? run->clsfy_result : label;
+
+			memcpy(run->centroids, &cent_arr[(size_t)cent_begin[idx_run] * dim], sizeof(float) * run->class_n * dim);
+			memcpy(run_label, &part_arr[(size_t)idx_run * sz_data_stride], sizeof(int) * data_n);
+			run->result.iteration_n = status[idx_run * KM_STATUS_SIZE + KM_STATUS_ITER];
+			run->result.converged   = status[idx_run * KM_STATUS_SIZE + KM_STATUS_DONE];
+			run->result.inertia     = kmeans_inertia(run->class_n, data_n, dim, run->centroids, data, run_label);
+			run->result.distance_n  = (long long)run->result.iteration_n * data_n * run->class_n;
+		}
+
+		/* ------------- */
+		/* release stage */
+		/* ------------- */
+		clReleaseMemObject(buf_cen);
+		clReleaseMemObject(buf_cen_run);
+		clReleaseMemObject(buf_cen_begin);
+		clReleaseMemObject(buf_par);
+		clReleaseMemObject(buf_sum);
+		clReleaseMemObject(buf_cnt);
+		clReleaseMemObject(buf_status);
+		clReleaseMemObject(buf_cen_empty);
+		clReleaseMemObject(buf_dist);
+		clReleaseKernel(kernel_assign);
+		clReleaseKernel(kernel_divide);
+		clReleaseKernel(kernel_reseed_dist);
+		clReleaseKernel(kernel_reseed_pick);
+		clReleaseKernel(kernel_check);
+		free(cent_run);
+		free(cent_begin);
+		free(cent_arr);
+		free(part_arr);
+		free(status);
+	}
+
+	clReleaseMemObject(buf_dat);
+	km_ocl_release(&ocl);
+	free(label);
+}
+
+
+/* Prediction: the centroids, the program and the kmeans_predict kernel stay on the device; the
+   query, label and distance buffers, device and pinned, grow to the largest batch seen */
+struct KmeansModel
+{
+	/* the host copy, for small batches and when there is no device */
+	KmSimdModel* host;
+	bool has_device;
+
+	KmOcl ocl;
+	cl_int class_n;
+	cl_int dim;
+	cl_kernel kernel_predict;
+	cl_mem buf_cen;
+
+	/* queries the buffers below hold */
+	cl_int sz_query;
+	cl_mem buf_stage;
+	float *stage_ptr;
+	cl_mem buf_part_stage;
+	cl_int *part_ptr;
+	cl_mem buf_dist_stage;
+	float *dist_ptr;
+	cl_mem buf_dat;
+	cl_mem buf_par;
+	cl_mem buf_dist;
+};
+
+static void km_model_release_buffers(KmeansModel* model)
+{
+	if(0 == model->sz_query)
+	{
+		return;
+	}
+
+	clEnqueueUnmapMemObject(model->ocl.queue, model->buf_stage,      model->stage_ptr, 0, NULL, NULL);
+	clEnqueueUnmapMemObject(model->ocl.queue, model->buf_part_stage, model->part_ptr,  0, NULL, NULL);
+	clEnqueueUnmapMemObject(model->ocl.queue, model->buf_dist_stage, model->dist_ptr,  0, NULL, NULL);
+	clFinish(model->ocl.queue);
+	clReleaseMemObject(model->buf_stage);
+	clReleaseMemObject(model->buf_part_stage);
+	clReleaseMemObject(model->buf_dist_stage);
+	clReleaseMemObject(model->buf_dat);
+	clReleaseMemObject(model->buf_par);
+	clReleaseMemObject(model->buf_dist);
+	model->sz_query = 0;
+}
+
+/* room for query_n queries; grows at least twofold so that rising batch sizes reallocate rarely */
+static void km_model_reserve(KmeansModel* model, cl_int query_n)
+{
+	cl_int err = CL_SUCCESS;
+	cl_int sz_query = 0;
+	size_t sz_soa   = 0;
+
+	if(query_n <= model->sz_query)
+	{
+		return;
+	}
+
+	sz_query = std::min(MAX_NO_DATA, std::max(query_n, 2 * model->sz_query));
+	sz_query = ((sz_query + SZ_DATA_ALIGN - 1) / SZ_DATA_ALIGN) * SZ_DATA_ALIGN;
+	sz_soa   = sizeof(cl_float) * sz_query * model->dim;
+	km_model_release_buffers(model);
+
+	model->buf_stage      = clCreateBuffer(model->ocl.context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, sz_soa,                     NULL, &err);
+	CHECK_ERROR(err);
+	model->buf_part_stage = clCreateBuffer(model->ocl.context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, sizeof(cl_int)   * sz_query, NULL, &err);
+	CHECK_ERROR(err);
+	model->buf_dist_stage = clCreateBuffer(model->ocl.context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, sizeof(cl_float) * sz_query, NULL, &err);
+	CHECK_ERROR(err);
+	model->stage_ptr = (float  *)clEnqueueMapBuffer(model->ocl.queue, model->buf_stage,      CL_TRUE, CL_MAP_WRITE, 0, sz_soa,                     0, NULL, NULL, &err);
+	CHECK_ERROR(err);
+	model->part_ptr  = (cl_int *)clEnqueueMapBuffer(model->ocl.queue, model->buf_part_stage, CL_TRUE, CL_MAP_READ,  0, sizeof(cl_int)   * sz_query, 0, NULL, NULL, &err);
+	CHECK_ERROR(err);
+	model->dist_ptr  = (float  *)clEnqueueMapBuffer(model->ocl.queue, model->buf_dist_stage, CL_TRUE, CL_MAP_READ,  0, sizeof(cl_float) * sz_query, 0, NULL, NULL, &err);
+	CHECK_ERROR(err);
+	/* the padding past the last query of a batch is never read, but keep it defined */
+	memset(model->stage_ptr, 0, sz_soa);
+
+	model->buf_dat  = clCreateBuffer(model->ocl.context, CL_MEM_READ_ONLY,  sz_soa,                     NULL, &err);
+	CHECK_ERROR(err);
+	model->buf_par  = clCreateBuffer(model->ocl.context, CL_MEM_WRITE_ONLY, sizeof(cl_int)   * sz_query, NULL, &err);
+	CHECK_ERROR(err);
+	model->buf_dist = clCreateBuffer(model->ocl.context, CL_MEM_WRITE_ONLY, sizeof(cl_float) * sz_query, NULL, &err);
+	CHECK_ERROR(err);
+
+	err = clSetKernelArg(model->kernel_predict, 1, sizeof(cl_mem), &model->buf_dat);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(model->kernel_predict, 2, sizeof(cl_mem), &model->buf_par);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(model->kernel_predict, 3, sizeof(cl_mem), &model->buf_dist);
+	CHECK_ERROR(err);
+
+	model->sz_query = sz_query;
+}
+
+KmeansModel* kmeans_model_create(int class_n, int dim, const float* centroids)
+{
+	KmeansModel *model = new KmeansModel();
+	cl_device_id device = NULL;
+	cl_int err = CL_SUCCESS;
+
+	model->host       = km_simd_model_create(class_n, dim, centroids);
+	model->has_device = (0 < km_ocl_devices(1, &device));
+	model->class_n    = class_n;
+	model->dim        = dim;
+	model->sz_query   = 0;
+	if(!model->has_device)
+	{
+		fprintf(stderr, "no OpenCL GPU found, predicting on the CPU\n");
+		return model;
+	}
+
+	km_ocl_init(&model->ocl, device, class_n, dim);
+	model->kernel_predict = clCreateKernel(model->ocl.program, NAME_KERNEL_PREDICT, &err);
+	CHECK_ERROR(err);
+	model->buf_cen = clCreateBuffer(model->ocl.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(cl_float) * class_n * dim, (void *)centroids, &err);
+	CHECK_ERROR(err);
+
+	/* the query count and stride follow the batch, the buffers follow km_model_reserve */
+	err = clSetKernelArg(model->kernel_predict, 0, sizeof(cl_mem), &model->buf_cen);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(model->kernel_predict, 4, sizeof(cl_int), &model->class_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(model->kernel_predict, 6, sizeof(cl_int), &model->dim);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(model->kernel_predict, 8, sizeof(cl_int), &model->ocl.sz_tile_class);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(model->kernel_predict, 9, sizeof(cl_float) * model->ocl.sz_tile_class * dim, NULL);
+	CHECK_ERROR(err);
+
+	return model;
+}
+
+void kmeans_predict(KmeansModel* model, int query_n, const float* query, int* label, float* dist)
+{
+	int idx_query = 0;
+	cl_int idx_data = 0;
+	cl_int idx_dim  = 0;
+	cl_int dim = model->dim;
+	cl_int err = CL_SUCCESS;
+
+	if(!model->has_device || ((long long)query_n * model->class_n < PREDICT_HOST_WORK))
+	{
+		km_simd_predict(model->host, query_n, query, label, dist);
+		return;
+	}
+
+	/* batches beyond MAX_NO_DATA go through in pieces */
+	for(idx_query = 0 ; idx_query < query_n ; idx_query += MAX_NO_DATA)
+	{
+		cl_int cur_n = std::min(MAX_NO_DATA, query_n - idx_query);
+		cl_int sz_data_stride = ((cur_n + SZ_DATA_ALIGN - 1) / SZ_DATA_ALIGN) * SZ_DATA_ALIGN;
+		size_t sz_global = km_ocl_round_up((size_t)cur_n, model->ocl.sz_local_assign);
+
+		km_model_reserve(model, cur_n);
+
+		/* SoA with the stride of this batch, so only its own rows are copied */
+		for(idx_data = 0 ; idx_data < cur_n ; idx_data++)
+		{
+			const float *point = query + (size_t)(idx_query + idx_data) * dim;
+
+			for(idx_dim = 0 ; idx_dim < dim ; idx_dim++)
+			{
+				model->stage_ptr[(size_t)idx_dim * sz_data_stride + idx_data] = point[idx_dim];
+			}
+		}
+
+		err = clEnqueueWriteBuffer(model->ocl.queue, model->buf_dat, CL_FALSE, 0, sizeof(cl_float) * sz_data_stride * dim, model->stage_ptr, 0, NULL, NULL);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(model->kernel_predict, 5, sizeof(cl_int), &cur_n);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(model->kernel_predict, 7, sizeof(cl_int), &sz_data_stride);
+		CHECK_ERROR(err);
+		err = clEnqueueNDRangeKernel(model->ocl.queue, model->kernel_predict, 1, NULL, &sz_global, &model->ocl.sz_local_assign, 0, NULL, NULL);
+		CHECK_ERROR(err);
+		if(NULL != dist)
+		{
+			err = clEnqueueReadBuffer(model->ocl.queue, model->buf_dist, CL_FALSE, 0, sizeof(cl_float) * cur_n, model->dist_ptr, 0, NULL, NULL);
+			CHECK_ERROR(err);
+		}
+		err = clEnqueueReadBuffer(model->ocl.queue, model->buf_par, CL_TRUE, 0, sizeof(cl_int) * cur_n, model->part_ptr, 0, NULL, NULL);
+		CHECK_ERROR(err);
+
+		memcpy(label + idx_query, model->part_ptr, sizeof(int) * cur_n);
+		if(NULL != dist)
+		{
+			memcpy(dist + idx_query, model->dist_ptr, sizeof(float) * cur_n);
+		}
+	}
+}
+
+void kmeans_model_release(KmeansModel* model)
+{
+	if(model->has_device)
+	{
+		km_model_release_buffers(model);
+		clReleaseMemObject(model->buf_cen);
+		clReleaseKernel(model->kernel_predict);
+		km_ocl_release(&model->ocl);
+	}
+	km_simd_model_release(model->host);
+	delete model;
+}
+
+
+/* Online k-means: the centroids, their running counts (the g_seen_arr of kmeans_minibatch_step)
+   and the reservoir stay on the device with the program. kmeans_online_add uploads a batch,
+   assigns and accumulates it by brute force, moves the centroids with kmeans_minibatch_step and
+   copies the points the host's reservoir draws keep into their slots with kmeans_reservoir_keep,
+   so only the batch and its labels cross the bus. kmeans_online_refine runs kmeans()'s
+   iterations over the reservoir, kernel by kernel, with the same kernels. */
+struct KmeansOnline
+{
+	/* the host state, when there is no device; NULL otherwise */
+	KmOnline* host;
+
+	KmOcl ocl;
+	KmeansConfig config;
+	cl_int class_n;
+	cl_int dim;
+	cl_int clear_sum;
+
+	cl_kernel kernel_assign;
+	cl_kernel kernel_update;
+	cl_kernel kernel_step;
+	cl_kernel kernel_reduct;
+	cl_kernel kernel_reseed_dist;
+	cl_kernel kernel_reseed_pick;
+	cl_kernel kernel_check;
+	cl_kernel kernel_predict;
+	cl_kernel kernel_keep;
+
+	cl_mem buf_cen;
+	cl_mem buf_seen;
+	cl_mem buf_cen_arr;
+	cl_mem buf_cnt_arr;
+	cl_mem buf_cen_empty;
+	cl_mem buf_status;
+
+	/* reservoir in SoA order, res_n of its sz_res_stride slots filled */
+	KmRng rng;
+	long long added_n;
+	cl_int res_n;
+	cl_int sz_res_stride;
+	cl_mem buf_res;
+	cl_mem buf_res_par;
+	cl_mem buf_res_dist;
+	/* per slot, its entry in the keep list of the batch being added, else -1 */
+	cl_int *res_keep;
+
+	/* batch points the buffers below hold; the keep list is the batch positions, then at
+	   sz_batch the reservoir slots */
+	cl_int sz_batch;
+	cl_mem buf_stage;
+	float *stage_ptr;
+	cl_mem buf_part_stage;
+	cl_int *part_ptr;
+	cl_mem buf_keep_stage;
+	cl_int *keep_ptr;
+	cl_mem buf_dat;
+	cl_mem buf_par;
+	cl_mem buf_keep_src;
+	cl_mem buf_keep_res;
+};
+
+static void km_online_release_buffers(KmeansOnline* online)
+{
+	if(0 == online->sz_batch)
+	{
+		return;
+	}
+
+	clEnqueueUnmapMemObject(online->ocl.queue, online->buf_stage,      online->stage_ptr, 0, NULL, NULL);
+	clEnqueueUnmapMemObject(online->ocl.queue, online->buf_part_stage, online->part_ptr,  0, NULL, NULL);
+	clEnqueueUnmapMemObject(online->ocl.queue, online->buf_keep_stage, online->keep_ptr,  0, NULL, NULL);
+	clFinish(online->ocl.queue);
+	clReleaseMemObject(online->buf_stage);
+	clReleaseMemObject(online->buf_part_stage);
+	clReleaseMemObject(online->buf_keep_stage);
+	clReleaseMemObject(online->buf_dat);
+	clReleaseMemObject(online->buf_par);
+	clReleaseMemObject(online->buf_keep_src);
+	clReleaseMemObject(online->buf_keep_res);
+	online->sz_batch = 0;
+}
+
+/* room for batch_n points; grows as km_model_reserve does */
+static void km_online_reserve(KmeansOnline* online, cl_int batch_n)
+{
+	cl_int err = CL_SUCCESS;
+	cl_int sz_batch = 0;
+	size_t sz_soa   = 0;
+
+	if(batch_n <= online->sz_batch)
+	{
+		return;
+	}
+
+	sz_batch = std::min(MAX_NO_DATA, std::max(batch_n, 2 * online->sz_batch));
+	sz_batch = ((sz_batch + SZ_DATA_ALIGN - 1) / SZ_DATA_ALIGN) * SZ_DATA_ALIGN;
+	sz_soa   = sizeof(cl_float) * sz_batch * online->dim;
+	km_online_release_buffers(online);
+
+	online->buf_stage      = clCreateBuffer(online->ocl.context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, sz_soa,                       NULL, &err);
+	CHECK_ERROR(err);
+	online->buf_part_stage = clCreateBuffer(online->ocl.context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, sizeof(cl_int) * sz_batch,     NULL, &err);
+	CHECK_ERROR(err);
+	online->buf_keep_stage = clCreateBuffer(online->ocl.context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, sizeof(cl_int) * 2 * sz_batch, NULL, &err);
+	CHECK_ERROR(err);
+	online->stage_ptr = (float  *)clEnqueueMapBuffer(online->ocl.queue, online->buf_stage,      CL_TRUE, CL_MAP_WRITE, 0, sz_soa,                       0, NULL, NULL, &err);
+	CHECK_ERROR(err);
+	online->part_ptr  = (cl_int *)clEnqueueMapBuffer(online->ocl.queue, online->buf_part_stage, CL_TRUE, CL_MAP_READ,  0, sizeof(cl_int) * sz_batch,     0, NULL, NULL, &err);
+	CHECK_ERROR(err);
+	online->keep_ptr  = (cl_int *)clEnqueueMapBuffer(online->ocl.queue, online->buf_keep_stage, CL_TRUE, CL_MAP_WRITE, 0, sizeof(cl_int) * 2 * sz_batch, 0, NULL, NULL, &err);
+	CHECK_ERROR(err);
+	/* the padding past the last point of a batch is never read, but keep it defined */
+	memset(online->stage_ptr, 0, sz_soa);
+
+	online->buf_dat      = clCreateBuffer(online->ocl.context, CL_MEM_READ_ONLY,  sz_soa,                   NULL, &err);
+	CHECK_ERROR(err);
+	online->buf_par      = clCreateBuffer(online->ocl.context, CL_MEM_READ_WRITE, sizeof(cl_int) * sz_batch, NULL, &err);
+	CHECK_ERROR(err);
+	online->buf_keep_src = clCreateBuffer(online->ocl.context, CL_MEM_READ_ONLY,  sizeof(cl_int) * sz_batch, NULL, &err);
+	CHECK_ERROR(err);
+	online->buf_keep_res = clCreateBuffer(online->ocl.context, CL_MEM_READ_ONLY,  sizeof(cl_int) * sz_batch, NULL, &err);
+	CHECK_ERROR(err);
+
+	err = clSetKernelArg(online->kernel_keep, 1, sizeof(cl_mem), &online->buf_dat);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_keep, 2, sizeof(cl_mem), &online->buf_keep_src);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_keep, 3, sizeof(cl_mem), &online->buf_keep_res);
+	CHECK_ERROR(err);
+
+	online->sz_batch = sz_batch;
+}
+
+KmeansOnline* kmeans_online_create(const KmeansConfig* config, int class_n, int dim, const float* centroids)
+{
+	KmeansOnline *online = new KmeansOnline();
+	KmOcl *ocl = &online->ocl;
+	cl_device_id device = NULL;
+	cl_int err = CL_SUCCESS;
+	cl_int idx_slot = 0;
+	cl_int zero = 0;
+
+	if(0 == km_ocl_devices(1, &device))
+	{
+		fprintf(stderr, "no OpenCL GPU found, clustering on the CPU\n");
+		online->host = km_online_create(config, class_n, dim, centroids);
+		return online;
+	}
+	if(config->reservoir_n > MAX_NO_DATA)
+	{
+		printf("reservoir_n(%d) is larger than MAX_NO_DATA(%d). check it!\n", config->reservoir_n, MAX_NO_DATA);
+		exit(1);
+	}
+
+	online->host      = NULL;
+	online->config    = *config;
+	online->class_n   = class_n;
+	online->dim       = dim;
+	online->added_n   = 0;
+	online->res_n     = 0;
+	online->sz_batch  = 0;
+	/* a reservoir of 0 points still gets buffers, of one aligned block */
+	online->sz_res_stride = ((std::max(config->reservoir_n, 1) + SZ_DATA_ALIGN - 1) / SZ_DATA_ALIGN) * SZ_DATA_ALIGN;
+	online->res_keep  = (cl_int *)malloc(sizeof(cl_int) * online->sz_res_stride);
+	for(idx_slot = 0 ; idx_slot < online->sz_res_stride ; idx_slot++)
+	{
+		online->res_keep[idx_slot] = -1;
+	}
+	km_rng_seed(&online->rng, config->seed);
+
+	km_ocl_init(ocl, device, class_n, dim);
+	online->clear_sum = !ocl->use_local_update;
+
+	online->kernel_assign = clCreateKernel(ocl->program, NAME_KERNEL_ASSIGN, &err);
+	CHECK_ERROR(err);
+	online->kernel_update = clCreateKernel(ocl->program, ocl->use_local_update ? NAME_KERNEL_UPDATE : NAME_KERNEL_UPDATE_GLOBAL, &err);
+	CHECK_ERROR(err);
+	online->kernel_step   = clCreateKernel(ocl->program, NAME_KERNEL_MINIBATCH_STEP, &err);
+	CHECK_ERROR(err);
+	online->kernel_reduct = clCreateKernel(ocl->program, ocl->use_local_update ? NAME_KERNEL_REDUCT : NAME_KERNEL_DIVIDE, &err);
+	CHECK_ERROR(err);
+	online->kernel_reseed_dist = clCreateKernel(ocl->program, NAME_KERNEL_RESEED_DIST, &err);
+	CHECK_ERROR(err);
+	online->kernel_reseed_pick = clCreateKernel(ocl->program, NAME_KERNEL_RESEED_PICK, &err);
+	CHECK_ERROR(err);
+	online->kernel_check   = clCreateKernel(ocl->program, NAME_KERNEL_CHECK, &err);
+	CHECK_ERROR(err);
+	online->kernel_predict = clCreateKernel(ocl->program, NAME_KERNEL_PREDICT, &err);
+	CHECK_ERROR(err);
+	online->kernel_keep    = clCreateKernel(ocl->program, NAME_KERNEL_RESERVOIR_KEEP, &err);
+	CHECK_ERROR(err);
+
+	online->buf_cen       = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(cl_float) * class_n * dim, (void *)centroids, &err);
+	CHECK_ERROR(err);
+	online->buf_seen      = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n,                                          NULL, &err);
+	CHECK_ERROR(err);
+	online->buf_cnt_arr   = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_int)   * class_n * ocl->sz_group_update,                    NULL, &err);
+	CHECK_ERROR(err);
+	online->buf_cen_arr   = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n * dim * KM_ACC_SIZE * ocl->sz_group_update, NULL, &err);
+	CHECK_ERROR(err);
+	online->buf_cen_empty = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_int)   * class_n,                                          NULL, &err);
+	CHECK_ERROR(err);
+	online->buf_status    = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_int)   * KM_STATUS_SIZE,                                   NULL, &err);
 	CHECK_ERROR(err);
-	err = clSetKernelArg(kernel_reduct, 4, sizeof(cl_int), &sz_max_src_reduct);
+	online->buf_res       = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_float) * online->sz_res_stride * dim,                      NULL, &err);
 	CHECK_ERROR(err);
-	err = clSetKernelArg(kernel_reduct, 5, sizeof(cl_int), &SZ_STRIDE_REDUCT);
+	online->buf_res_par   = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_int)   * online->sz_res_stride,                            NULL, &err);
 	CHECK_ERROR(err);
-	err = clSetKernelArg(kernel_reduct, 6, sizeof(cl_int), &SZ_SLOT_IN_BANK_REDUCT);
+	online->buf_res_dist  = clCreateBuffer(ocl->context, CL_MEM_READ_WRITE, sizeof(cl_float) * online->sz_res_stride,                            NULL, &err);
 	CHECK_ERROR(err);
 
+	/* no point seen yet and no iteration run; the global sums start at zero and kmeans_minibatch_step
+	   and kmeans_divide clear them */
+	err = clEnqueueFillBuffer(ocl->queue, online->buf_seen,   &zero, sizeof(zero), 0, sizeof(cl_float) * class_n,      0, NULL, NULL);
+	CHECK_ERROR(err);
+	err = clEnqueueFillBuffer(ocl->queue, online->buf_status, &zero, sizeof(zero), 0, sizeof(cl_int) * KM_STATUS_SIZE, 0, NULL, NULL);
+	CHECK_ERROR(err);
+	if(online->clear_sum)
+	{
+		err = clEnqueueFillBuffer(ocl->queue, online->buf_cen_arr, &zero, sizeof(zero), 0, sizeof(cl_float) * class_n * dim * KM_ACC_SIZE, 0, NULL, NULL);
+		CHECK_ERROR(err);
+		err = clEnqueueFillBuffer(ocl->queue, online->buf_cnt_arr, &zero, sizeof(zero), 0, sizeof(cl_int)   * class_n,                     0, NULL, NULL);
+		CHECK_ERROR(err);
+	}
+	err = clFinish(ocl->queue);
+	CHECK_ERROR(err);
 
-	/* ---------- */
-	/* run kernel */
-	/* ---------- */
-	for(idx_iter = 0 ; idx_iter < iteration_n ; idx_iter++)
+	/* kmeans_minibatch_step and kmeans_reduct or kmeans_divide read and write the same buffers
+	   for every batch and refinement; the assignment, update and reseed kernels follow the points */
+	err = clSetKernelArg(online->kernel_step, 0, sizeof(cl_mem), &online->buf_cen);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_step, 1, sizeof(cl_mem), &online->buf_cen_arr);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_step, 2, sizeof(cl_mem), &online->buf_cnt_arr);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_step, 3, sizeof(cl_mem), &online->buf_seen);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_step, 4, sizeof(cl_int), &online->class_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_step, 5, sizeof(cl_int), &online->dim);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_step, 6, sizeof(cl_int), &ocl->sz_group_update);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_step, 7, sizeof(cl_int), &online->clear_sum);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_step, 8, sizeof(cl_mem), &online->buf_cen_empty);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_step, 9, sizeof(cl_mem), &online->buf_status);
+	CHECK_ERROR(err);
+
+	err = clSetKernelArg(online->kernel_reduct, 0, sizeof(cl_mem), &online->buf_cen);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_reduct, 1, sizeof(cl_mem), &online->buf_cen_arr);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_reduct, 2, sizeof(cl_mem), &online->buf_cnt_arr);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_reduct, 3, sizeof(cl_int), &online->class_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_reduct, 4, sizeof(cl_int), &online->dim);
+	CHECK_ERROR(err);
+	if(ocl->use_local_update)
 	{
-        /* ------------------------ */
-		/* run kernel -- assignment */
-        /* ------------------------ */
-		err = clEnqueueNDRangeKernel(queue, kernel_assign, 1, NULL, &sz_global_assign, &sz_local_assign, 0, NULL, NULL);
-		CHECK_ERROR(err);
-
-        /* -------------------- */
-		/* run kernel -- update */
-        /* -------------------- */
-		err = clEnqueueNDRangeKernel(queue, kernel_update, 1, NULL, &sz_global_update, &sz_local_update, 0, NULL, NULL);
-		CHECK_ERROR(err);
-		#if 0
-		if(idx_iter == 0)
-		{
-			int idx_bank;
-            int   * cnt_arr = (int   *)malloc(sizeof(int)   * SZ_MAX_CENTROID * SZ_NO_TASK_IN_WG*SZ_MAX_PES_ALL);
-            Point * cen_arr = (Point *)malloc(sizeof(Point) * SZ_MAX_CENTROID * SZ_NO_TASK_IN_WG* SZ_MAX_PES_ALL);
-			err = clEnqueueReadBuffer(queue, buf_cnt_arr, CL_TRUE,  0, sizeof(int)   * SZ_MAX_CENTROID * SZ_NO_TASK_IN_WG*SZ_MAX_PES_ALL, cnt_arr,   0, NULL, NULL);
-			err = clEnqueueReadBuffer(queue, buf_cen_arr, CL_TRUE,  0, sizeof(Point) * SZ_MAX_CENTROID * SZ_NO_TASK_IN_WG*SZ_MAX_PES_ALL, cen_arr,   0, NULL, NULL);
-
-			for(idx_bank = 0 ; idx_bank < 16 ; idx_bank++)
-			{
-				int sum = 0;
-				float fx = 0;
-				float fy = 0;
-				int xxx;
-                int ttt_sum[256] = {0};
-                float ttt_fx[256] = {0};
-                float ttt_fy[256] = {0};
-                int idx_sss = 0;
-				for(xxx = 0 ; xxx < SZ_MAX_PES_ALL*SZ_NO_TASK_IN_WG ; xxx++)
-				{
-                    idx_sss = xxx/32/SZ_NO_TASK_IN_WG;
-                    ttt_sum[idx_sss] += cnt_arr[idx_bank  * SZ_MAX_PES_ALL + xxx];
-                    ttt_fx[idx_sss]  += cen_arr[idx_bank  * SZ_MAX_PES_ALL + xxx].x;
-                    ttt_fy[idx_sss]  += cen_arr[idx_bank  * SZ_MAX_PES_ALL + xxx].y;
+		err = clSetKernelArg(online->kernel_reduct, 5, sizeof(cl_int), &ocl->sz_group_update);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(online->kernel_reduct, 6, sizeof(cl_mem), &online->buf_cen_empty);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(online->kernel_reduct, 7, sizeof(cl_mem), &online->buf_status);
+		CHECK_ERROR(err);
+	}
+	else
+	{
+		err = clSetKernelArg(online->kernel_reduct, 5, sizeof(cl_mem), &online->buf_cen_empty);
+		CHECK_ERROR(err);
+		err = clSetKernelArg(online->kernel_reduct, 6, sizeof(cl_mem), &online->buf_status);
+		CHECK_ERROR(err);
+	}
+
+	/* the reservoir count of kmeans_predict follows the refinement, the batch buffers of
+	   kmeans_reservoir_keep follow km_online_reserve */
+	err = clSetKernelArg(online->kernel_predict, 0, sizeof(cl_mem), &online->buf_cen);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_predict, 1, sizeof(cl_mem), &online->buf_res);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_predict, 2, sizeof(cl_mem), &online->buf_res_par);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_predict, 3, sizeof(cl_mem), &online->buf_res_dist);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_predict, 4, sizeof(cl_int), &online->class_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_predict, 6, sizeof(cl_int), &online->dim);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_predict, 7, sizeof(cl_int), &online->sz_res_stride);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_predict, 8, sizeof(cl_int), &ocl->sz_tile_class);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_predict, 9, sizeof(cl_float) * ocl->sz_tile_class * dim, NULL);
+	CHECK_ERROR(err);
+
+	err = clSetKernelArg(online->kernel_keep, 0, sizeof(cl_mem), &online->buf_res);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_keep, 5, sizeof(cl_int), &online->dim);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(online->kernel_keep, 7, sizeof(cl_int), &online->sz_res_stride);
+	CHECK_ERROR(err);
+
+	return online;
+}
+
+void kmeans_online_add(KmeansOnline* online, int batch_n, const float* batch, int* partitioned)
+{
+	KmOcl *ocl = &online->ocl;
+	int idx_batch = 0;
+	cl_int idx_data = 0;
+	cl_int idx_dim  = 0;
+	cl_int idx_keep = 0;
+	cl_int dim = online->dim;
+	cl_int err = CL_SUCCESS;
+	size_t sz_work_check = 1;
+
+	if(NULL != online->host)
+	{
+		km_online_add(online->host, batch_n, batch, partitioned);
+		return;
+	}
+
+	/* no stopping rule between batches: kmeans_check only clears the status words */
+	km_ocl_set_check_args(online->kernel_check, online->buf_status, -1.0f, 0);
+
+	/* batches beyond MAX_NO_DATA go through in pieces */
+	for(idx_batch = 0 ; idx_batch < batch_n ; idx_batch += MAX_NO_DATA)
+	{
+		cl_int cur_n = std::min(MAX_NO_DATA, batch_n - idx_batch);
+		cl_int sz_data_stride = ((cur_n + SZ_DATA_ALIGN - 1) / SZ_DATA_ALIGN) * SZ_DATA_ALIGN;
+		size_t sz_global_assign = km_ocl_round_up((size_t)cur_n, ocl->sz_local_assign);
+		size_t sz_global_step   = km_ocl_round_up((size_t)online->class_n, ocl->sz_local_reduct);
+		cl_int no_keep = 0;
+
+		km_online_reserve(online, cur_n);
+
+		/* SoA with the stride of this batch, and the reservoir draws in point order; of two
+		   points drawn for one slot only the later is kept */
+		for(idx_data = 0 ; idx_data < cur_n ; idx_data++)
+		{
+			const float *point = batch + (size_t)(idx_batch + idx_data) * dim;
+			int slot = km_reservoir_slot(&online->rng, online->added_n++, online->config.reservoir_n);
 
-					sum += cnt_arr[idx_bank * SZ_MAX_PES_ALL + xxx];
-					fx  += cen_arr[idx_bank * SZ_MAX_PES_ALL + xxx].x;
-					fy  += cen_arr[idx_bank * SZ_MAX_PES_ALL + xxx].y;
-                }
-                if(idx_bank == 0)
-                {
-                    for(xxx = 0 ; xxx < 64 ; xxx++)
-                    {
-                        printf("   %4d  %4d  %11.3f %11.3f\n", xxx, ttt_sum[xxx], ttt_fx[xxx], ttt_fy[xxx]);
-                    }
-                    printf("RRR %2d ==> [%6d] [%11.3f %11.3f]\n", idx_bank, sum, fx, fy);
-                }
+			for(idx_dim = 0 ; idx_dim < dim ; idx_dim++)
+			{
+				online->stage_ptr[(size_t)idx_dim * sz_data_stride + idx_data] = point[idx_dim];
+			}
+
+			if(0 > slot)
+			{
+				continue;
 			}
-            free(cnt_arr);
-            free(cen_arr);
+			if(0 <= online->res_keep[slot])
+			{
+				online->keep_ptr[online->res_keep[slot]] = idx_data;
+				continue;
+			}
+			online->res_keep[slot] = no_keep;
+			online->keep_ptr[no_keep] = idx_data;
+			online->keep_ptr[online->sz_batch + no_keep] = slot;
+			no_keep++;
+		}
+		for(idx_keep = 0 ; idx_keep < no_keep ; idx_keep++)
+		{
+			online->res_keep[online->keep_ptr[online->sz_batch + idx_keep]] = -1;
 		}
-		#endif
+		online->res_n = (cl_int)std::min(online->added_n, (long long)online->config.reservoir_n);
 
-        /* ----------------------- */
-		/* run kernel -- reduction */
-        /* ----------------------- */
-		err = clEnqueueNDRangeKernel(queue, kernel_reduct, 1, NULL, &sz_global_reduct, &sz_local_reduct, 0, NULL, NULL);
+		err = clEnqueueWriteBuffer(ocl->queue, online->buf_dat, CL_FALSE, 0, sizeof(cl_float) * sz_data_stride * dim, online->stage_ptr, 0, NULL, NULL);
 		CHECK_ERROR(err);
-		#if 0
-		if(idx_iter == 0)
+
+		km_ocl_set_assign_args(ocl, online->kernel_assign, online->buf_cen, online->buf_dat, online->buf_par, online->buf_status,
+		                       online->class_n, cur_n, dim, sz_data_stride);
+		km_ocl_set_update_args(ocl, online->kernel_update, online->buf_cen_arr, online->buf_cnt_arr, online->buf_dat, online->buf_par, online->buf_status,
+		                       online->class_n, cur_n, dim, sz_data_stride);
+
+		err = clEnqueueNDRangeKernel(ocl->queue, online->kernel_assign, 1, NULL, &sz_global_assign, &ocl->sz_local_assign, 0, NULL, NULL);
+		CHECK_ERROR(err);
+		err = clEnqueueNDRangeKernel(ocl->queue, online->kernel_update, 1, NULL, &ocl->sz_global_update, &ocl->sz_local_update, 0, NULL, NULL);
+		CHECK_ERROR(err);
+		err = clEnqueueNDRangeKernel(ocl->queue, online->kernel_step, 1, NULL, &sz_global_step, &ocl->sz_local_reduct, 0, NULL, NULL);
+		CHECK_ERROR(err);
+		err = clEnqueueNDRangeKernel(ocl->queue, online->kernel_check, 1, NULL, &sz_work_check, &sz_work_check, 0, NULL, NULL);
+		CHECK_ERROR(err);
+
+		if(0 < no_keep)
 		{
-            int idx_bank;
-			err = clEnqueueReadBuffer(queue, buf_cen, CL_TRUE,  0, sizeof(Point)  * class_n, centroids,   0, NULL, NULL);
-			printf("\n\nclclcl\n");
-			for(idx_bank = 0 ; idx_bank < class_n ; idx_bank++)
-			{
-				printf("%2d ==> [%11.3f %11.3f]\n", idx_bank, centroids[idx_bank].x, centroids[idx_bank].y);
-			}
+			size_t sz_global_keep = km_ocl_round_up((size_t)no_keep, ocl->sz_local_reduct);
+
+			err = clEnqueueWriteBuffer(ocl->queue, online->buf_keep_src, CL_FALSE, 0, sizeof(cl_int) * no_keep, online->keep_ptr,                    0, NULL, NULL);
+			CHECK_ERROR(err);
+			err = clEnqueueWriteBuffer(ocl->queue, online->buf_keep_res, CL_FALSE, 0, sizeof(cl_int) * no_keep, online->keep_ptr + online->sz_batch, 0, NULL, NULL);
+			CHECK_ERROR(err);
+			err = clSetKernelArg(online->kernel_keep, 4, sizeof(cl_int), &no_keep);
+			CHECK_ERROR(err);
+			err = clSetKernelArg(online->kernel_keep, 6, sizeof(cl_int), &sz_data_stride);
+			CHECK_ERROR(err);
+			err = clEnqueueNDRangeKernel(ocl->queue, online->kernel_keep, 1, NULL, &sz_global_keep, &ocl->sz_local_reduct, 0, NULL, NULL);
+			CHECK_ERROR(err);
 		}
-		#endif
-	}		
 
-	/* ----------- */
-	/* read buffer */
-	/* ----------- */
-	err = clEnqueueReadBuffer(queue, buf_par, CL_FALSE, 0, sizeof(cl_int) * data_n,  partitioned, 0, NULL, NULL);
+		/* the staging memory is refilled by the next piece */
+		if(NULL != partitioned)
+		{
+			err = clEnqueueReadBuffer(ocl->queue, online->buf_par, CL_TRUE, 0, sizeof(cl_int) * cur_n, online->part_ptr, 0, NULL, NULL);
+			CHECK_ERROR(err);
+			memcpy(partitioned + idx_batch, online->part_ptr, sizeof(int) * cur_n);
+		}
+		else
+		{
+			err = clFinish(ocl->queue);
+			CHECK_ERROR(err);
+		}
+	}
+}
+
+/* kmeans()'s iterations over the reservoir, then one kmeans_predict pass against the final
+   centroids for the cluster sizes and the inertia */
+void kmeans_online_refine(KmeansOnline* online, int iteration_n, KmeansResult* result)
+{
+	KmOcl *ocl = &online->ocl;
+	cl_int idx_iter = 0;
+	cl_int idx_data = 0;
+	cl_int idx_class = 0;
+	cl_int res_n = online->res_n;
+	cl_int err = CL_SUCCESS;
+	cl_int zero = 0;
+	cl_int unassigned = -1;
+	size_t sz_work_check = 1;
+	size_t sz_global_assign = 0;
+	size_t sz_global_reduct = 0;
+	cl_int status[KM_STATUS_SIZE] = { 0, 0, 0, 0, 0, 0 };
+	cl_event ev_status = NULL;
+	std::vector<KmLaunch> body;
+	/* not profiled: KM_OCL_PROFILE covers kmeans() */
+	KmProf prof;
+	cl_int *part_arr = NULL;
+	float *dist_arr = NULL;
+	float *seen_arr = NULL;
+	double inertia = 0.0;
+
+	if(NULL != online->host)
+	{
+		km_online_refine(online->host, iteration_n, result);
+		return;
+	}
+
+	result->iteration_n = 0;
+	result->converged   = 0;
+	result->inertia     = 0.0;
+	result->distance_n  = 0;
+	if(0 == res_n)
+	{
+		return;
+	}
+
+	prof.path = NULL;
+	sz_global_assign = km_ocl_round_up((size_t)res_n, ocl->sz_local_assign);
+	sz_global_reduct = km_ocl_round_up(ocl->use_local_update ? ((size_t)online->class_n * online->dim) : (size_t)online->class_n, ocl->sz_local_reduct);
+
+	/* no point starts in a cluster, as in kmeans() */
+	err = clEnqueueFillBuffer(ocl->queue, online->buf_res_par, &unassigned, sizeof(unassigned), 0, sizeof(cl_int) * res_n, 0, NULL, NULL);
 	CHECK_ERROR(err);
-	err = clEnqueueReadBuffer(queue, buf_cen, CL_TRUE,  0, sizeof(Point)  * class_n, centroids,   0, NULL, NULL);
+	err = clEnqueueFillBuffer(ocl->queue, online->buf_status,  &zero,       sizeof(zero),       0, sizeof(status),         0, NULL, NULL);
 	CHECK_ERROR(err);
 
-	/* ------------- */
-	/* release stage */
-	/* ------------- */
+	km_ocl_set_assign_args(ocl, online->kernel_assign, online->buf_cen, online->buf_res, online->buf_res_par, online->buf_status,
+	                       online->class_n, res_n, online->dim, online->sz_res_stride);
+	km_ocl_set_update_args(ocl, online->kernel_update, online->buf_cen_arr, online->buf_cnt_arr, online->buf_res, online->buf_res_par, online->buf_status,
+	                       online->class_n, res_n, online->dim, online->sz_res_stride);
+	km_ocl_set_reseed_args(ocl, online->kernel_reseed_dist, online->kernel_reseed_pick, online->buf_cen, online->buf_res, online->buf_res_par,
+	                       online->buf_res_dist, online->buf_cen_empty, online->buf_status, online->class_n, res_n, online->dim, online->sz_res_stride);
+	km_ocl_set_check_args(online->kernel_check, online->buf_status, online->config.tolerance, 1);
+
+	{
+		KmLaunch launch_assign      = { online->kernel_assign, sz_global_assign, ocl->sz_local_assign, NAME_KERNEL_ASSIGN };
+		KmLaunch launch_update      = { online->kernel_update, ocl->sz_global_update, ocl->sz_local_update, ocl->use_local_update ? NAME_KERNEL_UPDATE : NAME_KERNEL_UPDATE_GLOBAL };
+		KmLaunch launch_reduct      = { online->kernel_reduct, sz_global_reduct, ocl->sz_local_reduct, ocl->use_local_update ? NAME_KERNEL_REDUCT : NAME_KERNEL_DIVIDE };
+		KmLaunch launch_reseed_dist = { online->kernel_reseed_dist, sz_global_assign, ocl->sz_local_assign, NAME_KERNEL_RESEED_DIST };
+		KmLaunch launch_reseed_pick = { online->kernel_reseed_pick, ocl->sz_local_reduct, ocl->sz_local_reduct, NAME_KERNEL_RESEED_PICK };
+		KmLaunch launch_check       = { online->kernel_check, sz_work_check, sz_work_check, NAME_KERNEL_CHECK };
+		body.push_back(launch_assign);
+		body.push_back(launch_update);
+		body.push_back(launch_reduct);
+		body.push_back(launch_reseed_dist);
+		body.push_back(launch_reseed_pick);
+		body.push_back(launch_check);
+	}
+
+	for(idx_iter = 0 ; idx_iter < iteration_n ; idx_iter++)
+	{
+		km_ocl_enqueue_body(ocl, body, &prof, idx_iter);
+
+		if((0 == ((idx_iter + 1) % online->config.check_interval)) && km_ocl_poll_status(ocl, online->buf_status, status, 1, &ev_status))
+		{
+			break;
+		}
+	}
+
+	err = clSetKernelArg(online->kernel_predict, 5, sizeof(cl_int), &res_n);
+	CHECK_ERROR(err);
+	err = clEnqueueNDRangeKernel(ocl->queue, online->kernel_predict, 1, NULL, &sz_global_assign, &ocl->sz_local_assign, 0, NULL, NULL);
+	CHECK_ERROR(err);
+
+	part_arr = (cl_int *)malloc(sizeof(cl_int) * res_n);
+	dist_arr = (float  *)malloc(sizeof(float)  * res_n);
+	seen_arr = (float  *)calloc(online->class_n, sizeof(float));
+	if(NULL != ev_status)
+	{
+		clReleaseEvent(ev_status);
+	}
+	err = clEnqueueReadBuffer(ocl->queue, online->buf_status,   CL_FALSE, 0, sizeof(status),         status,   0, NULL, NULL);
+	CHECK_ERROR(err);
+	err = clEnqueueReadBuffer(ocl->queue, online->buf_res_dist, CL_FALSE, 0, sizeof(float)  * res_n, dist_arr, 0, NULL, NULL);
+	CHECK_ERROR(err);
+	err = clEnqueueReadBuffer(ocl->queue, online->buf_res_par,  CL_TRUE,  0, sizeof(cl_int) * res_n, part_arr, 0, NULL, NULL);
+	CHECK_ERROR(err);
+
+	/* every reservoir point stands for added_n / res_n points added */
+	for(idx_data = 0 ; idx_data < res_n ; idx_data++)
+	{
+		seen_arr[part_arr[idx_data]] += 1.0f;
+		inertia += dist_arr[idx_data];
+	}
+	for(idx_class = 0 ; idx_class < online->class_n ; idx_class++)
+	{
+		seen_arr[idx_class] = (float)((double)seen_arr[idx_class] * online->added_n / res_n);
+	}
+	err = clEnqueueWriteBuffer(ocl->queue, online->buf_seen, CL_FALSE, 0, sizeof(float) * online->class_n, seen_arr, 0, NULL, NULL);
+	CHECK_ERROR(err);
+	/* the next batches run with the status words cleared */
+	err = clEnqueueFillBuffer(ocl->queue, online->buf_status, &zero, sizeof(zero), 0, sizeof(status), 0, NULL, NULL);
+	CHECK_ERROR(err);
+	err = clFinish(ocl->queue);
+	CHECK_ERROR(err);
+
+	result->iteration_n = status[KM_STATUS_ITER];
+	result->converged   = status[KM_STATUS_DONE];
+	result->inertia     = inertia;
+	result->distance_n  = (long long)(result->iteration_n + 1) * res_n * online->class_n;
+
+	free(part_arr);
+	free(dist_arr);
+	free(seen_arr);
+}
+
+void kmeans_online_centroids(KmeansOnline* online, float* centroids)
+{
+	cl_int err = CL_SUCCESS;
+
+	if(NULL != online->host)
+	{
+		km_online_centroids(online->host, centroids);
+		return;
+	}
+
+	err = clEnqueueReadBuffer(online->ocl.queue, online->buf_cen, CL_TRUE, 0, sizeof(cl_float) * online->class_n * online->dim, centroids, 0, NULL, NULL);
+	CHECK_ERROR(err);
+}
+
+void kmeans_online_release(KmeansOnline* online)
+{
+	if(NULL != online->host)
+	{
+		km_online_release(online->host);
+		delete online;
+		return;
+	}
+
+	km_online_release_buffers(online);
+	clReleaseMemObject(online->buf_cen);
+	clReleaseMemObject(online->buf_seen);
+	clReleaseMemObject(online->buf_cen_arr);
+	clReleaseMemObject(online->buf_cnt_arr);
+	clReleaseMemObject(online->buf_cen_empty);
+	clReleaseMemObject(online->buf_status);
+	clReleaseMemObject(online->buf_res);
+	clReleaseMemObject(online->buf_res_par);
+	clReleaseMemObject(online->buf_res_dist);
+	clReleaseKernel(online->kernel_assign);
+	clReleaseKernel(online->kernel_update);
+	clReleaseKernel(online->kernel_step);
+	clReleaseKernel(online->kernel_reduct);
+	clReleaseKernel(online->kernel_reseed_dist);
+	clReleaseKernel(online->kernel_reseed_pick);
+	clReleaseKernel(online->kernel_check);
+	clReleaseKernel(online->kernel_predict);
+	clReleaseKernel(online->kernel_keep);
+	km_ocl_release(&online->ocl);
+	free(online->res_keep);
+	delete online;
+}
+
+
+/* Weighted k-means: kmeans()'s brute-force iterations, kernel by kernel, with
+   kmeans_update_weighted and kmeans_divide_weighted (kmeans_weighted.cl) in place of the update
+   and reduction. The weights go to the device once, next to the SoA data; the weighted sums are
+   compensated global atomics, so there is no per-work-group slice to reduce. The seeding
+   (weighted k-means++) and the weighted inertia run on the host. */
+void kmeans_weighted(const KmeansConfig* config, int class_n, int data_n, int dim, float* centroids, const float* data, const float* weight,
+                     int* partitioned, KmeansResult* result)
+{
+	cl_int idx_iter = 0;
+	size_t idx_data = 0;
+	cl_int idx_dim  = 0;
+	cl_int err = CL_SUCCESS;
+	cl_int zero = 0;
+
+	KmOcl ocl;
+	cl_device_id device = NULL;
+
+	/* data in SoA order, as in kmeans() */
+	cl_int sz_data_stride = ((data_n + SZ_DATA_ALIGN - 1) / SZ_DATA_ALIGN) * SZ_DATA_ALIGN;
+	float *data_soa = NULL;
+
+	cl_kernel kernel_assign = NULL;
+	cl_kernel kernel_update = NULL;
+	cl_kernel kernel_divide = NULL;
+	cl_kernel kernel_reseed_dist = NULL;
+	cl_kernel kernel_reseed_pick = NULL;
+	cl_kernel kernel_check = NULL;
+	size_t sz_global_assign = 0;
+	size_t sz_global_divide = 0;
+	size_t sz_work_check    = 1;
+	cl_int idx_arg = 0;
+
+	cl_int status[KM_STATUS_SIZE] = { 0, 0, 0, 0, 0, 0 };
+	cl_event ev_status = NULL;
+	std::vector<KmLaunch> body;
+	/* not profiled: KM_OCL_PROFILE covers kmeans() */
+	KmProf prof;
+
+	cl_mem buf_cen = NULL;
+	cl_mem buf_dat = NULL;
+	cl_mem buf_wgt = NULL;
+	cl_mem buf_par = NULL;
+	cl_mem buf_sum = NULL;
+	cl_mem buf_wgt_sum   = NULL;
+	cl_mem buf_cen_empty = NULL;
+	cl_mem buf_dist   = NULL;
+	cl_mem buf_status = NULL;
+
+	if(NULL == weight)
+	{
+		kmeans(config, class_n, data_n, dim, centroids, data, partitioned, result);
+		return;
+	}
+	if(data_n > MAX_NO_DATA)
+	{
+		printf("data_n(%d) is larger than MAX_NO_DATA(%d). check it!\n", data_n, MAX_NO_DATA);
+		exit(1);
+	}
+	if(0 == km_ocl_devices(1, &device))
+	{
+		fprintf(stderr, "no OpenCL GPU found, running on the CPU\n");
+		kmeans_weighted_simd(config, class_n, data_n, dim, centroids, data, weight, partitioned, result);
+		return;
+	}
+	km_ocl_init(&ocl, device, class_n, dim);
+	prof.path = NULL;
+
+	sz_global_assign = km_ocl_round_up((size_t)data_n, ocl.sz_local_assign);
+	sz_global_divide = km_ocl_round_up((size_t)class_n, ocl.sz_local_reduct);
+
+	kernel_assign = clCreateKernel(ocl.program, NAME_KERNEL_ASSIGN, &err);
+	CHECK_ERROR(err);
+	kernel_update = clCreateKernel(ocl.program, NAME_KERNEL_UPDATE_WEIGHTED, &err);
+	CHECK_ERROR(err);
+	kernel_divide = clCreateKernel(ocl.program, NAME_KERNEL_DIVIDE_WEIGHTED, &err);
+	CHECK_ERROR(err);
+	kernel_reseed_dist = clCreateKernel(ocl.program, NAME_KERNEL_RESEED_DIST, &err);
+	CHECK_ERROR(err);
+	kernel_reseed_pick = clCreateKernel(ocl.program, NAME_KERNEL_RESEED_PICK, &err);
+	CHECK_ERROR(err);
+	kernel_check  = clCreateKernel(ocl.program, NAME_KERNEL_CHECK, &err);
+	CHECK_ERROR(err);
+
+	buf_cen       = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n * dim,               NULL, &err);
+	CHECK_ERROR(err);
+	buf_dat       = clCreateBuffer(ocl.context, CL_MEM_READ_ONLY,  sizeof(cl_float) * sz_data_stride * dim,        NULL, &err);
+	CHECK_ERROR(err);
+	buf_wgt       = clCreateBuffer(ocl.context, CL_MEM_READ_ONLY,  sizeof(cl_float) * data_n,                      NULL, &err);
+	CHECK_ERROR(err);
+	buf_par       = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_int)   * data_n,                      NULL, &err);
+	CHECK_ERROR(err);
+	buf_sum       = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n * dim * KM_ACC_SIZE, NULL, &err);
+	CHECK_ERROR(err);
+	buf_wgt_sum   = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_float) * class_n * KM_ACC_SIZE,       NULL, &err);
+	CHECK_ERROR(err);
+	buf_cen_empty = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_int)   * class_n,                     NULL, &err);
+	CHECK_ERROR(err);
+	buf_dist      = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_float) * data_n,                      NULL, &err);
+	CHECK_ERROR(err);
+	buf_status    = clCreateBuffer(ocl.context, CL_MEM_READ_WRITE, sizeof(cl_int)   * KM_STATUS_SIZE,              NULL, &err);
+	CHECK_ERROR(err);
+
+	data_soa = (float *)calloc((size_t)sz_data_stride * dim, sizeof(float));
+	for(idx_data = 0 ; idx_data < (size_t)data_n ; idx_data++)
+	{
+		for(idx_dim = 0 ; idx_dim < dim ; idx_dim++)
+		{
+			data_soa[(size_t)idx_dim * sz_data_stride + idx_data] = data[idx_data * dim + idx_dim];
+		}
+		/* no point starts in a cluster, so the first iteration counts every point as changed */
+		partitioned[idx_data] = -1;
+	}
+	km_weighted_seed(config, class_n, data_n, dim, data, weight, centroids);
+
+	err = clEnqueueWriteBuffer(ocl.queue, buf_dat, CL_FALSE, 0, sizeof(cl_float) * sz_data_stride * dim, data_soa,    0, NULL, NULL);
+	CHECK_ERROR(err);
+	err = clEnqueueWriteBuffer(ocl.queue, buf_wgt, CL_FALSE, 0, sizeof(cl_float) * data_n,               weight,      0, NULL, NULL);
+	CHECK_ERROR(err);
+	err = clEnqueueWriteBuffer(ocl.queue, buf_cen, CL_FALSE, 0, sizeof(cl_float) * class_n * dim,        centroids,   0, NULL, NULL);
+	CHECK_ERROR(err);
+	err = clEnqueueWriteBuffer(ocl.queue, buf_par, CL_FALSE, 0, sizeof(cl_int)   * data_n,               partitioned, 0, NULL, NULL);
+	CHECK_ERROR(err);
+	/* the sums start at zero and kmeans_divide_weighted clears them */
+	err = clEnqueueFillBuffer(ocl.queue, buf_sum,     &zero, sizeof(zero), 0, sizeof(cl_float) * class_n * dim * KM_ACC_SIZE, 0, NULL, NULL);
+	CHECK_ERROR(err);
+	err = clEnqueueFillBuffer(ocl.queue, buf_wgt_sum, &zero, sizeof(zero), 0, sizeof(cl_float) * class_n * KM_ACC_SIZE,       0, NULL, NULL);
+	CHECK_ERROR(err);
+	err = clEnqueueFillBuffer(ocl.queue, buf_status,  &zero, sizeof(zero), 0, sizeof(status),                                 0, NULL, NULL);
+	CHECK_ERROR(err);
+	err = clFinish(ocl.queue);
+	CHECK_ERROR(err);
+	free(data_soa);
+
+	km_ocl_set_assign_args(&ocl, kernel_assign, buf_cen, buf_dat, buf_par, buf_status, class_n, data_n, dim, sz_data_stride);
+	km_ocl_set_reseed_args(&ocl, kernel_reseed_dist, kernel_reseed_pick, buf_cen, buf_dat, buf_par, buf_dist, buf_cen_empty, buf_status,
+	                       class_n, data_n, dim, sz_data_stride);
+	km_ocl_set_check_args(kernel_check, buf_status, config->tolerance, 1);
+
+	idx_arg = 0;
+	err = clSetKernelArg(kernel_update, idx_arg++, sizeof(cl_mem), &buf_sum);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_update, idx_arg++, sizeof(cl_mem), &buf_wgt_sum);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_update, idx_arg++, sizeof(cl_mem), &buf_dat);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_update, idx_arg++, sizeof(cl_mem), &buf_wgt);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_update, idx_arg++, sizeof(cl_mem), &buf_par);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_update, idx_arg++, sizeof(cl_int), &data_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_update, idx_arg++, sizeof(cl_int), &dim);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_update, idx_arg++, sizeof(cl_int), &sz_data_stride);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_update, idx_arg++, sizeof(cl_mem), &buf_status);
+	CHECK_ERROR(err);
+
+	idx_arg = 0;
+	err = clSetKernelArg(kernel_divide, idx_arg++, sizeof(cl_mem), &buf_cen);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_divide, idx_arg++, sizeof(cl_mem), &buf_sum);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_divide, idx_arg++, sizeof(cl_mem), &buf_wgt_sum);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_divide, idx_arg++, sizeof(cl_int), &class_n);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_divide, idx_arg++, sizeof(cl_int), &dim);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_divide, idx_arg++, sizeof(cl_mem), &buf_cen_empty);
+	CHECK_ERROR(err);
+	err = clSetKernelArg(kernel_divide, idx_arg++, sizeof(cl_mem), &buf_status);
+	CHECK_ERROR(err);
+
+	{
+		KmLaunch launch_assign      = { kernel_assign, sz_global_assign, ocl.sz_local_assign, NAME_KERNEL_ASSIGN };
+		KmLaunch launch_update      = { kernel_update, ocl.sz_global_update, ocl.sz_local_update, NAME_KERNEL_UPDATE_WEIGHTED };
+		KmLaunch launch_divide      = { kernel_divide, sz_global_divide, ocl.sz_local_reduct, NAME_KERNEL_DIVIDE_WEIGHTED };
+		KmLaunch launch_reseed_dist = { kernel_reseed_dist, sz_global_assign, ocl.sz_local_assign, NAME_KERNEL_RESEED_DIST };
+		KmLaunch launch_reseed_pick = { kernel_reseed_pick, ocl.sz_local_reduct, ocl.sz_local_reduct, NAME_KERNEL_RESEED_PICK };
+		KmLaunch launch_check       = { kernel_check, sz_work_check, sz_work_check, NAME_KERNEL_CHECK };
+		body.push_back(launch_assign);
+		body.push_back(launch_update);
+		body.push_back(launch_divide);
+		body.push_back(launch_reseed_dist);
+		body.push_back(launch_reseed_pick);
+		body.push_back(launch_check);
+	}
+
+	for(idx_iter = 0 ; idx_iter < config->iteration_n ; idx_iter++)
+	{
+		km_ocl_enqueue_body(&ocl, body, &prof, idx_iter);
+
+		if((0 == ((idx_iter + 1) % config->check_interval)) && km_ocl_poll_status(&ocl, buf_status, status, 1, &ev_status))
+		{
+			break;
+		}
+	}
+
+	if(NULL != ev_status)
+	{
+		clReleaseEvent(ev_status);
+	}
+	err = clEnqueueReadBuffer(ocl.queue, buf_cen,    CL_FALSE, 0, sizeof(cl_float) * class_n * dim, centroids,   0, NULL, NULL);
+	CHECK_ERROR(err);
+	err = clEnqueueReadBuffer(ocl.queue, buf_par,    CL_FALSE, 0, sizeof(cl_int)   * data_n,        partitioned, 0, NULL, NULL);
+	CHECK_ERROR(err);
+	err = clEnqueueReadBuffer(ocl.queue, buf_status, CL_TRUE,  0, sizeof(status),                   status,      0, NULL, NULL);
+	CHECK_ERROR(err);
+
+	result->iteration_n = status[KM_STATUS_ITER];
+	result->converged   = status[KM_STATUS_DONE];
+	result->inertia     = km_weighted_inertia(class_n, data_n, dim, centroids, data, weight, partitioned);
+	result->distance_n  = (long long)result->iteration_n * data_n * class_n;
+
 	clReleaseMemObject(buf_cen);
 	clReleaseMemObject(buf_dat);
+	clReleaseMemObject(buf_wgt);
 	clReleaseMemObject(buf_par);
-	clReleaseMemObject(buf_cen_arr);
-	clReleaseMemObject(buf_cnt_arr);
+	clReleaseMemObject(buf_sum);
+	clReleaseMemObject(buf_wgt_sum);
+	clReleaseMemObject(buf_cen_empty);
+	clReleaseMemObject(buf_dist);
+	clReleaseMemObject(buf_status);
 	clReleaseKernel(kernel_assign);
 	clReleaseKernel(kernel_update);
-	clReleaseKernel(kernel_reduct);
-	clReleaseProgram(program);
-	clReleaseCommandQueue(queue);
-	clReleaseContext(context);
-
+	clReleaseKernel(kernel_divide);
+	clReleaseKernel(kernel_reseed_dist);
+	clReleaseKernel(kernel_reseed_pick);
+	clReleaseKernel(kernel_check);
+	km_ocl_release(&ocl);
 }
@@ -0,0 +1,289 @@
+/*
+
+ The whole Lloyd loop in one launch, built together with kmeans.cl (it uses DIM, the g_status
+ words and the compensated local sums from there).
+
+ On small problems the kernels of an iteration finish in microseconds and the launches, five or
+ more per iteration, cost as much as the work. kmeans_persistent runs every iteration of
+ kmeans() in a single launch instead: assignment, compensated accumulation, division, reseed of
+ empty clusters and the stopping rule, as the per-kernel path does them, with the sums added in
+ another order.
+
+ OpenCL 1.2 has no barrier across work-groups, and one built from global atomics deadlocks
+ unless every group is resident at once, which nothing guarantees. The kernel therefore runs as
+ one work-group, so barrier() is the grid-wide sync, with the centroids, their sums and counts
+ and the status words in local memory for the whole run. kmeans() only picks it while an
+ iteration is small enough for one compute unit.
+
+*/
+
+/* as in kmeans.cl: distances round as on the host */
+#pragma OPENCL FP_CONTRACT OFF
+
+/* l_tmp_status[KM_STATUS_SHIFT] = max(shift, |new_cent - old_cent|), as status_shift_max */
+void local_shift_max(volatile __local int* l_tmp_status, float new_cent, float old_cent)
+{
+	float shift = fabs(new_cent - old_cent);
+
+	if(0 != shift)
+	{
+		atomic_max((volatile __local unsigned int*)&l_tmp_status[KM_STATUS_SHIFT], as_uint(shift));
+	}
+}
+
+__kernel void kmeans_persistent(	__global        float*  g_res_cent_arr,
+									__global  const float*  g_src_data_arr,
+									__global        int*    g_res_part_arr,
+									__global        float*  g_dist_arr,
+									                int     no_max_class,
+									                int     sz_src_data,
+									                int     dim,
+									                int     sz_data_stride,
+									                int     iteration_n,
+									                float   tolerance,
+									__local         float*  l_tmp_cent_buf,
+									__local         float*  l_tmp_data_sum,
+									__local         int*    l_tmp_count_sum,
+									__local         float*  l_tmp_dist,
+									__local         int*    l_tmp_pos,
+									__local         int*    l_tmp_status,
+									__global        int*    g_status)
+{
+	int idx_iter     = 0;
+	int idx_pos_cent = 0;
+	int idx_pos_data = 0;
+	int idx_class    = 0;
+	int idx_dim      = 0;
+	int pos_local    = get_local_id(0);
+	int sz_local     = get_local_size(0);
+	int sz_cent      = no_max_class * DIM;
+	int sz_sum       = sz_cent * KM_ACC;
+	int cur_class    = 0;
+	int min_class    = 0;
+	int cur_count    = 0;
+	int no_changed   = 0;
+	int best_pos     = 0;
+	float min_dist   = 0;
+	float best_dist  = 0;
+	float dist       = 0;
+	float diff       = 0;
+	float new_cent   = 0;
+#if (0 < KM_DIM)
+	float p_cur_data[KM_DIM];
+#endif
+
+	for(idx_pos_cent = pos_local ; idx_pos_cent < sz_cent ; idx_pos_cent += sz_local)
+	{
+		l_tmp_cent_buf[idx_pos_cent] = g_res_cent_arr[idx_pos_cent];
+	}
+	for(idx_pos_cent = pos_local ; idx_pos_cent < KM_STATUS_SIZE ; idx_pos_cent += sz_local)
+	{
+		l_tmp_status[idx_pos_cent] = g_status[idx_pos_cent];
+	}
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	for(idx_iter = 0 ; (idx_iter < iteration_n) && !l_tmp_status[KM_STATUS_DONE] ; idx_iter++)
+	{
+		for(idx_pos_cent = pos_local ; idx_pos_cent < sz_sum ; idx_pos_cent += sz_local)
+		{
+			l_tmp_data_sum[idx_pos_cent] = 0;
+		}
+		for(idx_pos_cent = pos_local ; idx_pos_cent < no_max_class ; idx_pos_cent += sz_local)
+		{
+			l_tmp_count_sum[idx_pos_cent] = 0;
+		}
+
+		/* ----------------------- */
+		barrier(CLK_LOCAL_MEM_FENCE);
+		/* ----------------------- */
+
+		/* assignment and accumulation, as kmeans_assign_update without bounds */
+		no_changed = 0;
+		for(idx_pos_data = pos_local ; idx_pos_data < sz_src_data ; idx_pos_data += sz_local)
+		{
+#if (0 < KM_DIM)
+			for(idx_dim = 0 ; idx_dim < KM_DIM ; idx_dim++)
+			{
+				p_cur_data[idx_dim] = g_src_data_arr[(size_t)idx_dim * sz_data_stride + idx_pos_data];
+			}
+#define CUR_DATA(d) (p_cur_data[(d)])
+#else
+#define CUR_DATA(d) (g_src_data_arr[(size_t)(d) * sz_data_stride + idx_pos_data])
+#endif
+
+			cur_class = g_res_part_arr[idx_pos_data];
+			min_class = 0;
+			min_dist  = FLT_MAX;
+			for(idx_class = 0 ; idx_class < no_max_class ; idx_class++)
+			{
+				dist = 0;
+				for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+				{
+					diff  = CUR_DATA(idx_dim) - l_tmp_cent_buf[idx_class * DIM + idx_dim];
+					dist += diff * diff;
+				}
+				if(dist < min_dist)
+				{
+					min_class = idx_class;
+					min_dist  = dist;
+				}
+			}
+			if(cur_class != min_class)
+			{
+				g_res_part_arr[idx_pos_data] = min_class;
+				no_changed++;
+			}
+
+			atomic_inc(&l_tmp_count_sum[min_class]);
+			for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+			{
+				local_atomic_acc_f32(&l_tmp_data_sum[(min_class * DIM + idx_dim) * KM_ACC], CUR_DATA(idx_dim));
+			}
+#undef CUR_DATA
+		}
+		if(0 != no_changed)
+		{
+			atomic_add(&l_tmp_status[KM_STATUS_CHANGED], no_changed);
+		}
+
+		/* ----------------------- */
+		barrier(CLK_LOCAL_MEM_FENCE);
+		/* ----------------------- */
+
+		/* division, as kmeans_reduct: a centroid without points stays put and is reseeded below */
+		for(idx_pos_cent = pos_local ; idx_pos_cent < sz_cent ; idx_pos_cent += sz_local)
+		{
+			cur_count = l_tmp_count_sum[idx_pos_cent / DIM];
+			if(0 != cur_count)
+			{
+				new_cent = (l_tmp_data_sum[idx_pos_cent * KM_ACC] + l_tmp_data_sum[idx_pos_cent * KM_ACC + 1]) / cur_count;
+				local_shift_max(l_tmp_status, new_cent, l_tmp_cent_buf[idx_pos_cent]);
+				l_tmp_cent_buf[idx_pos_cent] = new_cent;
+			}
+		}
+		for(idx_class = pos_local ; idx_class < no_max_class ; idx_class += sz_local)
+		{
+			if(0 == l_tmp_count_sum[idx_class])
+			{
+				atomic_inc(&l_tmp_status[KM_STATUS_EMPTY]);
+			}
+		}
+
+		/* ----------------------- */
+		barrier(CLK_LOCAL_MEM_FENCE);
+		/* ----------------------- */
+
+		/* empty clusters, as kmeans_reseed_dist + kmeans_reseed_pick */
+		if(0 != l_tmp_status[KM_STATUS_EMPTY])
+		{
+			/* each work-item reads back the labels it wrote above */
+			for(idx_pos_data = pos_local ; idx_pos_data < sz_src_data ; idx_pos_data += sz_local)
+			{
+				cur_class = g_res_part_arr[idx_pos_data];
+				dist = 0;
+				for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+				{
+					diff  = g_src_data_arr[(size_t)idx_dim * sz_data_stride + idx_pos_data] - l_tmp_cent_buf[cur_class * DIM + idx_dim];
+					dist += diff * diff;
+				}
+				g_dist_arr[idx_pos_data] = isnan(dist) ? -1.0f : dist;
+			}
+
+			/* ----------------------- */
+			barrier(CLK_GLOBAL_MEM_FENCE);
+			/* ----------------------- */
+
+			for(idx_class = 0 ; idx_class < no_max_class ; idx_class++)
+			{
+				if(0 != l_tmp_count_sum[idx_class])
+				{
+					continue;
+				}
+
+				best_dist = -FLT_MAX;
+				best_pos  = -1;
+				for(idx_pos_data = pos_local ; idx_pos_data < sz_src_data ; idx_pos_data += sz_local)
+				{
+					if(g_dist_arr[idx_pos_data] > best_dist)
+					{
+						best_dist = g_dist_arr[idx_pos_data];
+						best_pos  = idx_pos_data;
+					}
+				}
+				l_tmp_dist[pos_local] = best_dist;
+				l_tmp_pos [pos_local] = best_pos;
+
+				/* ----------------------- */
+				barrier(CLK_LOCAL_MEM_FENCE);
+				/* ----------------------- */
+
+				if(0 == pos_local)
+				{
+					for(idx_pos_data = 1 ; idx_pos_data < sz_local ; idx_pos_data++)
+					{
+						if((l_tmp_dist[idx_pos_data] > l_tmp_dist[0]) ||
+						   ((l_tmp_dist[idx_pos_data] == l_tmp_dist[0]) && (0 <= l_tmp_pos[idx_pos_data]) && (l_tmp_pos[idx_pos_data] < l_tmp_pos[0])))
+						{
+							l_tmp_dist[0] = l_tmp_dist[idx_pos_data];
+							l_tmp_pos [0] = l_tmp_pos [idx_pos_data];
+						}
+					}
+				}
+
+				/* ----------------------- */
+				barrier(CLK_LOCAL_MEM_FENCE);
+				/* ----------------------- */
+
+				best_pos = l_tmp_pos[0];
+				if(0 <= best_pos)
+				{
+					for(idx_dim = pos_local ; idx_dim < DIM ; idx_dim += sz_local)
+					{
+						new_cent = g_src_data_arr[(size_t)idx_dim * sz_data_stride + best_pos];
+						local_shift_max(l_tmp_status, new_cent, l_tmp_cent_buf[idx_class * DIM + idx_dim]);
+						l_tmp_cent_buf[idx_class * DIM + idx_dim] = new_cent;
+					}
+					if(0 == pos_local)
+					{
+						g_dist_arr[best_pos] = -FLT_MAX;
+						l_tmp_status[KM_STATUS_CHANGED]++;
+					}
+				}
+
+				/* ----------------------------------------------- */
+				barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+				/* ----------------------------------------------- */
+			}
+		}
+
+		/* stopping rule, as kmeans_check */
+		if(0 == pos_local)
+		{
+			l_tmp_status[KM_STATUS_ITER]++;
+			if((0 <= tolerance) &&
+			   ((0 == l_tmp_status[KM_STATUS_CHANGED]) || (as_float(l_tmp_status[KM_STATUS_SHIFT]) <= tolerance)))
+			{
+				l_tmp_status[KM_STATUS_DONE] = 1;
+			}
+			l_tmp_status[KM_STATUS_CHANGED] = 0;
+			l_tmp_status[KM_STATUS_SHIFT]   = 0;
+			l_tmp_status[KM_STATUS_EMPTY]   = 0;
+		}
+
+		/* ----------------------- */
+		barrier(CLK_LOCAL_MEM_FENCE);
+		/* ----------------------- */
+	}
+
+	for(idx_pos_cent = pos_local ; idx_pos_cent < sz_cent ; idx_pos_cent += sz_local)
+	{
+		g_res_cent_arr[idx_pos_cent] = l_tmp_cent_buf[idx_pos_cent];
+	}
+	for(idx_pos_cent = pos_local ; idx_pos_cent < KM_STATUS_SIZE ; idx_pos_cent += sz_local)
+	{
+		g_status[idx_pos_cent] = l_tmp_status[idx_pos_cent];
+	}
+}
@@ -0,0 +1,81 @@
+/*
+  KMeans prediction, online KMeans and weighted KMeans for the host engines: the blocked SIMD
+  assignment of kmeans_simd.cpp, the host state of kmeans_online.cpp and the weighted loop of
+  kmeans_weighted.cpp
+*/
+
+#include "kmeans.h"
+#include "kmeans_common.h"
+
+#include <stddef.h>
+
+
+struct KmeansModel
+{
+    KmSimdModel* simd;
+};
+
+KmeansModel* kmeans_model_create(int class_n, int dim, const float* centroids)
+{
+    KmeansModel* model = new KmeansModel;
+
+    model->simd = km_simd_model_create(class_n, dim, centroids);
+    return model;
+}
+
+void kmeans_predict(KmeansModel* model, int query_n, const float* query, int* label, float* dist)
+{
+    km_simd_predict(model->simd, query_n, query, label, dist);
+}
+
+void kmeans_model_release(KmeansModel* model)
+{
+    km_simd_model_release(model->simd);
+    delete model;
+}
+
+
+struct KmeansOnline
+{
+    KmOnline* host;
+};
+
+KmeansOnline* kmeans_online_create(const KmeansConfig* config, int class_n, int dim, const float* centroids)
+{
+    KmeansOnline* online = new KmeansOnline;
+
+    online->host = km_online_create(config, class_n, dim, centroids);
+    return online;
+}
+
+void kmeans_online_add(KmeansOnline* online, int batch_n, const float* batch, int* clsfy_result)
+{
+    km_online_add(online->host, batch_n, batch, clsfy_result);
+}
+
+void kmeans_online_refine(KmeansOnline* online, int iteration_n, KmeansResult* result)
+{
+    km_online_refine(online->host, iteration_n, result);
+}
+
+void kmeans_online_centroids(KmeansOnline* online, float* centroids)
+{
+    km_online_centroids(online->host, centroids);
+}
+
+void kmeans_online_release(KmeansOnline* online)
+{
+    km_online_release(online->host);
+    delete online;
+}
+
+
+void kmeans_weighted(const KmeansConfig* config, int class_n, int data_n, int dim, float* centroids, const float* data, const float* weight,
+                     int* clsfy_result, KmeansResult* result)
+{
+    if (NULL == weight) {
+        kmeans(config, class_n, data_n, dim, centroids, data, clsfy_result, result);
+        return;
+    }
+    kmeans_weighted_simd(config, class_n, data_n, dim, centroids, data, weight, clsfy_result, result);
+}
@@ -0,0 +1,291 @@
+/*
+
+ Hamerly-pruned assignment, built together with kmeans.cl (it uses KM_DIM, DIM and the
+ g_status words from there).
+
+ Every point keeps an upper bound on the distance to its centroid (g_upper) and a lower bound on
+ the distance to every other centroid (g_lower). Before each assignment the bounds move by how
+ far the centroids moved; a point whose upper bound stays below
+ max(lower bound, half the distance from its centroid to the nearest other centroid) cannot
+ change cluster and is skipped. Bounds are widened by eps, the relative rounding error of a float
+ distance, and rounded outwards on every update, so a skipped point is one the brute-force
+ kmeans_assign would have left where it is.
+
+ Per iteration: kmeans_cent_bounds, kmeans_assign_hamerly, then the usual update kernels
+ (or kmeans_cent_bounds and kmeans_assign_update of kmeans_fused.cl with use_bound set).
+
+*/
+
+/* as in kmeans.cl: distances round as on the host */
+#pragma OPENCL FP_CONTRACT OFF
+
+/* round a non-negative bound away from the value it bounds */
+float bound_round_up(float x)
+{
+	return x * (1.0f + 2.0f * FLT_EPSILON);
+}
+
+float bound_round_down(float x)
+{
+	return (x > 0.0f) ? x * (1.0f - 2.0f * FLT_EPSILON) : 0.0f;
+}
+
+/* the upper bound u proves the assigned centroid beats any centroid at distance m or more; NaN fails */
+int bound_skip(float u, float m, float eps)
+{
+	return u * (1.0f + eps) < m * (1.0f - eps);
+}
+
+float cent_dist2(__global const float* g_cent_a, __global const float* g_cent_b, int dim)
+{
+	int   idx_dim = 0;
+	float dist    = 0;
+	float diff    = 0;
+
+	for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+	{
+		diff  = g_cent_a[idx_dim] - g_cent_b[idx_dim];
+		dist += diff * diff;
+	}
+
+	return dist;
+}
+
+/* one work-item per centroid: how far it moved since the last call and half the distance to its
+   nearest neighbour. g_cent_prev is updated to the current centroids for the next call. */
+__kernel void kmeans_cent_bounds(	__global  const float*  g_cent_arr,
+									__global        float*  g_cent_prev,
+									__global        float*  g_cent_shift,
+									__global        float*  g_cent_half,
+									__global        int*    g_status,
+									                int     no_max_class,
+									                int     dim,
+									                int     use_half,
+									                float   eps)
+{
+	int    pos_class = get_global_id(0);
+	int    idx_class = 0;
+	int    idx_dim   = 0;
+	size_t pos_base  = 0;
+	float  shift     = 0;
+	float  half      = 0;
+	float  min_half  = FLT_MAX;
+
+	if((pos_class >= no_max_class) || g_status[KM_STATUS_DONE])
+	{
+		return;
+	}
+
+	pos_base = (size_t)pos_class * DIM;
+
+	shift = bound_round_up(sqrt(cent_dist2(&g_cent_arr[pos_base], &g_cent_prev[pos_base], dim)) * (1.0f + eps));
+	g_cent_shift[pos_class] = shift;
+	/* the lower bounds of every point drop by the largest move; a NaN move fails the compare and is left out */
+	if(shift > 0)
+	{
+		atomic_max((volatile __global unsigned int*)&g_status[KM_STATUS_BOUND], as_uint(shift));
+	}
+
+	if(use_half)
+	{
+		for(idx_class = 0 ; idx_class < no_max_class ; idx_class++)
+		{
+			if(idx_class == pos_class)
+			{
+				continue;
+			}
+			half = bound_round_down(0.5f * sqrt(cent_dist2(&g_cent_arr[pos_base], &g_cent_arr[(size_t)idx_class * DIM], dim)) * (1.0f - eps));
+			if(half < min_half)
+			{
+				min_half = half;
+			}
+		}
+		g_cent_half[pos_class] = min_half;
+	}
+
+	for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+	{
+		g_cent_prev[pos_base + idx_dim] = g_cent_arr[pos_base + idx_dim];
+	}
+}
+
+/* kmeans_assign with Hamerly bounds. A work-group walks the centroid tiles only if one of its
+   points failed the bound test; those points rescan every centroid exactly as kmeans_assign does. */
+__kernel void kmeans_assign_hamerly(	__global  const float*  g_src_cent_arr,
+										__global  const float*  g_src_data_arr,
+										__global        int*    g_res_part_arr,
+										__global        float*  g_upper,
+										__global        float*  g_lower,
+										__global  const float*  g_cent_shift,
+										__global  const float*  g_cent_half,
+										                int     sz_max_class,
+										                int     sz_max_src_data,
+										                int     dim,
+										                int     sz_data_stride,
+										                int     sz_tile_class,
+										__local         float*  l_tmp_cent_buf,
+										__global        int*    g_status,
+										__local         int*    l_tmp_changed,
+										                float   eps)
+{
+	int pos_cur_src  = get_global_id(0);
+	int is_valid     = (pos_cur_src < sz_max_src_data);
+	int need_scan    = 0;
+	int idx_elem     = 0;
+	int idx_tile     = 0;
+	int idx_class    = 0;
+	int idx_dim      = 0;
+	int sz_cur_tile  = 0;
+	int cur_class    = -1;
+	int min_class    = 0;
+	float min_dist    = FLT_MAX;
+	float second_dist = FLT_MAX;
+	float dist       = 0;
+	float diff       = 0;
+	float upper      = 0;
+	float lower      = 0;
+	float bound      = 0;
+#if (0 < KM_DIM)
+	float p_cur_data[KM_DIM];
+#endif
+
+	if(g_status[KM_STATUS_DONE])
+	{
+		return;
+	}
+
+	/* [0] changed points, [1] set when some point of the group needs a scan */
+	if(0 == get_local_id(0))
+	{
+		l_tmp_changed[0] = 0;
+		l_tmp_changed[1] = 0;
+	}
+
+#if (0 < KM_DIM)
+	for(idx_dim = 0 ; idx_dim < KM_DIM ; idx_dim++)
+	{
+		p_cur_data[idx_dim] = is_valid ? g_src_data_arr[(size_t)idx_dim * sz_data_stride + pos_cur_src] : 0;
+	}
+#endif
+
+	if(is_valid)
+	{
+		cur_class = g_res_part_arr[pos_cur_src];
+		need_scan = (cur_class < 0);
+	}
+
+	if(is_valid && !need_scan)
+	{
+		upper = bound_round_up(g_upper[pos_cur_src] + g_cent_shift[cur_class]);
+		lower = bound_round_down(g_lower[pos_cur_src] - as_float(g_status[KM_STATUS_BOUND]));
+		bound = fmax(g_cent_half[cur_class], lower);
+
+		if(!bound_skip(upper, bound, eps))
+		{
+			/* tighten the upper bound before paying for a full scan */
+			dist = 0;
+			for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+			{
+#if (0 < KM_DIM)
+				diff = p_cur_data[idx_dim] - g_src_cent_arr[(size_t)cur_class * KM_DIM + idx_dim];
+#else
+				diff = g_src_data_arr[(size_t)idx_dim * sz_data_stride + pos_cur_src] - g_src_cent_arr[(size_t)cur_class * dim + idx_dim];
+#endif
+				dist += diff * diff;
+			}
+			upper     = bound_round_up(sqrt(dist) * (1.0f + eps));
+			need_scan = !bound_skip(upper, bound, eps);
+		}
+
+		g_upper[pos_cur_src] = upper;
+		g_lower[pos_cur_src] = lower;
+	}
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	if(need_scan)
+	{
+		l_tmp_changed[1] = 1;
+	}
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	if(l_tmp_changed[1])
+	{
+		for(idx_tile = 0 ; idx_tile < sz_max_class ; idx_tile += sz_tile_class)
+		{
+			sz_cur_tile = min(sz_tile_class, sz_max_class - idx_tile);
+
+			/* ----------------------- */
+			barrier(CLK_LOCAL_MEM_FENCE);
+			/* ----------------------- */
+
+			for(idx_elem = get_local_id(0) ; idx_elem < sz_cur_tile * DIM ; idx_elem += get_local_size(0))
+			{
+				l_tmp_cent_buf[idx_elem] = g_src_cent_arr[(size_t)idx_tile * DIM + idx_elem];
+			}
+
+			/* ----------------------- */
+			barrier(CLK_LOCAL_MEM_FENCE);
+			/* ----------------------- */
+
+			if(!need_scan)
+			{
+				continue;
+			}
+
+			/* same order and compare as kmeans_assign, plus the runner-up for the lower bound */
+			for(idx_class = 0 ; idx_class < sz_cur_tile ; idx_class++)
+			{
+				dist = 0;
+
+				for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+				{
+#if (0 < KM_DIM)
+					diff = p_cur_data[idx_dim] - l_tmp_cent_buf[idx_class * KM_DIM + idx_dim];
+#else
+					diff = g_src_data_arr[(size_t)idx_dim * sz_data_stride + pos_cur_src] - l_tmp_cent_buf[idx_class * dim + idx_dim];
+#endif
+					dist += diff * diff;
+				}
+
+				if(dist < min_dist)
+				{
+					second_dist = min_dist;
+					min_class   = idx_tile + idx_class;
+					min_dist    = dist;
+				}
+				else if(dist < second_dist)
+				{
+					second_dist = dist;
+				}
+			}
+		}
+	}
+
+	if(need_scan)
+	{
+		g_upper[pos_cur_src] = bound_round_up(sqrt(min_dist) * (1.0f + eps));
+		g_lower[pos_cur_src] = bound_round_down(sqrt(second_dist) * (1.0f - eps));
+
+		if(cur_class != min_class)
+		{
+			g_res_part_arr[pos_cur_src] = min_class;
+			atomic_inc(l_tmp_changed);
+		}
+	}
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	/* one global atomic per work-group */
+	if((0 == get_local_id(0)) && (0 != l_tmp_changed[0]))
+	{
+		atomic_add(&g_status[KM_STATUS_CHANGED], l_tmp_changed[0]);
+	}
+}
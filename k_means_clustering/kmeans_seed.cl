@@ -0,0 +1,316 @@
+/*
+
+ k-means++ and k-means|| seeding, built together with kmeans.cl (it uses KM_DIM and DIM from
+ there). Same scheme as kmeans_seed.cpp.
+
+ kmeans_seed_dist folds new centroids into g_d2, each point's squared distance to the nearest
+ centroid so far, and leaves one D^2 sum per work-group in g_block_sum. A D^2-weighted draw
+ (kmeans_seed_pick) scans the block sums, then the points of one block, so k-means++ runs
+ dist/pick pairs with no host round trip. kmeans_seed_oversample is the k-means|| pass: every
+ point is kept independently, with the draw keyed by its index.
+
+*/
+
+/* as in kmeans.cl: distances round as on the host */
+#pragma OPENCL FP_CONTRACT OFF
+
+/* index in [0, n) where the running sum of g_weight first passes target, with target left as the
+   offset into that weight. The last non-zero weight when rounding puts target past the total, -1
+   when every weight is zero. One work-group; l_scan holds get_local_size(0) floats. */
+int group_weighted_find(__global const float* g_weight, int n, float* p_target, __local float* l_scan, __local int* l_sel)
+{
+	int   pos_local = get_local_id(0);
+	int   sz_local  = get_local_size(0);
+	int   sz_chunk  = (n + sz_local - 1) / sz_local;
+	int   pos_begin = min(n, pos_local * sz_chunk);
+	int   pos_end   = min(n, pos_begin + sz_chunk);
+	int   idx_pos   = 0;
+	int   offset    = 0;
+	int   sel       = 0;
+	float acc       = 0;
+	float prev      = 0;
+	float add       = 0;
+	float target    = *p_target;
+
+	for(idx_pos = pos_begin ; idx_pos < pos_end ; idx_pos++)
+	{
+		acc += g_weight[idx_pos];
+	}
+	l_scan[pos_local] = acc;
+	if(0 == pos_local)
+	{
+		l_sel[0] = sz_local;
+		l_sel[1] = -1;
+	}
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	/* inclusive prefix sum of the chunk sums */
+	for(offset = 1 ; offset < sz_local ; offset <<= 1)
+	{
+		add = (pos_local >= offset) ? l_scan[pos_local - offset] : 0;
+
+		/* ----------------------- */
+		barrier(CLK_LOCAL_MEM_FENCE);
+		/* ----------------------- */
+
+		l_scan[pos_local] += add;
+
+		/* ----------------------- */
+		barrier(CLK_LOCAL_MEM_FENCE);
+		/* ----------------------- */
+	}
+
+	prev = (0 < pos_local) ? l_scan[pos_local - 1] : 0;
+	if(0 < acc)
+	{
+		if(target < l_scan[pos_local])
+		{
+			atomic_min(&l_sel[0], pos_local);
+		}
+		atomic_max(&l_sel[1], pos_local);
+	}
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	sel = (l_sel[0] < sz_local) ? l_sel[0] : l_sel[1];
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	if(sel == pos_local)
+	{
+		int last = -1;
+
+		target -= prev;
+		for(idx_pos = pos_begin ; idx_pos < pos_end ; idx_pos++)
+		{
+			if(0 < g_weight[idx_pos])
+			{
+				last = idx_pos;
+				if(target < g_weight[idx_pos])
+				{
+					break;
+				}
+				target -= g_weight[idx_pos];
+			}
+		}
+		l_sel[0]  = (idx_pos < pos_end) ? idx_pos : last;
+		l_scan[0] = target;
+	}
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	if(0 <= sel)
+	{
+		sel       = l_sel[0];
+		*p_target = l_scan[0];
+	}
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	return sel;
+}
+
+/* one work-item per point: fold centroids [cent_begin, cent_end) of g_cent into D^2 and the
+   label, then one D^2 sum per work-group. first: D^2 starts at FLT_MAX. */
+__kernel void kmeans_seed_dist(	__global  const float*  g_cent_arr,
+								__global  const float*  g_src_data_arr,
+								__global        float*  g_d2_arr,
+								__global        int*    g_label_arr,
+								__global        float*  g_block_sum,
+								                int     cent_begin,
+								                int     cent_end,
+								                int     first,
+								                int     sz_max_src_data,
+								                int     dim,
+								                int     sz_data_stride,
+								__local         float*  l_tmp_sum)
+{
+	int pos_cur_src = get_global_id(0);
+	int pos_local   = get_local_id(0);
+	int sz_local    = get_local_size(0);
+	int is_valid    = (pos_cur_src < sz_max_src_data);
+	int idx_class   = 0;
+	int idx_dim     = 0;
+	int offset      = 0;
+	int min_class   = 0;
+	float min_dist  = FLT_MAX;
+	float dist      = 0;
+	float diff      = 0;
+
+	if(is_valid)
+	{
+		if(!first)
+		{
+			min_dist  = g_d2_arr[pos_cur_src];
+			min_class = g_label_arr[pos_cur_src];
+		}
+
+		for(idx_class = cent_begin ; idx_class < cent_end ; idx_class++)
+		{
+			dist = 0;
+			for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+			{
+				diff  = g_src_data_arr[(size_t)idx_dim * sz_data_stride + pos_cur_src] - g_cent_arr[(size_t)idx_class * DIM + idx_dim];
+				dist += diff * diff;
+			}
+			if(dist < min_dist)
+			{
+				min_class = idx_class;
+				min_dist  = dist;
+			}
+		}
+
+		g_d2_arr[pos_cur_src]    = min_dist;
+		g_label_arr[pos_cur_src] = min_class;
+	}
+
+	l_tmp_sum[pos_local] = is_valid ? min_dist : 0;
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	for(offset = 1 ; offset < sz_local ; offset <<= 1)
+	{
+		if((0 == (pos_local & (2 * offset - 1))) && (pos_local + offset < sz_local))
+		{
+			l_tmp_sum[pos_local] += l_tmp_sum[pos_local + offset];
+		}
+
+		/* ----------------------- */
+		barrier(CLK_LOCAL_MEM_FENCE);
+		/* ----------------------- */
+	}
+
+	if(0 == pos_local)
+	{
+		g_block_sum[get_group_id(0)] = l_tmp_sum[0];
+	}
+}
+
+/* a single work-group: D^2-weighted draw with g_rand[pos_pick] in [0, 1), copied into centroid
+   pos_pick of g_cent. sz_block is the work-group size of kmeans_seed_dist. */
+__kernel void kmeans_seed_pick(	__global  const float*  g_src_data_arr,
+								__global  const float*  g_d2_arr,
+								__global  const float*  g_block_sum,
+								__global  const float*  g_rand,
+								__global        float*  g_cent_arr,
+								                int     pos_pick,
+								                int     no_block,
+								                int     sz_block,
+								                int     sz_max_src_data,
+								                int     dim,
+								                int     sz_data_stride,
+								__local         float*  l_tmp_scan,
+								__local         int*    l_tmp_sel)
+{
+	int   pos_local = get_local_id(0);
+	int   sz_local  = get_local_size(0);
+	int   idx_pos   = 0;
+	int   pos_block = 0;
+	int   pos_data  = 0;
+	int   sz_cur    = 0;
+	int   idx_dim   = 0;
+	float total     = 0;
+	float target    = 0;
+
+	/* the total first, for the target */
+	for(idx_pos = pos_local ; idx_pos < no_block ; idx_pos += sz_local)
+	{
+		total += g_block_sum[idx_pos];
+	}
+	l_tmp_scan[pos_local] = total;
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	total = 0;
+	for(idx_pos = 0 ; idx_pos < sz_local ; idx_pos++)
+	{
+		total += l_tmp_scan[idx_pos];
+	}
+	target = g_rand[pos_pick] * total;
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	pos_block = group_weighted_find(g_block_sum, no_block, &target, l_tmp_scan, l_tmp_sel);
+	if(0 <= pos_block)
+	{
+		sz_cur   = min(sz_block, sz_max_src_data - pos_block * sz_block);
+		pos_data = group_weighted_find(&g_d2_arr[(size_t)pos_block * sz_block], sz_cur, &target, l_tmp_scan, l_tmp_sel);
+		/* the block sum and the point scan round differently; fall back to the block's first point */
+		pos_data = pos_block * sz_block + max(pos_data, 0);
+	}
+	else
+	{
+		/* every D^2 is zero: uniform */
+		pos_data = min(sz_max_src_data - 1, (int)(g_rand[pos_pick] * sz_max_src_data));
+	}
+
+	for(idx_dim = pos_local ; idx_dim < DIM ; idx_dim += sz_local)
+	{
+		g_cent_arr[(size_t)pos_pick * DIM + idx_dim] = g_src_data_arr[(size_t)idx_dim * sz_data_stride + pos_data];
+	}
+}
+
+/* splitmix64 step, as km_rng_next in kmeans_common.h */
+ulong seed_rng_next(ulong* p_state)
+{
+	ulong z = (*p_state += 0x9E3779B97F4A7C15UL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9UL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBUL;
+	return z ^ (z >> 31);
+}
+
+/* one work-item per point: the k-means|| pass round keeps the point with probability
+   oversample * D^2 / total, appending its index to g_pick. Indices past sz_pick_cap are dropped;
+   the host sorts the rest, so the order of the atomics does not matter. */
+__kernel void kmeans_seed_oversample(	__global  const float*  g_d2_arr,
+										__global        int*    g_pick_arr,
+										__global        int*    g_pick_n,
+										                int     sz_pick_cap,
+										                int     sz_max_src_data,
+										                float   total,
+										                float   oversample,
+										                ulong   seed,
+										                int     round)
+{
+	int   pos_cur_src = get_global_id(0);
+	int   pos_pick    = 0;
+	ulong state       = 0;
+	float u           = 0;
+
+	if(pos_cur_src >= sz_max_src_data)
+	{
+		return;
+	}
+
+	/* km_hash_uniform: the top 24 of its 53 bits */
+	state = seed + ((ulong)round << 40);
+	state = seed_rng_next(&state) + (ulong)pos_cur_src;
+	u     = (float)(seed_rng_next(&state) >> 40) * (1.0f / 16777216.0f);
+
+	if(u * total < oversample * g_d2_arr[pos_cur_src])
+	{
+		pos_pick = atomic_inc(g_pick_n);
+		if(pos_pick < sz_pick_cap)
+		{
+			g_pick_arr[pos_pick] = pos_cur_src;
+		}
+	}
+}
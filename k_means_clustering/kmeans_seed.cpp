@@ -0,0 +1,298 @@
+/*
+  Seeding for the host engines: k-means++ and k-means||
+
+  k-means++ (Arthur & Vassilvitskii 2007) picks each centroid with probability proportional to
+  D(x)^2, the squared distance from x to the nearest centroid picked so far; that is one pass over
+  the data per centroid. k-means|| (Bahmani et al. 2012) makes KM_SEED_ROUNDS passes instead, each
+  keeping every point with probability KM_SEED_OVERSAMPLE * class_n * D(x)^2 / sum(D^2), then reduces
+  the candidates to class_n centroids by k-means++ weighted with the number of points nearest to
+  each candidate.
+
+  D^2 is kept per point and summed over fixed blocks of SEED_BLOCK points. A D^2-weighted draw
+  walks the block sums and then one block, and neither the sums nor the draws depend on the
+  thread count.
+*/
+
+#include "kmeans.h"
+#include "kmeans_common.h"
+#include "kmeans_thread.h"
+
+#include <string.h>
+#include <float.h>
+
+#include <algorithm>
+#include <vector>
+
+
+// points per D^2 block
+#define SEED_BLOCK (4096)
+
+// mini-batch seeding runs on a sample of this many points per centroid (at least one batch)
+#define SEED_SAMPLE_PER_CLASS (64)
+
+
+struct SeedState
+{
+    long long data_n;
+    int dim;
+    const float* data;
+    long long block_n;
+    std::vector<float> d2;          // squared distance to the nearest centroid or candidate
+    std::vector<int> label;         // index of that centroid or candidate
+    std::vector<double> block_sum;  // D^2 summed over each block
+};
+
+// Fold centroids [cent_begin, cent_end) of cent into D^2 and the labels, and refresh the block sums
+static void seed_update(SeedState* st, const float* cent, int cent_begin, int cent_end)
+{
+    const int dim = st->dim;
+
+    km_parallel_run((size_t)st->data_n * (cent_end - cent_begin), [&](int thread_idx, int width)
+    {
+        size_t block_begin, block_end;
+
+        km_thread_range((size_t)st->block_n, thread_idx, width, &block_begin, &block_end);
+
+        for (size_t block_i = block_begin; block_i < block_end; block_i++) {
+            long long data_end = std::min(st->data_n, (long long)(block_i + 1) * SEED_BLOCK);
+            double sum = 0.0;
+
+            for (long long data_i = (long long)block_i * SEED_BLOCK; data_i < data_end; data_i++) {
+                const float* point = st->data + (size_t)data_i * dim;
+
+                for (int class_i = cent_begin; class_i < cent_end; class_i++) {
+                    const float* centroid = cent + (size_t)class_i * dim;
+                    float dist = 0.0f;
+
+                    for (int d = 0; d < dim; d++) {
+                        float t = point[d] - centroid[d];
+
+                        dist += t * t;
+                    }
+                    if (dist < st->d2[data_i]) {
+                        st->d2[data_i] = dist;
+                        st->label[data_i] = class_i;
+                    }
+                }
+                sum += st->d2[data_i];
+            }
+            st->block_sum[block_i] = sum;
+        }
+    });
+}
+
+// D^2-weighted draw of a point index for u in [0, 1); uniform when every D^2 is zero
+static long long seed_pick(const SeedState* st, double u)
+{
+    double total = 0.0, target;
+    long long block_i, data_i, data_end, last = -1;
+
+    for (block_i = 0; block_i < st->block_n; block_i++) {
+        total += st->block_sum[block_i];
+    }
+    if (!(total > 0.0)) {
+        return std::min(st->data_n - 1, (long long)(u * (double)st->data_n));
+    }
+
+    // rounding can put target past the last non-zero weight; that weight is taken then
+    target = u * total;
+    for (block_i = 0; block_i < st->block_n - 1 && target >= st->block_sum[block_i]; block_i++) {
+        target -= st->block_sum[block_i];
+    }
+    data_end = std::min(st->data_n, (block_i + 1) * SEED_BLOCK);
+    for (data_i = block_i * SEED_BLOCK; data_i < data_end; data_i++) {
+        if (st->d2[data_i] > 0.0f) {
+            last = data_i;
+            if (target < st->d2[data_i]) {
+                return data_i;
+            }
+            target -= st->d2[data_i];
+        }
+    }
+    return (last >= 0) ? last : block_i * SEED_BLOCK;
+}
+
+static void seed_state_init(SeedState* st, long long data_n, int dim, const float* data)
+{
+    st->data_n = data_n;
+    st->dim = dim;
+    st->data = data;
+    st->block_n = (data_n + SEED_BLOCK - 1) / SEED_BLOCK;
+    st->d2.assign((size_t)data_n, FLT_MAX);
+    st->label.assign((size_t)data_n, 0);
+    st->block_sum.assign((size_t)st->block_n, 0.0);
+}
+
+// k-means++ from centroid class_begin on; centroids before it are already in D^2
+static void seed_plusplus(SeedState* st, int class_begin, int class_n, KmRng* rng, float* centroids)
+{
+    const int dim = st->dim;
+
+    for (int class_i = class_begin; class_i < class_n; class_i++) {
+        long long data_i = (0 == class_i) ? (long long)(km_rng_next(rng) % (uint64_t)st->data_n)
+                                          : seed_pick(st, km_rng_uniform(rng));
+
+        memcpy(centroids + (size_t)class_i * dim, st->data + (size_t)data_i * dim, sizeof(float) * dim);
+        if (class_i + 1 < class_n) {
+            seed_update(st, centroids, class_i, class_i + 1);
+        }
+    }
+}
+
+void km_seed_reduce(int cand_n, int dim, const float* cand, const double* weight, int class_n, KmRng* rng, float* centroids)
+{
+    std::vector<float> d2((size_t)cand_n, FLT_MAX);
+    std::vector<double> w((size_t)cand_n);
+
+    for (int class_i = 0; class_i < class_n; class_i++) {
+        double total = 0.0, target;
+        int cand_i, last = -1;
+
+        for (cand_i = 0; cand_i < cand_n; cand_i++) {
+            w[cand_i] = weight[cand_i] * ((0 == class_i) ? 1.0 : (double)d2[cand_i]);
+            total += w[cand_i];
+        }
+
+        // weighted draw; the first candidate not yet taken when no weight is left
+        target = km_rng_uniform(rng) * total;
+        for (cand_i = 0; cand_i < cand_n; cand_i++) {
+            if (w[cand_i] > 0.0) {
+                last = cand_i;
+                if (target < w[cand_i]) {
+                    break;
+                }
+                target -= w[cand_i];
+            }
+        }
+        if (cand_i == cand_n) {
+            cand_i = (last >= 0) ? last : class_i % cand_n;
+        }
+
+        const float* pick = cand + (size_t)cand_i * dim;
+
+        memcpy(centroids + (size_t)class_i * dim, pick, sizeof(float) * dim);
+        km_parallel_for((size_t)cand_n, [&](size_t begin_sz, size_t end_sz)
+        {
+            for (size_t i = begin_sz; i < end_sz; i++) {
+                float dist = 0.0f;
+
+                for (int d = 0; d < dim; d++) {
+                    float t = cand[i * dim + d] - pick[d];
+
+                    dist += t * t;
+                }
+                if (dist < d2[i]) {
+                    d2[i] = dist;
+                }
+            }
+        });
+    }
+}
+
+// k-means|| candidates, then the weighted reduction; k-means++ fills in if too few were kept
+static void seed_parallel(const KmeansConfig* config, SeedState* st, int class_n, KmRng* rng, float* centroids)
+{
+    const int dim = st->dim;
+    const double oversample = (double)KM_SEED_OVERSAMPLE * class_n;
+    std::vector<float> cand;
+    long long first = (long long)(km_rng_next(rng) % (uint64_t)st->data_n);
+    int cand_n = 1;
+
+    cand.assign(st->data + (size_t)first * dim, st->data + (size_t)(first + 1) * dim);
+    seed_update(st, cand.data(), 0, 1);
+
+    for (int round = 0; round < KM_SEED_ROUNDS; round++) {
+        double total = 0.0;
+        std::vector<std::vector<long long> > thread_picked(km_thread_count());
+        std::vector<long long> picked;
+
+        for (long long block_i = 0; block_i < st->block_n; block_i++) {
+            total += st->block_sum[block_i];
+        }
+        if (!(total > 0.0)) {
+            break;
+        }
+
+        // every point is an independent draw keyed by its index, so the picks do not depend on
+        // the thread count; each thread keeps its own in index order
+        km_parallel_run((size_t)st->data_n, [&](int thread_idx, int width)
+        {
+            size_t begin_sz, end_sz;
+
+            km_thread_range((size_t)st->data_n, thread_idx, width, &begin_sz, &end_sz);
+            for (size_t data_i = begin_sz; data_i < end_sz; data_i++) {
+                if (km_hash_uniform(config->seed, round, (long long)data_i) * total < oversample * st->d2[data_i]) {
+                    thread_picked[thread_idx].push_back((long long)data_i);
+                }
+            }
+        });
+        for (size_t thread_idx = 0; thread_idx < thread_picked.size(); thread_idx++) {
+            picked.insert(picked.end(), thread_picked[thread_idx].begin(), thread_picked[thread_idx].end());
+        }
+        if (picked.empty()) {
+            continue;
+        }
+
+        for (long long data_i : picked) {
+            cand.insert(cand.end(), st->data + (size_t)data_i * dim, st->data + (size_t)(data_i + 1) * dim);
+        }
+        seed_update(st, cand.data(), cand_n, cand_n + (int)picked.size());
+        cand_n += (int)picked.size();
+    }
+
+    if (cand_n <= class_n) {
+        // the labels already index the candidates in this order
+        memcpy(centroids, cand.data(), sizeof(float) * cand_n * dim);
+        seed_plusplus(st, cand_n, class_n, rng, centroids);
+        return;
+    }
+
+    // weight of a candidate: the points nearest to it
+    std::vector<double> weight((size_t)cand_n, 0.0);
+
+    for (long long data_i = 0; data_i < st->data_n; data_i++) {
+        weight[st->label[data_i]] += 1.0;
+    }
+    km_seed_reduce(cand_n, dim, cand.data(), weight.data(), class_n, rng, centroids);
+}
+
+void km_seed(const KmeansConfig* config, int class_n, long long data_n, int dim, const float* data, float* centroids)
+{
+    SeedState st;
+    KmRng rng;
+
+    if (KMEANS_INIT_FILE == config->init || data_n < 1) {
+        return;
+    }
+
+    km_rng_seed(&rng, config->seed);
+    seed_state_init(&st, data_n, dim, data);
+
+    if (KMEANS_INIT_PARALLEL == config->init) {
+        seed_parallel(config, &st, class_n, &rng, centroids);
+    } else {
+        seed_plusplus(&st, 0, class_n, &rng, centroids);
+    }
+}
+
+void km_seed_sample(const KmeansConfig* config, int class_n, long long data_n, int dim, const float* data, const KmHoldout* holdout, KmRng* rng, float* centroids)
+{
+    long long sample_n = std::max((long long)config->batch_n, (long long)SEED_SAMPLE_PER_CLASS * class_n);
+    std::vector<long long> idx;
+    std::vector<float> sample;
+
+    if (KMEANS_INIT_FILE == config->init) {
+        return;
+    }
+
+    sample_n = std::min(sample_n, data_n - holdout->n);
+    idx.resize((size_t)sample_n);
+    km_sample_batch(rng, holdout, data_n, (int)sample_n, idx.data());
+
+    sample.resize((size_t)sample_n * dim);
+    for (long long sample_i = 0; sample_i < sample_n; sample_i++) {
+        memcpy(&sample[(size_t)sample_i * dim], data + (size_t)idx[sample_i] * dim, sizeof(float) * dim);
+    }
+
+    km_seed(config, class_n, sample_n, dim, sample.data(), centroids);
+}
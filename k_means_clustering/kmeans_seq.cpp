@@ -1,60 +1,128 @@
 
 #include "kmeans.h"
+#include "kmeans_common.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <float.h>
+#include <math.h>
 
 
-void kmeans(int iteration_n, int class_n, int data_n, Point* centroids, Point* data, int* partitioned)
+void kmeans(const KmeansConfig* config, int class_n, int data_n, int dim, float* centroids, const float* data, int* partitioned, KmeansResult* result)
 {
-    // Loop indices for iteration, data and class
-    int i, data_i, class_i;
+    // Loop indices for iteration, data, class and dimension
+    int i, data_i, class_i, d;
     // Count number of data in each class
     int* count = (int*)malloc(sizeof(int) * class_n);
-    // Temporal point value to calculate distance
-    Point t;
+    // Sum of the data in each class, in double so that large clusters do not lose their tail
+    double* sum = (double*)malloc(sizeof(double) * class_n * dim);
+    // Classes left without points by the update step
+    int* empty_class = (int*)malloc(sizeof(int) * class_n);
+    int empty_n;
+    // Centroids of the previous iteration, for the shift check
+    float* prev = (float*)malloc(sizeof(float) * class_n * dim);
+    // Points that changed cluster and largest coordinate shift in this iteration
+    int changed;
+    float shift;
+    int converged = 0;
 
+    km_seed(config, class_n, data_n, dim, data, centroids);
+
+    // No point starts in a cluster, so the first iteration counts every point as changed
+    for (data_i = 0; data_i < data_n; data_i++) {
+        partitioned[data_i] = -1;
+    }
 
-    // Iterate through number of interations
-    for (i = 0; i < iteration_n; i++) {
+
+    // Iterate until converged or out of interations
+    for (i = 0; i < config->iteration_n && !converged; i++) {
+        changed = 0;
 
         // Assignment step
         for (data_i = 0; data_i < data_n; data_i++) {
-            float min_dist = DBL_MAX;
-      
+            const float* point = data + (size_t)data_i * dim;
+            float min_dist = FLT_MAX;
+            int min_class = 0;
+
             for (class_i = 0; class_i < class_n; class_i++) {
-                t.x = data[data_i].x - centroids[class_i].x;
-                t.y = data[data_i].y - centroids[class_i].y;
+                const float* centroid = centroids + (size_t)class_i * dim;
+                float dist = 0.0f;
+
+                for (d = 0; d < dim; d++) {
+                    float t = point[d] - centroid[d];
+
+                    dist += t * t;
+                }
 
-                float dist = t.x * t.x + t.y * t.y;
-	
                 if (dist < min_dist) {
-                    partitioned[data_i] = class_i;
+                    min_class = class_i;
                     min_dist = dist;
                 }
             }
+
+            if (partitioned[data_i] != min_class) {
+                partitioned[data_i] = min_class;
+                changed++;
+            }
         }
 
         // Update step
+        memcpy(prev, centroids, sizeof(float) * class_n * dim);
+
         // Clear sum buffer and class count
         for (class_i = 0; class_i < class_n; class_i++) {
-            centroids[class_i].x = 0.0;
-            centroids[class_i].y = 0.0;
+            for (d = 0; d < dim; d++) {
+                sum[(size_t)class_i * dim + d] = 0.0;
+            }
             count[class_i] = 0;
         }
 
         // Sum up and count data for each class
-        for (data_i = 0; data_i < data_n; data_i++) {         
-            centroids[partitioned[data_i]].x += data[data_i].x;
-            centroids[partitioned[data_i]].y += data[data_i].y;
+        for (data_i = 0; data_i < data_n; data_i++) {
+            double* class_sum = sum + (size_t)partitioned[data_i] * dim;
+
+            for (d = 0; d < dim; d++) {
+                class_sum[d] += data[(size_t)data_i * dim + d];
+            }
             count[partitioned[data_i]]++;
         }
-        
-        // Divide the sum with number of class for mean point
+
+        // Divide the sum with number of class for mean point; an empty cluster keeps its centroid
+        empty_n = 0;
         for (class_i = 0; class_i < class_n; class_i++) {
-            centroids[class_i].x /= count[class_i];
-            centroids[class_i].y /= count[class_i];
+            if (0 == count[class_i]) {
+                empty_class[empty_n++] = class_i;
+                continue;
+            }
+            for (d = 0; d < dim; d++) {
+                centroids[(size_t)class_i * dim + d] = (float)(sum[(size_t)class_i * dim + d] / count[class_i]);
+            }
+        }
+
+        // and then moves onto the point farthest from its centroid; the move counts as a change,
+        // so the run does not stop before the new centroid has been through an assignment
+        changed += km_reseed_empty(empty_n, empty_class, data_n, dim, data, partitioned, centroids);
+
+        // Convergence check
+        shift = 0.0f;
+        for (size_t elem_i = 0; elem_i < (size_t)class_n * dim; elem_i++) {
+            float t = fabsf(centroids[elem_i] - prev[elem_i]);
+
+            // NaN sticks, so it never passes the tolerance
+            if (t > shift || isnan(t)) {
+                shift = t;
+            }
         }
+        converged = (config->tolerance >= 0) && ((0 == changed) || (shift <= config->tolerance));
     }
-}
 
+    result->iteration_n = i;
+    result->converged = converged;
+    result->inertia = kmeans_inertia(class_n, data_n, dim, centroids, data, partitioned);
+    result->distance_n = (long long)i * data_n * class_n;
+
+    free(empty_class);
+    free(sum);
+    free(prev);
+    free(count);
+}
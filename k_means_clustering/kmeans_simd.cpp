@@ -0,0 +1,535 @@
+/*
+  Blocked SIMD brute-force KMeans on the host thread pool
+
+  The points are copied once into blocks of SIMD_BLOCK points stored dimension by dimension
+  ([block][d][SIMD_BLOCK]), so one vector load brings the same coordinate of 8 or 16 points.
+  Each thread walks its own blocks in chunks of SIMD_CHUNK_BLOCK; a chunk is matched against one
+  tile of centroids at a time, sized to stay in L1, and the assign kernels compute a register
+  tile of points x centroids per pass over the dimensions. Once a chunk has seen every tile
+  its labels are final and its points are added to the thread's own centroid sums while they
+  are still in cache; the sums are merged per centroid after the pass.
+
+  Labels match the brute-force loop of kmeans_seq.cpp: every lane computes the same
+  t = x - c; dist += t * t sequence (built with -ffp-contract=off, so no FMA), and centroids
+  are compared in ascending order with a strict <. The sums are kept in double, as in
+  kmeans_seq.cpp, but added per thread and then merged, so the centroids can differ from it in
+  the last bit. Empty clusters are reseeded by km_reseed_empty, as there.
+
+  km_simd_predict runs the same assignment for kmeans_predict, staging the queries chunk by
+  chunk instead of copying them all up front.
+
+  The widest of AVX-512, AVX2 and plain C the CPU supports is picked at run time;
+  KM_SIMD=scalar|avx2|avx512 caps it.
+*/
+
+#include "kmeans.h"
+#include "kmeans_common.h"
+#include "kmeans_thread.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KM_SIMD_X86 (1)
+#endif
+
+
+// points per block, one AVX-512 or two AVX2 vectors
+#define SIMD_BLOCK (16)
+// blocks assigned against every centroid tile before their sums are taken
+#define SIMD_CHUNK_BLOCK (16)
+// bytes of centroids per tile: half of a 32 KiB L1 data cache
+#define SIMD_TILE_BYTES (16 * 1024)
+
+
+// Nearest centroid in [class_begin, class_end) for the SIMD_BLOCK points of block, folded into
+// the running minimum of min_dist/min_class
+typedef void (*SimdAssignFn)(const float* block, int dim, const float* centroids, int class_begin, int class_end, float* min_dist, int* min_class);
+
+static void simd_assign_scalar(const float* block, int dim, const float* centroids, int class_begin, int class_end, float* min_dist, int* min_class)
+{
+    for (int class_i = class_begin; class_i < class_end; class_i++) {
+        const float* centroid = centroids + (size_t)class_i * dim;
+        float dist[SIMD_BLOCK] = { 0.0f };
+
+        for (int d = 0; d < dim; d++) {
+            const float* x = block + (size_t)d * SIMD_BLOCK;
+
+            for (int p = 0; p < SIMD_BLOCK; p++) {
+                float t = x[p] - centroid[d];
+
+                dist[p] += t * t;
+            }
+        }
+        for (int p = 0; p < SIMD_BLOCK; p++) {
+            if (dist[p] < min_dist[p]) {
+                min_dist[p] = dist[p];
+                min_class[p] = class_i;
+            }
+        }
+    }
+}
+
+#ifdef KM_SIMD_X86
+
+// Keep dist where it beats best; NaN never does, as with the scalar <
+__attribute__((target("avx2")))
+static inline void simd_min_avx2(__m256 dist, int class_i, __m256* best, __m256i* best_class)
+{
+    __m256 mask = _mm256_cmp_ps(dist, *best, _CMP_LT_OQ);
+
+    *best = _mm256_blendv_ps(*best, dist, mask);
+    *best_class = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(*best_class), _mm256_castsi256_ps(_mm256_set1_epi32(class_i)), mask));
+}
+
+// 16 points as two vectors x 4 centroids: 8 independent accumulators per dimension
+__attribute__((target("avx2")))
+static void simd_assign_avx2(const float* block, int dim, const float* centroids, int class_begin, int class_end, float* min_dist, int* min_class)
+{
+    __m256 best_lo = _mm256_loadu_ps(min_dist);
+    __m256 best_hi = _mm256_loadu_ps(min_dist + 8);
+    __m256i class_lo = _mm256_loadu_si256((const __m256i*)min_class);
+    __m256i class_hi = _mm256_loadu_si256((const __m256i*)(min_class + 8));
+    int class_i = class_begin;
+
+    for (; class_i + 4 <= class_end; class_i += 4) {
+        const float* c0 = centroids + (size_t)class_i * dim;
+        const float* c1 = c0 + dim;
+        const float* c2 = c1 + dim;
+        const float* c3 = c2 + dim;
+        __m256 a0_lo = _mm256_setzero_ps(), a0_hi = _mm256_setzero_ps();
+        __m256 a1_lo = _mm256_setzero_ps(), a1_hi = _mm256_setzero_ps();
+        __m256 a2_lo = _mm256_setzero_ps(), a2_hi = _mm256_setzero_ps();
+        __m256 a3_lo = _mm256_setzero_ps(), a3_hi = _mm256_setzero_ps();
+
+        for (int d = 0; d < dim; d++) {
+            __m256 x_lo = _mm256_loadu_ps(block + (size_t)d * SIMD_BLOCK);
+            __m256 x_hi = _mm256_loadu_ps(block + (size_t)d * SIMD_BLOCK + 8);
+            __m256 c, t;
+
+            c = _mm256_set1_ps(c0[d]);
+            t = _mm256_sub_ps(x_lo, c); a0_lo = _mm256_add_ps(a0_lo, _mm256_mul_ps(t, t));
+            t = _mm256_sub_ps(x_hi, c); a0_hi = _mm256_add_ps(a0_hi, _mm256_mul_ps(t, t));
+            c = _mm256_set1_ps(c1[d]);
+            t = _mm256_sub_ps(x_lo, c); a1_lo = _mm256_add_ps(a1_lo, _mm256_mul_ps(t, t));
+            t = _mm256_sub_ps(x_hi, c); a1_hi = _mm256_add_ps(a1_hi, _mm256_mul_ps(t, t));
+            c = _mm256_set1_ps(c2[d]);
+            t = _mm256_sub_ps(x_lo, c); a2_lo = _mm256_add_ps(a2_lo, _mm256_mul_ps(t, t));
+            t = _mm256_sub_ps(x_hi, c); a2_hi = _mm256_add_ps(a2_hi, _mm256_mul_ps(t, t));
+            c = _mm256_set1_ps(c3[d]);
+            t = _mm256_sub_ps(x_lo, c); a3_lo = _mm256_add_ps(a3_lo, _mm256_mul_ps(t, t));
+            t = _mm256_sub_ps(x_hi, c); a3_hi = _mm256_add_ps(a3_hi, _mm256_mul_ps(t, t));
+        }
+
+        // ascending centroid order, so ties keep the lowest index
+        simd_min_avx2(a0_lo, class_i,     &best_lo, &class_lo); simd_min_avx2(a0_hi, class_i,     &best_hi, &class_hi);
+        simd_min_avx2(a1_lo, class_i + 1, &best_lo, &class_lo); simd_min_avx2(a1_hi, class_i + 1, &best_hi, &class_hi);
+        simd_min_avx2(a2_lo, class_i + 2, &best_lo, &class_lo); simd_min_avx2(a2_hi, class_i + 2, &best_hi, &class_hi);
+        simd_min_avx2(a3_lo, class_i + 3, &best_lo, &class_lo); simd_min_avx2(a3_hi, class_i + 3, &best_hi, &class_hi);
+    }
+
+    for (; class_i < class_end; class_i++) {
+        const float* c0 = centroids + (size_t)class_i * dim;
+        __m256 a0_lo = _mm256_setzero_ps(), a0_hi = _mm256_setzero_ps();
+
+        for (int d = 0; d < dim; d++) {
+            __m256 c = _mm256_set1_ps(c0[d]);
+            __m256 t;
+
+            t = _mm256_sub_ps(_mm256_loadu_ps(block + (size_t)d * SIMD_BLOCK), c);     a0_lo = _mm256_add_ps(a0_lo, _mm256_mul_ps(t, t));
+            t = _mm256_sub_ps(_mm256_loadu_ps(block + (size_t)d * SIMD_BLOCK + 8), c); a0_hi = _mm256_add_ps(a0_hi, _mm256_mul_ps(t, t));
+        }
+        simd_min_avx2(a0_lo, class_i, &best_lo, &class_lo);
+        simd_min_avx2(a0_hi, class_i, &best_hi, &class_hi);
+    }
+
+    _mm256_storeu_ps(min_dist, best_lo);
+    _mm256_storeu_ps(min_dist + 8, best_hi);
+    _mm256_storeu_si256((__m256i*)min_class, class_lo);
+    _mm256_storeu_si256((__m256i*)(min_class + 8), class_hi);
+}
+
+__attribute__((target("avx512f")))
+static inline void simd_min_avx512(__m512 dist, int class_i, __m512* best, __m512i* best_class)
+{
+    __mmask16 mask = _mm512_cmp_ps_mask(dist, *best, _CMP_LT_OQ);
+
+    *best = _mm512_mask_mov_ps(*best, mask, dist);
+    *best_class = _mm512_mask_mov_epi32(*best_class, mask, _mm512_set1_epi32(class_i));
+}
+
+// 16 points as one vector x 8 centroids
+__attribute__((target("avx512f")))
+static void simd_assign_avx512(const float* block, int dim, const float* centroids, int class_begin, int class_end, float* min_dist, int* min_class)
+{
+    __m512 best = _mm512_loadu_ps(min_dist);
+    __m512i best_class = _mm512_loadu_si512(min_class);
+    int class_i = class_begin;
+
+    for (; class_i + 8 <= class_end; class_i += 8) {
+        const float* c0 = centroids + (size_t)class_i * dim;
+        __m512 acc[8];
+
+        for (int k = 0; k < 8; k++) {
+            acc[k] = _mm512_setzero_ps();
+        }
+        for (int d = 0; d < dim; d++) {
+            __m512 x = _mm512_loadu_ps(block + (size_t)d * SIMD_BLOCK);
+
+            for (int k = 0; k < 8; k++) {
+                __m512 t = _mm512_sub_ps(x, _mm512_set1_ps(c0[(size_t)k * dim + d]));
+
+                acc[k] = _mm512_add_ps(acc[k], _mm512_mul_ps(t, t));
+            }
+        }
+        for (int k = 0; k < 8; k++) {
+            simd_min_avx512(acc[k], class_i + k, &best, &best_class);
+        }
+    }
+
+    for (; class_i < class_end; class_i++) {
+        const float* c0 = centroids + (size_t)class_i * dim;
+        __m512 acc = _mm512_setzero_ps();
+
+        for (int d = 0; d < dim; d++) {
+            __m512 t = _mm512_sub_ps(_mm512_loadu_ps(block + (size_t)d * SIMD_BLOCK), _mm512_set1_ps(c0[d]));
+
+            acc = _mm512_add_ps(acc, _mm512_mul_ps(t, t));
+        }
+        simd_min_avx512(acc, class_i, &best, &best_class);
+    }
+
+    _mm512_storeu_ps(min_dist, best);
+    _mm512_storeu_si512(min_class, best_class);
+}
+
+#endif // KM_SIMD_X86
+
+// Widest kernel the CPU supports, capped by KM_SIMD
+static SimdAssignFn simd_select(void)
+{
+    const char* env = getenv("KM_SIMD");
+    int cap = 2;
+
+    if (env != NULL) {
+        cap = (strcmp(env, "scalar") == 0) ? 0 : (strcmp(env, "avx2") == 0) ? 1 : 2;
+    }
+
+#ifdef KM_SIMD_X86
+    __builtin_cpu_init();
+    if (cap >= 2 && __builtin_cpu_supports("avx512f")) {
+        return simd_assign_avx512;
+    }
+    if (cap >= 1 && __builtin_cpu_supports("avx2")) {
+        return simd_assign_avx2;
+    }
+#else
+    (void)cap;
+#endif
+    return simd_assign_scalar;
+}
+
+
+// Per-thread sums and tallies; each worker allocates its own, so they stay in its memory
+struct SimdThread
+{
+    std::vector<double> sum;
+    std::vector<long long> count;
+    int changed;
+};
+
+
+void kmeans_simd(const KmeansConfig* config, int class_n, int data_n, int dim, float* centroids, const float* data, int* partitioned, KmeansResult* result)
+{
+    const SimdAssignFn assign = simd_select();
+    const size_t cent_sz = (size_t)class_n * dim;
+    const size_t block_n = ((size_t)data_n + SIMD_BLOCK - 1) / SIMD_BLOCK;
+    const size_t block_sz = (size_t)dim * SIMD_BLOCK;
+    // the assignment costs class_n distances per point, so size the pool by that work
+    const size_t work_sz = (size_t)data_n * class_n;
+    const int thread_n = km_parallel_width(work_sz);
+    // the merge reads every thread's sums of a centroid element
+    const size_t merge_sz = cent_sz * thread_n;
+    const int merge_n = km_parallel_width(merge_sz);
+    const int tile_class = std::max(1, (int)(SIMD_TILE_BYTES / (sizeof(float) * dim)));
+
+    // Points in blocks of SIMD_BLOCK, dimension-major inside a block; the tail block is zero-padded
+    std::vector<float> soa(block_n * block_sz);
+    // Centroids of the previous iteration, for the shift check
+    std::vector<float> prev(cent_sz);
+    std::vector<SimdThread> thread(thread_n);
+    std::vector<float> merge_shift(merge_n);
+    // Merged count of each class, and the classes left empty
+    std::vector<long long> merge_count(class_n);
+    std::vector<int> empty_class;
+    int i, changed, converged = 0;
+    float shift;
+
+    km_seed(config, class_n, data_n, dim, data, centroids);
+
+    // No point starts in a cluster, so the first iteration counts every point as changed.
+    // The blocks are filled by the worker that assigns them.
+    km_parallel_run(work_sz, [&](int thread_idx, int width)
+    {
+        size_t block_begin, block_end;
+
+        km_thread_range(block_n, thread_idx, width, &block_begin, &block_end);
+        for (size_t block_i = block_begin; block_i < block_end; block_i++) {
+            float* block = &soa[block_i * block_sz];
+
+            for (int p = 0; p < SIMD_BLOCK; p++) {
+                size_t data_i = block_i * SIMD_BLOCK + p;
+
+                for (int d = 0; d < dim; d++) {
+                    block[(size_t)d * SIMD_BLOCK + p] = (data_i < (size_t)data_n) ? data[data_i * dim + d] : 0.0f;
+                }
+                if (data_i < (size_t)data_n) {
+                    partitioned[data_i] = -1;
+                }
+            }
+        }
+    });
+
+
+    for (i = 0; i < config->iteration_n && !converged; i++) {
+
+        // Assignment step, each chunk summed into this thread's centroid sums once its labels are final
+        km_parallel_run(work_sz, [&](int thread_idx, int width)
+        {
+            SimdThread* p_thread = &thread[thread_idx];
+            size_t block_begin, block_end;
+            float min_dist[SIMD_CHUNK_BLOCK * SIMD_BLOCK];
+            int min_class[SIMD_CHUNK_BLOCK * SIMD_BLOCK];
+
+            km_thread_range(block_n, thread_idx, width, &block_begin, &block_end);
+            p_thread->sum.assign(cent_sz, 0.0);
+            p_thread->count.assign(class_n, 0);
+            p_thread->changed = 0;
+
+            for (size_t chunk_begin = block_begin; chunk_begin < block_end; chunk_begin += SIMD_CHUNK_BLOCK) {
+                size_t chunk_end = std::min(block_end, chunk_begin + SIMD_CHUNK_BLOCK);
+
+                for (int p = 0; p < SIMD_CHUNK_BLOCK * SIMD_BLOCK; p++) {
+                    min_dist[p] = FLT_MAX;
+                    min_class[p] = 0;
+                }
+
+                for (int tile_begin = 0; tile_begin < class_n; tile_begin += tile_class) {
+                    int tile_end = std::min(class_n, tile_begin + tile_class);
+
+                    for (size_t block_i = chunk_begin; block_i < chunk_end; block_i++) {
+                        size_t pos = (block_i - chunk_begin) * SIMD_BLOCK;
+
+                        assign(&soa[block_i * block_sz], dim, centroids, tile_begin, tile_end, &min_dist[pos], &min_class[pos]);
+                    }
+                }
+
+                for (size_t block_i = chunk_begin; block_i < chunk_end; block_i++) {
+                    const float* block = &soa[block_i * block_sz];
+                    size_t pos = (block_i - chunk_begin) * SIMD_BLOCK;
+
+                    for (int p = 0; p < SIMD_BLOCK; p++) {
+                        size_t data_i = block_i * SIMD_BLOCK + p;
+                        int class_i = min_class[pos + p];
+
+                        if (data_i >= (size_t)data_n) {
+                            break;
+                        }
+                        if (partitioned[data_i] != class_i) {
+                            partitioned[data_i] = class_i;
+                            p_thread->changed++;
+                        }
+
+                        double* p_sum = &p_thread->sum[(size_t)class_i * dim];
+
+                        for (int d = 0; d < dim; d++) {
+                            p_sum[d] += block[(size_t)d * SIMD_BLOCK + p];
+                        }
+                        p_thread->count[class_i]++;
+                    }
+                }
+            }
+        });
+
+        changed = 0;
+        for (int thread_idx = 0; thread_idx < thread_n; thread_idx++) {
+            changed += thread[thread_idx].changed;
+        }
+
+        // Update step: each thread merges the per-thread sums of a range of centroids, in thread order
+        memcpy(prev.data(), centroids, sizeof(float) * cent_sz);
+        km_parallel_run(merge_sz, [&](int thread_idx, int width)
+        {
+            int class_begin = (int)((long long)class_n * thread_idx / width);
+            int class_end = (int)((long long)class_n * (thread_idx + 1) / width);
+            float local_shift = 0.0f;
+
+            for (int class_i = class_begin; class_i < class_end; class_i++) {
+                long long count = 0;
+
+                for (int src_idx = 0; src_idx < thread_n; src_idx++) {
+                    count += thread[src_idx].count[class_i];
+                }
+                merge_count[class_i] = count;
+                // an empty cluster keeps its centroid until km_reseed_empty below
+                if (0 == count) {
+                    continue;
+                }
+
+                for (int d = 0; d < dim; d++) {
+                    size_t elem_i = (size_t)class_i * dim + d;
+                    double sum = 0.0;
+                    float t;
+
+                    for (int src_idx = 0; src_idx < thread_n; src_idx++) {
+                        sum += thread[src_idx].sum[elem_i];
+                    }
+                    centroids[elem_i] = (float)(sum / (double)count);
+
+                    // NaN sticks, as in kmeans_seq.cpp
+                    t = fabsf(centroids[elem_i] - prev[elem_i]);
+                    if (t > local_shift || isnan(t)) {
+                        local_shift = t;
+                    }
+                }
+            }
+
+            merge_shift[thread_idx] = local_shift;
+        });
+
+        shift = 0.0f;
+        for (int thread_idx = 0; thread_idx < merge_n; thread_idx++) {
+            float t = merge_shift[thread_idx];
+
+            if (t > shift || isnan(t)) {
+                shift = t;
+            }
+        }
+
+        // Empty clusters move onto the farthest points, as in kmeans_seq.cpp
+        empty_class.clear();
+        for (int class_i = 0; class_i < class_n; class_i++) {
+            if (0 == merge_count[class_i]) {
+                empty_class.push_back(class_i);
+            }
+        }
+        if (!empty_class.empty()) {
+            changed += km_reseed_empty((int)empty_class.size(), empty_class.data(), data_n, dim, data, partitioned, centroids);
+            for (int class_i : empty_class) {
+                for (int d = 0; d < dim; d++) {
+                    size_t elem_i = (size_t)class_i * dim + d;
+                    float t = fabsf(centroids[elem_i] - prev[elem_i]);
+
+                    if (t > shift || isnan(t)) {
+                        shift = t;
+                    }
+                }
+            }
+        }
+
+        converged = (config->tolerance >= 0) && ((0 == changed) || (shift <= config->tolerance));
+    }
+
+    result->iteration_n = i;
+    result->converged = converged;
+    result->inertia = kmeans_inertia(class_n, data_n, dim, centroids, data, partitioned);
+    result->distance_n = (long long)i * data_n * class_n;
+}
+
+
+struct KmSimdModel
+{
+    SimdAssignFn assign;
+    int class_n;
+    int dim;
+    int tile_class;
+    std::vector<float> centroids;
+    // per worker: SIMD_CHUNK_BLOCK blocks of queries
+    std::vector<std::vector<float> > stage;
+};
+
+KmSimdModel* km_simd_model_create(int class_n, int dim, const float* centroids)
+{
+    KmSimdModel* model = new KmSimdModel;
+
+    model->assign = simd_select();
+    model->class_n = class_n;
+    model->dim = dim;
+    model->tile_class = std::max(1, (int)(SIMD_TILE_BYTES / (sizeof(float) * dim)));
+    model->centroids.assign(centroids, centroids + (size_t)class_n * dim);
+    model->stage.resize(km_thread_count());
+    for (size_t thread_idx = 0; thread_idx < model->stage.size(); thread_idx++) {
+        model->stage[thread_idx].resize((size_t)SIMD_CHUNK_BLOCK * SIMD_BLOCK * dim);
+    }
+    return model;
+}
+
+// The assignment loop of kmeans_simd, one chunk of queries at a time staged in the worker's block
+void km_simd_predict(KmSimdModel* model, int query_n, const float* query, int* label, float* dist)
+{
+    const int class_n = model->class_n;
+    const int dim = model->dim;
+    const size_t block_n = ((size_t)query_n + SIMD_BLOCK - 1) / SIMD_BLOCK;
+    const size_t block_sz = (size_t)dim * SIMD_BLOCK;
+
+    km_parallel_run((size_t)query_n * class_n, [&](int thread_idx, int width)
+    {
+        float* stage = model->stage[thread_idx].data();
+        size_t block_begin, block_end;
+        float min_dist[SIMD_CHUNK_BLOCK * SIMD_BLOCK];
+        int min_class[SIMD_CHUNK_BLOCK * SIMD_BLOCK];
+
+        km_thread_range(block_n, thread_idx, width, &block_begin, &block_end);
+
+        for (size_t chunk_begin = block_begin; chunk_begin < block_end; chunk_begin += SIMD_CHUNK_BLOCK) {
+            size_t chunk_end = std::min(block_end, chunk_begin + SIMD_CHUNK_BLOCK);
+
+            for (size_t block_i = chunk_begin; block_i < chunk_end; block_i++) {
+                float* block = stage + (block_i - chunk_begin) * block_sz;
+
+                for (int p = 0; p < SIMD_BLOCK; p++) {
+                    size_t query_i = block_i * SIMD_BLOCK + p;
+
+                    for (int d = 0; d < dim; d++) {
+                        block[(size_t)d * SIMD_BLOCK + p] = (query_i < (size_t)query_n) ? query[query_i * dim + d] : 0.0f;
+                    }
+                }
+            }
+            for (int p = 0; p < SIMD_CHUNK_BLOCK * SIMD_BLOCK; p++) {
+                min_dist[p] = FLT_MAX;
+                min_class[p] = 0;
+            }
+
+            for (int tile_begin = 0; tile_begin < class_n; tile_begin += model->tile_class) {
+                int tile_end = std::min(class_n, tile_begin + model->tile_class);
+
+                for (size_t block_i = chunk_begin; block_i < chunk_end; block_i++) {
+                    size_t pos = (block_i - chunk_begin) * SIMD_BLOCK;
+
+                    model->assign(stage + (block_i - chunk_begin) * block_sz, dim, model->centroids.data(), tile_begin, tile_end,
+                                  &min_dist[pos], &min_class[pos]);
+                }
+            }
+
+            for (size_t query_i = chunk_begin * SIMD_BLOCK; query_i < std::min((size_t)query_n, chunk_end * SIMD_BLOCK); query_i++) {
+                size_t pos = query_i - chunk_begin * SIMD_BLOCK;
+
+                label[query_i] = min_class[pos];
+                if (dist != NULL) {
+                    dist[query_i] = min_dist[pos];
+                }
+            }
+        }
+    });
+}
+
+void km_simd_model_release(KmSimdModel* model)
+{
+    delete model;
+}
@@ -0,0 +1,31 @@
+/*
+  Streaming KMeans for the host engines
+
+  The host engines walk the points front to back every iteration, so they run on the mapped
+  file in place and the page cache does the streaming; kmeans() takes an int point count.
+  The kd-tree and the blocked brute force AUTO picks would copy every point, and Elkan keeps
+  class_n bounds per point, so AUTO and the kd-tree run Hamerly here, two floats per point.
+*/
+
+#include "kmeans.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+
+void kmeans_stream(const KmeansConfig* config, int class_n, long long data_n, int dim, float* centroids, const float* data, int* partitioned, KmeansResult* result)
+{
+    if (data_n > INT_MAX) {
+        fprintf(stderr, "data_n(%lld) is larger than INT_MAX, stream it with kmeans_opencl\n", data_n);
+        exit(EXIT_FAILURE);
+    }
+
+    KmeansConfig stream_config = *config;
+
+    if (KMEANS_PRUNE_AUTO == stream_config.prune || KMEANS_PRUNE_KDTREE == stream_config.prune) {
+        stream_config.prune = KMEANS_PRUNE_HAMERLY;
+    }
+
+    kmeans(&stream_config, class_n, (int)data_n, dim, centroids, data, partitioned, result);
+}
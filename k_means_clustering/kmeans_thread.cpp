@@ -0,0 +1,244 @@
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <stdlib.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "kmeans_thread.h"
+
+// Persistent workers 1..thread_n-1; the caller of km_parallel_run is worker 0.
+// Worker i always gets share i, so memory first touched in a parallel loop is reused by the
+// thread that placed it. Workers are pinned to one CPU each, which keeps that thread (and its
+// pages under a first-touch NUMA policy) on the same node for the life of the process.
+struct KmPool
+{
+	std::mutex                             run_mutex;  // one parallel region at a time
+	std::mutex                             mutex;
+	std::condition_variable                cv_start;
+	std::condition_variable                cv_done;
+	const std::function<void(int, int)>*   p_body;
+	int                                    width_s32;
+	int                                    pending_s32;
+	unsigned                               generation;
+	bool                                   stop;
+	std::vector<std::thread>               a_worker;
+
+	KmPool(void) : p_body(NULL), width_s32(1), pending_s32(0), generation(0), stop(false) {}
+	~KmPool(void);
+};
+
+static thread_local bool s_in_region = false;
+
+// KM_THREADS in the environment overrides the hardware thread count.
+static int km_thread_count_init(void)
+{
+	const char* p_env = getenv("KM_THREADS");
+	int count_s32 = (NULL != p_env) ? atoi(p_env) : 0;
+
+	if (count_s32 < 1)
+	{
+		count_s32 = (0 == std::thread::hardware_concurrency()) ? 1 : (int)std::thread::hardware_concurrency();
+	}
+
+	return count_s32;
+}
+
+int km_thread_count(void)
+{
+	static const int s_count_s32 = km_thread_count_init();
+
+	return s_count_s32;
+}
+
+int km_parallel_width(size_t size_sz)
+{
+	int thread_n = km_thread_count();
+
+	// Nested regions run on the current thread, so callers size per-worker state for one.
+	if (s_in_region)
+	{
+		return 1;
+	}
+
+	// Small ranges are not worth waking the workers.
+	return (size_sz < (size_t)thread_n * KM_THREAD_MIN_WORK) ? 1 : thread_n;
+}
+
+// Pin worker thread_idx to the thread_idx-th CPU the process may run on.
+static void km_pool_pin(std::thread& worker, int thread_idx)
+{
+#if defined(_WIN32)
+	DWORD_PTR processMask = 0, systemMask = 0;
+	int seen_s32 = 0;
+
+	GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask);
+	for (int cpu = 0; cpu < (int)(8 * sizeof(DWORD_PTR)); ++cpu)
+	{
+		if ((processMask >> cpu) & 1)
+		{
+			if (seen_s32++ == thread_idx)
+			{
+				SetThreadAffinityMask(worker.native_handle(), (DWORD_PTR)1 << cpu);
+				return;
+			}
+		}
+	}
+#elif defined(__linux__)
+	cpu_set_t allowed, one;
+	int seen_s32 = 0;
+
+	if (0 != sched_getaffinity(0, sizeof(allowed), &allowed))
+	{
+		return;
+	}
+	for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+	{
+		if (CPU_ISSET(cpu, &allowed))
+		{
+			if (seen_s32++ == thread_idx)
+			{
+				CPU_ZERO(&one);
+				CPU_SET(cpu, &one);
+				pthread_setaffinity_np(worker.native_handle(), sizeof(one), &one);
+				return;
+			}
+		}
+	}
+#else
+	(void)worker;
+	(void)thread_idx;
+#endif
+}
+
+static void km_pool_worker(KmPool* p_pool, int thread_idx)
+{
+	unsigned seen = 0;
+
+	s_in_region = true;
+
+	for (;;)
+	{
+		const std::function<void(int, int)>* p_body;
+		int width_s32;
+
+		{
+			std::unique_lock<std::mutex> lock(p_pool->mutex);
+
+			p_pool->cv_start.wait(lock, [&] { return p_pool->stop || (seen != p_pool->generation); });
+			if (p_pool->stop)
+			{
+				return;
+			}
+			seen = p_pool->generation;
+			p_body = p_pool->p_body;
+			width_s32 = p_pool->width_s32;
+		}
+
+		if (thread_idx >= width_s32)
+		{
+			continue;
+		}
+
+		(*p_body)(thread_idx, width_s32);
+
+		{
+			std::lock_guard<std::mutex> lock(p_pool->mutex);
+
+			if (0 == --p_pool->pending_s32)
+			{
+				p_pool->cv_done.notify_one();
+			}
+		}
+	}
+}
+
+KmPool::~KmPool(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		stop = true;
+	}
+	cv_start.notify_all();
+
+	for (size_t i = 0; i < a_worker.size(); ++i)
+	{
+		a_worker[i].join();
+	}
+}
+
+static KmPool* km_pool(void)
+{
+	static KmPool s_pool;
+	static std::once_flag s_pool_once;
+
+	std::call_once(s_pool_once, []
+	{
+		for (int thread_idx = 1; thread_idx < km_thread_count(); ++thread_idx)
+		{
+			s_pool.a_worker.emplace_back(km_pool_worker, &s_pool, thread_idx);
+			km_pool_pin(s_pool.a_worker.back(), thread_idx);
+		}
+	});
+
+	return &s_pool;
+}
+
+void km_parallel_run(size_t size_sz, const std::function<void(int, int)>& body)
+{
+	int thread_n = km_parallel_width(size_sz);
+	KmPool* p_pool;
+
+	// One worker, also for nested regions: run on the current thread instead of waiting for busy workers.
+	if (1 == thread_n)
+	{
+		body(0, 1);
+
+		return;
+	}
+
+	p_pool = km_pool();
+
+	std::lock_guard<std::mutex> run_lock(p_pool->run_mutex);
+
+	{
+		std::lock_guard<std::mutex> lock(p_pool->mutex);
+
+		p_pool->p_body = &body;
+		p_pool->width_s32 = thread_n;
+		p_pool->pending_s32 = thread_n - 1;
+		++p_pool->generation;
+	}
+	p_pool->cv_start.notify_all();
+
+	// The calling thread takes the first share.
+	s_in_region = true;
+	body(0, thread_n);
+	s_in_region = false;
+
+	std::unique_lock<std::mutex> lock(p_pool->mutex);
+
+	p_pool->cv_done.wait(lock, [&] { return 0 == p_pool->pending_s32; });
+}
+
+void km_parallel_for(size_t size_sz, const std::function<void(size_t, size_t)>& body)
+{
+	km_parallel_run(size_sz, [&](int thread_idx, int thread_n)
+	{
+		size_t begin_sz, end_sz;
+
+		km_thread_range(size_sz, thread_idx, thread_n, &begin_sz, &end_sz);
+		if (begin_sz < end_sz)
+		{
+			body(begin_sz, end_sz);
+		}
+	});
+}
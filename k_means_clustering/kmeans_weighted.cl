@@ -0,0 +1,88 @@
+/*
+
+ Weighted k-means, built together with kmeans.cl (it uses DIM, the g_status words, the
+ compensated atomics and cent_mark_empty from there).
+
+ Point i counts g_src_weight_arr[i] times. The nearest centroid of a point does not depend on
+ its weight, so kmeans_assign labels the points as for kmeans(); kmeans_update_weighted then adds
+ weight * point and weight into compensated global sums, as kmeans_update_global adds point and
+ 1, and kmeans_divide_weighted divides by the weight sum. The weight sums are float pairs, not
+ int counts, so the per-work-group slices of kmeans_update do not apply.
+
+*/
+
+/* as in kmeans.cl: distances round as on the host */
+#pragma OPENCL FP_CONTRACT OFF
+
+__kernel void kmeans_update_weighted(	__global        float*  g_res_sum_arr,
+										__global        float*  g_res_weight_arr,
+										__global  const float*  g_src_data_arr,
+										__global  const float*  g_src_weight_arr,
+										__global  const int*    g_src_part_arr,
+										                int     sz_src_data,
+										                int     dim,
+										                int     sz_data_stride,
+										__global  const int*    g_status)
+{
+	int idx_pos_data = 0;
+	int idx_dim      = 0;
+	int cur_part     = 0;
+	float cur_weight = 0;
+
+	if(g_status[KM_STATUS_DONE])
+	{
+		return;
+	}
+
+	for(idx_pos_data = get_global_id(0) ; idx_pos_data < sz_src_data ; idx_pos_data += get_global_size(0))
+	{
+		cur_part   = g_src_part_arr[idx_pos_data];
+		cur_weight = g_src_weight_arr[idx_pos_data];
+
+		global_atomic_acc_f32(&g_res_weight_arr[(size_t)cur_part * KM_ACC], cur_weight);
+		for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+		{
+			global_atomic_acc_f32(&g_res_sum_arr[((size_t)cur_part * DIM + idx_dim) * KM_ACC],
+			                      cur_weight * g_src_data_arr[(size_t)idx_dim * sz_data_stride + idx_pos_data]);
+		}
+	}
+}
+
+/* one work-item per centroid divides its sums by its weight and clears both, as kmeans_divide */
+__kernel void kmeans_divide_weighted(	__global        float*  g_res_cent_arr,
+										__global        float*  g_src_sum_arr,
+										__global        float*  g_src_weight_arr,
+										                int     no_max_class,
+										                int     dim,
+										__global        int*    g_cent_empty,
+										__global        int*    g_status)
+{
+	int pos_class = get_global_id(0);
+	int idx_dim   = 0;
+	size_t pos_base = 0;
+	float cur_weight = 0;
+	float new_cent   = 0;
+
+	if((pos_class >= no_max_class) || g_status[KM_STATUS_DONE])
+	{
+		return;
+	}
+
+	cur_weight = g_src_weight_arr[pos_class * KM_ACC] + g_src_weight_arr[pos_class * KM_ACC + 1];
+	pos_base   = (size_t)pos_class * DIM;
+	cent_mark_empty(g_cent_empty, pos_class, (0 == cur_weight), g_status);
+
+	for(idx_dim = 0 ; idx_dim < DIM ; idx_dim++)
+	{
+		if(0 != cur_weight)
+		{
+			new_cent = (g_src_sum_arr[(pos_base + idx_dim) * KM_ACC] + g_src_sum_arr[(pos_base + idx_dim) * KM_ACC + 1]) / cur_weight;
+			status_shift_max(g_status, new_cent, g_res_cent_arr[pos_base + idx_dim]);
+			g_res_cent_arr[pos_base + idx_dim] = new_cent;
+		}
+		g_src_sum_arr[(pos_base + idx_dim) * KM_ACC]     = 0;
+		g_src_sum_arr[(pos_base + idx_dim) * KM_ACC + 1] = 0;
+	}
+	g_src_weight_arr[pos_class * KM_ACC]     = 0;
+	g_src_weight_arr[pos_class * KM_ACC + 1] = 0;
+}
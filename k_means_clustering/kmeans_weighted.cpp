@@ -0,0 +1,192 @@
+/*
+  Weighted KMeans on the host thread pool
+
+  Every iteration labels the points with kmeans_simd's blocked assignment (km_simd_predict on a
+  model of the current centroids), then each thread adds weight * point and weight for its own
+  range of points into its own sums, in double, which are merged per centroid in thread order.
+  The nearest centroid does not depend on the weights, so the labels are those of kmeans_simd;
+  only the means, the seeding and the inertia weigh the points.
+*/
+
+#include "kmeans.h"
+#include "kmeans_common.h"
+#include "kmeans_thread.h"
+
+#include <string.h>
+#include <math.h>
+
+#include <vector>
+
+
+// Per-thread weighted sums; each worker allocates its own, as in kmeans_simd.cpp
+struct WeightedThread
+{
+    std::vector<double> sum;
+    std::vector<double> weight;
+    int changed;
+};
+
+
+double km_weighted_inertia(int class_n, int data_n, int dim, const float* centroids, const float* data, const float* weight, const int* partitioned)
+{
+    const int thread_n = km_parallel_width((size_t)data_n * dim);
+    std::vector<double> part(thread_n, 0.0);
+    double inertia = 0.0;
+
+    km_parallel_run((size_t)data_n * dim, [&](int thread_idx, int width)
+    {
+        int data_begin = (int)((long long)data_n * thread_idx / width);
+        int data_end = (int)((long long)data_n * (thread_idx + 1) / width);
+        double local = 0.0;
+
+        for (int data_i = data_begin; data_i < data_end; data_i++) {
+            const float* point = data + (size_t)data_i * dim;
+            int class_i = partitioned[data_i];
+            double dist = 0.0;
+
+            if (class_i < 0 || class_i >= class_n) {
+                continue;
+            }
+            for (int d = 0; d < dim; d++) {
+                double t = (double)point[d] - (double)centroids[(size_t)class_i * dim + d];
+
+                dist += t * t;
+            }
+            local += (double)weight[data_i] * dist;
+        }
+        part[thread_idx] = local;
+    });
+
+    for (int thread_idx = 0; thread_idx < thread_n; thread_idx++) {
+        inertia += part[thread_idx];
+    }
+    return inertia;
+}
+
+void km_weighted_seed(const KmeansConfig* config, int class_n, int data_n, int dim, const float* data, const float* weight, float* centroids)
+{
+    std::vector<double> cand_weight(data_n);
+    KmRng rng;
+
+    if (KMEANS_INIT_FILE == config->init || data_n < 1) {
+        return;
+    }
+    for (int data_i = 0; data_i < data_n; data_i++) {
+        cand_weight[data_i] = weight[data_i];
+    }
+    km_rng_seed(&rng, config->seed);
+    km_seed_reduce(data_n, dim, data, cand_weight.data(), class_n, &rng, centroids);
+}
+
+void kmeans_weighted_simd(const KmeansConfig* config, int class_n, int data_n, int dim, float* centroids, const float* data, const float* weight,
+                          int* partitioned, KmeansResult* result)
+{
+    const size_t cent_sz = (size_t)class_n * dim;
+    const int thread_n = km_parallel_width((size_t)data_n * dim);
+    std::vector<float> prev(cent_sz);
+    std::vector<int> label(data_n);
+    std::vector<WeightedThread> thread(thread_n);
+    std::vector<int> empty_class;
+    int i, changed, converged = 0;
+    float shift;
+
+    km_weighted_seed(config, class_n, data_n, dim, data, weight, centroids);
+
+    // No point starts in a cluster, so the first iteration counts every point as changed
+    for (int data_i = 0; data_i < data_n; data_i++) {
+        partitioned[data_i] = -1;
+    }
+
+    for (i = 0; i < config->iteration_n && !converged; i++) {
+        KmSimdModel* model = km_simd_model_create(class_n, dim, centroids);
+
+        // Assignment step
+        km_simd_predict(model, data_n, data, label.data(), NULL);
+        km_simd_model_release(model);
+
+        // Weighted sums, each thread over its own range of points
+        km_parallel_run((size_t)data_n * dim, [&](int thread_idx, int width)
+        {
+            WeightedThread* p_thread = &thread[thread_idx];
+            int data_begin = (int)((long long)data_n * thread_idx / width);
+            int data_end = (int)((long long)data_n * (thread_idx + 1) / width);
+
+            p_thread->sum.assign(cent_sz, 0.0);
+            p_thread->weight.assign(class_n, 0.0);
+            p_thread->changed = 0;
+
+            for (int data_i = data_begin; data_i < data_end; data_i++) {
+                const float* point = data + (size_t)data_i * dim;
+                int class_i = label[data_i];
+                double* p_sum = &p_thread->sum[(size_t)class_i * dim];
+
+                if (partitioned[data_i] != class_i) {
+                    partitioned[data_i] = class_i;
+                    p_thread->changed++;
+                }
+                for (int d = 0; d < dim; d++) {
+                    p_sum[d] += (double)weight[data_i] * point[d];
+                }
+                p_thread->weight[class_i] += weight[data_i];
+            }
+        });
+
+        // Update step, merging the threads in order
+        changed = 0;
+        for (int thread_idx = 1; thread_idx < thread_n; thread_idx++) {
+            for (size_t elem_i = 0; elem_i < cent_sz; elem_i++) {
+                thread[0].sum[elem_i] += thread[thread_idx].sum[elem_i];
+            }
+            for (int class_i = 0; class_i < class_n; class_i++) {
+                thread[0].weight[class_i] += thread[thread_idx].weight[class_i];
+            }
+        }
+        for (int thread_idx = 0; thread_idx < thread_n; thread_idx++) {
+            changed += thread[thread_idx].changed;
+        }
+
+        memcpy(prev.data(), centroids, sizeof(float) * cent_sz);
+        shift = 0.0f;
+        empty_class.clear();
+        for (int class_i = 0; class_i < class_n; class_i++) {
+            double total = thread[0].weight[class_i];
+
+            // weightless clusters move below, as in kmeans_simd.cpp
+            if (!(total > 0.0)) {
+                empty_class.push_back(class_i);
+                continue;
+            }
+            for (int d = 0; d < dim; d++) {
+                size_t elem_i = (size_t)class_i * dim + d;
+                float t;
+
+                centroids[elem_i] = (float)(thread[0].sum[elem_i] / total);
+                t = fabsf(centroids[elem_i] - prev[elem_i]);
+                if (t > shift || isnan(t)) {
+                    shift = t;
+                }
+            }
+        }
+
+        if (!empty_class.empty()) {
+            changed += km_reseed_empty((int)empty_class.size(), empty_class.data(), data_n, dim, data, partitioned, centroids);
+            for (int class_i : empty_class) {
+                for (int d = 0; d < dim; d++) {
+                    size_t elem_i = (size_t)class_i * dim + d;
+                    float t = fabsf(centroids[elem_i] - prev[elem_i]);
+
+                    if (t > shift || isnan(t)) {
+                        shift = t;
+                    }
+                }
+            }
+        }
+
+        converged = (config->tolerance >= 0) && ((0 == changed) || (shift <= config->tolerance));
+    }
+
+    result->iteration_n = i;
+    result->converged = converged;
+    result->inertia = km_weighted_inertia(class_n, data_n, dim, centroids, data, weight, partitioned);
+    result->distance_n = (long long)i * data_n * class_n;
+}
@@ -1,40 +1,168 @@
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
-#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <numeric>
+#include <vector>
 
 #include "vecAdd.h"
+#include "vecExpr.h"
+#include "vecReduce.h"
+#include "vecStream.h"
+#include "vecThread.h"
+
+#define BENCH_REPEAT (5)
 
 static float sa_a_f32[SIZE];
 static float sa_b_f32[SIZE];
 static float sa_alg_c_f32[SIZE];
 static float sa_ocl_c_f32[SIZE];
 
+// Best wall time of BENCH_REPEAT runs, in seconds.
+static double bench_time(const std::function<void(void)>& body)
+{
+	double best = 0.0;
+
+	for (int repeat = 0; repeat < BENCH_REPEAT; ++repeat)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		body();
+
+		double spent = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		if ((0 == repeat) || (spent < best))
+		{
+			best = spent;
+		}
+	}
+
+	return best;
+}
+
+static void bench_print(const char* p_name, double lib_time, double std_time, bool ok)
+{
+	printf("%-22s lib %9.6f sec  std %9.6f sec  x%5.2f  %s\n", p_name, lib_time, std_time, std_time / lib_time, ok ? "ok" : "MISMATCH");
+}
+
+// Float sums are checked against a double-precision reference; long float sums drift by
+// a fraction of a percent depending on the summation order.
+static bool bench_close(double a, double ref)
+{
+	return fabs(a - ref) <= 1e-2 * (fabs(ref) + 1.0);
+}
+
+// vec_* reductions and scans against the sequential standard algorithms.
+static int bench_reduce(void)
+{
+	const size_t size_sz = SIZE;
+	std::vector<float> a_x_f32(size_sz), a_y_f32(size_sz), a_z_f32(size_sz), a_lib_f32(size_sz), a_std_f32(size_sz);
+	std::vector<int> a_x_s32(size_sz), a_lib_s32(size_sz), a_std_s32(size_sz);
+	float lib_f32 = 0.f, std_f32 = 0.f;
+	int lib_s32 = 0, std_s32 = 0;
+	size_t lib_idx = 0, std_idx = 0;
+	double lib_time, std_time;
+
+	for (size_t i = 0; i < size_sz; ++i)
+	{
+		a_x_f32[i] = (float)(i % 1000) * 0.001f;
+		a_y_f32[i] = (float)((i * 7) % 1000) * 0.001f;
+		a_x_s32[i] = (int)(i % 1000) - 500;
+		// Prefix sums of a_z_f32 stay small integers, exact in float in any order.
+		a_z_f32[i] = (float)((int)(i % 7) - 3);
+	}
+	a_x_f32[size_sz / 3] = 2.f;
+
+	lib_time = bench_time([&] { lib_f32 = vec_sum(a_x_f32.data(), size_sz); });
+	std_time = bench_time([&] { std_f32 = std::reduce(a_x_f32.begin(), a_x_f32.end()); });
+	bench_print("sum f32", lib_time, std_time, bench_close(lib_f32, std::accumulate(a_x_f32.begin(), a_x_f32.end(), 0.0)));
+
+	lib_time = bench_time([&] { lib_s32 = vec_sum(a_x_s32.data(), size_sz); });
+	std_time = bench_time([&] { std_s32 = std::reduce(a_x_s32.begin(), a_x_s32.end()); });
+	bench_print("sum s32", lib_time, std_time, lib_s32 == std_s32);
+
+	lib_time = bench_time([&] { lib_f32 = vec_min(a_x_f32.data(), size_sz); });
+	std_time = bench_time([&] { std_f32 = std::reduce(a_x_f32.begin(), a_x_f32.end(), INFINITY, [](float a, float b) { return (b < a) ? b : a; }); });
+	bench_print("min f32", lib_time, std_time, lib_f32 == std_f32);
+
+	lib_time = bench_time([&] { lib_s32 = vec_max(a_x_s32.data(), size_sz); });
+	std_time = bench_time([&] { std_s32 = std::reduce(a_x_s32.begin(), a_x_s32.end(), INT_MIN, [](int a, int b) { return (b > a) ? b : a; }); });
+	bench_print("max s32", lib_time, std_time, lib_s32 == std_s32);
+
+	lib_time = bench_time([&] { lib_idx = vec_argmax(a_x_f32.data(), size_sz); });
+	std_time = bench_time([&] { std_idx = (size_t)(std::max_element(a_x_f32.begin(), a_x_f32.end()) - a_x_f32.begin()); });
+	bench_print("argmax f32", lib_time, std_time, lib_idx == std_idx);
+
+	lib_time = bench_time([&] { lib_f32 = vec_dot(a_x_f32.data(), a_y_f32.data(), size_sz); });
+	std_time = bench_time([&] { std_f32 = std::transform_reduce(a_x_f32.begin(), a_x_f32.end(), a_y_f32.begin(), 0.f); });
+	bench_print("dot f32", lib_time, std_time, bench_close(lib_f32, std::inner_product(a_x_f32.begin(), a_x_f32.end(), a_y_f32.begin(), 0.0)));
+
+	lib_time = bench_time([&] { vec_inclusive_scan(a_x_s32.data(), a_lib_s32.data(), size_sz); });
+	std_time = bench_time([&] { std::inclusive_scan(a_x_s32.begin(), a_x_s32.end(), a_std_s32.begin()); });
+	bench_print("inclusive scan s32", lib_time, std_time, a_lib_s32 == a_std_s32);
+
+	lib_time = bench_time([&] { vec_exclusive_scan(a_x_s32.data(), a_lib_s32.data(), size_sz); });
+	std_time = bench_time([&] { std::exclusive_scan(a_x_s32.begin(), a_x_s32.end(), a_std_s32.begin(), 0); });
+	bench_print("exclusive scan s32", lib_time, std_time, a_lib_s32 == a_std_s32);
+
+	lib_time = bench_time([&] { vec_inclusive_scan(a_z_f32.data(), a_lib_f32.data(), size_sz); });
+	std_time = bench_time([&] { std::inclusive_scan(a_z_f32.begin(), a_z_f32.end(), a_std_f32.begin()); });
+	bench_print("inclusive scan f32", lib_time, std_time, a_lib_f32 == a_std_f32);
+
+	return 0;
+}
+
 int main(int argc, char ** argv)
 {
 	int i_s32 = 0;
-    clock_t start_point, end_point;
+    std::chrono::steady_clock::time_point start_point, end_point;
 
-   	// Initialize values for array members.
-	for (i_s32 = 0; i_s32 < SIZE; ++i_s32)
-    {
-		sa_a_f32[i_s32] = i_s32 + 1.f;
-		sa_b_f32[i_s32] = (i_s32 + 1.f) * 2.f;
+	if ((argc > 1) && (0 == strcmp(argv[1], "reduce")))
+	{
+		return bench_reduce();
 	}
 
-    start_point = clock();
+	// vecAdd stream [elements] [trials]
+	if ((argc > 1) && (0 == strcmp(argv[1], "stream")))
+	{
+		size_t size_sz = (argc > 2) ? (size_t)strtoull(argv[2], NULL, 10) : SIZE;
+		int trial_n = (argc > 3) ? atoi(argv[3]) : VEC_STREAM_TRIALS;
+
+		return vec_stream_bench(size_sz, trial_n, stdout);
+	}
+
+   	// Initialize values for array members, on the workers that use them (first touch).
+	vec_parallel_for(SIZE, [](size_t begin_sz, size_t end_sz)
+	{
+		for (size_t i_sz = begin_sz; i_sz < end_sz; ++i_sz)
+		{
+			sa_a_f32[i_sz] = i_sz + 1.f;
+			sa_b_f32[i_sz] = (i_sz + 1.f) * 2.f;
+			sa_alg_c_f32[i_sz] = 0.f;
+			sa_ocl_c_f32[i_sz] = 0.f;
+		}
+	});
+
+    start_point = std::chrono::steady_clock::now();
 
     vecAdd_alg(sa_a_f32, sa_b_f32, sa_alg_c_f32, SIZE);
 
-    end_point = clock();
+    end_point = std::chrono::steady_clock::now();
 
-    printf("Exe time alg: %f sec\n", ((float)(end_point - start_point)/CLOCKS_PER_SEC));
+    printf("Exe time alg: %f sec\n", std::chrono::duration<double>(end_point - start_point).count());
 
-    start_point = clock();
+    start_point = std::chrono::steady_clock::now();
 
     vecAdd_ocl(sa_a_f32, sa_b_f32, sa_ocl_c_f32, SIZE);
 
-    end_point = clock();
+    end_point = std::chrono::steady_clock::now();
 
-    printf("Exe time ocl: %f sec\n", ((float)(end_point - start_point)/CLOCKS_PER_SEC));
+    printf("Exe time ocl: %f sec\n", std::chrono::duration<double>(end_point - start_point).count());
 
 	// Test if correct answer
 	for (i_s32 = 0; i_s32 < SIZE; ++i_s32)
@@ -50,5 +178,31 @@ int main(int argc, char ** argv)
 		printf("Everything seems to work fine! \n");
 	}
 
+    // Same addition through the fused expression engine.
+    start_point = std::chrono::steady_clock::now();
+
+    if (0 != eval(sa_ocl_c_f32, Vec(sa_a_f32, SIZE) + Vec(sa_b_f32, SIZE)))
+    {
+		printf("expression operands differ in size!\n");
+		return -1;
+    }
+
+    end_point = std::chrono::steady_clock::now();
+
+    printf("Exe time expr: %f sec\n", std::chrono::duration<double>(end_point - start_point).count());
+
+	for (i_s32 = 0; i_s32 < SIZE; ++i_s32)
+    {
+		if (sa_alg_c_f32[i_s32] != sa_ocl_c_f32[i_s32])
+        {
+			printf("expr mismatch: %d  %f %f\n", i_s32, sa_alg_c_f32[i_s32], sa_ocl_c_f32[i_s32]);
+			break;
+		}
+	}
+	if (i_s32 == SIZE)
+    {
+		printf("Expression engine matches! \n");
+	}
+
     return 0;
 }
\ No newline at end of file
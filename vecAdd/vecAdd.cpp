@@ -8,164 +8,204 @@ Sources: http://www.eriksmistad.no/getting-started-with-opencl-and-gpu-computing
 
 #include <CL/cl.h>
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-#define MAX_SOURCE_SIZE (0x100000)
+#include "vecAdd.h"
+#include "vecCpu.h"
+#include "vecOcl.h"
+#include "vecThread.h"
 
-int vecAdd_alg(const float* p_a_f32, const float* p_b_f32, float* p_c_f32, const int size_s32)
+#if defined(VEC_CPU_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <immintrin.h>
+#endif
+#endif
+
+#define FILE_NAME_ADD_KERNEL "vecAddKernel.cl"
+
+// c = a + b over n elements; stream selects non-temporal stores for c.
+typedef void (*VecAddRange)(const float* p_a_f32, const float* p_b_f32, float* p_c_f32, size_t n_sz, bool stream);
+
+static void vec_add_scalar(const float* p_a_f32, const float* p_b_f32, float* p_c_f32, size_t n_sz, bool)
 {
-    int i_s32 = 0;
+    size_t i_sz = 0;
 
-    for (i_s32 = 0; i_s32 < size_s32; ++i_s32)
+    for (i_sz = 0; i_sz < n_sz; ++i_sz)
     {
-        p_c_f32[i_s32] = p_a_f32[i_s32] + p_b_f32[i_s32];
+        p_c_f32[i_sz] = p_a_f32[i_sz] + p_b_f32[i_sz];
     }
-
-    return 0;
 }
 
-int vecAdd_ocl(const float* p_a_f32, const float* p_b_f32, float* p_c_f32, const int size_s32)
+#if defined(VEC_CPU_X86)
+VEC_TARGET("avx2")
+static void vec_add_avx2(const float* p_a_f32, const float* p_b_f32, float* p_c_f32, size_t n_sz, bool stream)
 {
-	// Load kernel from file vecAddKernel.cl
-	FILE *kernelFile;
-	char *kernelSource;
-	size_t kernelSize;
+    size_t i_sz = 0;
+
+    if (stream)
+    {
+        // Streaming stores need an aligned destination.
+        for (; (i_sz < n_sz) && (0 != ((uintptr_t)(p_c_f32 + i_sz) & 31)); ++i_sz)
+        {
+            p_c_f32[i_sz] = p_a_f32[i_sz] + p_b_f32[i_sz];
+        }
+        for (; i_sz + 8 <= n_sz; i_sz += 8)
+        {
+            _mm256_stream_ps(p_c_f32 + i_sz, _mm256_add_ps(_mm256_loadu_ps(p_a_f32 + i_sz), _mm256_loadu_ps(p_b_f32 + i_sz)));
+        }
+        _mm_sfence();
+    }
+    else
+    {
+        for (; i_sz + 8 <= n_sz; i_sz += 8)
+        {
+            _mm256_storeu_ps(p_c_f32 + i_sz, _mm256_add_ps(_mm256_loadu_ps(p_a_f32 + i_sz), _mm256_loadu_ps(p_b_f32 + i_sz)));
+        }
+    }
+
+    vec_add_scalar(p_a_f32 + i_sz, p_b_f32 + i_sz, p_c_f32 + i_sz, n_sz - i_sz, false);
+}
 
-	fopen_s(&kernelFile, "vecAddKernel.cl", "r");
+VEC_TARGET("avx512f")
+static void vec_add_avx512(const float* p_a_f32, const float* p_b_f32, float* p_c_f32, size_t n_sz, bool stream)
+{
+    size_t i_sz = 0;
 
-	if (!kernelFile)
+    if (stream)
     {
-		fprintf(stderr, "No file named vecAddKernel.cl was found\n");
+        for (; (i_sz < n_sz) && (0 != ((uintptr_t)(p_c_f32 + i_sz) & 63)); ++i_sz)
+        {
+            p_c_f32[i_sz] = p_a_f32[i_sz] + p_b_f32[i_sz];
+        }
+        for (; i_sz + 16 <= n_sz; i_sz += 16)
+        {
+            _mm512_stream_ps(p_c_f32 + i_sz, _mm512_add_ps(_mm512_loadu_ps(p_a_f32 + i_sz), _mm512_loadu_ps(p_b_f32 + i_sz)));
+        }
+        _mm_sfence();
+    }
+    else
+    {
+        for (; i_sz + 16 <= n_sz; i_sz += 16)
+        {
+            _mm512_storeu_ps(p_c_f32 + i_sz, _mm512_add_ps(_mm512_loadu_ps(p_a_f32 + i_sz), _mm512_loadu_ps(p_b_f32 + i_sz)));
+        }
+    }
 
-		exit(-1);
-	}
+    // The tail is at most 15 elements; a masked store keeps it in one instruction.
+    if (i_sz < n_sz)
+    {
+        __mmask16 mask = (__mmask16)((1u << (n_sz - i_sz)) - 1);
 
-	kernelSource = (char*)malloc(MAX_SOURCE_SIZE);
-	if (NULL == kernelSource)
-	{
-		printf("malloc failed!\n");
+        _mm512_mask_storeu_ps(p_c_f32 + i_sz, mask,
+            _mm512_add_ps(_mm512_maskz_loadu_ps(mask, p_a_f32 + i_sz), _mm512_maskz_loadu_ps(mask, p_b_f32 + i_sz)));
+    }
+}
+#endif
 
-		exit(-1);
-	}
-	kernelSize = fread(kernelSource, 1, MAX_SOURCE_SIZE, kernelFile);
-	fclose(kernelFile);
-
-	// Getting platform and device information
-	cl_platform_id platformId = NULL;
-	cl_device_id deviceID = NULL;
-	cl_uint retNumDevices;
-	cl_uint retNumPlatforms;
-	cl_int ret = clGetPlatformIDs(1, &platformId, &retNumPlatforms);
-	ret = clGetDeviceIDs(platformId, CL_DEVICE_TYPE_GPU, 1, &deviceID, &retNumDevices);
-
-#if 1
-    char* value;
-    size_t valueSize;
-    cl_uint maxComputeUnits;
-	cl_ulong localMemSize;
-	cl_device_local_mem_type localMemType;
-	size_t maxWorkGroupSize;
-
-	printf("retNumPlatforms: %d, retNumDevices: %d\n", retNumPlatforms, retNumDevices);
-
-	// print device name
-	clGetDeviceInfo(deviceID, CL_DEVICE_NAME, 0, NULL, &valueSize);
-	value = (char*) malloc(valueSize);
-	clGetDeviceInfo(deviceID, CL_DEVICE_NAME, valueSize, value, NULL);
-	printf("Device: %s\n", value);
-	free(value);
-
-	// print hardware device version
-	clGetDeviceInfo(deviceID, CL_DEVICE_VERSION, 0, NULL, &valueSize);
-	value = (char*) malloc(valueSize);
-	clGetDeviceInfo(deviceID, CL_DEVICE_VERSION, valueSize, value, NULL);
-	printf("Hardware version: %s\n", value);
-	free(value);
-
-	// print software driver version
-	clGetDeviceInfo(deviceID, CL_DRIVER_VERSION, 0, NULL, &valueSize);
-	value = (char*) malloc(valueSize);
-	clGetDeviceInfo(deviceID, CL_DRIVER_VERSION, valueSize, value, NULL);
-	printf("Software version: %s\n", value);
-	free(value);
-
-	// print c version supported by compiler for device
-	clGetDeviceInfo(deviceID, CL_DEVICE_OPENCL_C_VERSION, 0, NULL, &valueSize);
-	value = (char*) malloc(valueSize);
-	clGetDeviceInfo(deviceID, CL_DEVICE_OPENCL_C_VERSION, valueSize, value, NULL);
-	printf("OpenCL C version: %s\n", value);
-	free(value);
-
-	// print parallel compute units
-	clGetDeviceInfo(deviceID, CL_DEVICE_MAX_COMPUTE_UNITS,
-			sizeof(maxComputeUnits), &maxComputeUnits, NULL);
-	printf("Parallel compute units: %d\n", maxComputeUnits);
-
-	clGetDeviceInfo(deviceID, CL_DEVICE_LOCAL_MEM_SIZE,
-		sizeof(localMemSize), &localMemSize, NULL);
-	printf("Local mem size: %llu\n", localMemSize);
-
-	clGetDeviceInfo(deviceID, CL_DEVICE_LOCAL_MEM_TYPE,
-		sizeof(localMemType), &localMemType, NULL);
-	printf("Local mem type: %u\n", localMemType);
-
-	clGetDeviceInfo(deviceID, CL_DEVICE_MAX_WORK_GROUP_SIZE,
-		sizeof(maxWorkGroupSize), &maxWorkGroupSize, NULL);
-	printf("Max work group size: %llu\n", maxWorkGroupSize);
+static VecAddRange vec_add_select(void)
+{
+#if defined(VEC_CPU_X86)
+    switch (vec_cpu_isa())
+    {
+    case VEC_ISA_AVX512:
+        return vec_add_avx512;
+    case VEC_ISA_AVX2:
+        return vec_add_avx2;
+    default:
+        break;
+    }
 #endif
 
-	// Creating context.
-	cl_context context = clCreateContext(NULL, 1, &deviceID, NULL, NULL,  &ret);
+    return vec_add_scalar;
+}
 
+// Host path: one contiguous share per pool worker, vectorized with the best ISA of the CPU.
+// An output larger than the last level cache would only evict the inputs on its way to
+// memory, so it is written with non-temporal stores.
+int vecAdd_alg(const float* p_a_f32, const float* p_b_f32, float* p_c_f32, const size_t size_sz)
+{
+    static const VecAddRange s_add = vec_add_select();
+    bool stream = (size_sz * sizeof(float)) > vec_cpu_llc_size();
+
+    vec_parallel_for(size_sz, [&](size_t begin_sz, size_t end_sz)
+    {
+        s_add(p_a_f32 + begin_sz, p_b_f32 + begin_sz, p_c_f32 + begin_sz, end_sz - begin_sz, stream);
+    });
 
-	// Creating command queue
-	cl_command_queue commandQueue = clCreateCommandQueueWithProperties(context, deviceID, 0, &ret);
+    return 0;
+}
+
+// Device path on the shared OpenCL device; without one it runs on the host.
+int vecAdd_ocl(const float* p_a_f32, const float* p_b_f32, float* p_c_f32, const size_t size_sz)
+{
+	VecOclEnv* p_env = vec_ocl_env();
+
+	if (NULL == p_env)
+	{
+		return vecAdd_alg(p_a_f32, p_b_f32, p_c_f32, size_sz);
+	}
+
+	cl_context context = p_env->context;
+	cl_command_queue commandQueue = p_env->commandQueue;
+	cl_device_id deviceID = p_env->deviceID;
+	cl_int ret = CL_SUCCESS;
+
+	// Load kernel from file vecAddKernel.cl
+	size_t kernelSize;
+	char* kernelSource = vec_ocl_load_source(FILE_NAME_ADD_KERNEL, &kernelSize);
 
 	// Memory buffers for each array
-	cl_mem aMemObj = clCreateBuffer(context, CL_MEM_READ_ONLY, size_s32 * sizeof(float), NULL, &ret);
-	cl_mem bMemObj = clCreateBuffer(context, CL_MEM_READ_ONLY, size_s32 * sizeof(float), NULL, &ret);
-	cl_mem cMemObj = clCreateBuffer(context, CL_MEM_WRITE_ONLY, size_s32 * sizeof(float), NULL, &ret);
+	cl_mem aMemObj = clCreateBuffer(context, CL_MEM_READ_ONLY, size_sz * sizeof(float), NULL, &ret);
+	cl_mem bMemObj = clCreateBuffer(context, CL_MEM_READ_ONLY, size_sz * sizeof(float), NULL, &ret);
+	cl_mem cMemObj = clCreateBuffer(context, CL_MEM_WRITE_ONLY, size_sz * sizeof(float), NULL, &ret);
 
 
 	// Copy lists to memory buffers
-	ret = clEnqueueWriteBuffer(commandQueue, aMemObj, CL_TRUE, 0, size_s32 * sizeof(float), p_a_f32, 0, NULL, NULL);;
-	ret = clEnqueueWriteBuffer(commandQueue, bMemObj, CL_TRUE, 0, size_s32 * sizeof(float), p_b_f32, 0, NULL, NULL);
-
-	// Create program from kernel source
-	cl_program program = clCreateProgramWithSource(context, 1, (const char **)&kernelSource, (const size_t *)&kernelSize, &ret);	
+	ret = clEnqueueWriteBuffer(commandQueue, aMemObj, CL_TRUE, 0, size_sz * sizeof(float), p_a_f32, 0, NULL, NULL);;
+	ret = clEnqueueWriteBuffer(commandQueue, bMemObj, CL_TRUE, 0, size_sz * sizeof(float), p_b_f32, 0, NULL, NULL);
 
 	// Build program
-	ret = clBuildProgram(program, 1, &deviceID, NULL, NULL, NULL);
+	cl_program program = vec_ocl_build(kernelSource, kernelSize, NULL);
+	free(kernelSource);
 
 	// Create kernel
 	cl_kernel kernel = clCreateKernel(program, "addVectors", &ret);
+	if (CL_SUCCESS != ret)
+	{
+		printf("clCreateKernel(addVectors) failed! %d\n", ret);
+		exit(-1);
+	}
 
 
 	// Set arguments for kernel
 	ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), (void *)&aMemObj);	
 	ret = clSetKernelArg(kernel, 1, sizeof(cl_mem), (void *)&bMemObj);	
 	ret = clSetKernelArg(kernel, 2, sizeof(cl_mem), (void *)&cMemObj);	
+	cl_ulong size_u64 = size_sz;
+	ret = clSetKernelArg(kernel, 3, sizeof(cl_ulong), (void *)&size_u64);
 
 
-	// Execute the kernel
-	size_t globalItemSize = size_s32;
-	size_t localItemSize = 64; // globalItemSize has to be a multiple of localItemSize. 1024/64 = 16 
+	// Execute the kernel. addVectors is a grid-stride loop, so the launch only depends on the device.
+	size_t globalItemSize = 0;
+	size_t localItemSize = 0;
+	vec_ocl_stride_geometry(kernel, deviceID, size_sz / 4 + 1, &globalItemSize, &localItemSize);
 	ret = clEnqueueNDRangeKernel(commandQueue, kernel, 1, NULL, &globalItemSize, &localItemSize, 0, NULL, NULL);	
 
 	// Read from device back to host.
-	ret = clEnqueueReadBuffer(commandQueue, cMemObj, CL_TRUE, 0, size_s32 * sizeof(float), p_c_f32, 0, NULL, NULL);
+	ret = clEnqueueReadBuffer(commandQueue, cMemObj, CL_TRUE, 0, size_sz * sizeof(float), p_c_f32, 0, NULL, NULL);
 
-	// Clean up, release memory.
+	// Clean up, release memory. The context and queue belong to the shared environment.
 	ret = clFlush(commandQueue);
 	ret = clFinish(commandQueue);
-	ret = clReleaseCommandQueue(commandQueue);
 	ret = clReleaseKernel(kernel);
 	ret = clReleaseProgram(program);
 	ret = clReleaseMemObject(aMemObj);
 	ret = clReleaseMemObject(bMemObj);
 	ret = clReleaseMemObject(cMemObj);
-	ret = clReleaseContext(context);
 
 	return 0;
 }
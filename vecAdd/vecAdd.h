@@ -1,4 +1,7 @@
-#define SIZE (1920 * 1080 * 20)
+#include <stddef.h>
 
-int vecAdd_alg(const float* p_a_f32, const float* p_b_f32, float* p_c_f32, const int size_s32);
-int vecAdd_ocl(const float* p_a_f32, const float* p_b_f32, float* p_c_f32, const int size_s32);
+// Deliberately not a multiple of the work-group size or of 4.
+#define SIZE (1920 * 1080 * 20 + 3)
+
+int vecAdd_alg(const float* p_a_f32, const float* p_b_f32, float* p_c_f32, const size_t size_sz);
+int vecAdd_ocl(const float* p_a_f32, const float* p_b_f32, float* p_c_f32, const size_t size_sz);
@@ -1,7 +1,149 @@
+/* float4 elements per work-item and loop trip; the loads are issued before the stores */
+#define VEC_ADD_UNROLL (4)
+
+/* Grid-stride loop over any length n: the launch size comes from the device, not from n.
+   Work-items process float4 chunks; the last n % 4 elements are the scalar tail. */
 __kernel void addVectors(__global const float *a, 
 	__global const float *b,
-	__global float *c)
+	__global float *c,
+	const ulong n)
 {		
-    int gid = get_global_id(0);
-    c[gid] = a[gid] + b[gid];
+    size_t gid = get_global_id(0);
+    size_t stride = get_global_size(0);
+    size_t n4 = n >> 2;
+    size_t i = gid;
+    float4 r0, r1, r2, r3;
+
+    for (; i + (VEC_ADD_UNROLL - 1) * stride < n4; i += VEC_ADD_UNROLL * stride)
+    {
+        r0 = vload4(i, a) + vload4(i, b);
+        r1 = vload4(i + stride, a) + vload4(i + stride, b);
+        r2 = vload4(i + 2 * stride, a) + vload4(i + 2 * stride, b);
+        r3 = vload4(i + 3 * stride, a) + vload4(i + 3 * stride, b);
+
+        vstore4(r0, i, c);
+        vstore4(r1, i + stride, c);
+        vstore4(r2, i + 2 * stride, c);
+        vstore4(r3, i + 3 * stride, c);
+    }
+    for (; i < n4; i += stride)
+    {
+        vstore4(vload4(i, a) + vload4(i, b), i, c);
+    }
+
+    i = (n4 << 2) + gid;
+    if (i < n)
+    {
+        c[i] = a[i] + b[i];
+    }
+}
+
+/* STREAM kernels for the bandwidth benchmark (vecStream.cpp); same loop structure as addVectors. */
+
+/* c = a */
+__kernel void copyVectors(__global const float *a,
+	__global float *c,
+	const ulong n)
+{
+    size_t gid = get_global_id(0);
+    size_t stride = get_global_size(0);
+    size_t n4 = n >> 2;
+    size_t i = gid;
+    float4 r0, r1, r2, r3;
+
+    for (; i + (VEC_ADD_UNROLL - 1) * stride < n4; i += VEC_ADD_UNROLL * stride)
+    {
+        r0 = vload4(i, a);
+        r1 = vload4(i + stride, a);
+        r2 = vload4(i + 2 * stride, a);
+        r3 = vload4(i + 3 * stride, a);
+
+        vstore4(r0, i, c);
+        vstore4(r1, i + stride, c);
+        vstore4(r2, i + 2 * stride, c);
+        vstore4(r3, i + 3 * stride, c);
+    }
+    for (; i < n4; i += stride)
+    {
+        vstore4(vload4(i, a), i, c);
+    }
+
+    i = (n4 << 2) + gid;
+    if (i < n)
+    {
+        c[i] = a[i];
+    }
+}
+
+/* b = s * c */
+__kernel void scaleVectors(__global const float *c,
+	__global float *b,
+	const float s,
+	const ulong n)
+{
+    size_t gid = get_global_id(0);
+    size_t stride = get_global_size(0);
+    size_t n4 = n >> 2;
+    size_t i = gid;
+    float4 r0, r1, r2, r3;
+
+    for (; i + (VEC_ADD_UNROLL - 1) * stride < n4; i += VEC_ADD_UNROLL * stride)
+    {
+        r0 = s * vload4(i, c);
+        r1 = s * vload4(i + stride, c);
+        r2 = s * vload4(i + 2 * stride, c);
+        r3 = s * vload4(i + 3 * stride, c);
+
+        vstore4(r0, i, b);
+        vstore4(r1, i + stride, b);
+        vstore4(r2, i + 2 * stride, b);
+        vstore4(r3, i + 3 * stride, b);
+    }
+    for (; i < n4; i += stride)
+    {
+        vstore4(s * vload4(i, c), i, b);
+    }
+
+    i = (n4 << 2) + gid;
+    if (i < n)
+    {
+        b[i] = s * c[i];
+    }
+}
+
+/* a = b + s * c */
+__kernel void triadVectors(__global const float *b,
+	__global const float *c,
+	__global float *a,
+	const float s,
+	const ulong n)
+{
+    size_t gid = get_global_id(0);
+    size_t stride = get_global_size(0);
+    size_t n4 = n >> 2;
+    size_t i = gid;
+    float4 r0, r1, r2, r3;
+
+    for (; i + (VEC_ADD_UNROLL - 1) * stride < n4; i += VEC_ADD_UNROLL * stride)
+    {
+        r0 = vload4(i, b) + s * vload4(i, c);
+        r1 = vload4(i + stride, b) + s * vload4(i + stride, c);
+        r2 = vload4(i + 2 * stride, b) + s * vload4(i + 2 * stride, c);
+        r3 = vload4(i + 3 * stride, b) + s * vload4(i + 3 * stride, c);
+
+        vstore4(r0, i, a);
+        vstore4(r1, i + stride, a);
+        vstore4(r2, i + 2 * stride, a);
+        vstore4(r3, i + 3 * stride, a);
+    }
+    for (; i < n4; i += stride)
+    {
+        vstore4(vload4(i, b) + s * vload4(i, c), i, a);
+    }
+
+    i = (n4 << 2) + gid;
+    if (i < n)
+    {
+        a[i] = b[i] + s * c[i];
+    }
 }
@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <vector>
+
+#include "vecCpu.h"
+
+#if defined(VEC_CPU_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(VEC_CPU_X86)
+static void vec_cpuid(unsigned leaf, unsigned sub, unsigned a_reg[4])
+{
+#if defined(_MSC_VER)
+	int a_info[4];
+
+	__cpuidex(a_info, (int)leaf, (int)sub);
+	for (int i = 0; i < 4; ++i)
+	{
+		a_reg[i] = (unsigned)a_info[i];
+	}
+#else
+	__cpuid_count(leaf, sub, a_reg[0], a_reg[1], a_reg[2], a_reg[3]);
+#endif
+}
+
+// XCR0: the register state the OS saves on context switches.
+static unsigned long long vec_xgetbv(void)
+{
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	unsigned lo, hi;
+
+	__asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+
+	return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+#endif
+
+static int vec_cpu_detect(void)
+{
+	int isa = VEC_ISA_SCALAR;
+
+#if defined(VEC_CPU_X86)
+	unsigned a_reg[4];
+	unsigned long long xcr0;
+	unsigned leaf_n;
+
+	vec_cpuid(0, 0, a_reg);
+	leaf_n = a_reg[0];
+	if (leaf_n < 7)
+	{
+		return VEC_ISA_SCALAR;
+	}
+
+	// leaf 1 ECX: FMA (12), OSXSAVE (27), AVX (28)
+	vec_cpuid(1, 0, a_reg);
+	if ((0 == ((a_reg[2] >> 27) & 1)) || (0 == ((a_reg[2] >> 28) & 1)) || (0 == ((a_reg[2] >> 12) & 1)))
+	{
+		return VEC_ISA_SCALAR;
+	}
+
+	// XMM and YMM state
+	xcr0 = vec_xgetbv();
+	if (0x6 != (xcr0 & 0x6))
+	{
+		return VEC_ISA_SCALAR;
+	}
+
+	// leaf 7 EBX: AVX2 (5), AVX512F (16)
+	vec_cpuid(7, 0, a_reg);
+	if ((a_reg[1] >> 5) & 1)
+	{
+		isa = VEC_ISA_AVX2;
+	}
+	// opmask, upper ZMM0-15 and ZMM16-31 state
+	if ((VEC_ISA_AVX2 == isa) && ((a_reg[1] >> 16) & 1) && (0xE0 == (xcr0 & 0xE0)))
+	{
+		isa = VEC_ISA_AVX512;
+	}
+#endif
+
+	return isa;
+}
+
+int vec_cpu_isa(void)
+{
+	static const int s_isa = []
+	{
+		int isa = vec_cpu_detect();
+		const char* p_env = getenv("VEC_ISA");
+
+		if (NULL != p_env)
+		{
+			int limit = isa;
+
+			if (0 == strcmp(p_env, "scalar"))
+			{
+				limit = VEC_ISA_SCALAR;
+			}
+			else if (0 == strcmp(p_env, "avx2"))
+			{
+				limit = VEC_ISA_AVX2;
+			}
+			isa = (limit < isa) ? limit : isa;
+		}
+
+		return isa;
+	}();
+
+	return s_isa;
+}
+
+size_t vec_cpu_llc_size(void)
+{
+	static const size_t s_llc_sz = []
+	{
+		size_t llc_sz = 0;
+
+#if defined(_WIN32)
+		DWORD length = 0;
+
+		GetLogicalProcessorInformation(NULL, &length);
+
+		std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> a_info(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION) + 1);
+
+		if (GetLogicalProcessorInformation(a_info.data(), &length))
+		{
+			for (size_t i = 0; i < length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION); ++i)
+			{
+				if ((RelationCache == a_info[i].Relationship) && (a_info[i].Cache.Level >= 2) && (a_info[i].Cache.Size > llc_sz))
+				{
+					llc_sz = a_info[i].Cache.Size;
+				}
+			}
+		}
+#elif defined(_SC_LEVEL3_CACHE_SIZE)
+		long size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+
+		if (size <= 0)
+		{
+			size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+		}
+		llc_sz = (size > 0) ? (size_t)size : 0;
+#endif
+
+		return (0 == llc_sz) ? VEC_CPU_LLC_DEFAULT : llc_sz;
+	}();
+
+	return s_llc_sz;
+}
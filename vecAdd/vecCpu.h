@@ -0,0 +1,40 @@
+#ifndef __VEC_CPU_H__
+#define __VEC_CPU_H__
+
+/*
+
+Host CPU features for runtime dispatch.
+
+Code for instruction sets above the build baseline is compiled per function with VEC_TARGET
+and only called when vec_cpu_isa() reports the set, so one binary runs on every x86-64 CPU.
+The VEC_ISA environment variable (scalar, avx2, avx512) lowers the choice for testing.
+
+*/
+
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define VEC_CPU_X86 (1)
+#endif
+
+#if defined(VEC_CPU_X86) && (defined(__GNUC__) || defined(__clang__))
+#define VEC_TARGET(isa) __attribute__((target(isa)))
+#else
+// MSVC accepts every intrinsic without /arch flags.
+#define VEC_TARGET(isa)
+#endif
+
+#define VEC_ISA_SCALAR (0)
+#define VEC_ISA_AVX2   (1) /* AVX2 + FMA */
+#define VEC_ISA_AVX512 (2) /* AVX-512F */
+
+// Used when the last level cache size cannot be queried.
+#define VEC_CPU_LLC_DEFAULT ((size_t)32 * 1024 * 1024)
+
+// Best instruction set both the CPU and the OS (saved register state) support.
+int vec_cpu_isa(void);
+
+// Size of the last level cache in bytes.
+size_t vec_cpu_llc_size(void);
+
+#endif // __VEC_CPU_H__
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <map>
+#include <mutex>
+
+#include "vecExpr.h"
+#include "vecOcl.h"
+
+std::string VecGen::vec(const float* p_f32)
+{
+	size_t idx = 0;
+
+	for (idx = 0; idx < a_vec.size(); ++idx)
+	{
+		if (a_vec[idx] == p_f32)
+		{
+			break;
+		}
+	}
+	if (idx == a_vec.size())
+	{
+		a_vec.push_back(p_f32);
+	}
+
+	if (vector4)
+	{
+		return "vload4(i, v" + std::to_string(idx) + ")";
+	}
+
+	return "v" + std::to_string(idx) + "[i]";
+}
+
+std::string VecGen::scalar(float value_f32)
+{
+	a_scalar.push_back(value_f32);
+
+	if (vector4)
+	{
+		return "(float4)(s" + std::to_string(a_scalar.size() - 1) + ")";
+	}
+
+	return "s" + std::to_string(a_scalar.size() - 1);
+}
+
+bool vec_expr_use_ocl(void)
+{
+	return (NULL != vec_ocl_env());
+}
+
+// Kernel arguments: v0..vN-1, s0..sM-1, out, n. Same loop structure as addVectors.
+static std::string vec_expr_source(const std::string& code4, const std::string& code1, const VecGen& g)
+{
+	std::string source = "__kernel void vecExpr(";
+
+	for (size_t i = 0; i < g.a_vec.size(); ++i)
+	{
+		source += "__global const float* v" + std::to_string(i) + ", ";
+	}
+	for (size_t i = 0; i < g.a_scalar.size(); ++i)
+	{
+		source += "const float s" + std::to_string(i) + ", ";
+	}
+	source += "__global float* out, const ulong n)\n";
+	source += "{\n";
+	source += "\tsize_t gid = get_global_id(0);\n";
+	source += "\tsize_t stride = get_global_size(0);\n";
+	source += "\tsize_t n4 = n >> 2;\n";
+	source += "\tsize_t i;\n";
+	source += "\tfor (i = gid; i < n4; i += stride)\n";
+	source += "\t{\n";
+	source += "\t\tvstore4(" + code4 + ", i, out);\n";
+	source += "\t}\n";
+	source += "\ti = (n4 << 2) + gid;\n";
+	source += "\tif (i < n)\n";
+	source += "\t{\n";
+	source += "\t\tout[i] = " + code1 + ";\n";
+	source += "\t}\n";
+	source += "}\n";
+
+	return source;
+}
+
+static std::map<std::string, cl_kernel> s_kernel_cache;
+static std::mutex s_kernel_mutex;
+
+// Called with s_kernel_mutex held.
+static cl_kernel vec_expr_kernel(const std::string& source)
+{
+	std::map<std::string, cl_kernel>::iterator it = s_kernel_cache.find(source);
+	cl_program program;
+	cl_kernel kernel;
+	cl_int ret = CL_SUCCESS;
+
+	if (s_kernel_cache.end() != it)
+	{
+		return it->second;
+	}
+
+	program = vec_ocl_build(source.c_str(), source.size(), NULL);
+	kernel = clCreateKernel(program, "vecExpr", &ret);
+	if (CL_SUCCESS != ret)
+	{
+		printf("clCreateKernel failed! %d\n", ret);
+		exit(-1);
+	}
+	// The kernel keeps the program alive.
+	clReleaseProgram(program);
+
+	s_kernel_cache[source] = kernel;
+
+	return kernel;
+}
+
+void vec_expr_ocl(float* p_out_f32, size_t size_sz, const std::string& code4, const std::string& code1, const VecGen& g)
+{
+	VecOclEnv* p_env = vec_ocl_env();
+	std::vector<cl_mem> a_mem(g.a_vec.size());
+	cl_mem outMemObj;
+	cl_ulong size_u64 = (cl_ulong)size_sz;
+	cl_uint arg_idx = 0;
+	cl_int ret = CL_SUCCESS;
+	size_t globalItemSize = 0;
+	size_t localItemSize = 0;
+
+	if (0 == size_sz)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(s_kernel_mutex);
+
+	cl_kernel kernel = vec_expr_kernel(vec_expr_source(code4, code1, g));
+
+	vec_ocl_stride_geometry(kernel, p_env->deviceID, size_sz / 4 + 1, &globalItemSize, &localItemSize);
+
+	for (size_t i = 0; i < g.a_vec.size(); ++i)
+	{
+		a_mem[i] = clCreateBuffer(p_env->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, size_sz * sizeof(float), (void*)g.a_vec[i], &ret);
+		if (CL_SUCCESS != ret)
+		{
+			printf("clCreateBuffer failed! %d\n", ret);
+			exit(-1);
+		}
+		clSetKernelArg(kernel, arg_idx++, sizeof(cl_mem), &a_mem[i]);
+	}
+	for (size_t i = 0; i < g.a_scalar.size(); ++i)
+	{
+		clSetKernelArg(kernel, arg_idx++, sizeof(float), &g.a_scalar[i]);
+	}
+
+	outMemObj = clCreateBuffer(p_env->context, CL_MEM_WRITE_ONLY, size_sz * sizeof(float), NULL, &ret);
+	if (CL_SUCCESS != ret)
+	{
+		printf("clCreateBuffer failed! %d\n", ret);
+		exit(-1);
+	}
+	clSetKernelArg(kernel, arg_idx++, sizeof(cl_mem), &outMemObj);
+	clSetKernelArg(kernel, arg_idx++, sizeof(cl_ulong), &size_u64);
+
+	ret = clEnqueueNDRangeKernel(p_env->commandQueue, kernel, 1, NULL, &globalItemSize, &localItemSize, 0, NULL, NULL);
+	if (CL_SUCCESS != ret)
+	{
+		printf("clEnqueueNDRangeKernel failed! %d\n", ret);
+		exit(-1);
+	}
+
+	ret = clEnqueueReadBuffer(p_env->commandQueue, outMemObj, CL_TRUE, 0, size_sz * sizeof(float), p_out_f32, 0, NULL, NULL);
+	if (CL_SUCCESS != ret)
+	{
+		printf("clEnqueueReadBuffer failed! %d\n", ret);
+		exit(-1);
+	}
+
+	for (size_t i = 0; i < a_mem.size(); ++i)
+	{
+		clReleaseMemObject(a_mem[i]);
+	}
+	clReleaseMemObject(outMemObj);
+}
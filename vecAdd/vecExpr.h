@@ -0,0 +1,303 @@
+#ifndef __VEC_EXPR_H__
+#define __VEC_EXPR_H__
+
+/*
+
+Fused element-wise float vector expressions.
+
+	Vec a(p_a_f32, size), b(p_b_f32, size), c(p_c_f32, size);
+
+	eval(p_c_f32, a * alpha + b * beta);
+	eval(p_c_f32, vec_clamp(vec_fma(a, b, c), 0.f, 1.f));
+
+Every distinct expression shape is translated into one OpenCL kernel, so the whole chain
+costs a single pass over memory. The kernel is a grid-stride loop over float4 chunks with a
+scalar tail, so any length works. The compiled kernel is cached by its source text; scalars
+are passed as kernel arguments, which means a new alpha or beta reuses the cached kernel.
+Without an OpenCL device the same expression runs on the host in a multithreaded loop that
+the compiler can vectorize.
+
+The output may be one of the inputs (c = c * 2 + a) but must not overlap an input at an offset.
+Every Vec in one expression must have the same size; on a mismatch eval writes nothing and
+returns -1.
+
+*/
+
+#include <math.h>
+#include <stddef.h>
+
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "vecThread.h"
+
+#if defined(_MSC_VER)
+#define VEC_IVDEP __pragma(loop(ivdep))
+#elif defined(__GNUC__)
+#define VEC_IVDEP _Pragma("GCC ivdep")
+#else
+#define VEC_IVDEP
+#endif
+
+// Collects the kernel arguments of an expression while its OpenCL source is generated.
+// The kernel body is generated twice: over float4 chunks and for the scalar tail.
+struct VecGen
+{
+	bool                      vector4;
+	std::vector<const float*> a_vec;
+	std::vector<float>        a_scalar;
+
+	explicit VecGen(bool is_vector4) : vector4(is_vector4) {}
+
+	// Returns the OpenCL term reading the array (the same array maps to the same argument).
+	std::string vec(const float* p_f32);
+	// Returns the OpenCL term naming the scalar argument.
+	std::string scalar(float value_f32);
+};
+
+template <class E>
+struct VecExpr
+{
+	const E& self(void) const { return static_cast<const E&>(*this); }
+};
+
+// Size of an operand that takes any size (a scalar).
+#define VEC_SIZE_ANY ((size_t)-1)
+// Size of an expression whose operands differ in size.
+#define VEC_SIZE_BAD ((size_t)-2)
+
+// Leaf: a float array of size_sz elements.
+struct Vec : public VecExpr<Vec>
+{
+	const float* p_f32;
+	size_t       size_sz;
+
+	Vec(const float* p, size_t size) : p_f32(p), size_sz(size) {}
+
+	float operator[](size_t i) const { return p_f32[i]; }
+	size_t size(void) const { return size_sz; }
+	std::string gen(VecGen& g) const { return g.vec(p_f32); }
+};
+
+// Leaf: a scalar broadcast over the vector.
+struct VecScalar : public VecExpr<VecScalar>
+{
+	float value_f32;
+
+	explicit VecScalar(float value) : value_f32(value) {}
+
+	float operator[](size_t) const { return value_f32; }
+	size_t size(void) const { return VEC_SIZE_ANY; }
+	std::string gen(VecGen& g) const { return g.scalar(value_f32); }
+};
+
+// Operators. apply() is the host side, name() the OpenCL side of the same operation.
+struct VecOpAdd { static float apply(float l, float r) { return l + r; } static const char* name(void) { return "+"; } };
+struct VecOpSub { static float apply(float l, float r) { return l - r; } static const char* name(void) { return "-"; } };
+struct VecOpMul { static float apply(float l, float r) { return l * r; } static const char* name(void) { return "*"; } };
+struct VecOpDiv { static float apply(float l, float r) { return l / r; } static const char* name(void) { return "/"; } };
+struct VecOpNeg { static float apply(float x) { return -x; } static const char* name(void) { return "-"; } };
+struct VecOpMin { static float apply(float l, float r) { return fminf(l, r); } static const char* name(void) { return "fmin"; } };
+struct VecOpMax { static float apply(float l, float r) { return fmaxf(l, r); } static const char* name(void) { return "fmax"; } };
+struct VecOpFma { static float apply(float a, float b, float c) { return fmaf(a, b, c); } static const char* name(void) { return "fma"; } };
+struct VecOpClamp { static float apply(float x, float lo, float hi) { return fminf(fmaxf(x, lo), hi); } static const char* name(void) { return "clamp"; } };
+
+// Size of an expression over two operands; operands of different sizes would be read past the
+// end, so they make VEC_SIZE_BAD, which eval reports.
+static inline size_t vec_size_of(size_t l, size_t r)
+{
+	if ((VEC_SIZE_BAD == l) || (VEC_SIZE_BAD == r))
+	{
+		return VEC_SIZE_BAD;
+	}
+	if (VEC_SIZE_ANY == l)
+	{
+		return r;
+	}
+	if ((VEC_SIZE_ANY != r) && (l != r))
+	{
+		return VEC_SIZE_BAD;
+	}
+	return l;
+}
+
+template <class X, class Op>
+struct VecUnary : public VecExpr<VecUnary<X, Op> >
+{
+	X x;
+
+	explicit VecUnary(const X& x_) : x(x_) {}
+
+	float operator[](size_t i) const { return Op::apply(x[i]); }
+	size_t size(void) const { return x.size(); }
+	std::string gen(VecGen& g) const { return std::string("(") + Op::name() + x.gen(g) + ")"; }
+};
+
+template <class L, class R, class Op>
+struct VecBinary : public VecExpr<VecBinary<L, R, Op> >
+{
+	L l;
+	R r;
+
+	VecBinary(const L& l_, const R& r_) : l(l_), r(r_) {}
+
+	float operator[](size_t i) const { return Op::apply(l[i], r[i]); }
+	size_t size(void) const { return vec_size_of(l.size(), r.size()); }
+	std::string gen(VecGen& g) const
+	{
+		// Operands are generated in a fixed order so one shape always produces the same source.
+		std::string l_code = l.gen(g);
+		std::string r_code = r.gen(g);
+
+		return "(" + l_code + " " + Op::name() + " " + r_code + ")";
+	}
+};
+
+// Same as VecBinary, but emitted as a call: fmin(l, r).
+template <class L, class R, class Op>
+struct VecCall2 : public VecExpr<VecCall2<L, R, Op> >
+{
+	L l;
+	R r;
+
+	VecCall2(const L& l_, const R& r_) : l(l_), r(r_) {}
+
+	float operator[](size_t i) const { return Op::apply(l[i], r[i]); }
+	size_t size(void) const { return vec_size_of(l.size(), r.size()); }
+	std::string gen(VecGen& g) const
+	{
+		std::string l_code = l.gen(g);
+		std::string r_code = r.gen(g);
+
+		return std::string(Op::name()) + "(" + l_code + ", " + r_code + ")";
+	}
+};
+
+template <class A, class B, class C, class Op>
+struct VecCall3 : public VecExpr<VecCall3<A, B, C, Op> >
+{
+	A a;
+	B b;
+	C c;
+
+	VecCall3(const A& a_, const B& b_, const C& c_) : a(a_), b(b_), c(c_) {}
+
+	float operator[](size_t i) const { return Op::apply(a[i], b[i], c[i]); }
+	size_t size(void) const { return vec_size_of(vec_size_of(a.size(), b.size()), c.size()); }
+	std::string gen(VecGen& g) const
+	{
+		std::string a_code = a.gen(g);
+		std::string b_code = b.gen(g);
+		std::string c_code = c.gen(g);
+
+		return std::string(Op::name()) + "(" + a_code + ", " + b_code + ", " + c_code + ")";
+	}
+};
+
+// Operand mapping: expressions stay as they are, numbers become VecScalar.
+template <class T>
+struct VecIsExpr : public std::is_base_of<VecExpr<T>, T> {};
+
+template <class T, class Enable = void>
+struct VecArg;
+
+template <class T>
+struct VecArg<T, typename std::enable_if<VecIsExpr<T>::value>::type>
+{
+	typedef T type;
+	static const T& make(const T& x) { return x; }
+};
+
+template <class T>
+struct VecArg<T, typename std::enable_if<std::is_arithmetic<T>::value>::type>
+{
+	typedef VecScalar type;
+	static VecScalar make(T x) { return VecScalar((float)x); }
+};
+
+#define VEC_EXPR_BINARY(FUNC, NODE, OP) \
+	template <class L, class R> \
+	typename std::enable_if<VecIsExpr<L>::value || VecIsExpr<R>::value, \
+		NODE<typename VecArg<L>::type, typename VecArg<R>::type, OP> >::type \
+	FUNC(const L& l, const R& r) \
+	{ \
+		return NODE<typename VecArg<L>::type, typename VecArg<R>::type, OP>(VecArg<L>::make(l), VecArg<R>::make(r)); \
+	}
+
+#define VEC_EXPR_TERNARY(FUNC, OP) \
+	template <class A, class B, class C> \
+	typename std::enable_if<VecIsExpr<A>::value || VecIsExpr<B>::value || VecIsExpr<C>::value, \
+		VecCall3<typename VecArg<A>::type, typename VecArg<B>::type, typename VecArg<C>::type, OP> >::type \
+	FUNC(const A& a, const B& b, const C& c) \
+	{ \
+		return VecCall3<typename VecArg<A>::type, typename VecArg<B>::type, typename VecArg<C>::type, OP>( \
+			VecArg<A>::make(a), VecArg<B>::make(b), VecArg<C>::make(c)); \
+	}
+
+VEC_EXPR_BINARY(operator+, VecBinary, VecOpAdd)
+VEC_EXPR_BINARY(operator-, VecBinary, VecOpSub)
+VEC_EXPR_BINARY(operator*, VecBinary, VecOpMul)
+VEC_EXPR_BINARY(operator/, VecBinary, VecOpDiv)
+// Prefixed so that they do not collide with fmin, fmax and fma of <math.h> and std::clamp.
+VEC_EXPR_BINARY(vec_fmin, VecCall2, VecOpMin)
+VEC_EXPR_BINARY(vec_fmax, VecCall2, VecOpMax)
+VEC_EXPR_TERNARY(vec_fma, VecOpFma)
+VEC_EXPR_TERNARY(vec_clamp, VecOpClamp)
+
+template <class X>
+VecUnary<X, VecOpNeg> operator-(const VecExpr<X>& x)
+{
+	return VecUnary<X, VecOpNeg>(x.self());
+}
+
+// Device side: true when an OpenCL device is available.
+bool vec_expr_use_ocl(void);
+// Run the kernel generated for code (cached by source) over size_sz elements.
+void vec_expr_ocl(float* p_out_f32, size_t size_sz, const std::string& code4, const std::string& code1, const VecGen& g);
+
+template <class E>
+void vec_expr_host(float* p_out_f32, const E& e, size_t begin_sz, size_t end_sz)
+{
+	VEC_IVDEP
+	for (size_t i = begin_sz; i < end_sz; ++i)
+	{
+		p_out_f32[i] = e[i];
+	}
+}
+
+// p_out_f32[i] = expr[i] for every element of the expression. Returns 0, or -1 without writing
+// anything when the operands differ in size.
+template <class E>
+int eval(float* p_out_f32, const VecExpr<E>& expr)
+{
+	const E& e = expr.self();
+	size_t size_sz = e.size();
+
+	if (VEC_SIZE_BAD == size_sz)
+	{
+		return -1;
+	}
+	// scalars only: nothing gives the length
+	if (VEC_SIZE_ANY == size_sz)
+	{
+		size_sz = 0;
+	}
+
+	if (vec_expr_use_ocl())
+	{
+		VecGen g4(true), g1(false);
+		std::string code4 = e.gen(g4);
+		std::string code1 = e.gen(g1);
+
+		vec_expr_ocl(p_out_f32, size_sz, code4, code1, g4);
+	}
+	else
+	{
+		vec_parallel_for(size_sz, [&](size_t begin_sz, size_t end_sz) { vec_expr_host(p_out_f32, e, begin_sz, end_sz); });
+	}
+
+	return 0;
+}
+
+#endif // __VEC_EXPR_H__
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mutex>
+
+#include "vecOcl.h"
+
+static VecOclEnv s_env;
+static VecOclEnv* sp_env = NULL;
+static std::once_flag s_env_once;
+
+static void vec_ocl_env_init(void)
+{
+	cl_uint retNumDevices = 0;
+	cl_uint retNumPlatforms = 0;
+	cl_int ret = CL_SUCCESS;
+
+	ret = clGetPlatformIDs(1, &s_env.platformId, &retNumPlatforms);
+	if ((CL_SUCCESS != ret) || (0 == retNumPlatforms))
+	{
+		return;
+	}
+
+	ret = clGetDeviceIDs(s_env.platformId, CL_DEVICE_TYPE_GPU, 1, &s_env.deviceID, &retNumDevices);
+	if ((CL_SUCCESS != ret) || (0 == retNumDevices))
+	{
+		return;
+	}
+
+	clGetDeviceInfo(s_env.deviceID, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(s_env.maxComputeUnits), &s_env.maxComputeUnits, NULL);
+	clGetDeviceInfo(s_env.deviceID, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(s_env.maxWorkGroupSize), &s_env.maxWorkGroupSize, NULL);
+
+	s_env.context = clCreateContext(NULL, 1, &s_env.deviceID, NULL, NULL, &ret);
+	if (CL_SUCCESS != ret)
+	{
+		return;
+	}
+
+	s_env.commandQueue = clCreateCommandQueueWithProperties(s_env.context, s_env.deviceID, 0, &ret);
+	if (CL_SUCCESS != ret)
+	{
+		clReleaseContext(s_env.context);
+
+		return;
+	}
+
+	sp_env = &s_env;
+}
+
+VecOclEnv* vec_ocl_env(void)
+{
+	std::call_once(s_env_once, vec_ocl_env_init);
+
+	return sp_env;
+}
+
+char* vec_ocl_load_source(const char* p_file_name, size_t* p_size)
+{
+	FILE* kernelFile;
+	char* kernelSource;
+	size_t kernelSize;
+
+	fopen_s(&kernelFile, p_file_name, "rb");
+
+	if (NULL == kernelFile)
+	{
+		fprintf(stderr, "No file named %s was found\n", p_file_name);
+		exit(-1);
+	}
+
+	fseek(kernelFile, 0, SEEK_END);
+	kernelSize = (size_t)ftell(kernelFile);
+	rewind(kernelFile);
+
+	kernelSource = (char*)malloc(kernelSize + 1);
+	if (NULL == kernelSource)
+	{
+		printf("malloc failed!\n");
+		exit(-1);
+	}
+
+	kernelSize = fread(kernelSource, 1, kernelSize, kernelFile);
+	kernelSource[kernelSize] = '\0';
+	fclose(kernelFile);
+
+	*p_size = kernelSize;
+
+	return kernelSource;
+}
+
+bool vec_ocl_has_extension(const char* p_name)
+{
+	VecOclEnv* p_env = vec_ocl_env();
+	size_t valueSize = 0;
+	char* value;
+	bool found;
+
+	if (NULL == p_env)
+	{
+		return false;
+	}
+
+	clGetDeviceInfo(p_env->deviceID, CL_DEVICE_EXTENSIONS, 0, NULL, &valueSize);
+	value = (char*)malloc(valueSize + 1);
+	clGetDeviceInfo(p_env->deviceID, CL_DEVICE_EXTENSIONS, valueSize, value, NULL);
+	value[valueSize] = '\0';
+
+	found = (NULL != strstr(value, p_name));
+	free(value);
+
+	return found;
+}
+
+void vec_ocl_stride_geometry(cl_kernel kernel, cl_device_id deviceID, size_t work_sz, size_t* p_global, size_t* p_local)
+{
+	size_t multiple = 0;
+	size_t kernelMax = 0;
+	size_t localSize = 0;
+	size_t groupNum = 0;
+	size_t groupNeed = 0;
+	cl_uint maxComputeUnits = 0;
+
+	clGetKernelWorkGroupInfo(kernel, deviceID, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(multiple), &multiple, NULL);
+	clGetKernelWorkGroupInfo(kernel, deviceID, CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernelMax), &kernelMax, NULL);
+	clGetDeviceInfo(deviceID, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(maxComputeUnits), &maxComputeUnits, NULL);
+
+	if (0 == multiple)
+	{
+		multiple = 1;
+	}
+	if (kernelMax < multiple)
+	{
+		kernelMax = multiple;
+	}
+	if (0 == maxComputeUnits)
+	{
+		maxComputeUnits = 1;
+	}
+
+	localSize = (VEC_OCL_LOCAL_TARGET > multiple) ? (VEC_OCL_LOCAL_TARGET / multiple * multiple) : multiple;
+	if (localSize > kernelMax)
+	{
+		localSize = kernelMax / multiple * multiple;
+	}
+
+	groupNum = (size_t)maxComputeUnits * VEC_OCL_GROUPS_PER_CU;
+	groupNeed = (work_sz + localSize - 1) / localSize;
+	if (groupNum > groupNeed)
+	{
+		groupNum = groupNeed;
+	}
+	if (0 == groupNum)
+	{
+		groupNum = 1;
+	}
+
+	*p_global = groupNum * localSize;
+	*p_local = localSize;
+}
+
+cl_program vec_ocl_build(const char* p_source, size_t source_size, const char* p_options)
+{
+	VecOclEnv* p_env = vec_ocl_env();
+	cl_int ret = CL_SUCCESS;
+	cl_program program = clCreateProgramWithSource(p_env->context, 1, &p_source, &source_size, &ret);
+
+	if (CL_SUCCESS != ret)
+	{
+		printf("clCreateProgramWithSource failed! %d\n", ret);
+		exit(-1);
+	}
+
+	ret = clBuildProgram(program, 1, &p_env->deviceID, p_options, NULL, NULL);
+	if (CL_SUCCESS != ret)
+	{
+		size_t logSize = 0;
+		char* log;
+
+		clGetProgramBuildInfo(program, p_env->deviceID, CL_PROGRAM_BUILD_LOG, 0, NULL, &logSize);
+		log = (char*)malloc(logSize + 1);
+		clGetProgramBuildInfo(program, p_env->deviceID, CL_PROGRAM_BUILD_LOG, logSize, log, NULL);
+		log[logSize] = '\0';
+		printf("clBuildProgram failed! %d\n%s\n", ret, log);
+		free(log);
+		exit(-1);
+	}
+
+	return program;
+}
@@ -0,0 +1,40 @@
+#ifndef __VEC_OCL_H__
+#define __VEC_OCL_H__
+
+#include <CL/cl.h>
+
+#include <stddef.h>
+
+// Process-wide OpenCL objects shared by the vector libraries.
+// Discovery and context creation happen once, on first use.
+struct VecOclEnv
+{
+	cl_platform_id   platformId;
+	cl_device_id     deviceID;
+	cl_context       context;
+	cl_command_queue commandQueue;
+	cl_uint          maxComputeUnits;
+	size_t           maxWorkGroupSize;
+};
+
+// Returns NULL when no OpenCL GPU device is present; callers then run on the host.
+VecOclEnv* vec_ocl_env(void);
+
+// Read a kernel source file from the working directory. Exits when the file is missing.
+char* vec_ocl_load_source(const char* p_file_name, size_t* p_size);
+
+// True when the shared device lists the extension in CL_DEVICE_EXTENSIONS.
+bool vec_ocl_has_extension(const char* p_name);
+
+// Launch size of a grid-stride kernel over work_sz items. The work-group is a multiple of the
+// kernel's preferred work-group size multiple and the grid is VEC_OCL_GROUPS_PER_CU work-groups
+// per compute unit, capped by what work_sz needs. It does not depend on work_sz being round.
+#define VEC_OCL_LOCAL_TARGET  (256)
+#define VEC_OCL_GROUPS_PER_CU (8)
+
+void vec_ocl_stride_geometry(cl_kernel kernel, cl_device_id deviceID, size_t work_sz, size_t* p_global, size_t* p_local);
+
+// Build a program for the shared device. Prints the build log and exits on failure.
+cl_program vec_ocl_build(const char* p_source, size_t source_size, const char* p_options);
+
+#endif // __VEC_OCL_H__
@@ -0,0 +1,569 @@
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mutex>
+#include <vector>
+
+#include "vecOcl.h"
+#include "vecReduce.h"
+#include "vecThread.h"
+
+#define FILE_NAME_REDUCE_KERNEL "vecReduceKernel.cl"
+
+#define VEC_REDUCE_LOCAL_SIZE   (256)
+#define VEC_REDUCE_GROUP_PER_CU (8)
+#define VEC_SCAN_ITEMS          (8) /* SCAN_ITEMS in vecReduceKernel.cl */
+
+// Independent accumulators per host thread, so the reduction loops vectorize.
+#define VEC_REDUCE_LANES        (8)
+
+#define VEC_OP_SUM (0)
+#define VEC_OP_MIN (1)
+#define VEC_OP_MAX (2)
+#define VEC_OP_NUM (3)
+
+struct VecReduceProgram
+{
+	cl_program program;
+	cl_kernel  reduceFirst;
+	cl_kernel  reduceDotFirst;
+	cl_kernel  reduceArgmax;
+	cl_kernel  scanTileSum;
+	cl_kernel  scanTile;
+	size_t     localSize;
+};
+
+template <class T> struct VecReduceType;
+
+template <> struct VecReduceType<float>
+{
+	static const int isFloat = 1;
+	static float maxValue(void) { return INFINITY; }
+	static float lowest(void) { return -INFINITY; }
+};
+
+template <> struct VecReduceType<int>
+{
+	static const int isFloat = 0;
+	static int maxValue(void) { return INT_MAX; }
+	static int lowest(void) { return INT_MIN; }
+};
+
+// One program per [element type][operation]; guarded by s_reduce_mutex.
+static VecReduceProgram s_program[2][VEC_OP_NUM];
+static bool s_program_ready[2][VEC_OP_NUM];
+static std::mutex s_reduce_mutex;
+
+static cl_kernel vec_reduce_kernel(cl_program program, const char* p_name)
+{
+	cl_int ret = CL_SUCCESS;
+	cl_kernel kernel = clCreateKernel(program, p_name, &ret);
+
+	if (CL_SUCCESS != ret)
+	{
+		printf("clCreateKernel(%s) failed! %d\n", p_name, ret);
+		exit(-1);
+	}
+
+	return kernel;
+}
+
+// Largest power of two not above the device and kernel limits.
+static size_t vec_reduce_local_size(VecReduceProgram* p_prog)
+{
+	VecOclEnv* p_env = vec_ocl_env();
+	cl_kernel a_kernel[] = { p_prog->reduceFirst, p_prog->reduceDotFirst, p_prog->reduceArgmax, p_prog->scanTileSum, p_prog->scanTile };
+	size_t limit = (p_env->maxWorkGroupSize < VEC_REDUCE_LOCAL_SIZE) ? p_env->maxWorkGroupSize : VEC_REDUCE_LOCAL_SIZE;
+	size_t localSize = 1;
+
+	for (size_t i = 0; i < sizeof(a_kernel) / sizeof(a_kernel[0]); ++i)
+	{
+		size_t kernelLimit = 0;
+
+		clGetKernelWorkGroupInfo(a_kernel[i], p_env->deviceID, CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernelLimit), &kernelLimit, NULL);
+		if ((0 != kernelLimit) && (kernelLimit < limit))
+		{
+			limit = kernelLimit;
+		}
+	}
+
+	while ((localSize << 1) <= limit)
+	{
+		localSize <<= 1;
+	}
+
+	return localSize;
+}
+
+// Called with s_reduce_mutex held.
+static VecReduceProgram* vec_reduce_program(int isFloat, int op)
+{
+	static char* s_source = NULL;
+	static size_t s_source_size = 0;
+	VecReduceProgram* p_prog = &s_program[isFloat][op];
+	char options[256];
+
+	if (s_program_ready[isFloat][op])
+	{
+		return p_prog;
+	}
+
+	if (NULL == s_source)
+	{
+		s_source = vec_ocl_load_source(FILE_NAME_REDUCE_KERNEL, &s_source_size);
+	}
+
+	snprintf(options, sizeof(options), "-DVEC_T=%s -DVEC_T_IS_FLOAT=%d -DVEC_OP=%d%s",
+		isFloat ? "float" : "int", isFloat, op,
+		(vec_ocl_has_extension("cl_khr_subgroups") || vec_ocl_has_extension("cl_intel_subgroups")) ? " -DUSE_SUBGROUP" : "");
+
+	p_prog->program        = vec_ocl_build(s_source, s_source_size, options);
+	p_prog->reduceFirst    = vec_reduce_kernel(p_prog->program, "reduce_first");
+	p_prog->reduceDotFirst = vec_reduce_kernel(p_prog->program, "reduce_dot_first");
+	p_prog->reduceArgmax   = vec_reduce_kernel(p_prog->program, "reduce_argmax");
+	p_prog->scanTileSum    = vec_reduce_kernel(p_prog->program, "scan_tile_sum");
+	p_prog->scanTile       = vec_reduce_kernel(p_prog->program, "scan_tile");
+	p_prog->localSize      = vec_reduce_local_size(p_prog);
+
+	s_program_ready[isFloat][op] = true;
+
+	return p_prog;
+}
+
+static cl_mem vec_reduce_buffer(size_t size, const void* p_host)
+{
+	VecOclEnv* p_env = vec_ocl_env();
+	cl_int ret = CL_SUCCESS;
+	cl_mem mem = clCreateBuffer(p_env->context, (NULL != p_host) ? (CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR) : CL_MEM_READ_WRITE, size, (void*)p_host, &ret);
+
+	if (CL_SUCCESS != ret)
+	{
+		printf("clCreateBuffer failed! %d\n", ret);
+		exit(-1);
+	}
+
+	return mem;
+}
+
+static void vec_reduce_enqueue(cl_kernel kernel, size_t groupNum, size_t localSize)
+{
+	size_t globalItemSize = groupNum * localSize;
+	cl_int ret = clEnqueueNDRangeKernel(vec_ocl_env()->commandQueue, kernel, 1, NULL, &globalItemSize, &localSize, 0, NULL, NULL);
+
+	if (CL_SUCCESS != ret)
+	{
+		printf("clEnqueueNDRangeKernel failed! %d\n", ret);
+		exit(-1);
+	}
+}
+
+static size_t vec_reduce_group_num(size_t size_sz, size_t localSize)
+{
+	size_t groupMax = (size_t)vec_ocl_env()->maxComputeUnits * VEC_REDUCE_GROUP_PER_CU;
+	size_t groupNum = (size_sz + localSize - 1) / localSize;
+
+	if (groupNum > groupMax)
+	{
+		groupNum = groupMax;
+	}
+
+	return (0 == groupNum) ? 1 : groupNum;
+}
+
+// sum/min/max of p_a, or sum of p_a * p_b when p_b is given.
+template <class T>
+static T vec_reduce_ocl(const T* p_a, const T* p_b, size_t size_sz, int op)
+{
+	std::lock_guard<std::mutex> lock(s_reduce_mutex);
+	VecReduceProgram* p_prog = vec_reduce_program(VecReduceType<T>::isFloat, op);
+	size_t localSize = p_prog->localSize;
+	size_t groupNum = vec_reduce_group_num(size_sz, localSize);
+	cl_ulong size_u64 = (cl_ulong)size_sz;
+	cl_ulong groupNum_u64 = (cl_ulong)groupNum;
+	cl_mem aMemObj = vec_reduce_buffer(size_sz * sizeof(T), p_a);
+	cl_mem bMemObj = (NULL != p_b) ? vec_reduce_buffer(size_sz * sizeof(T), p_b) : NULL;
+	cl_mem partMemObj = vec_reduce_buffer(groupNum * sizeof(T), NULL);
+	cl_mem resMemObj = vec_reduce_buffer(sizeof(T), NULL);
+	cl_kernel kernel = (NULL != p_b) ? p_prog->reduceDotFirst : p_prog->reduceFirst;
+	cl_uint arg_idx = 0;
+	T result;
+
+	// Pass 1: one partial per work-group.
+	clSetKernelArg(kernel, arg_idx++, sizeof(cl_mem), &aMemObj);
+	if (NULL != p_b)
+	{
+		clSetKernelArg(kernel, arg_idx++, sizeof(cl_mem), &bMemObj);
+	}
+	clSetKernelArg(kernel, arg_idx++, sizeof(cl_mem), &partMemObj);
+	clSetKernelArg(kernel, arg_idx++, sizeof(cl_ulong), &size_u64);
+	clSetKernelArg(kernel, arg_idx++, localSize * sizeof(T), NULL);
+	vec_reduce_enqueue(kernel, groupNum, localSize);
+
+	// Pass 2: a single work-group folds the partials.
+	clSetKernelArg(p_prog->reduceFirst, 0, sizeof(cl_mem), &partMemObj);
+	clSetKernelArg(p_prog->reduceFirst, 1, sizeof(cl_mem), &resMemObj);
+	clSetKernelArg(p_prog->reduceFirst, 2, sizeof(cl_ulong), &groupNum_u64);
+	clSetKernelArg(p_prog->reduceFirst, 3, localSize * sizeof(T), NULL);
+	vec_reduce_enqueue(p_prog->reduceFirst, 1, localSize);
+
+	clEnqueueReadBuffer(vec_ocl_env()->commandQueue, resMemObj, CL_TRUE, 0, sizeof(T), &result, 0, NULL, NULL);
+
+	clReleaseMemObject(aMemObj);
+	if (NULL != bMemObj)
+	{
+		clReleaseMemObject(bMemObj);
+	}
+	clReleaseMemObject(partMemObj);
+	clReleaseMemObject(resMemObj);
+
+	return result;
+}
+
+template <class T>
+static size_t vec_argmax_ocl(const T* p_src, size_t size_sz)
+{
+	std::lock_guard<std::mutex> lock(s_reduce_mutex);
+	VecReduceProgram* p_prog = vec_reduce_program(VecReduceType<T>::isFloat, VEC_OP_SUM);
+	cl_kernel kernel = p_prog->reduceArgmax;
+	size_t localSize = p_prog->localSize;
+	size_t groupNum = vec_reduce_group_num(size_sz, localSize);
+	cl_ulong size_u64 = (cl_ulong)size_sz;
+	cl_ulong groupNum_u64 = (cl_ulong)groupNum;
+	cl_mem srcMemObj = vec_reduce_buffer(size_sz * sizeof(T), p_src);
+	cl_mem partMemObj = vec_reduce_buffer(groupNum * sizeof(T), NULL);
+	cl_mem partIdxMemObj = vec_reduce_buffer(groupNum * sizeof(cl_ulong), NULL);
+	cl_mem resMemObj = vec_reduce_buffer(sizeof(T), NULL);
+	cl_mem resIdxMemObj = vec_reduce_buffer(sizeof(cl_ulong), NULL);
+	cl_ulong result = 0;
+
+	clSetKernelArg(kernel, 0, sizeof(cl_mem), &srcMemObj);
+	clSetKernelArg(kernel, 1, sizeof(cl_mem), NULL);
+	clSetKernelArg(kernel, 2, sizeof(cl_mem), &partMemObj);
+	clSetKernelArg(kernel, 3, sizeof(cl_mem), &partIdxMemObj);
+	clSetKernelArg(kernel, 4, sizeof(cl_ulong), &size_u64);
+	clSetKernelArg(kernel, 5, localSize * sizeof(T), NULL);
+	clSetKernelArg(kernel, 6, localSize * sizeof(cl_ulong), NULL);
+	vec_reduce_enqueue(kernel, groupNum, localSize);
+
+	clSetKernelArg(kernel, 0, sizeof(cl_mem), &partMemObj);
+	clSetKernelArg(kernel, 1, sizeof(cl_mem), &partIdxMemObj);
+	clSetKernelArg(kernel, 2, sizeof(cl_mem), &resMemObj);
+	clSetKernelArg(kernel, 3, sizeof(cl_mem), &resIdxMemObj);
+	clSetKernelArg(kernel, 4, sizeof(cl_ulong), &groupNum_u64);
+	vec_reduce_enqueue(kernel, 1, localSize);
+
+	clEnqueueReadBuffer(vec_ocl_env()->commandQueue, resIdxMemObj, CL_TRUE, 0, sizeof(cl_ulong), &result, 0, NULL, NULL);
+
+	clReleaseMemObject(srcMemObj);
+	clReleaseMemObject(partMemObj);
+	clReleaseMemObject(partIdxMemObj);
+	clReleaseMemObject(resMemObj);
+	clReleaseMemObject(resIdxMemObj);
+
+	return (size_t)result;
+}
+
+// Reduce-then-scan: tile sums, a recursive exclusive scan of those sums, then the per-tile scan.
+template <class T>
+static void vec_scan_ocl_buffer(VecReduceProgram* p_prog, cl_mem srcMemObj, cl_mem dstMemObj, size_t size_sz, int inclusive)
+{
+	size_t localSize = p_prog->localSize;
+	size_t tileSize = localSize * VEC_SCAN_ITEMS;
+	size_t tileNum = (size_sz + tileSize - 1) / tileSize;
+	cl_ulong size_u64 = (cl_ulong)size_sz;
+	cl_mem offsetMemObj = NULL;
+
+	if (tileNum > 1)
+	{
+		cl_mem sumMemObj = vec_reduce_buffer(tileNum * sizeof(T), NULL);
+
+		offsetMemObj = vec_reduce_buffer(tileNum * sizeof(T), NULL);
+
+		clSetKernelArg(p_prog->scanTileSum, 0, sizeof(cl_mem), &srcMemObj);
+		clSetKernelArg(p_prog->scanTileSum, 1, sizeof(cl_mem), &sumMemObj);
+		clSetKernelArg(p_prog->scanTileSum, 2, sizeof(cl_ulong), &size_u64);
+		clSetKernelArg(p_prog->scanTileSum, 3, localSize * sizeof(T), NULL);
+		vec_reduce_enqueue(p_prog->scanTileSum, tileNum, localSize);
+
+		vec_scan_ocl_buffer<T>(p_prog, sumMemObj, offsetMemObj, tileNum, 0);
+
+		clReleaseMemObject(sumMemObj);
+	}
+
+	clSetKernelArg(p_prog->scanTile, 0, sizeof(cl_mem), &srcMemObj);
+	clSetKernelArg(p_prog->scanTile, 1, sizeof(cl_mem), &dstMemObj);
+	clSetKernelArg(p_prog->scanTile, 2, sizeof(cl_mem), (NULL != offsetMemObj) ? &offsetMemObj : NULL);
+	clSetKernelArg(p_prog->scanTile, 3, sizeof(cl_ulong), &size_u64);
+	clSetKernelArg(p_prog->scanTile, 4, sizeof(cl_int), &inclusive);
+	clSetKernelArg(p_prog->scanTile, 5, tileSize * sizeof(T), NULL);
+	// one slot per sub-group and the group total: localSize + 1 when sub-groups have one item
+	clSetKernelArg(p_prog->scanTile, 6, (localSize + 1) * sizeof(T), NULL);
+	vec_reduce_enqueue(p_prog->scanTile, tileNum, localSize);
+
+	if (NULL != offsetMemObj)
+	{
+		clReleaseMemObject(offsetMemObj);
+	}
+}
+
+template <class T>
+static void vec_scan_ocl(const T* p_src, T* p_dst, size_t size_sz, int inclusive)
+{
+	std::lock_guard<std::mutex> lock(s_reduce_mutex);
+	VecReduceProgram* p_prog = vec_reduce_program(VecReduceType<T>::isFloat, VEC_OP_SUM);
+	cl_mem srcMemObj = vec_reduce_buffer(size_sz * sizeof(T), p_src);
+	cl_mem dstMemObj = vec_reduce_buffer(size_sz * sizeof(T), NULL);
+
+	vec_scan_ocl_buffer<T>(p_prog, srcMemObj, dstMemObj, size_sz, inclusive);
+
+	clEnqueueReadBuffer(vec_ocl_env()->commandQueue, dstMemObj, CL_TRUE, 0, size_sz * sizeof(T), p_dst, 0, NULL, NULL);
+
+	clReleaseMemObject(srcMemObj);
+	clReleaseMemObject(dstMemObj);
+}
+
+// Host reduction of elem(i) over [0, size_sz). Each thread keeps VEC_REDUCE_LANES accumulators.
+template <class T, class Elem, class Op>
+static T vec_reduce_host(size_t size_sz, T identity, Elem elem, Op op)
+{
+	std::vector<T> a_part(vec_thread_count(), identity);
+	T acc = identity;
+
+	vec_parallel_run(size_sz, [&](int thread_idx, int thread_n)
+	{
+		size_t begin_sz, end_sz, i;
+		T a_lane[VEC_REDUCE_LANES];
+		T part = identity;
+
+		vec_thread_range(size_sz, thread_idx, thread_n, &begin_sz, &end_sz);
+
+		for (int lane = 0; lane < VEC_REDUCE_LANES; ++lane)
+		{
+			a_lane[lane] = identity;
+		}
+		for (i = begin_sz; i + VEC_REDUCE_LANES <= end_sz; i += VEC_REDUCE_LANES)
+		{
+			for (int lane = 0; lane < VEC_REDUCE_LANES; ++lane)
+			{
+				a_lane[lane] = op(a_lane[lane], elem(i + lane));
+			}
+		}
+		for (; i < end_sz; ++i)
+		{
+			a_lane[0] = op(a_lane[0], elem(i));
+		}
+		for (int lane = 0; lane < VEC_REDUCE_LANES; ++lane)
+		{
+			part = op(part, a_lane[lane]);
+		}
+
+		a_part[thread_idx] = part;
+	});
+
+	for (size_t i = 0; i < a_part.size(); ++i)
+	{
+		acc = op(acc, a_part[i]);
+	}
+
+	return acc;
+}
+
+template <class T>
+static size_t vec_argmax_host(const T* p_src, size_t size_sz)
+{
+	std::vector<T> a_best(vec_thread_count(), VecReduceType<T>::lowest());
+	std::vector<size_t> a_best_idx(vec_thread_count(), size_sz);
+	size_t best_idx = size_sz;
+	T best = VecReduceType<T>::lowest();
+
+	vec_parallel_run(size_sz, [&](int thread_idx, int thread_n)
+	{
+		size_t begin_sz, end_sz;
+		size_t part_idx = size_sz;
+		T part = VecReduceType<T>::lowest();
+
+		vec_thread_range(size_sz, thread_idx, thread_n, &begin_sz, &end_sz);
+
+		for (size_t i = begin_sz; i < end_sz; ++i)
+		{
+			if ((p_src[i] > part) || ((p_src[i] == part) && (size_sz == part_idx)))
+			{
+				part = p_src[i];
+				part_idx = i;
+			}
+		}
+
+		a_best[thread_idx] = part;
+		a_best_idx[thread_idx] = part_idx;
+	});
+
+	// Ranges are in index order, so a strict comparison keeps the first maximum.
+	for (size_t i = 0; i < a_best.size(); ++i)
+	{
+		if ((a_best_idx[i] != size_sz) && ((a_best[i] > best) || (size_sz == best_idx)))
+		{
+			best = a_best[i];
+			best_idx = a_best_idx[i];
+		}
+	}
+
+	return best_idx;
+}
+
+// Per-thread totals, their exclusive scan, then a scan of every range from its offset.
+template <class T>
+static void vec_scan_host(const T* p_src, T* p_dst, size_t size_sz, int inclusive)
+{
+	std::vector<T> a_offset(vec_thread_count(), 0);
+	T run = 0;
+
+	// One worker: no totals pass, the scan below reads the source once.
+	if (1 < vec_parallel_width(size_sz))
+	{
+		vec_parallel_run(size_sz, [&](int thread_idx, int thread_n)
+		{
+			size_t begin_sz, end_sz;
+			T total = 0;
+
+			vec_thread_range(size_sz, thread_idx, thread_n, &begin_sz, &end_sz);
+
+			for (size_t i = begin_sz; i < end_sz; ++i)
+			{
+				total += p_src[i];
+			}
+
+			a_offset[thread_idx] = total;
+		});
+
+		for (size_t i = 0; i < a_offset.size(); ++i)
+		{
+			T total = a_offset[i];
+
+			a_offset[i] = run;
+			run += total;
+		}
+	}
+
+	vec_parallel_run(size_sz, [&](int thread_idx, int thread_n)
+	{
+		size_t begin_sz, end_sz;
+		T acc = a_offset[thread_idx];
+
+		vec_thread_range(size_sz, thread_idx, thread_n, &begin_sz, &end_sz);
+
+		for (size_t i = begin_sz; i < end_sz; ++i)
+		{
+			T cur = p_src[i];
+
+			if (inclusive)
+			{
+				acc += cur;
+				p_dst[i] = acc;
+			}
+			else
+			{
+				p_dst[i] = acc;
+				acc += cur;
+			}
+		}
+	});
+}
+
+template <class T>
+static T vec_sum_t(const T* p_src, size_t size_sz)
+{
+	if ((0 != size_sz) && (NULL != vec_ocl_env()))
+	{
+		return vec_reduce_ocl<T>(p_src, NULL, size_sz, VEC_OP_SUM);
+	}
+
+	return vec_reduce_host<T>(size_sz, (T)0, [&](size_t i) { return p_src[i]; }, [](T a, T b) { return a + b; });
+}
+
+template <class T>
+static T vec_min_t(const T* p_src, size_t size_sz)
+{
+	if ((0 != size_sz) && (NULL != vec_ocl_env()))
+	{
+		return vec_reduce_ocl<T>(p_src, NULL, size_sz, VEC_OP_MIN);
+	}
+
+	return vec_reduce_host<T>(size_sz, VecReduceType<T>::maxValue(), [&](size_t i) { return p_src[i]; }, [](T a, T b) { return (b < a) ? b : a; });
+}
+
+template <class T>
+static T vec_max_t(const T* p_src, size_t size_sz)
+{
+	if ((0 != size_sz) && (NULL != vec_ocl_env()))
+	{
+		return vec_reduce_ocl<T>(p_src, NULL, size_sz, VEC_OP_MAX);
+	}
+
+	return vec_reduce_host<T>(size_sz, VecReduceType<T>::lowest(), [&](size_t i) { return p_src[i]; }, [](T a, T b) { return (b > a) ? b : a; });
+}
+
+template <class T>
+static T vec_dot_t(const T* p_a, const T* p_b, size_t size_sz)
+{
+	if ((0 != size_sz) && (NULL != vec_ocl_env()))
+	{
+		return vec_reduce_ocl<T>(p_a, p_b, size_sz, VEC_OP_SUM);
+	}
+
+	return vec_reduce_host<T>(size_sz, (T)0, [&](size_t i) { return p_a[i] * p_b[i]; }, [](T a, T b) { return a + b; });
+}
+
+template <class T>
+static size_t vec_argmax_t(const T* p_src, size_t size_sz)
+{
+	if (0 == size_sz)
+	{
+		return size_sz;
+	}
+	if (NULL != vec_ocl_env())
+	{
+		return vec_argmax_ocl<T>(p_src, size_sz);
+	}
+
+	return vec_argmax_host<T>(p_src, size_sz);
+}
+
+template <class T>
+static void vec_scan_t(const T* p_src, T* p_dst, size_t size_sz, int inclusive)
+{
+	if (0 == size_sz)
+	{
+		return;
+	}
+	if (NULL != vec_ocl_env())
+	{
+		vec_scan_ocl<T>(p_src, p_dst, size_sz, inclusive);
+	}
+	else
+	{
+		vec_scan_host<T>(p_src, p_dst, size_sz, inclusive);
+	}
+}
+
+float vec_sum(const float* p_src_f32, size_t size_sz) { return vec_sum_t(p_src_f32, size_sz); }
+int vec_sum(const int* p_src_s32, size_t size_sz) { return vec_sum_t(p_src_s32, size_sz); }
+
+float vec_min(const float* p_src_f32, size_t size_sz) { return vec_min_t(p_src_f32, size_sz); }
+int vec_min(const int* p_src_s32, size_t size_sz) { return vec_min_t(p_src_s32, size_sz); }
+
+float vec_max(const float* p_src_f32, size_t size_sz) { return vec_max_t(p_src_f32, size_sz); }
+int vec_max(const int* p_src_s32, size_t size_sz) { return vec_max_t(p_src_s32, size_sz); }
+
+size_t vec_argmax(const float* p_src_f32, size_t size_sz) { return vec_argmax_t(p_src_f32, size_sz); }
+size_t vec_argmax(const int* p_src_s32, size_t size_sz) { return vec_argmax_t(p_src_s32, size_sz); }
+
+float vec_dot(const float* p_a_f32, const float* p_b_f32, size_t size_sz) { return vec_dot_t(p_a_f32, p_b_f32, size_sz); }
+int vec_dot(const int* p_a_s32, const int* p_b_s32, size_t size_sz) { return vec_dot_t(p_a_s32, p_b_s32, size_sz); }
+
+void vec_inclusive_scan(const float* p_src_f32, float* p_dst_f32, size_t size_sz) { vec_scan_t(p_src_f32, p_dst_f32, size_sz, 1); }
+void vec_inclusive_scan(const int* p_src_s32, int* p_dst_s32, size_t size_sz) { vec_scan_t(p_src_s32, p_dst_s32, size_sz, 1); }
+
+void vec_exclusive_scan(const float* p_src_f32, float* p_dst_f32, size_t size_sz) { vec_scan_t(p_src_f32, p_dst_f32, size_sz, 0); }
+void vec_exclusive_scan(const int* p_src_s32, int* p_dst_s32, size_t size_sz) { vec_scan_t(p_src_s32, p_dst_s32, size_sz, 0); }
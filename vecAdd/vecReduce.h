@@ -0,0 +1,40 @@
+#ifndef __VEC_REDUCE_H__
+#define __VEC_REDUCE_H__
+
+/*
+
+Device-wide reductions and prefix scans over float and int arrays.
+
+Runs on the shared OpenCL device (kernels in vecReduceKernel.cl) and falls back to a
+multithreaded host implementation without one. Float results are summed in a different
+order than a sequential loop, so they match std::reduce up to rounding.
+
+*/
+
+#include <stddef.h>
+
+float  vec_sum(const float* p_src_f32, size_t size_sz);
+int    vec_sum(const int* p_src_s32, size_t size_sz);
+
+float  vec_min(const float* p_src_f32, size_t size_sz);
+int    vec_min(const int* p_src_s32, size_t size_sz);
+
+float  vec_max(const float* p_src_f32, size_t size_sz);
+int    vec_max(const int* p_src_s32, size_t size_sz);
+
+// Index of the first maximum, size_sz for an empty array.
+size_t vec_argmax(const float* p_src_f32, size_t size_sz);
+size_t vec_argmax(const int* p_src_s32, size_t size_sz);
+
+float  vec_dot(const float* p_a_f32, const float* p_b_f32, size_t size_sz);
+int    vec_dot(const int* p_a_s32, const int* p_b_s32, size_t size_sz);
+
+// p_dst[i] = p_src[0] + ... + p_src[i]. The source and destination may be the same array.
+void   vec_inclusive_scan(const float* p_src_f32, float* p_dst_f32, size_t size_sz);
+void   vec_inclusive_scan(const int* p_src_s32, int* p_dst_s32, size_t size_sz);
+
+// p_dst[i] = p_src[0] + ... + p_src[i - 1], p_dst[0] = 0.
+void   vec_exclusive_scan(const float* p_src_f32, float* p_dst_f32, size_t size_sz);
+void   vec_exclusive_scan(const int* p_src_s32, int* p_dst_s32, size_t size_sz);
+
+#endif // __VEC_REDUCE_H__
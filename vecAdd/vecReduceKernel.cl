@@ -0,0 +1,392 @@
+/*
+
+Reduction and scan primitives used by vecReduce.cpp.
+
+The program is built once per element type and reduction operation:
+	-DVEC_T=<float|int> -DVEC_T_IS_FLOAT=<1|0> -DVEC_OP=<0 sum|1 min|2 max> [-DUSE_SUBGROUP]
+
+USE_SUBGROUP is passed when the device reports cl_khr_subgroups or cl_intel_subgroups.
+Work-group sizes are powers of two.
+
+*/
+
+#define VEC_OP_SUM (0)
+#define VEC_OP_MIN (1)
+#define VEC_OP_MAX (2)
+
+/* elements per work-item in a scan tile */
+#define SCAN_ITEMS (8)
+
+#if defined(USE_SUBGROUP) && defined(cl_khr_subgroups)
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+#endif
+
+#if (1 == VEC_T_IS_FLOAT)
+#define VEC_T_MAX    (INFINITY)
+#define VEC_T_LOWEST (-INFINITY)
+#else
+#define VEC_T_MAX    (INT_MAX)
+#define VEC_T_LOWEST (INT_MIN)
+#endif
+
+#if (VEC_OP_SUM == VEC_OP)
+#define OP_IDENTITY      ((VEC_T)0)
+#define OP_COMBINE(a, b) ((a) + (b))
+#define OP_SG_REDUCE(x)  sub_group_reduce_add(x)
+#elif (VEC_OP_MIN == VEC_OP)
+#define OP_IDENTITY      (VEC_T_MAX)
+#define OP_COMBINE(a, b) min((a), (b))
+#define OP_SG_REDUCE(x)  sub_group_reduce_min(x)
+#else
+#define OP_IDENTITY      (VEC_T_LOWEST)
+#define OP_COMBINE(a, b) max((a), (b))
+#define OP_SG_REDUCE(x)  sub_group_reduce_max(x)
+#endif
+
+/* work-group reduction, the result is valid on local id 0 */
+VEC_T wg_reduce(VEC_T x, __local VEC_T* scratch)
+{
+	uint lid = get_local_id(0);
+
+#ifdef USE_SUBGROUP
+	uint sg_n = get_num_sub_groups();
+	uint idx = 0;
+
+	x = OP_SG_REDUCE(x);
+
+	if(0 == get_sub_group_local_id())
+	{
+		scratch[get_sub_group_id()] = x;
+	}
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	/* local id 0 sits in sub-group 0, so x already holds scratch[0] */
+	if(0 == lid)
+	{
+		for(idx = 1 ; idx < sg_n ; idx++)
+		{
+			x = OP_COMBINE(x, scratch[idx]);
+		}
+	}
+#else
+	uint step = 0;
+
+	scratch[lid] = x;
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	for(step = (get_local_size(0) >> 1) ; step > 0 ; step >>= 1)
+	{
+		if(lid < step)
+		{
+			scratch[lid] = OP_COMBINE(scratch[lid], scratch[lid + step]);
+		}
+
+		/* ----------------------- */
+		barrier(CLK_LOCAL_MEM_FENCE);
+		/* ----------------------- */
+	}
+
+	x = scratch[0];
+#endif
+
+	return x;
+}
+
+/* work-group exclusive prefix sum of x, *p_total receives the sum over the group;
+   scratch holds local size + 1 values (one per sub-group plus the total) */
+VEC_T wg_scan_exclusive(VEC_T x, __local VEC_T* scratch, VEC_T* p_total)
+{
+	uint lid = get_local_id(0);
+	VEC_T prefix = 0;
+
+#ifdef USE_SUBGROUP
+	uint sg_id = get_sub_group_id();
+	uint sg_n  = get_num_sub_groups();
+	uint idx   = 0;
+	VEC_T run  = 0;
+	VEC_T tmp  = 0;
+
+	prefix = sub_group_scan_exclusive_add(x);
+
+	if(get_sub_group_local_id() == (get_sub_group_size() - 1))
+	{
+		scratch[sg_id] = prefix + x;
+	}
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	if(0 == lid)
+	{
+		for(idx = 0 ; idx < sg_n ; idx++)
+		{
+			tmp          = scratch[idx];
+			scratch[idx] = run;
+			run         += tmp;
+		}
+		scratch[sg_n] = run;
+	}
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	prefix  += scratch[sg_id];
+	*p_total = scratch[sg_n];
+#else
+	uint lsz = get_local_size(0);
+	uint off = 0;
+	VEC_T tmp = 0;
+
+	scratch[lid] = x;
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	/* Hillis-Steele inclusive scan */
+	for(off = 1 ; off < lsz ; off <<= 1)
+	{
+		tmp = (lid >= off) ? scratch[lid - off] : 0;
+
+		/* ----------------------- */
+		barrier(CLK_LOCAL_MEM_FENCE);
+		/* ----------------------- */
+
+		scratch[lid] += tmp;
+
+		/* ----------------------- */
+		barrier(CLK_LOCAL_MEM_FENCE);
+		/* ----------------------- */
+	}
+
+	prefix   = (lid > 0) ? scratch[lid - 1] : 0;
+	*p_total = scratch[lsz - 1];
+#endif
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	return prefix;
+}
+
+/* grid-stride partial reduction, one result per work-group */
+__kernel void reduce_first(	__global const VEC_T* src,
+							__global       VEC_T* dst,
+							         const ulong  n,
+							__local        VEC_T* scratch)
+{
+	VEC_T acc = OP_IDENTITY;
+	size_t idx = 0;
+
+	for(idx = get_global_id(0) ; idx < n ; idx += get_global_size(0))
+	{
+		acc = OP_COMBINE(acc, src[idx]);
+	}
+
+	acc = wg_reduce(acc, scratch);
+
+	if(0 == get_local_id(0))
+	{
+		dst[get_group_id(0)] = acc;
+	}
+}
+
+/* partial sums of a[i] * b[i]; the second pass is reduce_first of the sum program */
+__kernel void reduce_dot_first(	__global const VEC_T* a,
+								__global const VEC_T* b,
+								__global       VEC_T* dst,
+								         const ulong  n,
+								__local        VEC_T* scratch)
+{
+	VEC_T acc = 0;
+	size_t idx = 0;
+
+	for(idx = get_global_id(0) ; idx < n ; idx += get_global_size(0))
+	{
+		acc += a[idx] * b[idx];
+	}
+
+	acc = wg_reduce(acc, scratch);
+
+	if(0 == get_local_id(0))
+	{
+		dst[get_group_id(0)] = acc;
+	}
+}
+
+/* (value, index) reduction keeping the first index of the maximum.
+   src_idx is null on the first pass, where the index is the position itself. */
+__kernel void reduce_argmax(	__global const VEC_T* src,
+								__global const ulong* src_idx,
+								__global       VEC_T* dst,
+								__global       ulong* dst_idx,
+								         const ulong  n,
+								__local        VEC_T* scratch,
+								__local        ulong* scratch_idx)
+{
+	uint lid = get_local_id(0);
+	uint step = 0;
+	size_t idx = 0;
+	VEC_T best = VEC_T_LOWEST;
+	ulong best_idx = ULONG_MAX;
+	VEC_T cur = 0;
+	ulong cur_idx = 0;
+
+	for(idx = get_global_id(0) ; idx < n ; idx += get_global_size(0))
+	{
+		cur     = src[idx];
+		cur_idx = (0 != src_idx) ? src_idx[idx] : idx;
+
+		if((cur > best) || ((cur == best) && (cur_idx < best_idx)))
+		{
+			best     = cur;
+			best_idx = cur_idx;
+		}
+	}
+
+	scratch    [lid] = best;
+	scratch_idx[lid] = best_idx;
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	for(step = (get_local_size(0) >> 1) ; step > 0 ; step >>= 1)
+	{
+		if(lid < step)
+		{
+			cur     = scratch    [lid + step];
+			cur_idx = scratch_idx[lid + step];
+
+			if((cur > scratch[lid]) || ((cur == scratch[lid]) && (cur_idx < scratch_idx[lid])))
+			{
+				scratch    [lid] = cur;
+				scratch_idx[lid] = cur_idx;
+			}
+		}
+
+		/* ----------------------- */
+		barrier(CLK_LOCAL_MEM_FENCE);
+		/* ----------------------- */
+	}
+
+	if(0 == lid)
+	{
+		dst    [get_group_id(0)] = scratch    [0];
+		dst_idx[get_group_id(0)] = scratch_idx[0];
+	}
+}
+
+/* scan pass 1: the sum of each tile of (local size * SCAN_ITEMS) elements */
+__kernel void scan_tile_sum(	__global const VEC_T* src,
+								__global       VEC_T* tile_sum,
+								         const ulong  n,
+								__local        VEC_T* scratch)
+{
+	size_t lsz  = get_local_size(0);
+	size_t base = get_group_id(0) * lsz * SCAN_ITEMS;
+	size_t idx  = 0;
+	uint   k    = 0;
+	VEC_T  acc  = 0;
+
+	for(k = 0 ; k < SCAN_ITEMS ; k++)
+	{
+		idx = base + k * lsz + get_local_id(0);
+
+		if(idx < n)
+		{
+			acc += src[idx];
+		}
+	}
+
+	acc = wg_reduce(acc, scratch);
+
+	if(0 == get_local_id(0))
+	{
+		tile_sum[get_group_id(0)] = acc;
+	}
+}
+
+/* scan pass 2: scan each tile, starting from tile_offset[group] (null for a single tile) */
+__kernel void scan_tile(	__global const VEC_T* src,
+							__global       VEC_T* dst,
+							__global const VEC_T* tile_offset,
+							         const ulong  n,
+							         const int    inclusive,
+							__local        VEC_T* tile_buf,
+							__local        VEC_T* scratch)
+{
+	uint   lid  = get_local_id(0);
+	size_t lsz  = get_local_size(0);
+	size_t base = get_group_id(0) * lsz * SCAN_ITEMS;
+	size_t idx  = 0;
+	uint   k    = 0;
+	VEC_T  sum  = 0;
+	VEC_T  total = 0;
+	VEC_T  prefix = 0;
+	VEC_T  cur  = 0;
+
+	/* coalesced load of the tile */
+	for(k = 0 ; k < SCAN_ITEMS ; k++)
+	{
+		idx = k * lsz + lid;
+
+		tile_buf[idx] = ((base + idx) < n) ? src[base + idx] : 0;
+	}
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	/* each work-item owns SCAN_ITEMS consecutive elements */
+	for(k = 0 ; k < SCAN_ITEMS ; k++)
+	{
+		sum += tile_buf[lid * SCAN_ITEMS + k];
+	}
+
+	prefix = wg_scan_exclusive(sum, scratch, &total);
+
+	if(0 != tile_offset)
+	{
+		prefix += tile_offset[get_group_id(0)];
+	}
+
+	for(k = 0 ; k < SCAN_ITEMS ; k++)
+	{
+		cur = tile_buf[lid * SCAN_ITEMS + k];
+
+		if(inclusive)
+		{
+			prefix += cur;
+			tile_buf[lid * SCAN_ITEMS + k] = prefix;
+		}
+		else
+		{
+			tile_buf[lid * SCAN_ITEMS + k] = prefix;
+			prefix += cur;
+		}
+	}
+
+	/* ----------------------- */
+	barrier(CLK_LOCAL_MEM_FENCE);
+	/* ----------------------- */
+
+	for(k = 0 ; k < SCAN_ITEMS ; k++)
+	{
+		idx = k * lsz + lid;
+
+		if((base + idx) < n)
+		{
+			dst[base + idx] = tile_buf[idx];
+		}
+	}
+}
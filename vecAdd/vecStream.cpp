@@ -0,0 +1,396 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include "vecOcl.h"
+#include "vecStream.h"
+#include "vecThread.h"
+
+#define FILE_NAME_STREAM_KERNEL "vecAddKernel.cl"
+
+// Values grow by 15x per pass with the STREAM scalar of 3; more passes overflow float.
+#define VEC_STREAM_TRIALS_MAX (24)
+
+// Relative tolerance of the final array check; the device may contract b + s * c into an fma.
+#define VEC_STREAM_EPSILON (1e-5)
+
+enum
+{
+	VEC_STREAM_COPY = 0,
+	VEC_STREAM_SCALE,
+	VEC_STREAM_ADD,
+	VEC_STREAM_TRIAD,
+	VEC_STREAM_NUM
+};
+
+static const char* const sa_test_name[VEC_STREAM_NUM] = { "copy", "scale", "add", "triad" };
+static const char* const sa_kernel_name[VEC_STREAM_NUM] = { "copyVectors", "scaleVectors", "addVectors", "triadVectors" };
+static const size_t sa_array_n[VEC_STREAM_NUM] = { 2, 2, 3, 3 };
+
+static double vec_stream_now(void)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Sorts a_sec and prints one CSV line. The fastest trial gives max_gbps.
+static void vec_stream_report(FILE* p_out, const char* p_target, const char* p_test, size_t size_sz, size_t bytes_sz, std::vector<double>& a_sec, bool ok)
+{
+	size_t n = a_sec.size();
+	double median_sec;
+
+	std::sort(a_sec.begin(), a_sec.end());
+	median_sec = (0 == (n & 1)) ? 0.5 * (a_sec[n / 2 - 1] + a_sec[n / 2]) : a_sec[n / 2];
+
+	fprintf(p_out, "%s,%s,%llu,%llu,%d,%.3f,%.3f,%.3f,%s\n", p_target, p_test,
+		(unsigned long long)size_sz, (unsigned long long)bytes_sz, (int)n,
+		bytes_sz / a_sec[n - 1] * 1e-9, bytes_sz / median_sec * 1e-9, bytes_sz / a_sec[0] * 1e-9,
+		ok ? "ok" : "MISMATCH");
+	fflush(p_out);
+}
+
+// Expected a, b, c after pass_n passes, computed in the same order as the kernels.
+static void vec_stream_expect(int pass_n, float* p_a, float* p_b, float* p_c)
+{
+	float a = 1.f, b = 2.f, c = 0.f;
+
+	for (int pass = 0; pass < pass_n; ++pass)
+	{
+		c = a;
+		b = VEC_STREAM_SCALAR * c;
+		c = a + b;
+		a = b + VEC_STREAM_SCALAR * c;
+	}
+
+	*p_a = a;
+	*p_b = b;
+	*p_c = c;
+}
+
+static bool vec_stream_check(const float* p_f32, size_t size_sz, float expect)
+{
+	double tol = VEC_STREAM_EPSILON * fabs((double)expect);
+
+	for (size_t i = 0; i < size_sz; ++i)
+	{
+		if (fabs((double)p_f32[i] - expect) > tol)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void vec_stream_host_pass(int test, float* p_a, float* p_b, float* p_c, size_t size_sz)
+{
+	const float s = VEC_STREAM_SCALAR;
+
+	// Same worker ranges as the first touch in vec_stream_host.
+	vec_parallel_for(size_sz, [&](size_t begin_sz, size_t end_sz)
+	{
+		switch (test)
+		{
+		case VEC_STREAM_COPY:
+			for (size_t i = begin_sz; i < end_sz; ++i) { p_c[i] = p_a[i]; }
+			break;
+		case VEC_STREAM_SCALE:
+			for (size_t i = begin_sz; i < end_sz; ++i) { p_b[i] = s * p_c[i]; }
+			break;
+		case VEC_STREAM_ADD:
+			for (size_t i = begin_sz; i < end_sz; ++i) { p_c[i] = p_a[i] + p_b[i]; }
+			break;
+		default:
+			for (size_t i = begin_sz; i < end_sz; ++i) { p_a[i] = p_b[i] + s * p_c[i]; }
+			break;
+		}
+	});
+}
+
+static bool vec_stream_host(size_t size_sz, int trial_n, FILE* p_out)
+{
+	// malloc leaves large blocks untouched, so the initialization below places the pages.
+	float* p_a = (float*)malloc(size_sz * sizeof(float));
+	float* p_b = (float*)malloc(size_sz * sizeof(float));
+	float* p_c = (float*)malloc(size_sz * sizeof(float));
+	std::vector<double> a_sec[VEC_STREAM_NUM];
+	float expect_a, expect_b, expect_c;
+	bool ok;
+
+	if ((NULL == p_a) || (NULL == p_b) || (NULL == p_c))
+	{
+		printf("malloc failed!\n");
+		exit(-1);
+	}
+
+	vec_parallel_for(size_sz, [&](size_t begin_sz, size_t end_sz)
+	{
+		for (size_t i = begin_sz; i < end_sz; ++i)
+		{
+			p_a[i] = 1.f;
+			p_b[i] = 2.f;
+			p_c[i] = 0.f;
+		}
+	});
+
+	for (int trial = 0; trial < VEC_STREAM_WARMUP + trial_n; ++trial)
+	{
+		for (int test = 0; test < VEC_STREAM_NUM; ++test)
+		{
+			double start = vec_stream_now();
+
+			vec_stream_host_pass(test, p_a, p_b, p_c, size_sz);
+
+			if (trial >= VEC_STREAM_WARMUP)
+			{
+				a_sec[test].push_back(vec_stream_now() - start);
+			}
+		}
+	}
+
+	vec_stream_expect(VEC_STREAM_WARMUP + trial_n, &expect_a, &expect_b, &expect_c);
+	ok = vec_stream_check(p_a, size_sz, expect_a) && vec_stream_check(p_b, size_sz, expect_b) && vec_stream_check(p_c, size_sz, expect_c);
+
+	for (int test = 0; test < VEC_STREAM_NUM; ++test)
+	{
+		vec_stream_report(p_out, "host", sa_test_name[test], size_sz, sa_array_n[test] * size_sz * sizeof(float), a_sec[test], ok);
+	}
+
+	free(p_a);
+	free(p_b);
+	free(p_c);
+
+	return ok;
+}
+
+// Elapsed device time of a finished command, in seconds.
+static double vec_stream_event_sec(cl_event event)
+{
+	cl_ulong start = 0, end = 0;
+
+	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+	clReleaseEvent(event);
+
+	return (end - start) * 1e-9;
+}
+
+// Blocking copies between p_host_f32 and memObj. Timed on the host clock: a pageable copy is
+// staged by the driver outside the command's profiling window.
+static void vec_stream_transfer(cl_command_queue queue, cl_mem memObj, float* p_host_f32, size_t size_sz, int trial_n,
+	FILE* p_out, const char* p_h2d_name, const char* p_d2h_name)
+{
+	size_t bytes_sz = size_sz * sizeof(float);
+	std::vector<double> a_h2d, a_d2h;
+
+	for (int trial = 0; trial < VEC_STREAM_WARMUP + trial_n; ++trial)
+	{
+		double start = vec_stream_now();
+
+		clEnqueueWriteBuffer(queue, memObj, CL_TRUE, 0, bytes_sz, p_host_f32, 0, NULL, NULL);
+
+		double middle = vec_stream_now();
+
+		clEnqueueReadBuffer(queue, memObj, CL_TRUE, 0, bytes_sz, p_host_f32, 0, NULL, NULL);
+
+		if (trial >= VEC_STREAM_WARMUP)
+		{
+			a_h2d.push_back(middle - start);
+			a_d2h.push_back(vec_stream_now() - middle);
+		}
+	}
+
+	vec_stream_report(p_out, "ocl", p_h2d_name, size_sz, bytes_sz, a_h2d, true);
+	vec_stream_report(p_out, "ocl", p_d2h_name, size_sz, bytes_sz, a_d2h, true);
+}
+
+static bool vec_stream_ocl(VecOclEnv* p_env, size_t size_sz, int trial_n, FILE* p_out)
+{
+	cl_queue_properties a_prop[] = { CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0 };
+	size_t bytes_sz = size_sz * sizeof(float);
+	cl_command_queue queue;
+	cl_program program;
+	cl_kernel a_kernel[VEC_STREAM_NUM];
+	cl_mem memObjA, memObjB, memObjC, memObjPinned;
+	std::vector<double> a_sec[VEC_STREAM_NUM];
+	size_t sourceSize = 0;
+	char* p_source;
+	float* p_host_a;
+	float* p_host_b;
+	float* p_host_c;
+	float* p_pinned;
+	float expect_a, expect_b, expect_c;
+	cl_ulong n = (cl_ulong)size_sz;
+	cl_float s = VEC_STREAM_SCALAR;
+	cl_int ret = CL_SUCCESS;
+	bool ok;
+
+	queue = clCreateCommandQueueWithProperties(p_env->context, p_env->deviceID, a_prop, &ret);
+	if (CL_SUCCESS != ret)
+	{
+		printf("clCreateCommandQueueWithProperties failed! %d\n", ret);
+		return false;
+	}
+
+	p_source = vec_ocl_load_source(FILE_NAME_STREAM_KERNEL, &sourceSize);
+	program = vec_ocl_build(p_source, sourceSize, NULL);
+	free(p_source);
+
+	for (int test = 0; test < VEC_STREAM_NUM; ++test)
+	{
+		a_kernel[test] = clCreateKernel(program, sa_kernel_name[test], &ret);
+		if (CL_SUCCESS != ret)
+		{
+			printf("clCreateKernel(%s) failed! %d\n", sa_kernel_name[test], ret);
+			exit(-1);
+		}
+	}
+
+	memObjA = clCreateBuffer(p_env->context, CL_MEM_READ_WRITE, bytes_sz, NULL, &ret);
+	memObjB = clCreateBuffer(p_env->context, CL_MEM_READ_WRITE, bytes_sz, NULL, &ret);
+	memObjC = clCreateBuffer(p_env->context, CL_MEM_READ_WRITE, bytes_sz, NULL, &ret);
+	memObjPinned = clCreateBuffer(p_env->context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bytes_sz, NULL, &ret);
+
+	p_host_a = (float*)malloc(bytes_sz);
+	p_host_b = (float*)malloc(bytes_sz);
+	p_host_c = (float*)malloc(bytes_sz);
+	if ((NULL == p_host_a) || (NULL == p_host_b) || (NULL == p_host_c))
+	{
+		printf("malloc failed!\n");
+		exit(-1);
+	}
+
+	vec_parallel_for(size_sz, [&](size_t begin_sz, size_t end_sz)
+	{
+		for (size_t i = begin_sz; i < end_sz; ++i)
+		{
+			p_host_a[i] = 1.f;
+			p_host_b[i] = 2.f;
+			p_host_c[i] = 0.f;
+		}
+	});
+
+	// Transfers, before the resident buffers get their initial values.
+	vec_stream_transfer(queue, memObjA, p_host_a, size_sz, trial_n, p_out, "h2d_pageable", "d2h_pageable");
+
+	p_pinned = (float*)clEnqueueMapBuffer(queue, memObjPinned, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, bytes_sz, 0, NULL, NULL, &ret);
+	if (CL_SUCCESS == ret)
+	{
+		memcpy(p_pinned, p_host_a, bytes_sz);
+		vec_stream_transfer(queue, memObjA, p_pinned, size_sz, trial_n, p_out, "h2d_pinned", "d2h_pinned");
+		clEnqueueUnmapMemObject(queue, memObjPinned, p_pinned, 0, NULL, NULL);
+	}
+
+	clEnqueueWriteBuffer(queue, memObjA, CL_FALSE, 0, bytes_sz, p_host_a, 0, NULL, NULL);
+	clEnqueueWriteBuffer(queue, memObjB, CL_FALSE, 0, bytes_sz, p_host_b, 0, NULL, NULL);
+	clEnqueueWriteBuffer(queue, memObjC, CL_TRUE, 0, bytes_sz, p_host_c, 0, NULL, NULL);
+
+	// copyVectors(a, c, n)
+	clSetKernelArg(a_kernel[VEC_STREAM_COPY], 0, sizeof(cl_mem), &memObjA);
+	clSetKernelArg(a_kernel[VEC_STREAM_COPY], 1, sizeof(cl_mem), &memObjC);
+	clSetKernelArg(a_kernel[VEC_STREAM_COPY], 2, sizeof(cl_ulong), &n);
+	// scaleVectors(c, b, s, n)
+	clSetKernelArg(a_kernel[VEC_STREAM_SCALE], 0, sizeof(cl_mem), &memObjC);
+	clSetKernelArg(a_kernel[VEC_STREAM_SCALE], 1, sizeof(cl_mem), &memObjB);
+	clSetKernelArg(a_kernel[VEC_STREAM_SCALE], 2, sizeof(cl_float), &s);
+	clSetKernelArg(a_kernel[VEC_STREAM_SCALE], 3, sizeof(cl_ulong), &n);
+	// addVectors(a, b, c, n)
+	clSetKernelArg(a_kernel[VEC_STREAM_ADD], 0, sizeof(cl_mem), &memObjA);
+	clSetKernelArg(a_kernel[VEC_STREAM_ADD], 1, sizeof(cl_mem), &memObjB);
+	clSetKernelArg(a_kernel[VEC_STREAM_ADD], 2, sizeof(cl_mem), &memObjC);
+	clSetKernelArg(a_kernel[VEC_STREAM_ADD], 3, sizeof(cl_ulong), &n);
+	// triadVectors(b, c, a, s, n)
+	clSetKernelArg(a_kernel[VEC_STREAM_TRIAD], 0, sizeof(cl_mem), &memObjB);
+	clSetKernelArg(a_kernel[VEC_STREAM_TRIAD], 1, sizeof(cl_mem), &memObjC);
+	clSetKernelArg(a_kernel[VEC_STREAM_TRIAD], 2, sizeof(cl_mem), &memObjA);
+	clSetKernelArg(a_kernel[VEC_STREAM_TRIAD], 3, sizeof(cl_float), &s);
+	clSetKernelArg(a_kernel[VEC_STREAM_TRIAD], 4, sizeof(cl_ulong), &n);
+
+	for (int trial = 0; trial < VEC_STREAM_WARMUP + trial_n; ++trial)
+	{
+		for (int test = 0; test < VEC_STREAM_NUM; ++test)
+		{
+			size_t globalItemSize, localItemSize;
+			cl_event event;
+
+			vec_ocl_stride_geometry(a_kernel[test], p_env->deviceID, size_sz / 4 + 1, &globalItemSize, &localItemSize);
+
+			ret = clEnqueueNDRangeKernel(queue, a_kernel[test], 1, NULL, &globalItemSize, &localItemSize, 0, NULL, &event);
+			if (CL_SUCCESS != ret)
+			{
+				printf("clEnqueueNDRangeKernel(%s) failed! %d\n", sa_kernel_name[test], ret);
+				exit(-1);
+			}
+			clWaitForEvents(1, &event);
+
+			if (trial >= VEC_STREAM_WARMUP)
+			{
+				a_sec[test].push_back(vec_stream_event_sec(event));
+			}
+			else
+			{
+				clReleaseEvent(event);
+			}
+		}
+	}
+
+	clEnqueueReadBuffer(queue, memObjA, CL_FALSE, 0, bytes_sz, p_host_a, 0, NULL, NULL);
+	clEnqueueReadBuffer(queue, memObjB, CL_FALSE, 0, bytes_sz, p_host_b, 0, NULL, NULL);
+	clEnqueueReadBuffer(queue, memObjC, CL_TRUE, 0, bytes_sz, p_host_c, 0, NULL, NULL);
+
+	vec_stream_expect(VEC_STREAM_WARMUP + trial_n, &expect_a, &expect_b, &expect_c);
+	ok = vec_stream_check(p_host_a, size_sz, expect_a) && vec_stream_check(p_host_b, size_sz, expect_b) && vec_stream_check(p_host_c, size_sz, expect_c);
+
+	for (int test = 0; test < VEC_STREAM_NUM; ++test)
+	{
+		vec_stream_report(p_out, "ocl", sa_test_name[test], size_sz, sa_array_n[test] * bytes_sz, a_sec[test], ok);
+	}
+
+	for (int test = 0; test < VEC_STREAM_NUM; ++test)
+	{
+		clReleaseKernel(a_kernel[test]);
+	}
+	clReleaseProgram(program);
+	clReleaseMemObject(memObjA);
+	clReleaseMemObject(memObjB);
+	clReleaseMemObject(memObjC);
+	clReleaseMemObject(memObjPinned);
+	clReleaseCommandQueue(queue);
+	free(p_host_a);
+	free(p_host_b);
+	free(p_host_c);
+
+	return ok;
+}
+
+int vec_stream_bench(size_t size_sz, int trial_n, FILE* p_out)
+{
+	VecOclEnv* p_env = vec_ocl_env();
+	bool ok;
+
+	if (trial_n < 1)
+	{
+		trial_n = 1;
+	}
+	if (trial_n > VEC_STREAM_TRIALS_MAX)
+	{
+		fprintf(stderr, "vec_stream_bench: %d trials requested, running %d (the checked values overflow beyond that)\n", trial_n, VEC_STREAM_TRIALS_MAX);
+		trial_n = VEC_STREAM_TRIALS_MAX;
+	}
+
+	fprintf(p_out, "target,test,elements,bytes,trials,min_gbps,median_gbps,max_gbps,check\n");
+
+	ok = vec_stream_host(size_sz, trial_n, p_out);
+
+	if (NULL != p_env)
+	{
+		ok = vec_stream_ocl(p_env, size_sz, trial_n, p_out) && ok;
+	}
+
+	return ok ? 0 : -1;
+}
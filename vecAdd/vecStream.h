@@ -0,0 +1,37 @@
+#ifndef __VEC_STREAM_H__
+#define __VEC_STREAM_H__
+
+/*
+
+STREAM-style memory bandwidth benchmark (McCalpin's Copy, Scale, Add and Triad).
+
+	Copy : c = a          2 arrays moved per element
+	Scale: b = s * c      2
+	Add  : c = a + b      3
+	Triad: a = b + s * c  3
+
+The host runs the four kernels on every worker thread. Each array is first touched by the
+worker that later streams it, so on NUMA machines its pages sit on that worker's node.
+The device runs the same kernels from vecAddKernel.cl against resident buffers and is timed
+with profiling events, so the numbers are pure on-device bandwidth. Host to device and device
+to host copies are measured separately, from pageable and from pinned host memory.
+
+Every test runs VEC_STREAM_WARMUP untimed passes and then trial_n timed passes; trial_n is
+capped at 24, with a note on stderr, because the checked values overflow float beyond that.
+The output is one CSV line per test:
+
+	target,test,elements,bytes,trials,min_gbps,median_gbps,max_gbps,check
+
+*/
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define VEC_STREAM_WARMUP (2)
+#define VEC_STREAM_TRIALS (10)
+#define VEC_STREAM_SCALAR (3.0f)
+
+// Run the host and, when a device is present, the device tests. Returns 0 when every check passes.
+int vec_stream_bench(size_t size_sz, int trial_n, FILE* p_out);
+
+#endif // __VEC_STREAM_H__
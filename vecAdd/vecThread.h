@@ -0,0 +1,49 @@
+#ifndef __VEC_THREAD_H__
+#define __VEC_THREAD_H__
+
+#include <stddef.h>
+
+#include <functional>
+
+// Number of host worker threads used by the parallel loops.
+int vec_thread_count(void);
+
+// Range boundaries are aligned to VEC_THREAD_ALIGN elements so that workers never share a cache line.
+#define VEC_THREAD_ALIGN (16)
+
+// Below this many elements per worker the loops stay on the calling thread.
+#define VEC_THREAD_MIN_WORK (VEC_THREAD_ALIGN * 64)
+
+// Number of workers vec_parallel_run uses for size_sz elements (1 for small sizes).
+int vec_parallel_width(size_t size_sz);
+
+// Run body(thread_idx, thread_n) once on each of the vec_parallel_width(size_sz) workers.
+// Workers come from a persistent pool, pinned to one CPU each; worker thread_idx always gets
+// the same share, so data first touched in a parallel loop stays local to the thread using it.
+// A parallel loop started from inside another one runs on the calling thread.
+void vec_parallel_run(size_t size_sz, const std::function<void(int, int)>& body);
+
+// Split [0, size_sz) into one contiguous range per worker and run body(begin, end) on each.
+void vec_parallel_for(size_t size_sz, const std::function<void(size_t, size_t)>& body);
+
+// The range of worker thread_idx out of thread_n, as used by vec_parallel_for.
+static inline void vec_thread_range(size_t size_sz, int thread_idx, int thread_n, size_t* p_begin_sz, size_t* p_end_sz)
+{
+	size_t chunk_sz = (size_sz + thread_n - 1) / thread_n;
+
+	chunk_sz = (chunk_sz + VEC_THREAD_ALIGN - 1) / VEC_THREAD_ALIGN * VEC_THREAD_ALIGN;
+
+	*p_begin_sz = chunk_sz * thread_idx;
+	*p_end_sz   = *p_begin_sz + chunk_sz;
+
+	if (*p_begin_sz > size_sz)
+	{
+		*p_begin_sz = size_sz;
+	}
+	if (*p_end_sz > size_sz)
+	{
+		*p_end_sz = size_sz;
+	}
+}
+
+#endif // __VEC_THREAD_H__